@@ -406,6 +406,7 @@ typedef struct model_s
 	texture_t	**textures;
 
 	byte		*visdata;
+	struct pvscache_s	*pvscache;	// unpacked visdata, see Mod_BuildPVSCache
 	byte		*lightdata;
 	char		*entities;
 
@@ -426,5 +427,10 @@ void	Mod_TouchModel (char *name);
 
 mleaf_t *Mod_PointInLeaf (float *p, model_t *model);
 byte	*Mod_LeafPVS (mleaf_t *leaf, model_t *model);
+byte	*Mod_LeafPVSBuffer (mleaf_t *leaf, model_t *model, byte *buffer);
+void	Mod_OrPVS (byte *dest, byte *src, int bytes);
+
+// bytes in a PVS row, padded for Mod_OrPVS
+#define	PVS_ROWBYTES(numleafs)	(((((numleafs)+7)>>3) + 15) & ~15)
 
 #endif	// __MODEL__
@@ -219,6 +219,11 @@ typedef struct
 
 // frag scoreboard
 	scoreboard_t	*scores;		// [cl.maxclients]
+
+// PROTOCOL_DELTA entity frames
+	int			protocol;		// from the serverinfo
+	int			framesequence;	// last svc_packetentities parsed, acked in clc_move
+	entityframe_t	frames[UPDATE_BACKUP];
 } client_state_t;
 
 
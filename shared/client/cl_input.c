@@ -345,6 +345,9 @@ void CL_SendMove (usercmd_t *cmd)
     MSG_WriteByte (&buf, in_impulse);
 	in_impulse = 0;
 
+	if (cl.protocol == PROTOCOL_DELTA)
+		MSG_WriteLong (&buf, cl.framesequence);
+
 //
 // deliver the message
 //
@@ -0,0 +1,150 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// cl_null.c -- stands in for the client, menus and key handling in the
+// headless dedicated server, which never has a local player
+
+#include "quakedef.h"
+
+client_static_t	cls;
+client_state_t	cl;
+
+cvar_t	cl_name = {"_cl_name", "player", true};
+cvar_t	cl_color = {"_cl_color", "0", true};
+
+// sv_user still needs the view roll, so keep its cvars and math
+cvar_t	cl_rollspeed = {"cl_rollspeed", "200"};
+cvar_t	cl_rollangle = {"cl_rollangle", "2.0"};
+
+keydest_t	key_dest;
+int		key_count;
+char	key_lines[32][256];
+int		key_linepos;
+int		edit_line;
+char	chat_buffer[32];
+qboolean team_message;
+
+int		m_state;
+int		m_return_state;
+qboolean m_return_onerror;
+char	m_return_reason[32];
+
+void CL_Init (void)
+{
+}
+
+void CL_EstablishConnection (char *host)
+{
+}
+
+void CL_Disconnect (void)
+{
+}
+
+void CL_Disconnect_f (void)
+{
+}
+
+void CL_NextDemo (void)
+{
+}
+
+void CL_StopPlayback (void)
+{
+}
+
+void CL_SendCmd (void)
+{
+}
+
+int CL_ReadFromServer (void)
+{
+	return 0;
+}
+
+void CL_DecayLights (void)
+{
+}
+
+void Key_Init (void)
+{
+}
+
+void Key_WriteBindings (FILE *f)
+{
+}
+
+void M_Init (void)
+{
+}
+
+void M_Menu_Main_f (void)
+{
+}
+
+void M_Menu_Quit_f (void)
+{
+}
+
+void V_Init (void)
+{
+	Cvar_RegisterVariable (&cl_rollspeed);
+	Cvar_RegisterVariable (&cl_rollangle);
+}
+
+/*
+===============
+V_CalcRoll
+
+Used by sv_user
+===============
+*/
+float V_CalcRoll (vec3_t angles, vec3_t velocity)
+{
+	vec3_t	forward, right, up;
+	float	sign;
+	float	side;
+	float	value;
+
+	AngleVectors (angles, forward, right, up);
+	side = DotProduct (velocity, right);
+	sign = side < 0 ? -1 : 1;
+	side = fabs(side);
+
+	value = cl_rollangle.value;
+
+	if (side < cl_rollspeed.value)
+		side = side * value / cl_rollspeed.value;
+	else
+		side = value;
+
+	return side*sign;
+}
+
+void Chase_Init (void)
+{
+}
+
+void Sbar_Init (void)
+{
+}
+
+void W_LoadWadFile (char *filename)
+{
+}
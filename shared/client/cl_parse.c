@@ -64,7 +64,8 @@ char *svc_strings[] =
 	"svc_finale",			// [string] music [string] text
 	"svc_cdtrack",			// [byte] track [byte] looptrack
 	"svc_sellscreen",
-	"svc_cutscene"
+	"svc_cutscene",
+	"svc_packetentities"	// [long] sequence [byte] delta <see code>
 };
 
 //=============================================================================
@@ -120,13 +121,13 @@ void CL_ParseStartSoundPacket(void)
 	else
 		attenuation = DEFAULT_SOUND_PACKET_ATTENUATION;
 	
-	channel = MSG_ReadShort ();
+	channel = (unsigned short)MSG_ReadShort ();	// entities go up to 13 bits
 	sound_num = MSG_ReadByte ();
 
 	ent = channel >> 3;
 	channel &= 7;
 
-	if (ent > MAX_EDICTS)
+	if (ent >= MAX_EDICTS)
 		Host_Error ("CL_ParseStartSoundPacket: ent = %i", ent);
 	
 	for (i=0 ; i<3 ; i++)
@@ -217,11 +218,12 @@ void CL_ParseServerInfo (void)
 
 // parse protocol version number
 	i = MSG_ReadLong ();
-	if (i != PROTOCOL_VERSION)
+	if (i != PROTOCOL_VERSION && i != PROTOCOL_DELTA)
 	{
 		Con_Printf ("Server returned version %i, not %i\n", i, PROTOCOL_VERSION);
 		return;
 	}
+	cl.protocol = i;
 
 // parse maxclients
 	cl.maxclients = MSG_ReadByte ();
@@ -318,50 +320,21 @@ void CL_ParseServerInfo (void)
 
 /*
 ==================
-CL_ParseUpdate
+CL_ApplyEntityState
 
-Parse an entity update message from the server
+Moves an entity to the state from this message.
 If an entities model or origin changes from frame to frame, it must be
 relinked.  Other attributes can change without relinking.
 ==================
 */
-int	bitcounts[16];
-
-void CL_ParseUpdate (int bits)
+void CL_ApplyEntityState (int num, entity_state_t *state, qboolean nolerp)
 {
-	int			i;
 	model_t		*model;
-	int			modnum;
 	qboolean	forcelink;
 	entity_t	*ent;
-	int			num;
-#ifdef GLQUAKE
-	int			skin;
-#endif
-
-	if (cls.signon == SIGNONS - 1)
-	{	// first update is the final signon stage
-		cls.signon = SIGNONS;
-		CL_SignonReply ();
-	}
-
-	if (bits & U_MOREBITS)
-	{
-		i = MSG_ReadByte ();
-		bits |= (i<<8);
-	}
-
-	if (bits & U_LONGENTITY)	
-		num = MSG_ReadShort ();
-	else
-		num = MSG_ReadByte ();
 
 	ent = CL_EntityNum (num);
 
-	for (i=0 ; i<16 ; i++)
-		if (bits&(1<<i))
-			bitcounts[i]++;
-
 	if (ent->msgtime != cl.mtime[1])
 		forcelink = true;	// no previous frame to lerp from
 	else
@@ -369,16 +342,7 @@ void CL_ParseUpdate (int bits)
 
 	ent->msgtime = cl.mtime[0];
 	
-	if (bits & U_MODEL)
-	{
-		modnum = MSG_ReadByte ();
-		if (modnum >= MAX_MODELS)
-			Host_Error ("CL_ParseModel: bad modnum");
-	}
-	else
-		modnum = ent->baseline.modelindex;
-		
-	model = cl.model_precache[modnum];
+	model = cl.model_precache[state->modelindex];
 	if (model != ent->model)
 	{
 		ent->model = model;
@@ -399,68 +363,37 @@ void CL_ParseUpdate (int bits)
 #endif
 	}
 	
-	if (bits & U_FRAME)
-		ent->frame = MSG_ReadByte ();
-	else
-		ent->frame = ent->baseline.frame;
+	ent->frame = state->frame;
 
-	if (bits & U_COLORMAP)
-		i = MSG_ReadByte();
-	else
-		i = ent->baseline.colormap;
-	if (!i)
+	if (!state->colormap)
 		ent->colormap = vid.colormap;
 	else
 	{
-		if (i > cl.maxclients)
+		if (state->colormap > cl.maxclients)
 			Sys_Error ("i >= cl.maxclients");
-		ent->colormap = cl.scores[i-1].translations;
+		ent->colormap = cl.scores[state->colormap-1].translations;
 	}
 
 #ifdef GLQUAKE
-	if (bits & U_SKIN)
-		skin = MSG_ReadByte();
-	else
-		skin = ent->baseline.skin;
-	if (skin != ent->skinnum) {
-		ent->skinnum = skin;
+	if (state->skin != ent->skinnum) {
+		ent->skinnum = state->skin;
 		if (num > 0 && num <= cl.maxclients)
 			R_TranslatePlayerSkin (num - 1);
 	}
-
 #else
-
-	if (bits & U_SKIN)
-		ent->skinnum = MSG_ReadByte();
-	else
-		ent->skinnum = ent->baseline.skin;
+	ent->skinnum = state->skin;
 #endif
 
-	if (bits & U_EFFECTS)
-		ent->effects = MSG_ReadByte();
-	else
-		ent->effects = ent->baseline.effects;
+	ent->effects = state->effects;
 
 // shift the known values for interpolation
 	VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
 	VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
 
-	if (bits & U_ORIGIN1)		ent->msg_origins[0][0]	= MSG_ReadCoord ();
-	else						ent->msg_origins[0][0]	= ent->baseline.origin[0];
-	if (bits & U_ANGLE1)		ent->msg_angles[0][0]	= MSG_ReadAngle();
-	else						ent->msg_angles[0][0]	= ent->baseline.angles[0];
-
-	if (bits & U_ORIGIN2)		ent->msg_origins[0][1]	= MSG_ReadCoord ();
-	else						ent->msg_origins[0][1]	= ent->baseline.origin[1];
-	if (bits & U_ANGLE2)		ent->msg_angles[0][1]	= MSG_ReadAngle();
-	else						ent->msg_angles[0][1]	= ent->baseline.angles[1];
-
-	if (bits & U_ORIGIN3)		ent->msg_origins[0][2]	= MSG_ReadCoord ();
-	else						ent->msg_origins[0][2]	= ent->baseline.origin[2];
-	if (bits & U_ANGLE3)		ent->msg_angles[0][2]	= MSG_ReadAngle();
-	else						ent->msg_angles[0][2]	= ent->baseline.angles[2];
+	VectorCopy (state->origin, ent->msg_origins[0]);
+	VectorCopy (state->angles, ent->msg_angles[0]);
 
-	if (bits & U_NOLERP)
+	if (nolerp)
 		ent->forcelink = true;
 
 	if (forcelink)
@@ -473,6 +406,258 @@ void CL_ParseUpdate (int bits)
 	}
 }
 
+/*
+==================
+CL_ParseUpdate
+
+Parse an entity update message from the server
+==================
+*/
+int	bitcounts[16];
+
+void CL_ParseUpdate (int bits)
+{
+	int			i;
+	entity_t	*ent;
+	int			num;
+	entity_state_t	state;
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	if (bits & U_MOREBITS)
+	{
+		i = MSG_ReadByte ();
+		bits |= (i<<8);
+	}
+
+	if (bits & U_LONGENTITY)	
+		num = MSG_ReadShort ();
+	else
+		num = MSG_ReadByte ();
+
+	ent = CL_EntityNum (num);
+
+	for (i=0 ; i<16 ; i++)
+		if (bits&(1<<i))
+			bitcounts[i]++;
+
+// anything not sent is at its baseline
+	state = ent->baseline;
+
+	if (bits & U_MODEL)
+	{
+		state.modelindex = MSG_ReadByte ();
+		if (state.modelindex >= MAX_MODELS)
+			Host_Error ("CL_ParseModel: bad modnum");
+	}
+	if (bits & U_FRAME)
+		state.frame = MSG_ReadByte ();
+	if (bits & U_COLORMAP)
+		state.colormap = MSG_ReadByte();
+	if (bits & U_SKIN)
+		state.skin = MSG_ReadByte();
+	if (bits & U_EFFECTS)
+		state.effects = MSG_ReadByte();
+
+	if (bits & U_ORIGIN1)
+		state.origin[0] = MSG_ReadCoord ();
+	if (bits & U_ANGLE1)
+		state.angles[0] = MSG_ReadAngle();
+	if (bits & U_ORIGIN2)
+		state.origin[1] = MSG_ReadCoord ();
+	if (bits & U_ANGLE2)
+		state.angles[1] = MSG_ReadAngle();
+	if (bits & U_ORIGIN3)
+		state.origin[2] = MSG_ReadCoord ();
+	if (bits & U_ANGLE3)
+		state.angles[2] = MSG_ReadAngle();
+
+	CL_ApplyEntityState (num, &state, bits & U_NOLERP);
+}
+
+/*
+==================
+CL_PackBaseline
+
+The baseline as the server packs it, for entities new to a frame
+==================
+*/
+void CL_PackBaseline (int num, packedentity_t *pe)
+{
+	int				i;
+	entity_state_t	*baseline;
+
+	baseline = &CL_EntityNum(num)->baseline;
+
+	pe->number = num;
+	pe->modelindex = baseline->modelindex;
+	pe->frame = baseline->frame;
+	pe->colormap = baseline->colormap;
+	pe->skin = baseline->skin;
+	pe->effects = baseline->effects;
+	pe->flags = 0;
+	for (i=0 ; i<3 ; i++)
+	{	// these came from MSG_ReadCoord and MSG_ReadAngle, so they're exact
+		pe->origin[i] = (int)(baseline->origin[i]*8);
+		pe->angles[i] = (int)(baseline->angles[i]*256/360) & 255;
+	}
+}
+
+/*
+==================
+CL_ParseDeltaEntity
+==================
+*/
+void CL_ParseDeltaEntity (packedentity_t *from, packedentity_t *to, int num)
+{
+	int		bits;
+
+	*to = *from;
+	to->number = num;
+
+	bits = MSG_ReadByte ();
+	if (bits & U_MOREBITS)
+		bits |= MSG_ReadByte ()<<8;
+
+	if (bits & U_NOLERP)
+		to->flags |= PE_NOLERP;
+	else
+		to->flags &= ~PE_NOLERP;
+
+	if (bits & U_MODEL)
+		to->modelindex = MSG_ReadByte ();
+	if (bits & U_FRAME)
+		to->frame = MSG_ReadByte ();
+	if (bits & U_COLORMAP)
+		to->colormap = MSG_ReadByte ();
+	if (bits & U_SKIN)
+		to->skin = MSG_ReadByte ();
+	if (bits & U_EFFECTS)
+		to->effects = MSG_ReadByte ();
+	if (bits & U_ORIGIN1)
+		to->origin[0] = MSG_ReadShort ();
+	if (bits & U_ANGLE1)
+		to->angles[0] = MSG_ReadByte ();
+	if (bits & U_ORIGIN2)
+		to->origin[1] = MSG_ReadShort ();
+	if (bits & U_ANGLE2)
+		to->angles[1] = MSG_ReadByte ();
+	if (bits & U_ORIGIN3)
+		to->origin[2] = MSG_ReadShort ();
+	if (bits & U_ANGLE3)
+		to->angles[2] = MSG_ReadByte ();
+}
+
+/*
+==================
+CL_ParsePacketEntities
+
+Rebuilds a PROTOCOL_DELTA entity frame from the frame it was delta
+compressed from, then updates every entity in it
+==================
+*/
+void CL_ParsePacketEntities (void)
+{
+	int				i, j;
+	int				sequence, delta, word, num, count, numbase;
+	entityframe_t	*frame, *base;
+	packedentity_t	*out, baseline;
+	entity_state_t	state;
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	sequence = MSG_ReadLong ();
+	delta = MSG_ReadByte ();
+	if (delta >= UPDATE_BACKUP)
+		Host_Error ("CL_ParsePacketEntities: delta of %i frames", delta);
+
+	base = NULL;
+	numbase = 0;
+	if (delta)
+	{
+		base = &cl.frames[(sequence - delta) & UPDATE_MASK];
+		if (base->sequence != sequence - delta)
+			Host_Error ("CL_ParsePacketEntities: delta from invalid frame");
+		numbase = base->numentities;
+	}
+
+	frame = &cl.frames[sequence & UPDATE_MASK];
+	out = frame->entities;
+	count = 0;
+	i = 0;
+	while (1)
+	{
+		word = MSG_ReadShort ();
+		if (msg_badread)
+			Host_Error ("CL_ParsePacketEntities: end of message");
+		if (!word)
+			break;
+		num = word & (U_REMOVE-1);
+
+	// everything before it is unchanged
+		while (i < numbase && base->entities[i].number < num)
+		{
+			if (count == MAX_PACKET_ENTITIES)
+				Host_Error ("CL_ParsePacketEntities: too many entities");
+			out[count++] = base->entities[i++];
+		}
+
+		if (word & U_REMOVE)
+		{
+			if (i == numbase || base->entities[i].number != num)
+				Host_Error ("CL_ParsePacketEntities: remove of %i not in the frame", num);
+			i++;
+			continue;
+		}
+
+		if (count == MAX_PACKET_ENTITIES)
+			Host_Error ("CL_ParsePacketEntities: too many entities");
+		if (i < numbase && base->entities[i].number == num)
+			CL_ParseDeltaEntity (&base->entities[i++], &out[count++], num);
+		else
+		{
+			CL_PackBaseline (num, &baseline);
+			CL_ParseDeltaEntity (&baseline, &out[count++], num);
+		}
+	}
+
+	while (i < numbase)
+	{
+		if (count == MAX_PACKET_ENTITIES)
+			Host_Error ("CL_ParsePacketEntities: too many entities");
+		out[count++] = base->entities[i++];
+	}
+
+	frame->sequence = sequence;
+	frame->numentities = count;
+	cl.framesequence = sequence;
+
+	for (i=0 ; i<count ; i++, out++)
+	{
+		if (out->modelindex >= MAX_MODELS)
+			Host_Error ("CL_ParsePacketEntities: bad modnum");
+		state.modelindex = out->modelindex;
+		state.frame = out->frame;
+		state.colormap = out->colormap;
+		state.skin = out->skin;
+		state.effects = out->effects;
+		for (j=0 ; j<3 ; j++)
+		{
+			state.origin[j] = out->origin[j] * (1.0/8);
+			state.angles[j] = (signed char)out->angles[j] * (360.0/256);
+		}
+		CL_ApplyEntityState (out->number, &state, out->flags & PE_NOLERP);
+	}
+}
+
 /*
 ==================
 CL_ParseBaseline
@@ -772,7 +957,7 @@ void CL_ParseServerMessage (void)
 		
 		case svc_version:
 			i = MSG_ReadLong ();
-			if (i != PROTOCOL_VERSION)
+			if (i != PROTOCOL_VERSION && i != PROTOCOL_DELTA)
 				Host_Error ("CL_ParseServerMessage: Server is protocol %i instead of %i\n", i, PROTOCOL_VERSION);
 			break;
 			
@@ -947,6 +1132,12 @@ void CL_ParseServerMessage (void)
 		case svc_sellscreen:
 			Cmd_ExecuteString ("help", src_command);
 			break;
+
+		case svc_packetentities:
+			if (cl.protocol != PROTOCOL_DELTA)
+				Host_Error ("CL_ParseServerMessage: svc_packetentities without PROTOCOL_DELTA");
+			CL_ParsePacketEntities ();
+			break;
 		}
 	}
 }
@@ -176,6 +176,9 @@ byte *COM_LoadStackFile (char *path, void *buffer, int bufsize);
 byte *COM_LoadTempFile (char *path);
 byte *COM_LoadHunkFile (char *path);
 void COM_LoadCacheFile (char *path, struct cache_user_s *cu);
+byte *COM_MapFile (char *filename);
+int COM_FileStamp (char *filename);
+void COM_CreatePath (char *path);
 
 
 extern	struct cvar_s	registered;
@@ -341,9 +341,14 @@ void Con_Print (char *txt)
 	}
 }
 
+#ifdef _WIN32
 open (const char*, int, int);
 write (int, const void*, unsigned int);
 close (int);
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 /*
 ================
@@ -381,7 +386,7 @@ void Con_Printf (char *fmt, ...)
 	static qboolean	inupdate;
 	
 	va_start (argptr,fmt);
-	vsprintf_s(msg, sizeof(msg), fmt, argptr);
+	vsnprintf (msg, sizeof(msg), fmt, argptr);
 	va_end (argptr);
 	
 // also echo to debugging console
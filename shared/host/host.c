@@ -183,6 +183,7 @@ void	Host_FindMaxClients (void)
 	if (svs.maxclients < 1)
 		svs.maxclients = 8;
 
+	svs.maxclientslimit = svs.maxclients;
 	if (svs.maxclientslimit < 4)
 		svs.maxclientslimit = 4;
 
@@ -193,6 +194,7 @@ void	Host_FindMaxClients (void)
 		svs.maxclients = svs.maxclientslimit;
 
 	svs.clients = Hunk_AllocName (svs.maxclientslimit*sizeof(client_t), "clients");
+	svs.frames = Hunk_AllocName (svs.maxclientslimit*UPDATE_BACKUP*sizeof(entityframe_t), "frames");
 
 	if (svs.maxclients > 1)
 		Cvar_SetValue ("deathmatch", 1.0);
@@ -368,8 +370,8 @@ void SV_DropClient (qboolean crash)
 		Sys_Printf ("Client %s removed\n",host_client->name);
 	}
 
-// break the net connection
-	NET_Close (host_client->netconnection);
+// break the net connection once anything still queued has been delivered
+	NET_Linger (host_client->netconnection);
 	host_client->netconnection = NULL;
 
 // free the client (the body stays around)
@@ -408,7 +410,6 @@ void Host_ShutdownServer(qboolean crash)
 	int		count;
 	sizebuf_t	buf;
 	char		message[4];
-	double	start;
 
 	if (!sv.active)
 		return;
@@ -419,40 +420,26 @@ void Host_ShutdownServer(qboolean crash)
 	if (cls.state == ca_connected)
 		CL_Disconnect ();
 
-// flush any pending messages - like the score!!!
-	start = Sys_FloatTime();
-	do
+// queue any pending messages - like the score!!! - and make sure all the
+// clients know we're disconnecting.  Nothing waits for them to arrive, the
+// connections linger after the drop until they have
+	buf.data = message;
+	buf.maxsize = 4;
+	buf.cursize = 0;
+	MSG_WriteByte(&buf, svc_disconnect);
+
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 	{
-		count = 0;
-		for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+		if (host_client->active && host_client->message.cursize)
 		{
-			if (host_client->active && host_client->message.cursize)
-			{
-				if (NET_CanSendMessage (host_client->netconnection))
-				{
-					NET_SendMessage(host_client->netconnection, &host_client->message);
-					SZ_Clear (&host_client->message);
-				}
-				else
-				{
-					NET_GetMessage(host_client->netconnection);
-					count++;
-				}
-			}
+			NET_QueueMessage (host_client->netconnection, &host_client->message);
+			SZ_Clear (&host_client->message);
 		}
-		if ((Sys_FloatTime() - start) > 3.0)
-			break;
 	}
-	while (count);
 
-// make sure all the clients know we're disconnecting
-	buf.data = message;
-	buf.maxsize = 4;
-	buf.cursize = 0;
-	MSG_WriteByte(&buf, svc_disconnect);
-	count = NET_SendToAll(&buf, 5);
+	count = NET_QueueToAll(&buf);
 	if (count)
-		Con_Printf("Host_ShutdownServer: NET_SendToAll failed for %u clients\n", count);
+		Con_Printf("Host_ShutdownServer: NET_QueueToAll failed for %u clients\n", count);
 
 	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 		if (host_client->active)
@@ -549,6 +536,9 @@ Host_ServerFrame
 */
 void Host_ServerFrame (void)
 {
+	Prof_Frame ();
+	PROF_BEGIN ("Host_ServerFrame");
+
 // run the world state	
 	pr_global_struct->frametime = host_frametime;
 
@@ -559,15 +549,28 @@ void Host_ServerFrame (void)
 	SV_CheckForNewClients ();
 
 // read client messages
+	PROF_BEGIN ("SV_RunClients");
 	SV_RunClients ();
+	PROF_END ();
 	
 // move things around and think
 // always pause in single player if in console or menus
 	if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game) )
+	{
+		PROF_BEGIN ("SV_Physics");
 		SV_Physics ();
+		PROF_END ();
+	}
 
 // send all messages to the clients
+	PROF_BEGIN ("SV_SendClientMessages");
 	SV_SendClientMessages ();
+	NET_Flush ();
+	PROF_END ();
+
+	Host_AutoSnapshot ();
+
+	PROF_END ();
 }
 
 /*
@@ -747,6 +750,7 @@ void Host_Init (quakeparms_t *parms)
 	Mod_Init ();
 	NET_Init ();
 	SV_Init ();
+	Prof_Init ();
 
 	Con_Printf ("Exe: "__TIME__" "__DATE__"\n");
 	Con_Printf ("%4.1f megabyte heap\n",parms->memsize/ (1024*1024.0));
@@ -827,6 +831,9 @@ void Host_Shutdown(void)
 
 	Host_WriteConfiguration (); 
 
+// don't quit in the middle of writing a snapshot
+	Host_FinishSnapshot ();
+
 	CDAudio_Shutdown ();
 	NET_Shutdown ();
 	S_Shutdown();
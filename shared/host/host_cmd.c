@@ -417,37 +417,68 @@ void Host_SavegameComment (char *text)
 
 /*
 ===============
-Host_Savegame_f
+Host_CanSave
+
+Checks the game is in a state a save can restore
 ===============
 */
-void Host_Savegame_f (void)
+qboolean Host_CanSave (qboolean print)
 {
-	char	name[256];
-	FILE	*f;
 	int		i;
-	char	comment[SAVEGAME_COMMENT_LENGTH+1];
-
-	if (cmd_source != src_command)
-		return;
 
 	if (!sv.active)
 	{
-		Con_Printf ("Not playing a local game.\n");
-		return;
+		if (print)
+			Con_Printf ("Not playing a local game.\n");
+		return false;
 	}
 
 	if (cl.intermission)
 	{
-		Con_Printf ("Can't save in intermission.\n");
-		return;
+		if (print)
+			Con_Printf ("Can't save in intermission.\n");
+		return false;
 	}
 
 	if (svs.maxclients != 1)
 	{
-		Con_Printf ("Can't save multiplayer games.\n");
-		return;
+		if (print)
+			Con_Printf ("Can't save multiplayer games.\n");
+		return false;
 	}
 
+	for (i=0 ; i<svs.maxclients ; i++)
+	{
+		if (svs.clients[i].active && (svs.clients[i].edict->v.health <= 0) )
+		{
+			if (print)
+				Con_Printf ("Can't savegame with a dead player\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+===============
+Host_Savegame_f
+===============
+*/
+void Host_Savegame_f (void)
+{
+	char	name[256];
+	FILE	*f;
+	int		i;
+	char	comment[SAVEGAME_COMMENT_LENGTH+1];
+
+	if (cmd_source != src_command)
+		return;
+
+	if (!Host_CanSave (true))
+		return;
+
 	if (Cmd_Argc() != 2)
 	{
 		Con_Printf ("save <savename> : save a game\n");
@@ -459,15 +490,6 @@ void Host_Savegame_f (void)
 		Con_Printf ("Relative pathnames are not allowed.\n");
 		return;
 	}
-		
-	for (i=0 ; i<svs.maxclients ; i++)
-	{
-		if (svs.clients[i].active && (svs.clients[i].edict->v.health <= 0) )
-		{
-			Con_Printf ("Can't savegame with a dead player\n");
-			return;
-		}
-	}
 
 	sprintf (name, "%s/%s", com_gamedir, Cmd_Argv(1));
 	COM_DefaultExtension (name, ".sav");
@@ -627,7 +649,13 @@ void Host_Loadgame_f (void)
 		else
 		{	// parse an edict
 
+			if (!ED_Grow (entnum + 1))
+			{
+				fclose (f);
+				Host_Error ("Loadgame: more than %i edicts", MAX_EDICTS);
+			}
 			ent = EDICT_NUM(entnum);
+			ED_UnindexEdict (ent);
 			memset (&ent->v, 0, progs->entityfields * 4);
 			ent->free = false;
 			ED_ParseEdict (start, ent);
@@ -642,6 +670,7 @@ void Host_Loadgame_f (void)
 	
 	sv.num_edicts = entnum;
 	sv.time = time;
+	ED_RebuildFreeList ();
 
 	fclose (f);
 
@@ -655,6 +684,649 @@ void Host_Loadgame_f (void)
 	}
 }
 
+/*
+===============================================================================
+
+SNAPSHOTS
+
+A binary image of what a savegame holds: the saved globals, the edicts,
+the light styles and every string they point at outside the progs string
+table.  The image is built in one pass and written by a background thread,
+so the server only stops for the copy.  It's for the machine and progs that
+made it: the byte order is native and the progs crc has to match.
+
+===============================================================================
+*/
+
+#define	SNAPSHOT_IDENT		(('P'<<24)+('N'<<16)+('S'<<8)+'Q')	// little-endian "QSNP"
+#define	SNAPSHOT_VERSION	1
+
+#define	SNAP_STRINGCACHE	4096	// string_t to heap offset, so repeats are stored once
+
+typedef struct
+{
+	int		ident;
+	int		version;
+	int		crc;						// of the progs that wrote it
+	int		numglobals;
+	int		entityfields;
+	int		num_edicts;
+	int		stringsize;					// bytes of string heap after the edicts
+	int		filesize;
+	char	comment[SAVEGAME_COMMENT_LENGTH+1];
+	char	mapname[64];
+	float	time;
+	int		skill;
+	float	spawn_parms[NUM_SPAWN_PARMS];
+	int		lightstyles[MAX_LIGHTSTYLES];	// string heap offsets, -1 if unset
+} snapheader_t;
+
+// the globals follow the header, then every edict as one of these and its
+// entityfields longs of entvars.  String fields hold either a progs string
+// offset or -1 - a string heap offset
+typedef struct
+{
+	int		free;
+	float	freetime;
+} snapedict_t;
+
+typedef struct
+{
+	byte	*data;
+	int		cursize;
+	int		maxsize;
+} snapbuf_t;
+
+cvar_t	sv_autosnapshot = {"sv_autosnapshot","0"};	// seconds between autosnap.qss writes
+
+static snapbuf_t	snap_image;			// owned by the writer thread while snap_writing
+static snapbuf_t	snap_heap;
+static char			snap_name[MAX_OSPATH];
+static qboolean		snap_writing;
+static qboolean		snap_error;
+static double		snap_lasttime;
+
+static byte			*snap_loaddata;		// the file Host_LoadSnapshot_f is loading
+static int			*snap_loadfields;
+
+static int			snap_cachestring[SNAP_STRINGCACHE];
+static int			snap_cacheheap[SNAP_STRINGCACHE];
+
+/*
+===============
+Snap_Alloc
+
+Returns room for size more bytes at the end of buf
+===============
+*/
+static void *Snap_Alloc (snapbuf_t *buf, int size)
+{
+	void	*data;
+
+	if (buf->cursize + size > buf->maxsize)
+	{
+		buf->maxsize = (buf->cursize + size) * 3 / 2;
+		buf->data = realloc (buf->data, buf->maxsize);
+		if (!buf->data)
+			Sys_Error ("Snap_Alloc: couldn't allocate %i bytes", buf->maxsize);
+	}
+
+	data = buf->data + buf->cursize;
+	buf->cursize += size;
+	return data;
+}
+
+/*
+===============
+Snap_String
+
+Progs strings are the same in every run, anything else is copied to the
+string heap
+===============
+*/
+static int Snap_String (string_t s)
+{
+	int		h, len, ofs;
+	char	*text;
+
+	if (s >= 0 && s < progs->numstrings)
+		return s;
+
+	h = (unsigned)s % SNAP_STRINGCACHE;
+	if (snap_cachestring[h] == s && snap_cacheheap[h] != -1)
+		return -1 - snap_cacheheap[h];
+
+	text = pr_strings + s;
+	len = strlen (text) + 1;
+	ofs = snap_heap.cursize;
+	memcpy (Snap_Alloc (&snap_heap, len), text, len);
+
+	snap_cachestring[h] = s;
+	snap_cacheheap[h] = ofs;
+	return -1 - ofs;
+}
+
+/*
+===============
+Snap_StringFields
+
+Fills in the offsets of the string fields (or globals) in defs, only the
+ones with all the flags in need set
+===============
+*/
+static int Snap_StringFields (ddef_t *defs, int numdefs, int need, int *ofs)
+{
+	int		i, count;
+
+	count = 0;
+	for (i=0 ; i<numdefs ; i++)
+		if ((defs[i].type & ~DEF_SAVEGLOBAL) == ev_string && (defs[i].type & need) == need)
+			ofs[count++] = defs[i].ofs;
+
+	return count;
+}
+
+/*
+===============
+Host_WriteSnapshot
+
+Runs on the background thread
+===============
+*/
+static void Host_WriteSnapshot (void *data, int index)
+{
+	char	temp[MAX_OSPATH+4];	// snap_name and .tmp
+	FILE	*f;
+
+	sprintf (temp, "%s.tmp", snap_name);
+	f = fopen (temp, "wb");
+	if (!f)
+	{
+		snap_error = true;
+		return;
+	}
+
+	if (fwrite (snap_image.data, 1, snap_image.cursize, f) != snap_image.cursize)
+		snap_error = true;
+	if (fclose (f))
+		snap_error = true;
+
+	// the old snapshot stays until the new one is complete
+	if (!snap_error && rename (temp, snap_name))
+	{
+		remove (snap_name);
+		if (rename (temp, snap_name))
+			snap_error = true;
+	}
+}
+
+/*
+===============
+Host_FinishSnapshot
+
+Waits for the last snapshot to be written
+===============
+*/
+void Host_FinishSnapshot (void)
+{
+	if (!snap_writing)
+		return;
+
+	Sys_FinishBackgroundJob ();
+	snap_writing = false;
+
+	if (snap_error)
+		Con_Printf ("ERROR: couldn't write %s.\n", snap_name);
+}
+
+/*
+===============
+Host_SaveSnapshot
+===============
+*/
+void Host_SaveSnapshot (char *name)
+{
+	snapheader_t	*header;
+	snapedict_t		*se;
+	edict_t			*ent;
+	int				*v;
+	int				*stringfields, numstringfields;
+	int				*stringglobals, numstringglobals;
+	int				i, j;
+	double			start;
+
+	start = Sys_FloatTime ();
+
+	Host_FinishSnapshot ();
+
+// room for the directory, the .qss and the writer's .tmp
+	if (strlen(com_gamedir) + strlen(name) + 10 > MAX_OSPATH)
+	{
+		Con_Printf ("%s: name too long\n", name);
+		return;
+	}
+
+	snap_image.cursize = 0;
+	snap_heap.cursize = 0;
+	for (i=0 ; i<SNAP_STRINGCACHE ; i++)
+		snap_cacheheap[i] = -1;
+
+	Snap_Alloc (&snap_image, sizeof(snapheader_t) + progs->numglobals*4
+		+ sv.num_edicts * (sizeof(snapedict_t) + progs->entityfields*4));
+	snap_image.cursize = 0;
+
+	header = Snap_Alloc (&snap_image, sizeof(*header));
+	memset (header, 0, sizeof(*header));
+	header->ident = SNAPSHOT_IDENT;
+	header->version = SNAPSHOT_VERSION;
+	header->crc = pr_crc;
+	header->numglobals = progs->numglobals;
+	header->entityfields = progs->entityfields;
+	header->num_edicts = sv.num_edicts;
+	Host_SavegameComment (header->comment);
+	Q_strncpy (header->mapname, sv.name, sizeof(header->mapname)-1);
+	header->time = sv.time;
+	header->skill = current_skill;
+	for (i=0 ; i<NUM_SPAWN_PARMS ; i++)
+		header->spawn_parms[i] = svs.clients->spawn_parms[i];
+
+	stringfields = malloc ((progs->numfielddefs + progs->numglobaldefs) * sizeof(int));
+	stringglobals = stringfields + progs->numfielddefs;
+	numstringfields = Snap_StringFields (pr_fielddefs, progs->numfielddefs, 0, stringfields);
+	numstringglobals = Snap_StringFields (pr_globaldefs, progs->numglobaldefs, DEF_SAVEGLOBAL, stringglobals);
+
+// the globals, only the ones the loader restores have their strings moved
+// to the heap, the rest can hold anything and are never read back
+	v = Snap_Alloc (&snap_image, progs->numglobals*4);
+	memcpy (v, pr_globals, progs->numglobals*4);
+	for (j=0 ; j<numstringglobals ; j++)
+		v[stringglobals[j]] = Snap_String (v[stringglobals[j]]);
+
+// the edicts, free ones cleared the way a savegame's "{}" loads them
+	for (i=0 ; i<sv.num_edicts ; i++)
+	{
+		ent = EDICT_NUM(i);
+		se = Snap_Alloc (&snap_image, sizeof(*se) + progs->entityfields*4);
+		se->free = ent->free;
+		se->freetime = ent->freetime;
+		v = (int *)(se + 1);
+		if (ent->free)
+		{
+			memset (v, 0, progs->entityfields*4);
+			continue;
+		}
+		memcpy (v, &ent->v, progs->entityfields*4);
+		for (j=0 ; j<numstringfields ; j++)
+			if (v[stringfields[j]])
+				v[stringfields[j]] = Snap_String (v[stringfields[j]]);
+	}
+
+	free (stringfields);
+
+// the light styles go with the rest of the strings
+	header = (snapheader_t *)snap_image.data;
+	for (i=0 ; i<MAX_LIGHTSTYLES ; i++)
+	{
+		if (!sv.lightstyles[i])
+		{
+			header->lightstyles[i] = -1;
+			continue;
+		}
+		j = strlen (sv.lightstyles[i]) + 1;
+		header->lightstyles[i] = snap_heap.cursize;
+		memcpy (Snap_Alloc (&snap_heap, j), sv.lightstyles[i], j);
+	}
+
+	header->stringsize = snap_heap.cursize;
+	memcpy (Snap_Alloc (&snap_image, snap_heap.cursize), snap_heap.data, snap_heap.cursize);
+	header = (snapheader_t *)snap_image.data;
+	header->filesize = snap_image.cursize;
+
+	sprintf (snap_name, "%s/%s", com_gamedir, name);
+	COM_DefaultExtension (snap_name, ".qss");
+	snap_error = false;
+	snap_writing = true;
+	Sys_BeginBackgroundJob (Host_WriteSnapshot, NULL);
+
+	Con_DPrintf ("%s: %i edicts, %i bytes, copied in %.2f ms\n", snap_name,
+		sv.num_edicts, snap_image.cursize, (Sys_FloatTime() - start) * 1000);
+}
+
+/*
+===============
+Host_CanSnapshot
+
+A snapshot holds the whole server, so unlike a savegame it can be taken
+of a multiplayer game.  A single player game still goes through
+Host_CanSave, a snapshot of a dead player would only restore the death.
+===============
+*/
+static qboolean Host_CanSnapshot (qboolean print)
+{
+	if (svs.maxclients == 1)
+		return Host_CanSave (print);
+
+	if (!sv.active)
+	{
+		if (print)
+			Con_Printf ("Not running a server.\n");
+		return false;
+	}
+
+	if (cl.intermission)
+	{
+		if (print)
+			Con_Printf ("Can't save in intermission.\n");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+===============
+Host_Snapshot_f
+===============
+*/
+void Host_Snapshot_f (void)
+{
+	if (cmd_source != src_command)
+		return;
+
+	if (!Host_CanSnapshot (true))
+		return;
+
+	if (Cmd_Argc() != 2)
+	{
+		Con_Printf ("snapshot <name> : write a binary snapshot of the game\n");
+		return;
+	}
+
+	if (strstr(Cmd_Argv(1), ".."))
+	{
+		Con_Printf ("Relative pathnames are not allowed.\n");
+		return;
+	}
+
+	Con_Printf ("Writing snapshot %s\n", Cmd_Argv(1));
+	Host_SaveSnapshot (Cmd_Argv(1));
+}
+
+/*
+===============
+Host_AutoSnapshot
+
+Called every server frame, writes autosnap.qss every sv_autosnapshot seconds
+===============
+*/
+void Host_AutoSnapshot (void)
+{
+	if (sv_autosnapshot.value <= 0)
+		return;
+	if (realtime - snap_lasttime < sv_autosnapshot.value)
+		return;
+	snap_lasttime = realtime;
+
+	if (!Host_CanSnapshot (false))
+		return;
+
+	Host_SaveSnapshot ("autosnap");
+}
+
+/*
+===============
+Snap_FreeLoad
+
+Frees what Host_LoadSnapshot_f allocated.  Called before it returns or
+raises an error, and again when it starts in case something else raised
+one in the middle of a load.
+===============
+*/
+static void Snap_FreeLoad (void)
+{
+	free (snap_loaddata);
+	snap_loaddata = NULL;
+	free (snap_loadfields);
+	snap_loadfields = NULL;
+}
+
+/*
+===============
+Snap_LoadString
+===============
+*/
+static string_t Snap_LoadString (int s, snapheader_t *header, char *heap)
+{
+	if (s >= 0)
+	{
+		if (s >= progs->numstrings)
+		{
+			Snap_FreeLoad ();
+			Host_Error ("Snapshot has a bad string");
+		}
+		return s;
+	}
+
+	s = -1 - s;
+	if (s >= header->stringsize || !memchr (heap + s, 0, header->stringsize - s))
+	{
+		Snap_FreeLoad ();
+		Host_Error ("Snapshot has a bad string");
+	}
+	return heap + s - pr_strings;
+}
+
+/*
+===============
+Host_LoadSnapshot_f
+===============
+*/
+void Host_LoadSnapshot_f (void)
+{
+	char			name[MAX_OSPATH];
+	snapheader_t	*header;
+	snapedict_t		*se;
+	byte			*data;
+	char			*heap;
+	edict_t			*ent;
+	ddef_t			*def;
+	int				*v;
+	int				*stringfields, numstringfields;
+	int				handle, length;
+	int				i, j, type;
+
+	if (cmd_source != src_command)
+		return;
+
+	Snap_FreeLoad ();
+
+	if (Cmd_Argc() != 2)
+	{
+		Con_Printf ("loadsnapshot <name> : load a binary snapshot\n");
+		return;
+	}
+
+	cls.demonum = -1;		// stop demo loop in case this fails
+
+	// it may still be writing the one we want
+	Host_FinishSnapshot ();
+
+	if (strlen(com_gamedir) + strlen(Cmd_Argv(1)) + 6 > MAX_OSPATH)
+	{
+		Con_Printf ("%s: name too long\n", Cmd_Argv(1));
+		return;
+	}
+	sprintf (name, "%s/%s", com_gamedir, Cmd_Argv(1));
+	COM_DefaultExtension (name, ".qss");
+
+	Con_Printf ("Loading snapshot from %s...\n", name);
+	length = Sys_FileOpenRead (name, &handle);
+	if (length == -1)
+	{
+		Con_Printf ("ERROR: couldn't open.\n");
+		return;
+	}
+
+	snap_loaddata = data = malloc (length);
+	if (!data)
+	{
+		Sys_FileClose (handle);
+		Con_Printf ("ERROR: couldn't allocate %i bytes.\n", length);
+		return;
+	}
+	i = Sys_FileRead (handle, data, length);
+	Sys_FileClose (handle);
+
+	header = (snapheader_t *)data;
+	if (i != length || length < sizeof(*header) || header->ident != SNAPSHOT_IDENT)
+	{
+		Snap_FreeLoad ();
+		Con_Printf ("%s is not a snapshot\n", name);
+		return;
+	}
+	if (header->version != SNAPSHOT_VERSION)
+	{
+		Con_Printf ("Snapshot is version %i, not %i\n", header->version, SNAPSHOT_VERSION);
+		Snap_FreeLoad ();
+		return;
+	}
+	if (header->filesize != length || header->num_edicts < 1 || header->stringsize < 0
+	|| header->filesize != sizeof(*header) + header->numglobals*4 + header->stringsize
+		+ header->num_edicts * (sizeof(snapedict_t) + header->entityfields*4))
+	{
+		Snap_FreeLoad ();
+		Con_Printf ("%s is damaged\n", name);
+		return;
+	}
+	if (progs && header->crc != pr_crc)
+	{
+		Snap_FreeLoad ();
+		Con_Printf ("Snapshot was made with different progs\n");
+		return;
+	}
+
+	current_skill = header->skill;
+	Cvar_SetValue ("skill", (float)current_skill);
+
+	CL_Disconnect_f ();
+
+	SV_SpawnServer (header->mapname);
+
+	if (!sv.active)
+	{
+		Snap_FreeLoad ();
+		Con_Printf ("Couldn't load map\n");
+		return;
+	}
+
+	if (header->crc != pr_crc || header->numglobals != progs->numglobals
+	|| header->entityfields != progs->entityfields)
+	{
+		Snap_FreeLoad ();
+		Host_Error ("Snapshot was made with different progs");
+	}
+	if (!ED_Grow (header->num_edicts))
+	{
+		i = header->num_edicts;
+		Snap_FreeLoad ();
+		Host_Error ("Snapshot has %i edicts, the limit is %i", i, MAX_EDICTS);
+	}
+
+	sv.paused = true;		// pause until all clients connect
+	sv.loadgame = true;
+
+// the string heap goes on the hunk, where ED_NewString would have put it
+	heap = Hunk_AllocName (header->stringsize, "snapstr");
+	memcpy (heap, data + length - header->stringsize, header->stringsize);
+
+	for (i=0 ; i<MAX_LIGHTSTYLES ; i++)
+	{
+		j = header->lightstyles[i];
+		if (j < 0 || j >= header->stringsize || !memchr (heap + j, 0, header->stringsize - j))
+			sv.lightstyles[i] = NULL;
+		else
+			sv.lightstyles[i] = heap + j;
+	}
+
+// the same globals a savegame restores
+	v = (int *)(header + 1);
+	for (i=0 ; i<progs->numglobaldefs ; i++)
+	{
+		def = &pr_globaldefs[i];
+		if ( !(def->type & DEF_SAVEGLOBAL) )
+			continue;
+		type = def->type & ~DEF_SAVEGLOBAL;
+
+		if (type == ev_string)
+			((int *)pr_globals)[def->ofs] = Snap_LoadString (v[def->ofs], header, heap);
+		else if (type == ev_float || type == ev_entity)
+			((int *)pr_globals)[def->ofs] = v[def->ofs];
+	}
+
+// the edicts
+	snap_loadfields = stringfields = malloc (progs->numfielddefs * sizeof(int));
+	if (!stringfields)
+	{
+		Snap_FreeLoad ();
+		Host_Error ("Host_LoadSnapshot_f: couldn't allocate %i string fields", progs->numfielddefs);
+	}
+	numstringfields = Snap_StringFields (pr_fielddefs, progs->numfielddefs, 0, stringfields);
+
+	se = (snapedict_t *)(v + header->numglobals);
+	for (i=0 ; i<header->num_edicts ; i++)
+	{
+		v = (int *)(se + 1);
+		ent = EDICT_NUM(i);
+		ED_UnindexEdict (ent);
+
+		memcpy (&ent->v, v, progs->entityfields*4);
+		ent->free = se->free;
+		ent->freetime = se->freetime;
+
+		if (ent->free)
+			SV_UnlinkEdict (ent);
+		else
+		{
+			for (j=0 ; j<numstringfields ; j++)
+			{
+				if (!v[stringfields[j]])
+					continue;
+				((int *)&ent->v)[stringfields[j]] = Snap_LoadString (v[stringfields[j]], header, heap);
+				ED_IndexField (ent, stringfields[j]);
+			}
+
+		// link it into the bsp tree
+			SV_LinkEdict (ent, false);
+		}
+
+		se = (snapedict_t *)(v + header->entityfields);
+	}
+
+// anything the map spawned past the snapshot's edicts goes away
+	for ( ; i<sv.num_edicts ; i++)
+	{
+		ent = EDICT_NUM(i);
+		ED_UnindexEdict (ent);
+		SV_UnlinkEdict (ent);
+		ent->free = true;
+	}
+
+	sv.num_edicts = header->num_edicts;
+	sv.time = header->time;
+	ED_RebuildFreeList ();
+
+	for (i=0 ; i<NUM_SPAWN_PARMS ; i++)
+		svs.clients->spawn_parms[i] = header->spawn_parms[i];
+
+	Snap_FreeLoad ();
+
+	if (cls.state != ca_dedicated)
+	{
+		CL_EstablishConnection ("local");
+		Host_Reconnect_f ();
+	}
+}
+
 //============================================================================
 
 /*
@@ -1606,6 +2278,9 @@ void Host_InitCommands (void)
 	Cmd_AddCommand ("ping", Host_Ping_f);
 	Cmd_AddCommand ("load", Host_Loadgame_f);
 	Cmd_AddCommand ("save", Host_Savegame_f);
+	Cmd_AddCommand ("snapshot", Host_Snapshot_f);
+	Cmd_AddCommand ("loadsnapshot", Host_LoadSnapshot_f);
+	Cvar_RegisterVariable (&sv_autosnapshot);
 	Cmd_AddCommand ("give", Host_Give_f);
 
 	Cmd_AddCommand ("startdemos", Host_Startdemos_f);
@@ -51,6 +51,7 @@ void	FloorDivMod (double numer, double denom, int *quotient, int *rem);
 int		GreatestCommonDivisor (int i1, int i2);
 float	VectorNormalize(vec3_t v);
 void	AngleVectors (vec3_t angles, vec3_t forward, vec3_t right, vec3_t up);
+struct mplane_s;
 int		BoxOnPlaneSide (vec3_t emins, vec3_t emaxs, struct mplane_s *plane);
 float	anglemod(float a);
 
@@ -30,6 +30,7 @@ static char     *safeargvs[NUM_SAFE_ARGVS] = {"-nolan", "-nosound", "-nocdaudio"
 
 cvar_t  registered = {"registered","0"};
 cvar_t  cmdline = {"cmdline","0", false, true};
+cvar_t  com_filelog = {"com_filelog","0"};      // print every file COM_FindFile opens
 
 qboolean        com_modified;   // set true if using non-id files
 
@@ -1137,6 +1138,7 @@ void COM_Init (void)
 
 	Cvar_RegisterVariable (&registered);
 	Cvar_RegisterVariable (&cmdline);
+	Cvar_RegisterVariable (&com_filelog);
 	Cmd_AddCommand ("path", COM_Path_f);
 
 	COM_InitFilesystem ();
@@ -1192,10 +1194,12 @@ int     com_filesize;
 // in memory
 //
 
-typedef struct
+typedef struct packfile_s
 {
 	char    name[MAX_QPATH];
 	int             filepos, filelen;
+	struct pack_s           *pack;
+	struct packfile_s       *hashnext;
 } packfile_t;
 
 typedef struct pack_s
@@ -1204,6 +1208,9 @@ typedef struct pack_s
 	int             handle;
 	int             numfiles;
 	packfile_t      *files;
+	int             order;          // position in com_searchpaths
+	byte            *data;          // the whole pak mapped read only, or NULL
+	unsigned short  crc;            // of the directory, for COM_FileStamp
 } pack_t;
 
 //
@@ -1236,6 +1243,85 @@ typedef struct searchpath_s
 
 searchpath_t    *com_searchpaths;
 
+#define FILEHASH_SIZE   1024    // must be a power of two
+
+packfile_t      *com_filehash[FILEHASH_SIZE];
+
+/*
+============
+COM_HashFileName
+
+============
+*/
+int COM_HashFileName (char *name)
+{
+	unsigned        hash;
+
+	for (hash = 0 ; *name ; name++)
+		hash = hash * 33 + *name;
+
+	return (hash ^ (hash >> 10)) & (FILEHASH_SIZE-1);
+}
+
+/*
+============
+COM_BuildFileHash
+
+Chains every file in every pak on the search path into com_filehash.
+Has to be called again whenever the search path changes.
+============
+*/
+void COM_BuildFileHash (void)
+{
+	searchpath_t    *search;
+	pack_t          *pak;
+	packfile_t      *file;
+	int             i, order, hash;
+
+	memset (com_filehash, 0, sizeof(com_filehash));
+
+	for (search = com_searchpaths, order = 0 ; search ; search = search->next, order++)
+	{
+		if (!search->pack)
+			continue;
+		pak = search->pack;
+		pak->order = order;
+		for (i=0, file=pak->files ; i<pak->numfiles ; i++, file++)
+		{
+			hash = COM_HashFileName (file->name);
+			file->pack = pak;
+			file->hashnext = com_filehash[hash];
+			com_filehash[hash] = file;
+		}
+	}
+}
+
+/*
+============
+COM_FindPackFile
+
+Returns the pak entry for filename that comes first in the search path,
+skipping the first skip elements of the path
+============
+*/
+packfile_t *COM_FindPackFile (char *filename, int skip)
+{
+	packfile_t      *file, *best;
+
+	best = NULL;
+	for (file = com_filehash[COM_HashFileName (filename)] ; file ; file = file->hashnext)
+	{
+		if (file->pack->order < skip)
+			continue;
+		if (best && best->pack->order <= file->pack->order)
+			continue;
+		if (!strcmp (file->name, filename))
+			best = file;
+	}
+
+	return best;
+}
+
 /*
 ============
 COM_Path_f
@@ -1289,7 +1375,7 @@ void COM_WriteFile (char *filename, void *data, int len)
 ============
 COM_CreatePath
 
-Only used for CopyFile
+Creates the directories leading up to the file in path
 ============
 */
 void    COM_CreatePath (char *path)
@@ -1343,61 +1429,42 @@ void COM_CopyFile (char *netpath, char *cachepath)
 
 /*
 ===========
-COM_FindFile
+COM_LocateFile
 
-Finds the file in the search path.
-Sets com_filesize and one of handle or file
+Finds the search path element that has the file.  If it is a pak file,
+packfile is set, otherwise the full path is left in netpath.
 ===========
 */
-int COM_FindFile (char *filename, int *handle, FILE **file)
+searchpath_t *COM_LocateFile (char *filename, packfile_t **packfile, char *netpath)
 {
 	searchpath_t    *search;
-	char            netpath[MAX_OSPATH];
-	char            cachepath[MAX_OSPATH];
-	pack_t          *pak;
-	int                     i;
-	int                     findtime, cachetime;
+	int                     skip;
 
-	if (file && handle)
-		Sys_Error ("COM_FindFile: both handle and file set");
-	if (!file && !handle)
-		Sys_Error ("COM_FindFile: neither handle or file set");
-		
 //
 // search through the path, one element at a time
 //
 	search = com_searchpaths;
+	skip = 0;
 	if (proghack)
 	{	// gross hack to use quake 1 progs with quake 2 maps
 		if (!strcmp(filename, "progs.dat"))
+		{
 			search = search->next;
+			skip = 1;
+		}
 	}
 
+// find the pak that has it first, directories in front of that pak
+// still have to be looked in
+	*packfile = COM_FindPackFile (filename, skip);
+
 	for ( ; search ; search = search->next)
 	{
 	// is the element a pak file?
 		if (search->pack)
 		{
-		// look through all the pak file elements
-			pak = search->pack;
-			for (i=0 ; i<pak->numfiles ; i++)
-				if (!strcmp (pak->files[i].name, filename))
-				{       // found it!
-					Sys_Printf ("PackFile: %s : %s\n",pak->filename, filename);
-					if (handle)
-					{
-						*handle = pak->handle;
-						Sys_FileSeek (pak->handle, pak->files[i].filepos);
-					}
-					else
-					{       // open a new file on the pakfile
-						*file = fopen (pak->filename, "rb");
-						if (*file)
-							fseek (*file, pak->files[i].filepos, SEEK_SET);
-					}
-					com_filesize = pak->files[i].filelen;
-					return com_filesize;
-				}
+			if (*packfile && (*packfile)->pack == search->pack)
+				return search;          // found it!
 		}
 		else
 		{               
@@ -1410,46 +1477,99 @@ int COM_FindFile (char *filename, int *handle, FILE **file)
 			
 			sprintf (netpath, "%s/%s",search->filename, filename);
 			
-			findtime = Sys_FileTime (netpath);
-			if (findtime == -1)
+			if (Sys_FileTime (netpath) == -1)
 				continue;
-				
-		// see if the file needs to be updated in the cache
-			if (!com_cachedir[0])
-				strcpy (cachepath, netpath);
-			else
-			{	
+
+			*packfile = NULL;
+			return search;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+===========
+COM_FindFile
+
+Finds the file in the search path.
+Sets com_filesize and one of handle or file
+===========
+*/
+int COM_FindFile (char *filename, int *handle, FILE **file)
+{
+	searchpath_t    *search;
+	char            netpath[MAX_OSPATH];
+	char            cachepath[MAX_OSPATH];
+	pack_t          *pak;
+	packfile_t      *packfile;
+	int                     i;
+	int                     findtime, cachetime;
+
+	if (file && handle)
+		Sys_Error ("COM_FindFile: both handle and file set");
+	if (!file && !handle)
+		Sys_Error ("COM_FindFile: neither handle or file set");
+		
+	search = COM_LocateFile (filename, &packfile, netpath);
+
+	if (search && packfile)
+	{
+		pak = search->pack;
+		if (com_filelog.value)
+			Sys_Printf ("PackFile: %s : %s\n",pak->filename, filename);
+		if (handle)
+		{
+			*handle = pak->handle;
+			Sys_FileSeek (pak->handle, packfile->filepos);
+		}
+		else
+		{       // open a new file on the pakfile
+			*file = fopen (pak->filename, "rb");
+			if (*file)
+				fseek (*file, packfile->filepos, SEEK_SET);
+		}
+		com_filesize = packfile->filelen;
+		return com_filesize;
+	}
+
+	if (search)
+	{
+	// see if the file needs to be updated in the cache
+		if (com_cachedir[0])
+		{	
+			findtime = Sys_FileTime (netpath);
 #if defined(_WIN32)
-				if ((strlen(netpath) < 2) || (netpath[1] != ':'))
-					sprintf (cachepath,"%s%s", com_cachedir, netpath);
-				else
-					sprintf (cachepath,"%s%s", com_cachedir, netpath+2);
-#else
+			if ((strlen(netpath) < 2) || (netpath[1] != ':'))
 				sprintf (cachepath,"%s%s", com_cachedir, netpath);
+			else
+				sprintf (cachepath,"%s%s", com_cachedir, netpath+2);
+#else
+			sprintf (cachepath,"%s%s", com_cachedir, netpath);
 #endif
 
-				cachetime = Sys_FileTime (cachepath);
-			
-				if (cachetime < findtime)
-					COM_CopyFile (netpath, cachepath);
-				strcpy (netpath, cachepath);
-			}	
+			cachetime = Sys_FileTime (cachepath);
+		
+			if (cachetime < findtime)
+				COM_CopyFile (netpath, cachepath);
+			strcpy (netpath, cachepath);
+		}	
 
+		if (com_filelog.value)
 			Sys_Printf ("FindFile: %s\n",netpath);
-			com_filesize = Sys_FileOpenRead (netpath, &i);
-			if (handle)
-				*handle = i;
-			else
-			{
-				Sys_FileClose (i);
-				*file = fopen (netpath, "rb");
-			}
-			return com_filesize;
+		com_filesize = Sys_FileOpenRead (netpath, &i);
+		if (handle)
+			*handle = i;
+		else
+		{
+			Sys_FileClose (i);
+			*file = fopen (netpath, "rb");
 		}
-		
+		return com_filesize;
 	}
 	
-	Sys_Printf ("FindFile: can't find %s\n", filename);
+	if (com_filelog.value)
+		Sys_Printf ("FindFile: can't find %s\n", filename);
 	
 	if (handle)
 		*handle = -1;
@@ -1459,6 +1579,70 @@ int COM_FindFile (char *filename, int *handle, FILE **file)
 	return -1;
 }
 
+/*
+===========
+COM_MapFile
+
+Returns the file straight out of a mapped pak file, or NULL if it isn't in
+one, in which case it has to be loaded the normal way.  Sets com_filesize.
+The data is read only, not zero terminated, and good until the program
+exits.
+===========
+*/
+byte *COM_MapFile (char *filename)
+{
+	searchpath_t    *search;
+	packfile_t      *packfile;
+	char            netpath[MAX_OSPATH];
+
+	search = COM_LocateFile (filename, &packfile, netpath);
+	if (!search || !packfile || !search->pack->data)
+		return NULL;
+
+	if (com_filelog.value)
+		Sys_Printf ("MapFile: %s : %s\n", search->pack->filename, filename);
+
+	com_filesize = packfile->filelen;
+	return search->pack->data + packfile->filepos;
+}
+
+/*
+===========
+COM_FileStamp
+
+Returns a number that changes with the file, for data saved from it: the
+directory crc of the pak it is in, or the modification time of a loose
+file.  -1 if the file can't be found.  Sets com_filesize, which should be
+checked as well.
+===========
+*/
+int COM_FileStamp (char *filename)
+{
+	searchpath_t    *search;
+	packfile_t      *packfile;
+	char            netpath[MAX_OSPATH];
+	int             handle;
+
+	search = COM_LocateFile (filename, &packfile, netpath);
+	if (!search)
+	{
+		com_filesize = -1;
+		return -1;
+	}
+
+	if (packfile)
+	{
+		com_filesize = packfile->filelen;
+		return search->pack->crc;
+	}
+
+	com_filesize = Sys_FileOpenRead (netpath, &handle);
+	if (handle == -1)
+		return -1;
+	Sys_FileClose (handle);
+	return Sys_FileTime (netpath);
+}
+
 
 /*
 ===========
@@ -1659,6 +1843,9 @@ pack_t *COM_LoadPackFile (char *packfile)
 	pack->handle = packhandle;
 	pack->numfiles = numpackfiles;
 	pack->files = newfiles;
+	pack->crc = crc;
+	if (!COM_CheckParm ("-nomappak"))
+		pack->data = Sys_FileMap (packhandle);
 	
 	Con_Printf ("Added packfile %s (%i files)\n", packfile, numpackfiles);
 	return pack;
@@ -1705,6 +1892,8 @@ void COM_AddGameDirectory (char *dir)
 		com_searchpaths = search;               
 	}
 
+	COM_BuildFileHash ();
+
 //
 // add the contents of the parms.txt file to the end of the command line
 //
@@ -1805,6 +1994,8 @@ void COM_InitFilesystem (void)
 			search->next = com_searchpaths;
 			com_searchpaths = search;
 		}
+
+		COM_BuildFileHash ();
 	}
 
 	if (COM_CheckParm ("-proghack"))
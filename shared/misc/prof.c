@@ -0,0 +1,458 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// prof.c -- scoped server frame profiler
+
+// Every closed scope is written to a ring of events, so the last few
+// seconds of frames are always available.  "profsummary" reduces the ring
+// to per scope percentiles and "profdump" writes it in the chrome trace
+// event format, which chrome://tracing and ui.perfetto.dev can load.
+
+#include "quakedef.h"
+
+#define	PROF_MAXNAMES		1024
+#define	PROF_NAMELEN		48
+#define	PROF_MAXDEPTH		32
+#define	PROF_MINEVENTS		1024
+#define	PROF_MAXEVENTS		(16*1024*1024)
+
+typedef struct
+{
+	char	*key;				// the pointer handed to Prof_Begin
+	char	name[PROF_NAMELEN];	// copied, since a progs reload can change it
+} profname_t;
+
+typedef struct
+{
+	double	start;				// relative to prof_base
+	float	time;
+	int		name;
+} profevent_t;
+
+typedef struct
+{
+	double	start;
+	int		name;
+} profscope_t;
+
+cvar_t	host_profile = {"host_profile","0"};
+cvar_t	host_profileevents = {"host_profileevents","1048576"};
+
+qboolean	prof_active;
+
+static	profname_t	prof_names[PROF_MAXNAMES];	// slot 0 collects overflow
+static	int			prof_numnames;
+
+static	profevent_t	*prof_events;
+static	int			prof_maxevents;
+static	int			prof_numevents;		// valid events in the ring
+static	int			prof_nextevent;		// next slot to write
+static	double		prof_base;
+
+static	profscope_t	prof_stack[PROF_MAXDEPTH];
+static	int			prof_depth;
+
+/*
+================
+Prof_NameNum
+
+Scope names are nearly always string constants or progs strings, so they
+are looked up by address and only checked against the saved copy
+================
+*/
+static int Prof_NameNum (char *key)
+{
+	unsigned	hash;
+	int			i, slot;
+	profname_t	*n;
+
+	hash = (unsigned)((size_t)key >> 2) * 2654435761u;
+	for (i=0 ; i<PROF_MAXNAMES-1 ; i++)
+	{
+		slot = 1 + (hash + i) % (PROF_MAXNAMES-1);
+		n = &prof_names[slot];
+		if (!n->key)
+		{
+			if (prof_numnames >= PROF_MAXNAMES*3/4)
+				return 0;
+			n->key = key;
+			strncpy (n->name, key, PROF_NAMELEN-1);
+			prof_numnames++;
+			return slot;
+		}
+		if (n->key == key && !strncmp (n->name, key, PROF_NAMELEN-1))
+			return slot;
+	}
+
+	return 0;
+}
+
+/*
+================
+Prof_Begin
+================
+*/
+void Prof_Begin (char *name)
+{
+	profscope_t	*s;
+
+	if (prof_depth++ >= PROF_MAXDEPTH)
+		return;		// only counted, so the matching end still pairs up
+
+	s = &prof_stack[prof_depth-1];
+	s->name = Prof_NameNum (name);
+	s->start = Sys_FloatTime ();
+}
+
+/*
+================
+Prof_End
+================
+*/
+void Prof_End (void)
+{
+	profscope_t	*s;
+	profevent_t	*e;
+	double		now;
+
+	if (!prof_depth)
+		return;
+	if (--prof_depth >= PROF_MAXDEPTH)
+		return;
+
+	now = Sys_FloatTime ();
+	s = &prof_stack[prof_depth];
+
+	e = &prof_events[prof_nextevent];
+	e->start = s->start - prof_base;
+	e->time = now - s->start;
+	e->name = s->name;
+
+	if (++prof_nextevent == prof_maxevents)
+		prof_nextevent = 0;
+	if (prof_numevents < prof_maxevents)
+		prof_numevents++;
+}
+
+/*
+================
+Prof_Clear
+================
+*/
+static void Prof_Clear (void)
+{
+	prof_numevents = 0;
+	prof_nextevent = 0;
+	prof_base = Sys_FloatTime ();
+}
+
+/*
+================
+Prof_Frame
+
+Called at the start of every server frame, outside of any scope
+================
+*/
+void Prof_Frame (void)
+{
+	int		count;
+
+	prof_depth = 0;		// a Host_Error may have jumped out of open scopes
+
+	if (!host_profile.value)
+	{
+		prof_active = false;	// the events are kept for dumping
+		return;
+	}
+
+	count = (int)host_profileevents.value;
+	if (count < PROF_MINEVENTS)
+		count = PROF_MINEVENTS;
+	if (count > PROF_MAXEVENTS)
+		count = PROF_MAXEVENTS;
+
+	if (count != prof_maxevents)
+	{
+		free (prof_events);
+		prof_events = malloc (count * sizeof(*prof_events));
+		prof_maxevents = prof_events ? count : 0;
+		prof_active = false;
+		if (!prof_events)
+		{
+			Con_Printf ("Couldn't allocate %i profile events\n", count);
+			Cvar_SetValue ("host_profile", 0);
+			return;
+		}
+	}
+
+	if (!prof_active)
+	{
+		Prof_Clear ();
+		prof_active = true;
+	}
+}
+
+/*
+===============================================================================
+
+REPORTS
+
+===============================================================================
+*/
+
+typedef struct
+{
+	int		name;
+	float	time;
+} profsample_t;
+
+typedef struct
+{
+	int		name;
+	int		count;
+	double	total;
+	float	p50, p95, p99, max;
+} profrow_t;
+
+static	profrow_t	prof_rows[PROF_MAXNAMES];
+
+static int Prof_SampleCompare (const void *a, const void *b)
+{
+	const profsample_t	*sa = a, *sb = b;
+
+	if (sa->name != sb->name)
+		return sa->name - sb->name;
+	if (sa->time != sb->time)
+		return sa->time < sb->time ? -1 : 1;
+	return 0;
+}
+
+static int Prof_RowCompare (const void *a, const void *b)
+{
+	const profrow_t	*ra = a, *rb = b;
+
+	if (ra->total != rb->total)
+		return ra->total > rb->total ? -1 : 1;
+	return 0;
+}
+
+/*
+================
+Prof_FirstEvent
+
+Index of the oldest event in the ring
+================
+*/
+static int Prof_FirstEvent (void)
+{
+	if (prof_numevents < prof_maxevents)
+		return 0;
+	return prof_nextevent;
+}
+
+/*
+================
+Prof_Summary_f
+
+profsummary [count] : percentiles of every scope, slowest total first
+================
+*/
+static void Prof_Summary_f (void)
+{
+	profsample_t	*samples, *sample;
+	profevent_t		*e;
+	profrow_t		*row;
+	int				i, j, first, group, numrows, maxrows;
+	double			span;
+
+	if (!prof_numevents)
+	{
+		Con_Printf ("No profile events, set host_profile 1\n");
+		return;
+	}
+
+	maxrows = 20;
+	if (Cmd_Argc() > 1)
+		maxrows = Q_atoi (Cmd_Argv(1));
+
+	samples = malloc (prof_numevents * sizeof(*samples));
+	if (!samples)
+	{
+		Con_Printf ("Couldn't allocate %i profile samples\n", prof_numevents);
+		return;
+	}
+
+	first = Prof_FirstEvent ();
+	span = 0;
+	for (i=0, j=first ; i<prof_numevents ; i++)
+	{
+		e = &prof_events[j];
+		samples[i].name = e->name;
+		samples[i].time = e->time;
+		if (e->start + e->time > span)
+			span = e->start + e->time;
+		if (++j == prof_maxevents)
+			j = 0;
+	}
+	span -= prof_events[first].start;
+
+	qsort (samples, prof_numevents, sizeof(*samples), Prof_SampleCompare);
+
+// reduce each run of one name to a row
+	numrows = 0;
+	for (i=0 ; i<prof_numevents ; i += group)
+	{
+		sample = &samples[i];
+		for (group=1 ; i+group < prof_numevents ; group++)
+			if (sample[group].name != sample->name)
+				break;
+
+		row = &prof_rows[numrows++];
+		row->name = sample->name;
+		row->count = group;
+		row->total = 0;
+		for (j=0 ; j<group ; j++)
+			row->total += sample[j].time;
+		row->p50 = sample[(group-1) * 50 / 100].time;
+		row->p95 = sample[(group-1) * 95 / 100].time;
+		row->p99 = sample[(group-1) * 99 / 100].time;
+		row->max = sample[group-1].time;
+	}
+
+	free (samples);
+
+	qsort (prof_rows, numrows, sizeof(*prof_rows), Prof_RowCompare);
+
+	Con_Printf ("%i events over %.1f seconds, times in ms\n", prof_numevents, span);
+	Con_Printf ("%-28s %7s %9s %7s %7s %7s %7s\n", "scope", "count", "total", "p50", "p95", "p99", "max");
+	for (i=0 ; i<numrows && i<maxrows ; i++)
+	{
+		row = &prof_rows[i];
+		Con_Printf ("%-28.28s %7i %9.2f %7.3f %7.3f %7.3f %7.3f\n",
+			row->name ? prof_names[row->name].name : "(other)",
+			row->count, row->total*1000,
+			row->p50*1000, row->p95*1000, row->p99*1000, row->max*1000);
+	}
+}
+
+/*
+================
+Prof_WriteString
+================
+*/
+static void Prof_WriteString (FILE *f, char *s)
+{
+	fputc ('"', f);
+	for ( ; *s ; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fputc ('\\', f);
+		if ((unsigned char)*s < ' ')
+			fprintf (f, "\\u%04x", (unsigned char)*s);
+		else
+			fputc (*s, f);
+	}
+	fputc ('"', f);
+}
+
+/*
+================
+Prof_Dump_f
+
+profdump <filename> : write the ring as chrome trace events
+================
+*/
+static void Prof_Dump_f (void)
+{
+	char		name[MAX_OSPATH];
+	FILE		*f;
+	profevent_t	*e;
+	int			i, j;
+
+	if (Cmd_Argc() != 2)
+	{
+		Con_Printf ("profdump <filename> : write the profile as a chrome trace\n");
+		return;
+	}
+
+	if (strstr(Cmd_Argv(1), ".."))
+	{
+		Con_Printf ("Relative pathnames are not allowed.\n");
+		return;
+	}
+
+	if (!prof_numevents)
+	{
+		Con_Printf ("No profile events, set host_profile 1\n");
+		return;
+	}
+
+	sprintf (name, "%s/%s", com_gamedir, Cmd_Argv(1));
+	COM_DefaultExtension (name, ".json");
+
+	f = fopen (name, "w");
+	if (!f)
+	{
+		Con_Printf ("ERROR: couldn't open %s.\n", name);
+		return;
+	}
+
+	Con_Printf ("Writing %i events to %s...\n", prof_numevents, name);
+
+	fprintf (f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (i=0, j=Prof_FirstEvent () ; i<prof_numevents ; i++)
+	{
+		e = &prof_events[j];
+		fprintf (f, "{\"name\":");
+		Prof_WriteString (f, e->name ? prof_names[e->name].name : "(other)");
+		fprintf (f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}%s\n",
+			e->start * 1000000, e->time * 1000000,
+			i == prof_numevents-1 ? "" : ",");
+		if (++j == prof_maxevents)
+			j = 0;
+	}
+	fprintf (f, "]}\n");
+
+	fclose (f);
+}
+
+/*
+================
+Prof_Clear_f
+================
+*/
+static void Prof_Clear_f (void)
+{
+	Prof_Clear ();
+}
+
+/*
+================
+Prof_Init
+================
+*/
+void Prof_Init (void)
+{
+	Cvar_RegisterVariable (&host_profile);
+	Cvar_RegisterVariable (&host_profileevents);
+
+	Cmd_AddCommand ("profsummary", Prof_Summary_f);
+	Cmd_AddCommand ("profdump", Prof_Dump_f);
+	Cmd_AddCommand ("profclear", Prof_Clear_f);
+}
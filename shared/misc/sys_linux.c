@@ -0,0 +1,846 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sys_linux.c -- POSIX system interface code for the headless dedicated server
+
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "quakedef.h"
+
+#define DEDICATED_MEMORY	0x00800000	// default hunk; a server only holds
+										//  models, progs and edicts
+
+qboolean			isDedicated = true;
+
+static qboolean		nostdout = false;
+
+/*
+===============================================================================
+
+FILE IO
+
+===============================================================================
+*/
+
+#define	MAX_HANDLES		10
+FILE	*sys_handles[MAX_HANDLES];
+
+int		findhandle (void)
+{
+	int		i;
+
+	for (i=1 ; i<MAX_HANDLES ; i++)
+		if (!sys_handles[i])
+			return i;
+	Sys_Error ("out of handles");
+	return -1;
+}
+
+/*
+================
+filelength
+================
+*/
+int filelength (FILE *f)
+{
+	int		pos;
+	int		end;
+
+	pos = ftell (f);
+	fseek (f, 0, SEEK_END);
+	end = ftell (f);
+	fseek (f, pos, SEEK_SET);
+
+	return end;
+}
+
+int Sys_FileOpenRead (char *path, int *hndl)
+{
+	FILE	*f;
+	int		i;
+
+	i = findhandle ();
+
+	f = fopen(path, "rb");
+	if (!f)
+	{
+		*hndl = -1;
+		return -1;
+	}
+	sys_handles[i] = f;
+	*hndl = i;
+
+	return filelength(f);
+}
+
+int Sys_FileOpenWrite (char *path)
+{
+	FILE	*f;
+	int		i;
+
+	i = findhandle ();
+
+	f = fopen(path, "wb");
+	if (!f)
+		Sys_Error ("Error opening %s: %s", path, strerror(errno));
+	sys_handles[i] = f;
+
+	return i;
+}
+
+void Sys_FileClose (int handle)
+{
+	fclose (sys_handles[handle]);
+	sys_handles[handle] = NULL;
+}
+
+void Sys_FileSeek (int handle, int position)
+{
+	fseek (sys_handles[handle], position, SEEK_SET);
+}
+
+int Sys_FileRead (int handle, void *dest, int count)
+{
+	return fread (dest, 1, count, sys_handles[handle]);
+}
+
+int Sys_FileWrite (int handle, void *data, int count)
+{
+	return fwrite (data, 1, count, sys_handles[handle]);
+}
+
+void *Sys_FileMap (int handle)
+{
+	struct stat	st;
+	void		*data;
+	int			fd;
+
+	fd = fileno (sys_handles[handle]);
+	if (fstat (fd, &st) == -1 || st.st_size == 0)
+		return NULL;
+
+	// the mapping outlives the descriptor, so the handle can still be closed
+	data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	return data;
+}
+
+int	Sys_FileTime (char *path)
+{
+	struct stat	buf;
+
+	if (stat (path, &buf) == -1)
+		return -1;
+
+	return buf.st_mtime;
+}
+
+void Sys_mkdir (char *path)
+{
+	mkdir (path, 0777);
+}
+
+
+/*
+===============================================================================
+
+SYSTEM IO
+
+===============================================================================
+*/
+
+/*
+================
+Sys_MakeCodeWriteable
+================
+*/
+void Sys_MakeCodeWriteable (unsigned long startaddr, unsigned long length)
+{
+	int		pagesize;
+	unsigned long	addr;
+
+	pagesize = getpagesize ();
+	addr = startaddr & ~(pagesize - 1);
+	length += startaddr - addr;
+
+	if (mprotect ((void *)addr, length, PROT_READ | PROT_WRITE | PROT_EXEC) == -1)
+		Sys_Error ("Protection change failed\n");
+}
+
+void *Sys_ReserveMemory (int size)
+{
+	void	*base;
+
+	base = mmap (NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	return base;
+}
+
+void Sys_CommitMemory (void *base, int size)
+{
+	if (mprotect (base, size, PROT_READ | PROT_WRITE) == -1)
+		Sys_Error ("Sys_CommitMemory: couldn't commit %i bytes: %s", size, strerror (errno));
+}
+
+void Sys_ReleaseMemory (void *base, int size)
+{
+	munmap (base, size);
+}
+
+void Sys_SetFPCW (void)
+{
+}
+
+void Sys_LowFPPrecision (void)
+{
+}
+
+void Sys_HighFPPrecision (void)
+{
+}
+
+void Sys_DebugLog (char *file, char *fmt, ...)
+{
+	va_list		argptr;
+	static char	data[1024];
+	FILE		*f;
+
+	va_start (argptr, fmt);
+	vsnprintf (data, sizeof(data), fmt, argptr);
+	va_end (argptr);
+
+	f = fopen (file, "a");
+	if (!f)
+		return;
+	fputs (data, f);
+	fclose (f);
+}
+
+/*
+================
+Sys_Init
+================
+*/
+void Sys_Init (void)
+{
+	// a dropped client shouldn't take the server down with it
+	signal (SIGPIPE, SIG_IGN);
+
+	// stdin is polled from the main loop
+	fcntl (0, F_SETFL, fcntl (0, F_GETFL, 0) | O_NONBLOCK);
+}
+
+void Sys_Error (char *error, ...)
+{
+	va_list		argptr;
+	char		text[1024];
+	static int	in_sys_error = 0;
+
+	va_start (argptr, error);
+	vsnprintf (text, sizeof(text), error, argptr);
+	va_end (argptr);
+
+	fcntl (0, F_SETFL, fcntl (0, F_GETFL, 0) & ~O_NONBLOCK);
+	fprintf (stderr, "ERROR: %s\n", text);
+
+	if (!in_sys_error)
+	{
+		in_sys_error = 1;
+		Host_Shutdown ();
+	}
+
+	exit (1);
+}
+
+void Sys_Printf (char *fmt, ...)
+{
+	va_list		argptr;
+	char		text[1024];
+	unsigned char	*p;
+
+	if (nostdout)
+		return;
+
+	va_start (argptr,fmt);
+	vsnprintf (text, sizeof(text), fmt, argptr);
+	va_end (argptr);
+
+	// strip the high bit off the console font's coloured characters
+	for (p = (unsigned char *)text ; *p ; p++)
+	{
+		*p &= 0x7f;
+		if (*p < 32 && *p != 10 && *p != 13 && *p != 9)
+			*p = '.';
+	}
+
+	fputs (text, stdout);
+	fflush (stdout);
+}
+
+quakeparms_t	parms;
+
+void Sys_Quit (void)
+{
+	Host_Shutdown ();
+
+	fcntl (0, F_SETFL, fcntl (0, F_GETFL, 0) & ~O_NONBLOCK);
+	fflush (stdout);
+
+	exit (0);
+}
+
+
+/*
+================
+Sys_FloatTime
+================
+*/
+double Sys_FloatTime (void)
+{
+	static time_t	secbase;
+	struct timespec	ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	if (!secbase)
+	{
+		secbase = ts.tv_sec;
+		return ts.tv_nsec / 1000000000.0;
+	}
+
+	return (ts.tv_sec - secbase) + ts.tv_nsec / 1000000000.0;
+}
+
+
+char *Sys_ConsoleInput (void)
+{
+	static char	text[256];
+	int		len;
+
+	len = read (0, text, sizeof(text) - 1);
+	if (len < 1)
+		return NULL;
+
+	text[len-1] = 0;	// rip off the \n and terminate
+
+	return text;
+}
+
+void Sys_Sleep (void)
+{
+	usleep (1000);
+}
+
+
+void Sys_SendKeyEvents (void)
+{
+}
+
+
+/*
+===============================================================================
+
+WORKER THREADS
+
+===============================================================================
+*/
+
+#define	MAX_WORKERS		8
+
+static int				sys_numworkers = -1;	// -1 until the pool is started
+static pthread_mutex_t	sys_jobmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	sys_jobwake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	sys_jobdone = PTHREAD_COND_INITIALIZER;
+static int				sys_jobgeneration;		// bumped for every batch
+static int				sys_jobworkers;			// workers taking part in it
+
+static sys_job_t		sys_job;
+static void				*sys_jobdata;
+static int				sys_jobcount;
+static volatile int		sys_jobnext;
+static int				sys_jobbusy;			// workers still on the current batch
+
+static void Sys_DoJobs (void)
+{
+	int		index;
+
+	while ((index = __sync_fetch_and_add (&sys_jobnext, 1)) < sys_jobcount)
+		sys_job (sys_jobdata, index);
+}
+
+static void *Sys_WorkerThread (void *param)
+{
+	int		worker, seen;
+
+	worker = (int)(long)param;
+	seen = 0;
+
+	pthread_mutex_lock (&sys_jobmutex);
+	while (1)
+	{
+		while (sys_jobgeneration == seen)
+			pthread_cond_wait (&sys_jobwake, &sys_jobmutex);
+		seen = sys_jobgeneration;
+		if (worker >= sys_jobworkers)
+			continue;		// small batch, not needed
+
+		pthread_mutex_unlock (&sys_jobmutex);
+		Sys_DoJobs ();
+		pthread_mutex_lock (&sys_jobmutex);
+
+		if (!--sys_jobbusy)
+			pthread_cond_signal (&sys_jobdone);
+	}
+
+	return NULL;
+}
+
+static void Sys_StartWorkers (void)
+{
+	pthread_t	thread;
+	int			i;
+
+	sys_numworkers = sysconf (_SC_NPROCESSORS_ONLN) - 1;
+
+	i = COM_CheckParm ("-threads");
+	if (i && i < com_argc-1)
+		sys_numworkers = Q_atoi (com_argv[i+1]);
+
+	if (sys_numworkers > MAX_WORKERS)
+		sys_numworkers = MAX_WORKERS;
+	if (sys_numworkers < 0)
+		sys_numworkers = 0;
+
+	for (i=0 ; i<sys_numworkers ; i++)
+	{
+		if (pthread_create (&thread, NULL, Sys_WorkerThread, (void *)(long)i))
+		{
+			Con_Printf ("Couldn't start worker thread %i\n", i);
+			sys_numworkers = i;
+			break;
+		}
+		pthread_detach (thread);
+	}
+
+	Con_DPrintf ("%i worker threads\n", sys_numworkers);
+}
+
+int Sys_NumWorkers (void)
+{
+	if (sys_numworkers < 0)
+		Sys_StartWorkers ();
+
+	return sys_numworkers;
+}
+
+void Sys_RunJobs (sys_job_t job, void *data, int count)
+{
+	int		i, workers;
+
+	workers = Sys_NumWorkers ();
+	if (workers > count - 1)
+		workers = count - 1;
+
+	if (workers <= 0)
+	{
+		for (i=0 ; i<count ; i++)
+			job (data, i);
+		return;
+	}
+
+	pthread_mutex_lock (&sys_jobmutex);
+	sys_job = job;
+	sys_jobdata = data;
+	sys_jobcount = count;
+	sys_jobnext = 0;
+	sys_jobbusy = workers;
+	sys_jobworkers = workers;
+	sys_jobgeneration++;
+	pthread_cond_broadcast (&sys_jobwake);
+	pthread_mutex_unlock (&sys_jobmutex);
+
+	Sys_DoJobs ();
+
+	pthread_mutex_lock (&sys_jobmutex);
+	while (sys_jobbusy)
+		pthread_cond_wait (&sys_jobdone, &sys_jobmutex);
+	pthread_mutex_unlock (&sys_jobmutex);
+}
+
+
+static sys_job_t		sys_bgjob;
+static void				*sys_bgdata;
+static pthread_t		sys_bgthread;
+static qboolean			sys_bgrunning;
+
+static void *Sys_BackgroundThread (void *param)
+{
+	sys_bgjob (sys_bgdata, 0);
+	return NULL;
+}
+
+void Sys_BeginBackgroundJob (sys_job_t job, void *data)
+{
+	Sys_FinishBackgroundJob ();
+
+	sys_bgjob = job;
+	sys_bgdata = data;
+	if (pthread_create (&sys_bgthread, NULL, Sys_BackgroundThread, NULL))
+	{
+		job (data, 0);
+		return;
+	}
+	sys_bgrunning = true;
+}
+
+void Sys_FinishBackgroundJob (void)
+{
+	if (!sys_bgrunning)
+		return;
+
+	pthread_join (sys_bgthread, NULL);
+	sys_bgrunning = false;
+}
+
+
+typedef struct
+{
+	sys_job_t	job;
+	void		*data;
+	pthread_t	thread;
+} systhread_t;
+
+static void *Sys_ThreadMain (void *param)
+{
+	systhread_t	*t;
+
+	t = param;
+	t->job (t->data, 0);
+	return NULL;
+}
+
+void *Sys_CreateThread (sys_job_t job, void *data)
+{
+	systhread_t	*t;
+
+	t = malloc (sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->job = job;
+	t->data = data;
+	if (pthread_create (&t->thread, NULL, Sys_ThreadMain, t))
+	{
+		free (t);
+		return NULL;
+	}
+	return t;
+}
+
+void Sys_WaitThread (void *thread)
+{
+	systhread_t	*t;
+
+	t = thread;
+	pthread_join (t->thread, NULL);
+	free (t);
+}
+
+void *Sys_CreateLock (void)
+{
+	pthread_mutex_t		*lock;
+	pthread_mutexattr_t	attr;
+
+	lock = malloc (sizeof(*lock));
+	if (!lock)
+		Sys_Error ("Sys_CreateLock: out of memory");
+
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (lock, &attr);
+	pthread_mutexattr_destroy (&attr);
+	return lock;
+}
+
+void Sys_Lock (void *lock)
+{
+	pthread_mutex_lock (lock);
+}
+
+void Sys_Unlock (void *lock)
+{
+	pthread_mutex_unlock (lock);
+}
+
+void Sys_MemoryBarrier (void)
+{
+	__sync_synchronize ();
+}
+
+
+/*
+===============================================================================
+
+MAIN LOOP EVENTS
+
+The server sleeps in epoll_wait on console input, every socket the UDP
+driver opens and a timerfd armed for the next tick.  Everything is edge
+triggered: the frame drains whatever is waiting, so one wakeup per burst
+is enough.
+
+===============================================================================
+*/
+
+#define	MIN_FRAMETIME	(1.0/72)	// input never runs frames closer than this
+#define	MAX_WAITEVENTS	16
+
+static int	sys_epoll = -1;
+static int	sys_timer = -1;
+
+static void Sys_InitEvents (void)
+{
+	struct epoll_event	ev;
+
+	if (sys_epoll != -1)
+		return;
+
+	sys_epoll = epoll_create1 (EPOLL_CLOEXEC);
+	if (sys_epoll == -1)
+		Sys_Error ("epoll_create1: %s", strerror (errno));
+
+	sys_timer = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (sys_timer == -1)
+		Sys_Error ("timerfd_create: %s", strerror (errno));
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = sys_timer;
+	if (epoll_ctl (sys_epoll, EPOLL_CTL_ADD, sys_timer, &ev) == -1)
+		Sys_Error ("epoll_ctl: %s", strerror (errno));
+
+	// this fails when stdin is a plain file or /dev/null, which never
+	// has anything worth waking for
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = 0;
+	epoll_ctl (sys_epoll, EPOLL_CTL_ADD, 0, &ev);
+}
+
+/*
+==================
+Sys_WatchSocket
+
+Closing the socket takes it back out of the set
+==================
+*/
+void Sys_WatchSocket (int socket)
+{
+	struct epoll_event	ev;
+
+	Sys_InitEvents ();
+
+	memset (&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = socket;
+	if (epoll_ctl (sys_epoll, EPOLL_CTL_ADD, socket, &ev) == -1)
+		Sys_Printf ("Couldn't watch socket %i: %s\n", socket, strerror (errno));
+}
+
+/*
+==================
+Sys_WaitForFrame
+
+Blocks until the next server tick is due, or until a packet or console
+line arrives and at least MIN_FRAMETIME has passed since the last frame,
+so a client's move is simulated as soon as it lands instead of waiting
+out the rest of sys_ticrate.  With no level running there is nothing to
+tick, and only input wakes it.
+==================
+*/
+void Sys_WaitForFrame (double oldtime)
+{
+	extern sizebuf_t	cmd_text;
+	struct epoll_event	events[MAX_WAITEVENTS];
+	struct itimerspec	timer;
+	uint64_t	expirations;
+	double		now, tick, early, deadline;
+	qboolean	ticking, input;
+	int			i, count;
+
+	Sys_InitEvents ();
+
+	ticking = sv.active;
+	tick = oldtime + sys_ticrate.value;
+	early = oldtime + MIN_FRAMETIME;
+	if (early > tick)
+		early = tick;
+
+	// console lines are read at the end of a frame and executed at the
+	// start of the next one, so leftover commands count as input
+	input = cmd_text.cursize != 0;
+
+	while (1)
+	{
+		now = Sys_FloatTime ();
+		if (ticking && now >= tick)
+			return;
+		if (input && now >= early)
+			return;
+
+		// a zeroed timer is disarmed
+		memset (&timer, 0, sizeof(timer));
+		if (ticking || input)
+		{
+			deadline = (input ? early : tick) - now;
+			timer.it_value.tv_sec = (time_t)deadline;
+			timer.it_value.tv_nsec = (long)((deadline - timer.it_value.tv_sec) * 1000000000.0);
+			if (!timer.it_value.tv_sec && !timer.it_value.tv_nsec)
+				timer.it_value.tv_nsec = 1;
+		}
+		timerfd_settime (sys_timer, 0, &timer, NULL);
+
+		count = epoll_wait (sys_epoll, events, MAX_WAITEVENTS, -1);
+		for (i=0 ; i<count ; i++)
+		{
+			if (events[i].data.fd == sys_timer)
+				read (sys_timer, &expirations, sizeof(expirations));
+			else
+				input = true;
+		}
+	}
+}
+
+
+/*
+==================
+Sys_AllocHunk
+
+QuakeC strings are 32 bit offsets from pr_strings, and some of them point
+at the engine's static data rather than into the hunk, so on 64 bit the
+hunk has to stay within 2 gigs of the program image (which is linked
+-no-pie for the same reason)
+==================
+*/
+void *Sys_AllocHunk (int size)
+{
+#if defined(__x86_64__) && defined(MAP_32BIT)
+	void	*base;
+
+	base = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	return base;
+#else
+	return malloc (size);
+#endif
+}
+
+
+/*
+==================
+main
+==================
+*/
+char		*argv[MAX_NUM_ARGVS];
+static char	*dedicated_string = "-dedicated";
+
+int main (int c, char **v)
+{
+	double			time, oldtime, newtime;
+	static	char	cwd[1024];
+	int				i, t;
+
+	if (!getcwd (cwd, sizeof(cwd)))
+		Sys_Error ("Couldn't determine current directory");
+
+	if (cwd[Q_strlen(cwd)-1] == '/')
+		cwd[Q_strlen(cwd)-1] = 0;
+
+	parms.basedir = cwd;
+	parms.cachedir = NULL;
+
+	// this binary can only run a dedicated server, so make sure the host
+	// sees -dedicated even when it isn't given
+	for (i=0 ; i<c && i<MAX_NUM_ARGVS-1 ; i++)
+		argv[i] = v[i];
+	parms.argc = i;
+	for (i=1 ; i<parms.argc ; i++)
+		if (!Q_strcmp (argv[i], dedicated_string))
+			break;
+	if (i == parms.argc)
+		argv[parms.argc++] = dedicated_string;
+
+	parms.argv = argv;
+
+	COM_InitArgv (parms.argc, parms.argv);
+
+	parms.argc = com_argc;
+	parms.argv = com_argv;
+
+	parms.memsize = DEDICATED_MEMORY;
+
+	if (COM_CheckParm ("-heapsize"))
+	{
+		t = COM_CheckParm("-heapsize") + 1;
+
+		if (t < com_argc)
+			parms.memsize = Q_atoi (com_argv[t]) * 1024;
+	}
+
+	parms.membase = Sys_AllocHunk (parms.memsize);
+
+	if (!parms.membase)
+		Sys_Error ("Not enough memory free; check disk space\n");
+
+	if (COM_CheckParm ("-nostdout"))
+		nostdout = true;
+
+	Sys_Init ();
+
+	Sys_Printf ("Host_Init\n");
+	Host_Init (&parms);
+
+	oldtime = Sys_FloatTime ();
+
+	while (1)
+	{
+		Sys_WaitForFrame (oldtime);
+		newtime = Sys_FloatTime ();
+		time = newtime - oldtime;
+
+		Host_Frame (time);
+		oldtime = newtime;
+	}
+
+	return 0;
+}
@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "winquake.h"
 #include "resource.h"
 #include "conproc.h"
+#include <io.h>
 
 #define MINIMUM_WIN_MEMORY		0x01000000
 #define MAXIMUM_WIN_MEMORY		0x04000000
@@ -216,6 +217,26 @@ int Sys_FileWrite (int handle, void *data, int count)
 	return x;
 }
 
+void *Sys_FileMap (int handle)
+{
+	HANDLE	mapping;
+	void	*data;
+	int		t;
+
+	t = VID_ForceUnlockedAndReturnState ();
+
+	data = NULL;
+	mapping = CreateFileMapping ((HANDLE)_get_osfhandle (_fileno (sys_handles[handle])), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping)
+	{
+		data = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle (mapping);		// the view holds on to it
+	}
+
+	VID_ForceLockState (t);
+	return data;
+}
+
 int	Sys_FileTime (char *path)
 {
 	FILE	*f;
@@ -266,6 +287,22 @@ void Sys_MakeCodeWriteable (unsigned long startaddr, unsigned long length)
    		Sys_Error("Protection change failed\n");
 }
 
+void *Sys_ReserveMemory (int size)
+{
+	return VirtualAlloc (NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+void Sys_CommitMemory (void *base, int size)
+{
+	if (!VirtualAlloc (base, size, MEM_COMMIT, PAGE_READWRITE))
+		Sys_Error ("Sys_CommitMemory: couldn't commit %i bytes", size);
+}
+
+void Sys_ReleaseMemory (void *base, int size)
+{
+	VirtualFree (base, 0, MEM_RELEASE);
+}
+
 
 #ifndef _M_IX86
 
@@ -656,6 +693,234 @@ void Sys_SendKeyEvents (void)
 }
 
 
+/*
+===============================================================================
+
+WORKER THREADS
+
+===============================================================================
+*/
+
+#define	MAX_WORKERS		8
+
+static int				sys_numworkers = -1;	// -1 until the pool is started
+static HANDLE			sys_workerwake[MAX_WORKERS];
+static HANDLE			sys_workersdone;
+
+static sys_job_t		sys_job;
+static void				*sys_jobdata;
+static int				sys_jobcount;
+static volatile LONG	sys_jobnext;
+static volatile LONG	sys_jobbusy;			// workers still on the current batch
+
+static void Sys_DoJobs (void)
+{
+	int		index;
+
+	while ((index = InterlockedIncrement (&sys_jobnext) - 1) < sys_jobcount)
+		sys_job (sys_jobdata, index);
+}
+
+static DWORD WINAPI Sys_WorkerThread (LPVOID param)
+{
+	int		worker;
+
+	worker = (int)param;
+
+	while (1)
+	{
+		WaitForSingleObject (sys_workerwake[worker], INFINITE);
+		Sys_DoJobs ();
+		if (!InterlockedDecrement (&sys_jobbusy))
+			SetEvent (sys_workersdone);
+	}
+
+	return 0;
+}
+
+static void Sys_StartWorkers (void)
+{
+	SYSTEM_INFO	info;
+	HANDLE		thread;
+	int			i;
+
+	GetSystemInfo (&info);
+	sys_numworkers = info.dwNumberOfProcessors - 1;
+
+	i = COM_CheckParm ("-threads");
+	if (i && i < com_argc-1)
+		sys_numworkers = Q_atoi (com_argv[i+1]);
+
+	if (sys_numworkers > MAX_WORKERS)
+		sys_numworkers = MAX_WORKERS;
+	if (sys_numworkers < 0)
+		sys_numworkers = 0;
+
+	sys_workersdone = CreateEvent (NULL, FALSE, FALSE, NULL);
+	if (!sys_workersdone)
+		sys_numworkers = 0;
+
+	for (i=0 ; i<sys_numworkers ; i++)
+	{
+		sys_workerwake[i] = CreateEvent (NULL, FALSE, FALSE, NULL);
+		thread = NULL;
+		if (sys_workerwake[i])
+			thread = CreateThread (NULL, 0, Sys_WorkerThread, (LPVOID)i, 0, NULL);
+		if (!thread)
+		{
+			Con_Printf ("Couldn't start worker thread %i\n", i);
+			sys_numworkers = i;
+			break;
+		}
+		CloseHandle (thread);
+	}
+
+	Con_DPrintf ("%i worker threads\n", sys_numworkers);
+}
+
+int Sys_NumWorkers (void)
+{
+	if (sys_numworkers < 0)
+		Sys_StartWorkers ();
+
+	return sys_numworkers;
+}
+
+void Sys_RunJobs (sys_job_t job, void *data, int count)
+{
+	int		i, workers;
+
+	workers = Sys_NumWorkers ();
+	if (workers > count - 1)
+		workers = count - 1;
+
+	if (workers <= 0)
+	{
+		for (i=0 ; i<count ; i++)
+			job (data, i);
+		return;
+	}
+
+	sys_job = job;
+	sys_jobdata = data;
+	sys_jobcount = count;
+	sys_jobnext = 0;
+	sys_jobbusy = workers;
+
+	for (i=0 ; i<workers ; i++)
+		SetEvent (sys_workerwake[i]);
+
+	Sys_DoJobs ();
+
+	WaitForSingleObject (sys_workersdone, INFINITE);
+}
+
+
+static sys_job_t		sys_bgjob;
+static void				*sys_bgdata;
+static HANDLE			sys_bgthread;
+
+static DWORD WINAPI Sys_BackgroundThread (LPVOID param)
+{
+	sys_bgjob (sys_bgdata, 0);
+	return 0;
+}
+
+void Sys_BeginBackgroundJob (sys_job_t job, void *data)
+{
+	Sys_FinishBackgroundJob ();
+
+	sys_bgjob = job;
+	sys_bgdata = data;
+	sys_bgthread = CreateThread (NULL, 0, Sys_BackgroundThread, NULL, 0, NULL);
+	if (!sys_bgthread)
+		job (data, 0);
+}
+
+void Sys_FinishBackgroundJob (void)
+{
+	if (!sys_bgthread)
+		return;
+
+	WaitForSingleObject (sys_bgthread, INFINITE);
+	CloseHandle (sys_bgthread);
+	sys_bgthread = NULL;
+}
+
+
+typedef struct
+{
+	sys_job_t	job;
+	void		*data;
+	HANDLE		thread;
+} systhread_t;
+
+static DWORD WINAPI Sys_ThreadMain (LPVOID param)
+{
+	systhread_t	*t;
+
+	t = param;
+	t->job (t->data, 0);
+	return 0;
+}
+
+void *Sys_CreateThread (sys_job_t job, void *data)
+{
+	systhread_t	*t;
+
+	t = malloc (sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->job = job;
+	t->data = data;
+	t->thread = CreateThread (NULL, 0, Sys_ThreadMain, t, 0, NULL);
+	if (!t->thread)
+	{
+		free (t);
+		return NULL;
+	}
+	return t;
+}
+
+void Sys_WaitThread (void *thread)
+{
+	systhread_t	*t;
+
+	t = thread;
+	WaitForSingleObject (t->thread, INFINITE);
+	CloseHandle (t->thread);
+	free (t);
+}
+
+void *Sys_CreateLock (void)
+{
+	CRITICAL_SECTION	*lock;
+
+	lock = malloc (sizeof(*lock));
+	if (!lock)
+		Sys_Error ("Sys_CreateLock: out of memory");
+
+	InitializeCriticalSection (lock);	// always recursive
+	return lock;
+}
+
+void Sys_Lock (void *lock)
+{
+	EnterCriticalSection (lock);
+}
+
+void Sys_Unlock (void *lock)
+{
+	LeaveCriticalSection (lock);
+}
+
+void Sys_MemoryBarrier (void)
+{
+	MemoryBarrier ();
+}
+
+
 /*
 ==============================================================================
 
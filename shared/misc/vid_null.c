@@ -0,0 +1,131 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// vid_null.c -- null video driver for the headless dedicated server; no
+// renderer is linked, only the pieces the host and model loader touch
+
+#include "quakedef.h"
+
+viddef_t	vid;				// global video state
+unsigned short	d_8to16table[256];
+
+int			r_pixbytes = 1;
+texture_t	*r_notexture_mip;
+vec3_t		r_origin, vpn, vright, vup;
+
+int			clearnotify;
+qboolean	scr_disabled_for_loading;
+int			scr_copytop;
+float		scr_centertime_off;
+
+void VID_Init (unsigned char *palette)
+{
+}
+
+void VID_Shutdown (void)
+{
+}
+
+void Draw_Init (void)
+{
+}
+
+void Draw_Character (int x, int y, int num)
+{
+}
+
+void Draw_String (int x, int y, char *str)
+{
+}
+
+void Draw_ConsoleBackground (int lines)
+{
+}
+
+void Draw_BeginDisc (void)
+{
+}
+
+void Draw_EndDisc (void)
+{
+}
+
+void SCR_Init (void)
+{
+}
+
+void SCR_UpdateScreen (void)
+{
+}
+
+void SCR_BeginLoadingPlaque (void)
+{
+}
+
+void SCR_EndLoadingPlaque (void)
+{
+}
+
+void R_Init (void)
+{
+}
+
+void R_InitSky (texture_t *mt)
+{
+}
+
+void D_FlushCaches (void)
+{
+}
+
+/*
+==================
+R_InitTextures
+
+The model loader falls back to this for missing textures, so a server
+still needs it
+==================
+*/
+void	R_InitTextures (void)
+{
+	int		x,y, m;
+	byte	*dest;
+
+// create a simple checkerboard texture for the default
+	r_notexture_mip = Hunk_AllocName (sizeof(texture_t) + 16*16+8*8+4*4+2*2, "notexture");
+
+	r_notexture_mip->width = r_notexture_mip->height = 16;
+	r_notexture_mip->offsets[0] = sizeof(texture_t);
+	r_notexture_mip->offsets[1] = r_notexture_mip->offsets[0] + 16*16;
+	r_notexture_mip->offsets[2] = r_notexture_mip->offsets[1] + 8*8;
+	r_notexture_mip->offsets[3] = r_notexture_mip->offsets[2] + 4*4;
+
+	for (m=0 ; m<4 ; m++)
+	{
+		dest = (byte *)r_notexture_mip + r_notexture_mip->offsets[m];
+		for (y=0 ; y< (16>>m) ; y++)
+			for (x=0 ; x< (16>>m) ; x++)
+			{
+				if (  (y< (8>>m) ) ^ (x< (8>>m) ) )
+					*dest++ = 0;
+				else
+					*dest++ = 0xff;
+			}
+	}
+}
@@ -173,6 +173,86 @@ hull_t *SV_HullForEntity (edict_t *ent, vec3_t mins, vec3_t maxs, vec3_t offset)
 /*
 ===============================================================================
 
+TRACE CACHE
+
+Monsters tend to repeat the same traces through the world and brush models
+many times a frame.  The clipnodes of a model never change while the map is
+up, so a trace through one only depends on where it starts and ends, and
+the result can be handed straight back.  Box hulls are rebuilt for every
+entity and are never cached.
+
+===============================================================================
+*/
+
+#define	TRACECACHE_SIZE	256		// must be a power of two
+
+typedef struct
+{
+	double		time;			// sv.time the entry was made
+	hull_t		*hull;
+	vec3_t		start, end, offset;
+	trace_t		trace;			// before the offset is put back
+} tracecache_t;
+
+static	tracecache_t	sv_tracememo[TRACECACHE_SIZE];
+
+cvar_t	sv_tracecache = {"sv_tracecache", "1"};
+
+/*
+==================
+SV_TraceCacheSlot
+
+==================
+*/
+tracecache_t *SV_TraceCacheSlot (hull_t *hull, vec3_t start, vec3_t end)
+{
+	unsigned	hash;
+	int			i;
+
+	hash = (unsigned)((byte *)hull - (byte *)0);
+	for (i=0 ; i<3 ; i++)
+	{
+		hash = hash * 31 + *(unsigned *)&start[i];
+		hash = hash * 31 + *(unsigned *)&end[i];
+	}
+	hash ^= hash >> 16;
+
+	return &sv_tracememo[hash & (TRACECACHE_SIZE-1)];
+}
+
+/*
+==================
+SV_TraceCacheGet
+
+Returns true and fills in trace if the slot holds this trace from this frame
+==================
+*/
+static qboolean SV_TraceCacheGet (tracecache_t *slot, hull_t *hull, vec3_t start, vec3_t end, vec3_t offset, trace_t *trace)
+{
+	if (slot->time != sv.time || slot->hull != hull
+	|| memcmp (slot->start, start, sizeof(vec3_t))
+	|| memcmp (slot->end, end, sizeof(vec3_t))
+	|| memcmp (slot->offset, offset, sizeof(vec3_t)))
+		return false;
+
+	sv_areastats.tracehits++;
+	*trace = slot->trace;
+	return true;
+}
+
+static void SV_TraceCachePut (tracecache_t *slot, hull_t *hull, vec3_t start, vec3_t end, vec3_t offset, trace_t *trace)
+{
+	slot->time = sv.time;
+	slot->hull = hull;
+	VectorCopy (start, slot->start);
+	VectorCopy (end, slot->end);
+	VectorCopy (offset, slot->offset);
+	slot->trace = *trace;
+}
+
+/*
+===============================================================================
+
 ENTITY AREA CHECKING
 
 ===============================================================================
@@ -187,23 +267,48 @@ typedef struct areanode_s
 	link_t	solid_edicts;
 } areanode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	32
+#define	AREA_DEPTH		4		// every node is split at least this deep
+#define	AREA_MAXDEPTH	8		// crowded nodes are split down to here
+#define	AREA_NODES		(2<<AREA_MAXDEPTH)
+#define	AREA_LEAFEDICTS	8		// nodes with fewer edicts than this aren't split
+#define	AREA_REBALANCE	32		// rebuild when a node list gets longer than this
 
 static	areanode_t	sv_areanodes[AREA_NODES];
 static	int			sv_numareanodes;
 
+static	vec3_t		sv_areamins, sv_areamaxs;
+static	int			sv_arealimit;
+static	double		sv_areatime;
+
+static	edict_t		*area_edicts[MAX_EDICTS];
+static	float		area_centers[MAX_EDICTS];
+static	qboolean	area_triggers[MAX_EDICTS];
+
+areastats_t	sv_areastats;
+
+int SV_FloatCompare (const void *a, const void *b)
+{
+	if (*(float *)a < *(float *)b)
+		return -1;
+	return *(float *)a > *(float *)b;
+}
+
 /*
 ===============
 SV_CreateAreaNode
 
+Splits at the median of the edicts that would end up below the node, or
+at the middle of the node if there are too few of them to matter
 ===============
 */
-areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
+areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs, edict_t **list, int count)
 {
 	areanode_t	*anode;
 	vec3_t		size;
 	vec3_t		mins1, maxs1, mins2, maxs2;
+	float		lo, hi;
+	edict_t		*ent;
+	int			i, n0, mid, n;
 
 	anode = &sv_areanodes[sv_numareanodes];
 	sv_numareanodes++;
@@ -211,7 +316,7 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 	ClearLink (&anode->trigger_edicts);
 	ClearLink (&anode->solid_edicts);
 	
-	if (depth == AREA_DEPTH)
+	if (depth == AREA_MAXDEPTH || (depth >= AREA_DEPTH && count < AREA_LEAFEDICTS))
 	{
 		anode->axis = -1;
 		anode->children[0] = anode->children[1] = NULL;
@@ -225,6 +330,43 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 		anode->axis = 1;
 	
 	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+	if (count >= AREA_LEAFEDICTS)
+	{
+		for (i=0 ; i<count ; i++)
+			area_centers[i] = 0.5 * (list[i]->v.absmin[anode->axis] + list[i]->v.absmax[anode->axis]);
+		qsort (area_centers, count, sizeof(float), SV_FloatCompare);
+		anode->dist = area_centers[count/2];
+
+	// don't let a tight cluster squeeze a child down to nothing
+		lo = mins[anode->axis] + 0.125 * size[anode->axis];
+		hi = maxs[anode->axis] - 0.125 * size[anode->axis];
+		if (anode->dist < lo)
+			anode->dist = lo;
+		else if (anode->dist > hi)
+			anode->dist = hi;
+	}
+
+// sort the list into edicts above the plane, below it and crossing it
+	n0 = 0;
+	mid = 0;
+	n = count;
+	while (mid < n)
+	{
+		ent = list[mid];
+		if (ent->v.absmin[anode->axis] > anode->dist)
+		{
+			list[mid++] = list[n0];
+			list[n0++] = ent;
+		}
+		else if (ent->v.absmax[anode->axis] < anode->dist)
+			mid++;
+		else
+		{
+			list[mid] = list[--n];
+			list[n] = ent;
+		}
+	}
+
 	VectorCopy (mins, mins1);	
 	VectorCopy (mins, mins2);	
 	VectorCopy (maxs, maxs1);	
@@ -232,8 +374,8 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 	
 	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
 	
-	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2, list, n0);
+	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1, list + n0, n - n0);
 
 	return anode;
 }
@@ -248,11 +390,98 @@ void SV_ClearWorld (void)
 {
 	SV_InitBoxHull ();
 	
+	VectorCopy (sv.worldmodel->mins, sv_areamins);
+	VectorCopy (sv.worldmodel->maxs, sv_areamaxs);
+
 	memset (sv_areanodes, 0, sizeof(sv_areanodes));
 	sv_numareanodes = 0;
-	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+	SV_CreateAreaNode (0, sv_areamins, sv_areamaxs, NULL, 0);
+
+	sv_arealimit = AREA_REBALANCE;
+	sv_areatime = 0;
+
+	memset (sv_tracememo, 0, sizeof(sv_tracememo));
 }
 
+/*
+===============
+SV_AreaNodeStats
+
+Returns the length of the longest list below node
+===============
+*/
+int SV_AreaNodeStats (areanode_t *node, int depth, int *nodes, int *maxdepth, int *linked)
+{
+	link_t		*l;
+	int			count, longest, child;
+
+	(*nodes)++;
+	if (depth > *maxdepth)
+		*maxdepth = depth;
+
+	count = 0;
+	for (l = node->solid_edicts.next ; l != &node->solid_edicts ; l = l->next)
+		count++;
+	for (l = node->trigger_edicts.next ; l != &node->trigger_edicts ; l = l->next)
+		count++;
+	*linked += count;
+	longest = count;
+
+	if (node->axis == -1)
+		return longest;
+
+	child = SV_AreaNodeStats (node->children[0], depth+1, nodes, maxdepth, linked);
+	if (child > longest)
+		longest = child;
+	child = SV_AreaNodeStats (node->children[1], depth+1, nodes, maxdepth, linked);
+	if (child > longest)
+		longest = child;
+
+	return longest;
+}
+
+/*
+===============
+SV_AreaStats_f
+
+Prints the shape of the area tree and how much work SV_Move has done
+since the last time, then clears the counters
+===============
+*/
+void SV_AreaStats_f (void)
+{
+	int		nodes, maxdepth, linked, longest;
+
+	if (!sv.active)
+	{
+		Con_Printf ("Server not active\n");
+		return;
+	}
+
+	nodes = maxdepth = linked = 0;
+	longest = SV_AreaNodeStats (sv_areanodes, 0, &nodes, &maxdepth, &linked);
+	Con_Printf ("%i area nodes, depth %i, %i linked edicts, longest list %i\n", nodes, maxdepth, linked, longest);
+	Con_Printf ("%i rebuilds\n", sv_areastats.rebuilds);
+
+	if (sv_areastats.moves)
+		Con_Printf ("%i moves: %.1f links visited, %.2f exact clips per move\n", sv_areastats.moves,
+			(float)sv_areastats.links / sv_areastats.moves, (float)sv_areastats.clips / sv_areastats.moves);
+	if (sv_areastats.frames)
+		Con_Printf ("%i frames: %.1f hull traces per frame\n", sv_areastats.frames,
+			(float)sv_areastats.traces / sv_areastats.frames);
+	if (sv_areastats.traces)
+		Con_Printf ("%i%% of hull traces from the trace cache, %i%% run in batches\n",
+			(int)(100.0 * sv_areastats.tracehits / sv_areastats.traces),
+			(int)(100.0 * sv_areastats.batched / sv_areastats.traces));
+	if (sv_areastats.touches)
+		Con_Printf ("%i touch checks: %.1f trigger links visited per check\n", sv_areastats.touches,
+			(float)sv_areastats.triggerlinks / sv_areastats.touches);
+	if (sv_areastats.fatpvs)
+		Con_Printf ("%i fat PVS, %i%% from the fat PVS cache\n", sv_areastats.fatpvs,
+			(int)(100.0 * sv_areastats.fatpvshits / sv_areastats.fatpvs));
+
+	memset (&sv_areastats, 0, sizeof(sv_areastats));
+}
 
 /*
 ===============
@@ -280,11 +509,15 @@ void SV_TouchLinks ( edict_t *ent, areanode_t *node )
 	edict_t		*touch;
 	int			old_self, old_other;
 
+	if (node == sv_areanodes)
+		sv_areastats.touches++;
+
 // touch linked edicts
 	for (l = node->trigger_edicts.next ; l != &node->trigger_edicts ; l = next)
 	{
 		next = l->next;
 		touch = EDICT_FROM_AREA(l);
+		sv_areastats.triggerlinks++;
 		if (touch == ent)
 			continue;
 		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
@@ -365,14 +598,117 @@ void SV_FindTouchedLeafs (edict_t *ent, mnode_t *node)
 
 /*
 ===============
-SV_LinkEdict
+SV_LinkToAreaNode
 
+Links into the first node the edict's box crosses
 ===============
 */
-void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
+void SV_LinkToAreaNode (edict_t *ent, qboolean trigger)
+{
+	areanode_t	*node;
+
+	node = sv_areanodes;
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+		if (ent->v.absmin[node->axis] > node->dist)
+			node = node->children[0];
+		else if (ent->v.absmax[node->axis] < node->dist)
+			node = node->children[1];
+		else
+			break;		// crosses the node
+	}
+	
+	if (trigger)
+		InsertLinkBefore (&ent->area, &node->trigger_edicts);
+	else
+		InsertLinkBefore (&ent->area, &node->solid_edicts);
+}
+
+/*
+===============
+SV_BalanceWorld
+
+Rebuilds the area tree around the edicts that are linked right now.
+Edicts stay in the same kind of list they were linked into and keep
+their abs boxes, so nothing but the order of the lists changes.
+===============
+*/
+void SV_BalanceWorld (void)
 {
 	areanode_t	*node;
+	link_t		*l;
+	edict_t		*ent;
+	int			i, count;
+	int			nodes, maxdepth, linked;
+
+	count = 0;
+	for (i=0, node=sv_areanodes ; i<sv_numareanodes ; i++, node++)
+	{
+		for (l = node->solid_edicts.next ; l != &node->solid_edicts ; l = l->next)
+		{
+			ent = EDICT_FROM_AREA(l);
+			area_triggers[NUM_FOR_EDICT(ent)] = false;
+			area_edicts[count++] = ent;
+		}
+		for (l = node->trigger_edicts.next ; l != &node->trigger_edicts ; l = l->next)
+		{
+			ent = EDICT_FROM_AREA(l);
+			area_triggers[NUM_FOR_EDICT(ent)] = true;
+			area_edicts[count++] = ent;
+		}
+	}
+
+	memset (sv_areanodes, 0, sizeof(sv_areanodes));
+	sv_numareanodes = 0;
+	SV_CreateAreaNode (0, sv_areamins, sv_areamaxs, area_edicts, count);
+
+	for (i=0 ; i<count ; i++)
+	{
+		ent = area_edicts[i];
+		SV_LinkToAreaNode (ent, area_triggers[NUM_FOR_EDICT(ent)]);
+	}
+
+// don't keep rebuilding if the crowding can't be split up
+	nodes = maxdepth = linked = 0;
+	sv_arealimit = 2 * SV_AreaNodeStats (sv_areanodes, 0, &nodes, &maxdepth, &linked);
+	if (sv_arealimit < AREA_REBALANCE)
+		sv_arealimit = AREA_REBALANCE;
+
+	sv_areastats.rebuilds++;
+}
+
+/*
+===============
+SV_CheckAreaNodes
+
+Called once a frame, rebuilds the area tree if a list has grown too long
+===============
+*/
+void SV_CheckAreaNodes (void)
+{
+	int			nodes, maxdepth, linked;
+
+	sv_areastats.frames++;
+
+	if (sv.time < sv_areatime)
+		return;
+	sv_areatime = sv.time + 1;
+
+	nodes = maxdepth = linked = 0;
+	if (SV_AreaNodeStats (sv_areanodes, 0, &nodes, &maxdepth, &linked) > sv_arealimit)
+		SV_BalanceWorld ();
+}
+
+/*
+===============
+SV_LinkEdict
 
+===============
+*/
+void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
+{
 	if (ent->area.prev)
 		SV_UnlinkEdict (ent);	// unlink from old position
 		
@@ -382,6 +718,8 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 	if (ent->free)
 		return;
 
+	PROF_BEGIN ("SV_LinkEdict");
+
 // set the abs box
 
 
@@ -416,32 +754,85 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 		SV_FindTouchedLeafs (ent, sv.worldmodel->nodes);
 
 	if (ent->v.solid == SOLID_NOT)
-		return;
-
-// find the first node that the ent's box crosses
-	node = sv_areanodes;
-	while (1)
 	{
-		if (node->axis == -1)
-			break;
-		if (ent->v.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->v.absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
+		PROF_END ();
+		return;
 	}
-	
-// link it in	
 
-	if (ent->v.solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else
-		InsertLinkBefore (&ent->area, &node->solid_edicts);
+// link it in	
+	SV_LinkToAreaNode (ent, ent->v.solid == SOLID_TRIGGER);
 	
 // if touch_triggers, touch all entities at this node and decend for more
 	if (touch_triggers)
 		SV_TouchLinks ( ent, sv_areanodes );
+
+	PROF_END ();
+}
+
+/*
+====================
+SV_AreaEdicts_r
+
+====================
+*/
+static	float	*area_mins, *area_maxs;
+static	edict_t	**area_list;
+static	int		area_count, area_maxcount;
+
+void SV_AreaEdicts_r (areanode_t *node)
+{
+	link_t		*l, *start;
+	edict_t		*check;
+	int			i;
+
+	for (i=0 ; i<2 ; i++)
+	{
+		start = i ? &node->trigger_edicts : &node->solid_edicts;
+		for (l = start->next ; l != start ; l = l->next)
+		{
+			check = EDICT_FROM_AREA(l);
+			if (area_mins[0] > check->v.absmax[0]
+			|| area_mins[1] > check->v.absmax[1]
+			|| area_mins[2] > check->v.absmax[2]
+			|| area_maxs[0] < check->v.absmin[0]
+			|| area_maxs[1] < check->v.absmin[1]
+			|| area_maxs[2] < check->v.absmin[2] )
+				continue;
+			if (area_count == area_maxcount)
+				return;
+			area_list[area_count++] = check;
+		}
+	}
+
+// recurse down both sides
+	if (node->axis == -1)
+		return;
+
+	if ( area_maxs[node->axis] > node->dist )
+		SV_AreaEdicts_r ( node->children[0] );
+	if ( area_mins[node->axis] < node->dist )
+		SV_AreaEdicts_r ( node->children[1] );
+}
+
+/*
+====================
+SV_AreaEdicts
+
+Fills in list with the linked edicts whose absolute boxes touch mins/maxs,
+in no particular order, and returns the count
+====================
+*/
+int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount)
+{
+	area_mins = mins;
+	area_maxs = maxs;
+	area_list = list;
+	area_count = 0;
+	area_maxcount = maxcount;
+
+	SV_AreaEdicts_r (sv_areanodes);
+
+	return area_count;
 }
 
 
@@ -491,6 +882,88 @@ int SV_HullPointContents (hull_t *hull, int num, vec3_t p)
 
 #endif	// !id386
 
+/*
+==================
+SV_HullPointContentsGroup
+
+Drops a group of points down the hull together, splitting the group only
+where the points fall on different sides of a node.  Each node's plane is
+fetched once and tested against all of the points in a tight loop.
+==================
+*/
+void SV_HullPointContentsGroup (hull_t *hull, int num, vec3_t *points, int *index, int count, int *contents)
+{
+	float		d;
+	float		*p;
+	dclipnode_t	*node;
+	mplane_t	*plane;
+	int			i, back, swap;
+
+	while (num >= 0)
+	{
+		if (num < hull->firstclipnode || num > hull->lastclipnode)
+			Sys_Error ("SV_HullPointContentsGroup: bad node number");
+	
+		node = hull->clipnodes + num;
+		plane = hull->planes + node->planenum;
+
+	// sort the group into the points in front of the plane and behind it
+		back = count;
+		for (i=0 ; i<back ; )
+		{
+			p = points[index[i]];
+			if (plane->type < 3)
+				d = p[plane->type] - plane->dist;
+			else
+				d = DotProduct (plane->normal, p) - plane->dist;
+			if (d < 0)
+			{
+				back--;
+				swap = index[i];
+				index[i] = index[back];
+				index[back] = swap;
+			}
+			else
+				i++;
+		}
+
+		if (back == 0)
+			num = node->children[1];
+		else if (back == count)
+			num = node->children[0];
+		else
+		{
+			SV_HullPointContentsGroup (hull, node->children[1], points, index + back, count - back, contents);
+			count = back;
+			num = node->children[0];
+		}
+	}
+
+	for (i=0 ; i<count ; i++)
+		contents[index[i]] = num;
+}
+
+/*
+==================
+SV_HullPointContentsBatch
+
+Same as calling SV_HullPointContents for each point
+==================
+*/
+void SV_HullPointContentsBatch (hull_t *hull, int num, vec3_t *points, int count, int *contents)
+{
+	int		index[MAX_BATCH_POINTS];
+	int		i;
+
+	if (count > MAX_BATCH_POINTS)
+		Sys_Error ("SV_HullPointContentsBatch: %i points", count);
+
+	for (i=0 ; i<count ; i++)
+		index[i] = i;
+
+	SV_HullPointContentsGroup (hull, num, points, index, count, contents);
+}
+
 
 /*
 ==================
@@ -668,6 +1141,208 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 	return false;
 }
 
+/*
+==================
+SV_HullCheckGroup
+
+Until a ray crosses a plane, SV_RecursiveHullCheck only carries it down
+to the child on its side, so rays that agree can go down together.  The
+rays in b from first to first+count are sorted at each node into the ones
+in front, the ones behind and the ones that cross, which are finished one
+at a time from that node.  Their distances from the plane are worked out
+four at a time, in the same order of operations as the scalar code, so
+every ray goes the way it would on its own.
+==================
+*/
+typedef struct
+{
+	int		index[MAX_BATCH_POINTS];
+	float	p1[3][MAX_BATCH_POINTS+3];		// by axis, padded to a multiple of four
+	float	p2[3][MAX_BATCH_POINTS+3];
+	float	t1[MAX_BATCH_POINTS+3];
+	float	t2[MAX_BATCH_POINTS+3];
+	trace_t	*traces;
+} tracebatch_t;
+
+static void SV_HullCheckGroup (hull_t *hull, int num, tracebatch_t *b, int first, int count)
+{
+	dclipnode_t	*node;
+	mplane_t	*plane;
+	int			i, j, k, side[MAX_BATCH_POINTS];
+	int			numside[3], at[3];
+	int			index[MAX_BATCH_POINTS];
+	float		p[6][MAX_BATCH_POINTS];
+	vec3_t		p1, p2;
+#ifdef idSSE2
+	__m128		nx, ny, nz, d;
+#endif
+
+	while (num >= 0 && count)
+	{
+		if (num < hull->firstclipnode || num > hull->lastclipnode)
+			Sys_Error ("SV_RecursiveHullCheck: bad node number");
+
+		node = hull->clipnodes + num;
+		plane = hull->planes + node->planenum;
+
+	// find the point distances
+#ifdef idSSE2
+		d = _mm_set1_ps (plane->dist);
+		if (plane->type < 3)
+		{
+			k = plane->type;
+			for (i=first ; i<first+count ; i+=4)
+			{
+				_mm_storeu_ps (b->t1 + i, _mm_sub_ps (_mm_loadu_ps (b->p1[k] + i), d));
+				_mm_storeu_ps (b->t2 + i, _mm_sub_ps (_mm_loadu_ps (b->p2[k] + i), d));
+			}
+		}
+		else
+		{
+			nx = _mm_set1_ps (plane->normal[0]);
+			ny = _mm_set1_ps (plane->normal[1]);
+			nz = _mm_set1_ps (plane->normal[2]);
+			for (i=first ; i<first+count ; i+=4)
+			{
+				_mm_storeu_ps (b->t1 + i, _mm_sub_ps (_mm_add_ps (_mm_add_ps (
+					_mm_mul_ps (nx, _mm_loadu_ps (b->p1[0] + i)),
+					_mm_mul_ps (ny, _mm_loadu_ps (b->p1[1] + i))),
+					_mm_mul_ps (nz, _mm_loadu_ps (b->p1[2] + i))), d));
+				_mm_storeu_ps (b->t2 + i, _mm_sub_ps (_mm_add_ps (_mm_add_ps (
+					_mm_mul_ps (nx, _mm_loadu_ps (b->p2[0] + i)),
+					_mm_mul_ps (ny, _mm_loadu_ps (b->p2[1] + i))),
+					_mm_mul_ps (nz, _mm_loadu_ps (b->p2[2] + i))), d));
+			}
+		}
+#else
+		for (i=first ; i<first+count ; i++)
+		{
+			if (plane->type < 3)
+			{
+				b->t1[i] = b->p1[plane->type][i] - plane->dist;
+				b->t2[i] = b->p2[plane->type][i] - plane->dist;
+			}
+			else
+			{
+				b->t1[i] = plane->normal[0]*b->p1[0][i] + plane->normal[1]*b->p1[1][i]
+					+ plane->normal[2]*b->p1[2][i] - plane->dist;
+				b->t2[i] = plane->normal[0]*b->p2[0][i] + plane->normal[1]*b->p2[1][i]
+					+ plane->normal[2]*b->p2[2][i] - plane->dist;
+			}
+		}
+#endif
+
+	// 0 in front, 1 behind, 2 crossing
+		numside[0] = numside[1] = numside[2] = 0;
+		for (i=0 ; i<count ; i++)
+		{
+			j = first + i;
+			if (b->t1[j] >= 0 && b->t2[j] >= 0)
+				side[i] = 0;
+			else if (b->t1[j] < 0 && b->t2[j] < 0)
+				side[i] = 1;
+			else
+				side[i] = 2;
+			numside[side[i]]++;
+		}
+
+	// sort the group by side
+		if (numside[0] != count && numside[1] != count)
+		{
+			for (i=0 ; i<count ; i++)
+			{
+				index[i] = b->index[first+i];
+				for (k=0 ; k<3 ; k++)
+				{
+					p[k][i] = b->p1[k][first+i];
+					p[3+k][i] = b->p2[k][first+i];
+				}
+			}
+			at[0] = first;
+			at[1] = first + numside[0];
+			at[2] = at[1] + numside[1];
+			for (i=0 ; i<count ; i++)
+			{
+				j = at[side[i]]++;
+				b->index[j] = index[i];
+				for (k=0 ; k<3 ; k++)
+				{
+					b->p1[k][j] = p[k][i];
+					b->p2[k][j] = p[3+k][i];
+				}
+			}
+		}
+
+	// the crossing rays part company with the rest here
+		for (i=first+numside[0]+numside[1] ; i<first+count ; i++)
+		{
+			for (k=0 ; k<3 ; k++)
+			{
+				p1[k] = b->p1[k][i];
+				p2[k] = b->p2[k][i];
+			}
+			SV_RecursiveHullCheck (hull, num, 0, 1, p1, p2, &b->traces[b->index[i]]);
+		}
+
+		if (numside[0] && numside[1])
+			SV_HullCheckGroup (hull, node->children[1], b, first + numside[0], numside[1]);
+		if (numside[0])
+		{
+			num = node->children[0];
+			count = numside[0];
+		}
+		else
+		{
+			num = node->children[1];
+			first += numside[0];
+			count = numside[1];
+		}
+	}
+
+// the leaf sets the contents flags the same way for each of them
+	for (i=first ; i<first+count ; i++)
+	{
+		for (k=0 ; k<3 ; k++)
+		{
+			p1[k] = b->p1[k][i];
+			p2[k] = b->p2[k][i];
+		}
+		SV_RecursiveHullCheck (hull, num, 0, 1, p1, p2, &b->traces[b->index[i]]);
+	}
+}
+
+/*
+==================
+SV_RecursiveHullCheckBatch
+
+Same as SV_RecursiveHullCheck (hull, num, 0, 1, start[i], end[i], &traces[i])
+for each trace, walking the nodes they share only once
+==================
+*/
+void SV_RecursiveHullCheckBatch (hull_t *hull, int num, int count, vec3_t *start, vec3_t *end, trace_t *traces)
+{
+	tracebatch_t	b;
+	int				i, k;
+
+	if (count > MAX_BATCH_POINTS)
+		Sys_Error ("SV_RecursiveHullCheckBatch: %i traces", count);
+
+	memset (&b, 0, sizeof(b));
+	for (i=0 ; i<count ; i++)
+	{
+		b.index[i] = i;
+		for (k=0 ; k<3 ; k++)
+		{
+			b.p1[k][i] = start[i][k];
+			b.p2[k][i] = end[i][k];
+		}
+	}
+	b.traces = traces;
+
+	sv_areastats.batched += count;
+	SV_HullCheckGroup (hull, num, &b, 0, count);
+}
+
 
 /*
 ==================
@@ -683,6 +1358,7 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 	vec3_t		offset;
 	vec3_t		start_l, end_l;
 	hull_t		*hull;
+	tracecache_t	*slot;
 
 // fill in a default trace
 	memset (&trace, 0, sizeof(trace_t));
@@ -696,8 +1372,22 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 	VectorSubtract (start, offset, start_l);
 	VectorSubtract (end, offset, end_l);
 
-// trace a line through the apropriate clipping hull
-	SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
+	sv_areastats.traces++;
+
+	if (hull != &box_hull && sv_tracecache.value)
+	{
+		slot = SV_TraceCacheSlot (hull, start, end);
+		if (!SV_TraceCacheGet (slot, hull, start, end, offset, &trace))
+		{
+			SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
+			SV_TraceCachePut (slot, hull, start, end, offset, &trace);
+		}
+	}
+	else
+	{
+	// trace a line through the apropriate clipping hull
+		SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
+	}
 
 // fix trace up by the offset
 	if (trace.fraction != 1)
@@ -730,6 +1420,7 @@ void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 	{
 		next = l->next;
 		touch = EDICT_FROM_AREA(l);
+		sv_areastats.links++;
 		if (touch->v.solid == SOLID_NOT)
 			continue;
 		if (touch == clip->passedict)
@@ -762,6 +1453,7 @@ void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 				continue;	// don't clip against owner
 		}
 
+		sv_areastats.clips++;
 		if ((int)touch->v.flags & FL_MONSTER)
 			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
 		else
@@ -819,46 +1511,144 @@ void SV_MoveBounds (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, vec3_t b
 
 /*
 ==================
-SV_Move
+SV_MoveToEntities
+
+The second half of SV_Move, clip->trace holds the trace through the world
 ==================
 */
-trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
+static void SV_MoveToEntities (moveclip_t *clip, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
 {
-	moveclip_t	clip;
 	int			i;
 
-	memset ( &clip, 0, sizeof ( moveclip_t ) );
-
-// clip to world
-	clip.trace = SV_ClipMoveToEntity ( sv.edicts, start, mins, maxs, end );
-
-	clip.start = start;
-	clip.end = end;
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.type = type;
-	clip.passedict = passedict;
+	clip->start = start;
+	clip->end = end;
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->type = type;
+	clip->passedict = passedict;
 
 	if (type == MOVE_MISSILE)
 	{
 		for (i=0 ; i<3 ; i++)
 		{
-			clip.mins2[i] = -15;
-			clip.maxs2[i] = 15;
+			clip->mins2[i] = -15;
+			clip->maxs2[i] = 15;
 		}
 	}
 	else
 	{
-		VectorCopy (mins, clip.mins2);
-		VectorCopy (maxs, clip.maxs2);
+		VectorCopy (mins, clip->mins2);
+		VectorCopy (maxs, clip->maxs2);
 	}
 	
 // create the bounding box of the entire move
-	SV_MoveBounds ( start, clip.mins2, clip.maxs2, end, clip.boxmins, clip.boxmaxs );
+	SV_MoveBounds ( start, clip->mins2, clip->maxs2, end, clip->boxmins, clip->boxmaxs );
 
 // clip to entities
-	SV_ClipToLinks ( sv_areanodes, &clip );
+	SV_ClipToLinks ( sv_areanodes, clip );
+}
+
+/*
+==================
+SV_Move
+==================
+*/
+trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
+{
+	moveclip_t	clip;
+
+	PROF_BEGIN ("SV_Move");
+
+	memset ( &clip, 0, sizeof ( moveclip_t ) );
+	sv_areastats.moves++;
+
+// clip to world
+	clip.trace = SV_ClipMoveToEntity ( sv.edicts, start, mins, maxs, end );
+
+	SV_MoveToEntities (&clip, start, mins, maxs, end, type, passedict);
+
+	PROF_END ();
 
 	return clip.trace;
 }
 
+/*
+==================
+SV_MoveBatch
+
+Same as calling SV_Move for each trace, but the traces through the world,
+which are most of the work, are run together
+==================
+*/
+void SV_MoveBatch (int count, vec3_t *start, vec3_t mins, vec3_t maxs, vec3_t *end, int type, edict_t *passedict, trace_t *traces)
+{
+	moveclip_t		clip;
+	hull_t			*hull;
+	tracecache_t	*slot[MAX_BATCH_POINTS];
+	vec3_t			offset;
+	vec3_t			start_l[MAX_BATCH_POINTS], end_l[MAX_BATCH_POINTS];
+	trace_t			run[MAX_BATCH_POINTS];
+	int				map[MAX_BATCH_POINTS];
+	int				i, numrun;
+
+	if (count > MAX_BATCH_POINTS)
+		Sys_Error ("SV_MoveBatch: %i traces", count);
+
+	PROF_BEGIN ("SV_Move");
+
+	sv_areastats.moves += count;
+	sv_areastats.traces += count;
+
+// clip to world, as SV_ClipMoveToEntity does, leaving out the ones the
+// trace cache has
+	hull = SV_HullForEntity (sv.edicts, mins, maxs, offset);
+
+	numrun = 0;
+	for (i=0 ; i<count ; i++)
+	{
+		memset (&traces[i], 0, sizeof(trace_t));
+		traces[i].fraction = 1;
+		traces[i].allsolid = true;
+		VectorCopy (end[i], traces[i].endpos);
+
+		slot[i] = NULL;
+		if (sv_tracecache.value)
+		{
+			slot[i] = SV_TraceCacheSlot (hull, start[i], end[i]);
+			if (SV_TraceCacheGet (slot[i], hull, start[i], end[i], offset, &traces[i]))
+				continue;
+		}
+
+		VectorSubtract (start[i], offset, start_l[numrun]);
+		VectorSubtract (end[i], offset, end_l[numrun]);
+		run[numrun] = traces[i];
+		map[numrun++] = i;
+	}
+
+	if (numrun)
+		SV_RecursiveHullCheckBatch (hull, hull->firstclipnode, numrun, start_l, end_l, run);
+
+	for (i=0 ; i<numrun ; i++)
+	{
+		traces[map[i]] = run[i];
+		if (slot[map[i]])
+			SV_TraceCachePut (slot[map[i]], hull, start[map[i]], end[map[i]], offset, &run[i]);
+	}
+
+	for (i=0 ; i<count ; i++)
+	{
+		if (traces[i].fraction != 1)
+			VectorAdd (traces[i].endpos, offset, traces[i].endpos);
+		if (traces[i].fraction < 1 || traces[i].startsolid)
+			traces[i].ent = sv.edicts;
+
+	// clip to entities
+		memset (&clip, 0, sizeof(clip));
+		clip.trace = traces[i];
+		SV_MoveToEntities (&clip, start[i], mins, maxs, end[i], type, passedict);
+		traces[i] = clip.trace;
+	}
+
+	PROF_END ();
+}
+
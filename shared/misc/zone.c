@@ -46,6 +46,117 @@ void Cache_FreeLow (int new_low_hunk);
 void Cache_FreeHigh (int new_high_hunk);
 
 
+/*
+==============================================================================
+
+						MEMORY STATISTICS
+
+Every hunk, cache and zone allocation is counted against its name and its
+subsystem as it happens, so memstats never has to walk the memory to say
+where it went.  Only the zone fragmentation report walks the zone.
+==============================================================================
+*/
+
+enum {ms_hunk, ms_highhunk, ms_cache, ms_zone, MS_NUMKINDS};
+
+static char *memkindnames[MS_NUMKINDS] = {"hunk", "highhunk", "cache", "zone"};
+
+typedef struct memstat_s
+{
+	char	name[16];
+	int		kind;
+	int		bytes, peak;
+	int		allocs, frees;
+	int		evictions;		// cache blocks thrown out to make room
+	int		evicted;		// thrown out and not allocated again yet
+	int		reloads;		// allocated again after being thrown out
+	int		lastallocs;		// allocs at the last report
+	struct memstat_s	*hashnext;
+} memstat_t;
+
+#define	MAX_MEMSTATS	512
+#define	MEMSTAT_HASH	256		// must be a power of two
+
+static	memstat_t	memstats[MAX_MEMSTATS];
+static	memstat_t	*memstathash[MEMSTAT_HASH];
+static	int			nummemstats;
+static	memstat_t	memkinds[MS_NUMKINDS];		// subsystem totals
+static	double		memstattime;
+
+void Mem_Stats_f (void);
+void Z_Stress_f (void);
+
+/*
+========================
+Mem_Stat
+
+Finds or adds the counters for name, which is only looked at up to
+length characters because hunk names aren't always terminated
+========================
+*/
+memstat_t *Mem_Stat (int kind, char *name, int length)
+{
+	char		n[16];
+	unsigned	hash;
+	int			i;
+	memstat_t	*stat;
+
+	if (length > sizeof(n) - 1)
+		length = sizeof(n) - 1;
+	hash = kind;
+	for (i=0 ; i<length && name[i] ; i++)
+	{
+		n[i] = name[i];
+		hash = hash * 33 + name[i];
+	}
+	n[i] = 0;
+	hash &= MEMSTAT_HASH-1;
+
+	for (stat = memstathash[hash] ; stat ; stat = stat->hashnext)
+		if (stat->kind == kind && !strcmp (stat->name, n))
+			return stat;
+
+	if (nummemstats == MAX_MEMSTATS)
+		return &memstats[MAX_MEMSTATS-1];	// lump the rest together
+
+	stat = &memstats[nummemstats++];
+	strcpy (stat->name, nummemstats == MAX_MEMSTATS ? "(other)" : n);
+	stat->kind = kind;
+	stat->hashnext = memstathash[hash];
+	memstathash[hash] = stat;
+
+	return stat;
+}
+
+/*
+========================
+Mem_Alloced / Mem_Freed
+========================
+*/
+void Mem_Alloced (memstat_t *stat, int bytes)
+{
+	memstat_t	*total;
+
+	total = &memkinds[stat->kind];
+	stat->allocs++;
+	total->allocs++;
+	stat->bytes += bytes;
+	total->bytes += bytes;
+	if (stat->bytes > stat->peak)
+		stat->peak = stat->bytes;
+	if (total->bytes > total->peak)
+		total->peak = total->bytes;
+}
+
+void Mem_Freed (memstat_t *stat, int bytes)
+{
+	stat->frees++;
+	memkinds[stat->kind].frees++;
+	stat->bytes -= bytes;
+	memkinds[stat->kind].bytes -= bytes;
+}
+
+
 /*
 ==============================================================================
 
@@ -91,6 +202,124 @@ void Z_ClearZone (memzone_t *zone, int size)
 }
 
 
+/*
+==============================================================================
+
+						SLAB ALLOCATION
+
+Small blocks come out of fixed size classes carved from pages in an arena
+of their own, so allocating or freeing one is a single list pop or push and
+the strings and aliases that come and go with command traffic can't chop
+the zone up.  Bigger blocks, and small ones once the arena is used up, go
+to the zone as before.
+==============================================================================
+*/
+
+#define	SLAB_SIZE		0x10000		// -slab <kb> to change
+#define	SLAB_PAGE		2048
+#define	SLAB_MINSHIFT	4			// smallest class is 16 bytes
+#define	SLAB_CLASSES	5			// largest is 256 bytes
+
+typedef struct slabfree_s
+{
+	struct slabfree_s	*next;
+} slabfree_t;
+
+static	byte		*slab_base;
+static	int			slab_size;
+static	int			slab_used;			// bytes of pages handed out
+static	byte		*slab_pageclass;	// size class of every page
+static	slabfree_t	*slab_free[SLAB_CLASSES];
+static	memstat_t	*slab_stats[SLAB_CLASSES];
+
+/*
+========================
+Z_InitSlabs
+========================
+*/
+void Z_InitSlabs (int size)
+{
+	int		i;
+
+	slab_size = size & ~(SLAB_PAGE-1);
+	slab_base = Hunk_AllocName (slab_size, "zoneslab");
+	slab_pageclass = Hunk_AllocName (slab_size / SLAB_PAGE, "zoneslab");
+	slab_used = 0;
+
+	for (i=0 ; i<SLAB_CLASSES ; i++)
+	{
+		slab_free[i] = NULL;
+		slab_stats[i] = Mem_Stat (ms_zone, va("slab%i", 1<<(i+SLAB_MINSHIFT)), 16);
+	}
+}
+
+/*
+========================
+Z_SlabAlloc
+
+Returns NULL if the block is too big for a class or there are no pages left
+========================
+*/
+void *Z_SlabAlloc (int size)
+{
+	int			c, blocksize;
+	slabfree_t	*block;
+	byte		*page;
+
+	for (c=0 ; c<SLAB_CLASSES ; c++)
+		if (size <= 1<<(c+SLAB_MINSHIFT))
+			break;
+	if (c == SLAB_CLASSES)
+		return NULL;
+
+	block = slab_free[c];
+	if (!block)
+	{	// carve up a new page
+		if (slab_used + SLAB_PAGE > slab_size)
+			return NULL;
+		page = slab_base + slab_used;
+		slab_pageclass[slab_used / SLAB_PAGE] = c;
+		slab_used += SLAB_PAGE;
+
+		blocksize = 1<<(c+SLAB_MINSHIFT);
+		for (size = SLAB_PAGE - blocksize ; size >= 0 ; size -= blocksize)
+		{
+			block = (slabfree_t *)(page + size);
+			block->next = slab_free[c];
+			slab_free[c] = block;
+		}
+		block = slab_free[c];
+	}
+
+	slab_free[c] = block->next;
+	Mem_Alloced (slab_stats[c], 1<<(c+SLAB_MINSHIFT));
+
+	return (void *)block;
+}
+
+/*
+========================
+Z_SlabFree
+========================
+*/
+void Z_SlabFree (void *ptr)
+{
+	int			c, ofs;
+	slabfree_t	*block;
+
+	ofs = (byte *)ptr - slab_base;
+	if (ofs >= slab_used)
+		Sys_Error ("Z_Free: freed a pointer in an unused slab page");
+	c = slab_pageclass[ofs / SLAB_PAGE];
+	if (ofs & ((1<<(c+SLAB_MINSHIFT)) - 1))
+		Sys_Error ("Z_Free: freed a pointer inside a slab block");
+
+	block = (slabfree_t *)ptr;
+	block->next = slab_free[c];
+	slab_free[c] = block;
+	Mem_Freed (slab_stats[c], 1<<(c+SLAB_MINSHIFT));
+}
+
 /*
 ========================
 Z_Free
@@ -103,6 +332,12 @@ void Z_Free (void *ptr)
 	if (!ptr)
 		Sys_Error ("Z_Free: NULL pointer");
 
+	if ((byte *)ptr >= slab_base && (byte *)ptr < slab_base + slab_size)
+	{
+		Z_SlabFree (ptr);
+		return;
+	}
+
 	block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
 	if (block->id != ZONEID)
 		Sys_Error ("Z_Free: freed a pointer without ZONEID");
@@ -110,6 +345,7 @@ void Z_Free (void *ptr)
 		Sys_Error ("Z_Free: freed a freed pointer");
 
 	block->tag = 0;		// mark as free
+	Mem_Freed (Mem_Stat (ms_zone, "zone", 4), block->size);
 	
 	other = block->prev;
 	if (!other->tag)
@@ -143,10 +379,16 @@ void *Z_Malloc (int size)
 {
 	void	*buf;
 	
-Z_CheckHeap ();	// DEBUG
-	buf = Z_TagMalloc (size, 1);
+	buf = Z_SlabAlloc (size);
 	if (!buf)
-		Sys_Error ("Z_Malloc: failed on allocation of %i bytes",size);
+	{
+#ifdef _DEBUG
+		Z_CheckHeap ();
+#endif
+		buf = Z_TagMalloc (size, 1);
+		if (!buf)
+			Sys_Error ("Z_Malloc: failed on allocation of %i bytes",size);
+	}
 	Q_memset (buf, 0, size);
 
 	return buf;
@@ -199,6 +441,7 @@ void *Z_TagMalloc (int size, int tag)
 	}
 	
 	base->tag = tag;				// no longer a free block
+	Mem_Alloced (Mem_Stat (ms_zone, "zone", 4), base->size);
 	
 	mainzone->rover = base->next;	// next allocation will start looking here
 	
@@ -418,6 +661,7 @@ void *Hunk_AllocName (int size, char *name)
 	h->size = size;
 	h->sentinal = HUNK_SENTINAL;
 	Q_strncpy (h->name, name, 8);
+	Mem_Alloced (Mem_Stat (ms_hunk, h->name, 8), size);
 	
 	return (void *)(h+1);
 }
@@ -439,8 +683,12 @@ int	Hunk_LowMark (void)
 
 void Hunk_FreeToLowMark (int mark)
 {
+	hunk_t	*h;
+
 	if (mark < 0 || mark > hunk_low_used)
 		Sys_Error ("Hunk_FreeToLowMark: bad mark %i", mark);
+	for (h = (hunk_t *)(hunk_base + mark) ; (byte *)h < hunk_base + hunk_low_used ; h = (hunk_t *)((byte *)h + h->size))
+		Mem_Freed (Mem_Stat (ms_hunk, h->name, 8), h->size);
 	memset (hunk_base + mark, 0, hunk_low_used - mark);
 	hunk_low_used = mark;
 }
@@ -458,6 +706,8 @@ int	Hunk_HighMark (void)
 
 void Hunk_FreeToHighMark (int mark)
 {
+	hunk_t	*h;
+
 	if (hunk_tempactive)
 	{
 		hunk_tempactive = false;
@@ -465,10 +715,23 @@ void Hunk_FreeToHighMark (int mark)
 	}
 	if (mark < 0 || mark > hunk_high_used)
 		Sys_Error ("Hunk_FreeToHighMark: bad mark %i", mark);
+	for (h = (hunk_t *)(hunk_base + hunk_size - hunk_high_used) ; (byte *)h < hunk_base + hunk_size - mark ; h = (hunk_t *)((byte *)h + h->size))
+		Mem_Freed (Mem_Stat (ms_highhunk, h->name, 8), h->size);
 	memset (hunk_base + hunk_size - hunk_high_used, 0, hunk_high_used - mark);
 	hunk_high_used = mark;
 }
 
+/*
+===================
+Hunk_FreeSize
+
+Bytes left between the low and high marks
+===================
+*/
+int	Hunk_FreeSize (void)
+{
+	return hunk_size - hunk_low_used - hunk_high_used;
+}
 
 /*
 ===================
@@ -505,6 +768,7 @@ void *Hunk_HighAllocName (int size, char *name)
 	h->size = size;
 	h->sentinal = HUNK_SENTINAL;
 	Q_strncpy (h->name, name, 8);
+	Mem_Alloced (Mem_Stat (ms_highhunk, h->name, 8), size);
 
 	return (void *)(h+1);
 }
@@ -556,9 +820,13 @@ typedef struct cache_system_s
 } cache_system_t;
 
 cache_system_t *Cache_TryAlloc (int size, qboolean nobottom);
+void Cache_FreeBlock (cache_system_t *cs);
+void Cache_Evict (cache_system_t *cs);
 
 cache_system_t	cache_head;
 
+static	void	*cache_lock;
+
 /*
 ===========
 Cache_Move
@@ -568,6 +836,8 @@ void Cache_Move ( cache_system_t *c)
 {
 	cache_system_t		*new;
 
+	Cache_Lock ();
+
 // we are clearing up space at the bottom, so only allocate it late
 	new = Cache_TryAlloc (c->size, true);
 	if (new)
@@ -577,15 +847,17 @@ void Cache_Move ( cache_system_t *c)
 		Q_memcpy ( new+1, c+1, c->size - sizeof(cache_system_t) );
 		new->user = c->user;
 		Q_memcpy (new->name, c->name, sizeof(new->name));
-		Cache_Free (c->user);
+		Cache_FreeBlock (c);		// still the same allocation
 		new->user->data = (void *)(new+1);
 	}
 	else
 	{
 //		Con_Printf ("cache_move failed\n");
 
-		Cache_Free (c->user);		// tough luck...
+		Cache_Evict (c);		// tough luck...
 	}
+
+	Cache_Unlock ();
 }
 
 /*
@@ -630,7 +902,7 @@ void Cache_FreeHigh (int new_high_hunk)
 		if ( (byte *)c + c->size <= hunk_base + hunk_size - new_high_hunk)
 			return;		// there is space to grow the hunk
 		if (c == prev)
-			Cache_Free (c->user);	// didn't move out of the way
+			Cache_Evict (c);	// didn't move out of the way
 		else
 		{
 			Cache_Move (c);	// try to move it
@@ -803,7 +1075,11 @@ void Cache_Init (void)
 	cache_head.next = cache_head.prev = &cache_head;
 	cache_head.lru_next = cache_head.lru_prev = &cache_head;
 
+	cache_lock = Sys_CreateLock ();
+
 	Cmd_AddCommand ("flush", Cache_Flush);
+	Cmd_AddCommand ("memstats", Mem_Stats_f);
+	Cmd_AddCommand ("zonestress", Z_Stress_f);
 }
 
 /*
@@ -822,16 +1098,70 @@ void Cache_Free (cache_user_t *c)
 
 	cs = ((cache_system_t *)c->data) - 1;
 
+	Cache_Lock ();
+	Mem_Freed (Mem_Stat (ms_cache, cs->name, sizeof(cs->name)), cs->size);
+	Cache_FreeBlock (cs);
+	Cache_Unlock ();
+}
+
+/*
+==============
+Cache_FreeBlock
+
+Unlinks the block without counting it as freed
+==============
+*/
+void Cache_FreeBlock (cache_system_t *cs)
+{
 	cs->prev->next = cs->next;
 	cs->next->prev = cs->prev;
 	cs->next = cs->prev = NULL;
 
-	c->data = NULL;
+	cs->user->data = NULL;
 
 	Cache_UnlinkLRU (cs);
 }
 
+/*
+==============
+Cache_Evict
+
+Frees a block to make room for something else
+==============
+*/
+void Cache_Evict (cache_system_t *cs)
+{
+	memstat_t	*stat;
+
+	stat = Mem_Stat (ms_cache, cs->name, sizeof(cs->name));
+	stat->evictions++;
+	stat->evicted++;
+	memkinds[ms_cache].evictions++;
+
+	Cache_Free (cs->user);
+}
+
+
+
+/*
+==============
+Cache_Lock
+==============
+*/
+void Cache_Lock (void)
+{
+	Sys_Lock (cache_lock);
+}
 
+/*
+==============
+Cache_Unlock
+==============
+*/
+void Cache_Unlock (void)
+{
+	Sys_Unlock (cache_lock);
+}
 
 /*
 ==============
@@ -863,6 +1193,7 @@ Cache_Alloc
 void *Cache_Alloc (cache_user_t *c, int size, char *name)
 {
 	cache_system_t	*cs;
+	memstat_t		*stat;
 
 	if (c->data)
 		Sys_Error ("Cache_Alloc: allready allocated");
@@ -881,6 +1212,15 @@ void *Cache_Alloc (cache_user_t *c, int size, char *name)
 			strncpy (cs->name, name, sizeof(cs->name)-1);
 			c->data = (void *)(cs+1);
 			cs->user = c;
+
+			stat = Mem_Stat (ms_cache, cs->name, sizeof(cs->name));
+			Mem_Alloced (stat, cs->size);
+			if (stat->evicted)
+			{	// had to load it again
+				stat->evicted--;
+				stat->reloads++;
+				memkinds[ms_cache].reloads++;
+			}
 			break;
 		}
 	
@@ -888,7 +1228,7 @@ void *Cache_Alloc (cache_user_t *c, int size, char *name)
 		if (cache_head.lru_prev == &cache_head)
 			Sys_Error ("Cache_Alloc: out of memory");
 													// not enough memory at all
-		Cache_Free ( cache_head.lru_prev->user );
+		Cache_Evict (cache_head.lru_prev);
 	} 
 	
 	return Cache_Check (c);
@@ -897,6 +1237,165 @@ void *Cache_Alloc (cache_user_t *c, int size, char *name)
 //============================================================================
 
 
+/*
+========================
+Mem_ZoneFragments
+
+Walks the zone for the free space, the number of free blocks and the
+largest one
+========================
+*/
+void Mem_ZoneFragments (int *freebytes, int *freeblocks, int *largest)
+{
+	memblock_t	*block;
+
+	*freebytes = *freeblocks = *largest = 0;
+	for (block = mainzone->blocklist.next ; block != &mainzone->blocklist ; block = block->next)
+	{
+		if (block->tag)
+			continue;
+		*freebytes += block->size;
+		(*freeblocks)++;
+		if (block->size > *largest)
+			*largest = block->size;
+	}
+}
+
+/*
+========================
+Mem_Stats_f
+
+memstats          prints the subsystem totals and every named allocation
+memstats <file>   writes the same to a file in the game directory, one
+                  record per line, for scripts to pick up
+========================
+*/
+void Mem_Stats_f (void)
+{
+	int			i, kind;
+	int			freebytes, freeblocks, largest;
+	memstat_t	*stat;
+	double		now, elapsed;
+	FILE		*f;
+	char		name[MAX_OSPATH];
+
+	now = Sys_FloatTime ();
+	elapsed = memstattime ? now - memstattime : 0;
+	Mem_ZoneFragments (&freebytes, &freeblocks, &largest);
+
+	if (Cmd_Argc () > 1)
+	{
+		if (strstr(Cmd_Argv(1), ".."))
+		{
+			Con_Printf ("Relative pathnames are not allowed.\n");
+			return;
+		}
+
+		sprintf (name, "%s/%s", com_gamedir, Cmd_Argv(1));
+		f = fopen (name, "w");
+		if (!f)
+		{
+			Con_Printf ("Couldn't write %s\n", name);
+			return;
+		}
+		fprintf (f, "# kind name bytes peak allocs frees evictions reloads\n");
+		for (kind=0 ; kind<MS_NUMKINDS ; kind++)
+		{
+			stat = &memkinds[kind];
+			fprintf (f, "%s * %i %i %i %i %i %i\n", memkindnames[kind], stat->bytes, stat->peak,
+				stat->allocs, stat->frees, stat->evictions, stat->reloads);
+		}
+		for (i=0, stat=memstats ; i<nummemstats ; i++, stat++)
+			fprintf (f, "%s %s %i %i %i %i %i %i\n", memkindnames[stat->kind], stat->name, stat->bytes, stat->peak,
+				stat->allocs, stat->frees, stat->evictions, stat->reloads);
+		fprintf (f, "# zonesize zonefree freeblocks largestfree slabsize slabused hunksize hunklow hunkhigh\n");
+		fprintf (f, "memory %i %i %i %i %i %i %i %i %i\n", mainzone->size, freebytes, freeblocks, largest,
+			slab_size, slab_used, hunk_size, hunk_low_used, hunk_high_used);
+		fclose (f);
+		Con_Printf ("Wrote %s\n", name);
+		return;
+	}
+
+	Con_Printf ("kind     name               bytes     peak  allocs  frees evicts reloads alloc/s\n");
+	for (kind=0 ; kind<MS_NUMKINDS ; kind++)
+	{
+		for (i=0, stat=memstats ; i<nummemstats ; i++, stat++)
+		{
+			if (stat->kind != kind)
+				continue;
+			Con_Printf ("%-8s %-15s %8i %8i %7i %6i %6i %7i %7.1f\n", memkindnames[kind], stat->name,
+				stat->bytes, stat->peak, stat->allocs, stat->frees, stat->evictions, stat->reloads,
+				elapsed ? (stat->allocs - stat->lastallocs) / elapsed : 0);
+			stat->lastallocs = stat->allocs;
+		}
+		stat = &memkinds[kind];
+		Con_Printf ("%-8s %-15s %8i %8i %7i %6i %6i %7i %7.1f\n", memkindnames[kind], "(TOTAL)",
+			stat->bytes, stat->peak, stat->allocs, stat->frees, stat->evictions, stat->reloads,
+			elapsed ? (stat->allocs - stat->lastallocs) / elapsed : 0);
+		stat->lastallocs = stat->allocs;
+	}
+
+	Con_Printf ("zone: %i of %i bytes free in %i blocks, largest %i\n",
+		freebytes, mainzone->size, freeblocks, largest);
+	Con_Printf ("slab: %i of %i bytes of pages used\n", slab_used, slab_size);
+	Con_Printf ("hunk: %i low, %i high, %i free of %i\n", hunk_low_used, hunk_high_used,
+		hunk_size - hunk_low_used - hunk_high_used, hunk_size);
+
+	memstattime = now;
+}
+
+/*
+========================
+Z_Stress_f
+
+Replays a stream of alias and cvar commands, the kind of traffic a server
+with a big config and remote console users sees, and reports how long it
+took and what it left the zone looking like.
+
+zonestress [commands]
+========================
+*/
+void Z_Stress_f (void)
+{
+	int		i, j, count, len;
+	int		allocs, freebytes, freeblocks, largest;
+	char	cmd[256], value[128], saved[128];
+	double	start, time;
+
+	count = 10000;
+	if (Cmd_Argc () > 1)
+		count = Q_atoi (Cmd_Argv(1));
+
+	Q_strncpy (saved, Cvar_VariableString ("scratch1"), sizeof(saved)-1);
+	saved[sizeof(saved)-1] = 0;
+
+	allocs = memkinds[ms_zone].allocs;
+	start = Sys_FloatTime ();
+
+	for (i=0 ; i<count ; i++)
+	{
+		len = (i * 37) % 120;
+		for (j=0 ; j<len ; j++)
+			value[j] = 'a' + (i + j) % 26;
+		value[len] = 0;
+
+		if (i & 1)
+			sprintf (cmd, "alias zstress%i \"%s\"", i % 64, value);
+		else
+			sprintf (cmd, "scratch1 \"%s\"", value);
+		Cmd_ExecuteString (cmd, src_command);
+	}
+
+	time = Sys_FloatTime () - start;
+	Cvar_Set ("scratch1", saved);
+
+	Mem_ZoneFragments (&freebytes, &freeblocks, &largest);
+	Con_Printf ("%i commands, %i zone allocations in %.3f seconds\n",
+		count, memkinds[ms_zone].allocs - allocs, time);
+	Con_Printf ("zone: %i bytes free in %i blocks, largest %i\n", freebytes, freeblocks, largest);
+	Con_Printf ("slab: %i of %i bytes of pages used\n", slab_used, slab_size);
+}
+
 /*
 ========================
 Memory_Init
@@ -906,6 +1405,7 @@ void Memory_Init (void *buf, int size)
 {
 	int p;
 	int zonesize = DYNAMIC_SIZE;
+	int slabsize;
 
 	hunk_base = buf;
 	hunk_size = size;
@@ -923,5 +1423,17 @@ void Memory_Init (void *buf, int size)
 	}
 	mainzone = Hunk_AllocName (zonesize, "zone" );
 	Z_ClearZone (mainzone, zonesize);
+	mainzone->size = zonesize;
+
+	slabsize = SLAB_SIZE;
+	p = COM_CheckParm ("-slab");
+	if (p)
+	{
+		if (p < com_argc-1)
+			slabsize = Q_atoi (com_argv[p+1]) * 1024;
+		else
+			Sys_Error ("Memory_Init: you must specify a size in KB after -slab");
+	}
+	Z_InitSlabs (slabsize);
 }
 
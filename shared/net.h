@@ -32,6 +32,11 @@ struct qsockaddr
 #define NET_HEADERSIZE		(2 * sizeof(unsigned int))
 #define NET_DATAGRAMSIZE	(MAX_DATAGRAM + NET_HEADERSIZE)
 
+#define	NET_LINGERTIME		5.0		// seconds a closed connection keeps
+									//  trying to deliver its backlog
+#define	NET_SHUTDOWNTIME	1.0		// seconds NET_Shutdown waits for
+									//  lingering connections
+
 // NetHeader flags
 #define NETFLAG_LENGTH_MASK	0x0000ffff
 #define NETFLAG_DATA		0x00010000
@@ -116,6 +121,13 @@ struct qsockaddr
 #define CCREP_PLAYER_INFO	0x84
 #define CCREP_RULE_INFO		0x85
 
+// packets waiting on a shared socket, see net_dgrm.c
+typedef struct
+{
+	struct queuedpacket_s	*head, *tail;
+	int						length;
+} packetqueue_t;
+
 typedef struct qsocket_s
 {
 	struct qsocket_s	*next;
@@ -146,12 +158,33 @@ typedef struct qsocket_s
 	struct qsockaddr	addr;
 	char				address[NET_NAMELEN];
 
+	int				protocol;		// best game protocol the client offered
+
+	qboolean		sharedsocket;	// socket is the landriver's accept socket
+	struct qsocket_s	*hashnext;	// in the shared socket address hash
+	packetqueue_t	incoming;		// sorted off the shared socket
+
+	int				backlogLength;	// reliable data waiting for sendMessage
+	byte			backlog [NET_MAXMESSAGE];	//  to be acknowledged
+	qboolean		lingering;		// closed, but still delivering its backlog
+	double			lingerTime;
+
 } qsocket_t;
 
 extern qsocket_t	*net_activeSockets;
 extern qsocket_t	*net_freeSockets;
 extern int			net_numsockets;
 
+#define	MAX_NETBATCH	64			// packets per ReadBatch or WriteBatch
+
+// for the batched landriver calls
+typedef struct
+{
+	byte				*data;
+	int					length;		// filled in by ReadBatch
+	struct qsockaddr	addr;
+} netpacket_t;
+
 typedef struct
 {
 	char		*name;
@@ -175,6 +208,9 @@ typedef struct
 	int			(*AddrCompare) (struct qsockaddr *addr1, struct qsockaddr *addr2);
 	int			(*GetSocketPort) (struct qsockaddr *addr);
 	int			(*SetSocketPort) (struct qsockaddr *addr, int port);
+// optional, NULL drivers get one Read or Write per packet
+	int			(*ReadBatch) (int socket, netpacket_t *packets, int count, int len);
+	int			(*WriteBatch) (int socket, netpacket_t *packets, int count);
 } net_landriver_t;
 
 #define	MAX_NET_DRIVERS		8
@@ -197,6 +233,7 @@ typedef struct
 	qboolean	(*CanSendUnreliableMessage) (qsocket_t *sock);
 	void		(*Close) (qsocket_t *sock);
 	void		(*Shutdown) (void);
+	void		(*Flush) (void);		// NULL if sends aren't held
 	int			controlSock;
 } net_driver_t;
 
@@ -275,8 +312,23 @@ int			NET_SendUnreliableMessage (struct qsocket_s *sock, sizebuf_t *data);
 // returns 1 if the message was sent properly
 // returns -1 if the connection died
 
-int			NET_SendToAll(sizebuf_t *data, int blocktime);
-// This is a reliable *blocking* send to all attached clients.
+int			NET_QueueMessage (struct qsocket_s *sock, sizebuf_t *data);
+// Reliable send that never has to wait.  If the connection is still waiting
+// on an acknowledgement the data joins its backlog, which NET_SendQueued
+// sends as one message when it can.  NET_CanSendMessage is false while
+// there is a backlog, so later reliable sends stay in order behind it.
+// returns 0 if the backlog is full, else as NET_SendMessage
+
+int			NET_QueueToAll (sizebuf_t *data);
+// NET_QueueMessage to all attached clients, returns how many it failed for
+
+void		NET_SendQueued (void);
+// Sends backlogs that have become unblocked and closes lingering connections
+// that are done, called every frame from NET_Poll
+
+void		NET_Flush (void);
+// Sends anything the drivers are holding to batch up.  Called once a frame
+// after the server's sends, and by anything that waits on a reply.
 
 
 void		NET_Close (struct qsocket_s *sock);
@@ -288,6 +340,11 @@ void		NET_Close (struct qsocket_s *sock);
 // from a server.
 // A netcon_t number will not be reused until this function is called for it
 
+void		NET_Linger (struct qsocket_s *sock);
+// NET_Close once the backlog and the last reliable message have been
+// delivered, or after NET_LINGERTIME seconds if they never are.  A
+// lingering connection gives up its qsocket if a new one needs it.
+
 void NET_Poll(void);
 
 
@@ -64,6 +64,366 @@ char *StrAddr (struct qsockaddr *addr)
 }
 #endif
 
+/*
+=============================================================================
+
+SHARED SOCKET
+
+With net_sharedsocket set, new connections use the landriver's accept
+socket instead of each opening their own.  Everything that comes in on it
+is read in batches and sorted by address into the connections' queues,
+with control packets kept aside for CheckNewConnections.  Everything sent
+on it is held until Datagram_Flush.  A server frame then costs a few
+system calls however many clients there are.
+
+=============================================================================
+*/
+
+cvar_t	net_sharedsocket = {"net_sharedsocket", "0"};
+
+#define	MAX_QUEUEDPACKETS	256
+#define	MAX_PACKETQUEUE		16			// older packets are dropped past this
+#define	ADDRHASH_SIZE		64
+
+typedef struct queuedpacket_s
+{
+	struct queuedpacket_s	*next;
+	int					length;
+	struct qsockaddr	addr;
+	byte				data[NET_DATAGRAMSIZE];
+} queuedpacket_t;
+
+typedef struct
+{
+	int				socket;				// the accept socket, -1 if not seen yet
+	qboolean		drained;			// nothing more to read until the next flush
+	int				users;				// qsockets talking through it
+	qboolean		closing;			// listen 0 came while it still had users
+	packetqueue_t	control;
+} sharedsocket_t;
+
+static queuedpacket_t	packetpool[MAX_QUEUEDPACKETS];
+static queuedpacket_t	*freepackets;
+
+static sharedsocket_t	sharedsockets[MAX_NET_DRIVERS];
+static qsocket_t		*addrhash[ADDRHASH_SIZE];
+
+static netpacket_t		sendpackets[MAX_NETBATCH];
+static byte				sendbuffers[MAX_NETBATCH][NET_DATAGRAMSIZE];
+static int				numsendpackets;
+static int				sendlandriver, sendsocket;
+
+static void InitPacketQueues (void)
+{
+	int		i;
+
+	freepackets = NULL;
+	for (i = 0; i < MAX_QUEUEDPACKETS; i++)
+	{
+		packetpool[i].next = freepackets;
+		freepackets = &packetpool[i];
+	}
+
+	for (i = 0; i < MAX_NET_DRIVERS; i++)
+		sharedsockets[i].socket = -1;
+}
+
+static void FreePacket (queuedpacket_t *p)
+{
+	p->next = freepackets;
+	freepackets = p;
+}
+
+static void QueuePacket (packetqueue_t *q, queuedpacket_t *p)
+{
+	queuedpacket_t	*old;
+
+	p->next = NULL;
+	if (q->tail)
+		q->tail->next = p;
+	else
+		q->head = p;
+	q->tail = p;
+
+	if (++q->length > MAX_PACKETQUEUE)
+	{	// not being read, so keep the newest
+		old = q->head;
+		q->head = old->next;
+		q->length--;
+		FreePacket (old);
+	}
+}
+
+static queuedpacket_t *DequeuePacket (packetqueue_t *q)
+{
+	queuedpacket_t	*p;
+
+	p = q->head;
+	if (!p)
+		return NULL;
+	q->head = p->next;
+	if (!q->head)
+		q->tail = NULL;
+	q->length--;
+	return p;
+}
+
+static void ClearPacketQueue (packetqueue_t *q)
+{
+	queuedpacket_t	*p;
+
+	while ((p = DequeuePacket (q)) != NULL)
+		FreePacket (p);
+}
+
+static int AddrHash (int landriver, struct qsockaddr *addr)
+{
+	unsigned	hash;
+	int			i;
+
+// the port and IP address for UDP, part of the node for IPX.  AddrCompare
+// decides, this only picks a chain
+	hash = landriver;
+	for (i = 0; i < 6; i++)
+		hash = hash * 31 + addr->sa_data[i];
+	return hash & (ADDRHASH_SIZE - 1);
+}
+
+static void HashSocket (qsocket_t *sock)
+{
+	int		h;
+
+	h = AddrHash (sock->landriver, &sock->addr);
+	sock->hashnext = addrhash[h];
+	addrhash[h] = sock;
+	sharedsockets[sock->landriver].users++;
+}
+
+static void UnhashSocket (qsocket_t *sock)
+{
+	qsocket_t	**link;
+
+	for (link = &addrhash[AddrHash (sock->landriver, &sock->addr)]; *link; link = &(*link)->hashnext)
+	{
+		if (*link == sock)
+		{
+			*link = sock->hashnext;
+			sharedsockets[sock->landriver].users--;
+			break;
+		}
+	}
+	sock->hashnext = NULL;
+}
+
+static qsocket_t *FindSharedSocket (int landriver, struct qsockaddr *addr)
+{
+	qsocket_t	*s;
+
+	for (s = addrhash[AddrHash (landriver, addr)]; s; s = s->hashnext)
+		if (s->landriver == landriver && net_landrivers[landriver].AddrCompare (addr, &s->addr) == 0)
+			return s;
+	return NULL;
+}
+
+/*
+==================
+ReadSharedSocket
+
+Reads everything waiting on a landriver's accept socket and sorts it
+==================
+*/
+static void ReadSharedSocket (int landriver)
+{
+	sharedsocket_t	*ss;
+	net_landriver_t	*driver;
+	queuedpacket_t	*batch[MAX_NETBATCH];
+	netpacket_t		packets[MAX_NETBATCH];
+	qsocket_t		*s;
+	int				i, count, ret;
+
+	ss = &sharedsockets[landriver];
+	driver = &net_landrivers[landriver];
+	if (ss->drained || ss->socket == -1)
+		return;
+
+	while (1)
+	{
+		for (count = 0; count < MAX_NETBATCH && freepackets; count++)
+		{
+			batch[count] = freepackets;
+			freepackets = freepackets->next;
+			packets[count].data = batch[count]->data;
+		}
+
+		if (driver->ReadBatch)
+			ret = driver->ReadBatch (ss->socket, packets, count, NET_DATAGRAMSIZE);
+		else
+		{
+			for (ret = 0; ret < count; ret++)
+			{
+				packets[ret].length = driver->Read (ss->socket, packets[ret].data, NET_DATAGRAMSIZE, &packets[ret].addr);
+				if (packets[ret].length <= 0)
+					break;
+			}
+		}
+		if (ret == -1)
+		{
+			Con_Printf("Read error\n");
+			ret = 0;
+		}
+
+		for (i = 0; i < ret; i++)
+		{
+			batch[i]->length = packets[i].length;
+			batch[i]->addr = packets[i].addr;
+
+			if (packets[i].length >= sizeof(int) && (BigLong(*((int *)packets[i].data)) & NETFLAG_CTL))
+			{
+				if (ss->closing)
+					FreePacket (batch[i]);	// nobody is answering them
+				else
+					QueuePacket (&ss->control, batch[i]);
+				continue;
+			}
+
+			s = FindSharedSocket (landriver, &packets[i].addr);
+			if (s)
+				QueuePacket (&s->incoming, batch[i]);
+			else
+				FreePacket (batch[i]);
+		}
+		for ( ; i < count; i++)
+			FreePacket (batch[i]);
+
+		if (ret < count || !count)
+		{
+			ss->drained = true;
+			return;
+		}
+	}
+}
+
+/*
+==================
+ReadControlPacket
+
+Returns the next control packet for the accept socket, 0 if there isn't one
+==================
+*/
+static int ReadControlPacket (int landriver, byte *buf, int len, struct qsockaddr *addr)
+{
+	queuedpacket_t	*p;
+	packetqueue_t	*q;
+
+	q = &sharedsockets[landriver].control;
+	if (!q->head)
+		ReadSharedSocket (landriver);
+
+	p = DequeuePacket (q);
+	if (!p)
+		return 0;
+
+	if (len > p->length)
+		len = p->length;
+	Q_memcpy (buf, p->data, len);
+	*addr = p->addr;
+	FreePacket (p);
+	return len;
+}
+
+/*
+==================
+Datagram_Read
+
+Reads the next packet for a connection into packetBuffer
+==================
+*/
+static int Datagram_Read (qsocket_t *sock, struct qsockaddr *addr)
+{
+	queuedpacket_t	*p;
+	int				length;
+
+	if (!sock->sharedsocket)
+		return sfunc.Read (sock->socket, (byte *)&packetBuffer, NET_DATAGRAMSIZE, addr);
+
+	if (!sock->incoming.head)
+		ReadSharedSocket (sock->landriver);
+
+	p = DequeuePacket (&sock->incoming);
+	if (!p)
+		return 0;
+
+	length = p->length;
+	Q_memcpy (&packetBuffer, p->data, length);
+	*addr = p->addr;
+	FreePacket (p);
+	return length;
+}
+
+/*
+==================
+Datagram_Write
+
+Sends a packet for a connection, or holds it for Datagram_Flush
+==================
+*/
+static int Datagram_Write (qsocket_t *sock, byte *buf, int len, struct qsockaddr *addr)
+{
+	netpacket_t	*p;
+
+	if (!sock->sharedsocket)
+		return sfunc.Write (sock->socket, buf, len, addr);
+
+	if (numsendpackets == MAX_NETBATCH
+	|| (numsendpackets && (sendlandriver != sock->landriver || sendsocket != sock->socket)))
+		Datagram_Flush ();
+
+	sendlandriver = sock->landriver;
+	sendsocket = sock->socket;
+
+	p = &sendpackets[numsendpackets];
+	p->data = sendbuffers[numsendpackets];
+	p->length = len;
+	p->addr = *addr;
+	Q_memcpy (p->data, buf, len);
+	numsendpackets++;
+
+	return len;
+}
+
+/*
+==================
+Datagram_Flush
+
+Sends the held packets, and lets the next read go to the shared sockets again
+==================
+*/
+void Datagram_Flush (void)
+{
+	net_landriver_t	*driver;
+	int				i, errors;
+
+	if (numsendpackets)
+	{
+		driver = &net_landrivers[sendlandriver];
+		if (driver->WriteBatch)
+			errors = driver->WriteBatch (sendsocket, sendpackets, numsendpackets) == -1;
+		else
+		{
+			errors = 0;
+			for (i = 0; i < numsendpackets; i++)
+				if (driver->Write (sendsocket, sendpackets[i].data, sendpackets[i].length, &sendpackets[i].addr) == -1)
+					errors++;
+		}
+		if (errors)
+			Con_DPrintf("Datagram_Flush: write error\n");
+		numsendpackets = 0;
+	}
+
+	for (i = 0; i < MAX_NET_DRIVERS; i++)
+		sharedsockets[i].drained = false;
+}
+
 int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 {
 	unsigned int	packetLen;
@@ -102,7 +462,7 @@ int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 
 	sock->canSend = false;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -135,7 +495,7 @@ int SendMessageNext (qsocket_t *sock)
 
 	sock->sendNext = false;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -168,7 +528,7 @@ int ReSendMessage (qsocket_t *sock)
 
 	sock->sendNext = false;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -210,7 +570,7 @@ int Datagram_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 	packetBuffer.sequence = BigLong(sock->unreliableSendSequence++);
 	Q_memcpy (packetBuffer.data, data->data, data->cursize);
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (Datagram_Write (sock, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	packetsSent++;
@@ -233,7 +593,7 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 	while(1)
 	{	
-		length = sfunc.Read (sock->socket, (byte *)&packetBuffer, NET_DATAGRAMSIZE, &readaddr);
+		length = Datagram_Read (sock, &readaddr);
 
 //	if ((rand() & 255) > 220)
 //		continue;
@@ -334,7 +694,7 @@ int	Datagram_GetMessage (qsocket_t *sock)
 		{
 			packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
 			packetBuffer.sequence = BigLong(sequence);
-			sfunc.Write (sock->socket, (byte *)&packetBuffer, NET_HEADERSIZE, &readaddr);
+			Datagram_Write (sock, (byte *)&packetBuffer, NET_HEADERSIZE, &readaddr);
 
 			if (sequence != sock->receiveSequence)
 			{
@@ -423,6 +783,8 @@ int Datagram_Init (void)
 
 	myDriverLevel = net_driverlevel;
 	Cmd_AddCommand ("net_stats", NET_Stats_f);
+	Cvar_RegisterVariable (&net_sharedsocket);
+	InitPacketQueues ();
 
 	if (COM_CheckParm("-nolan"))
 		return -1;
@@ -444,6 +806,8 @@ void Datagram_Shutdown (void)
 {
 	int i;
 
+	Datagram_Flush ();
+
 //
 // shutdown the lan drivers
 //
@@ -458,19 +822,68 @@ void Datagram_Shutdown (void)
 }
 
 
+static void CloseSharedSocket (int landriver)
+{
+	sharedsocket_t	*ss;
+
+	ss = &sharedsockets[landriver];
+	net_landrivers[landriver].Listen (false);
+	ClearPacketQueue (&ss->control);
+	ss->socket = -1;
+	ss->closing = false;
+}
+
+
 void Datagram_Close (qsocket_t *sock)
 {
+	sharedsocket_t	*ss;
+
+	if (sock->sharedsocket)
+	{	// the socket stays open for everyone else
+		UnhashSocket (sock);
+		ClearPacketQueue (&sock->incoming);
+		sock->sharedsocket = false;
+
+		ss = &sharedsockets[sock->landriver];
+		if (ss->closing && !ss->users)
+			CloseSharedSocket (sock->landriver);
+		return;
+	}
 	sfunc.CloseSocket(sock->socket);
 }
 
 
+/*
+==================
+Datagram_Listen
+
+The accept socket also carries every shared connection, so listen 0 only
+stops new connections while any are left, and the socket is closed when
+the last of them goes
+==================
+*/
 void Datagram_Listen (qboolean state)
 {
 	int i;
 
 	for (i = 0; i < net_numlandrivers; i++)
-		if (net_landrivers[i].initialized)
-			net_landrivers[i].Listen (state);
+	{
+		if (!net_landrivers[i].initialized)
+			continue;
+
+		if (state)
+		{
+			sharedsockets[i].closing = false;
+			net_landrivers[i].Listen (true);
+		}
+		else if (sharedsockets[i].users)
+		{
+			sharedsockets[i].closing = true;
+			ClearPacketQueue (&sharedsockets[i].control);
+		}
+		else
+			CloseSharedSocket (i);
+	}
 }
 
 
@@ -486,14 +899,22 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	int			command;
 	int			control;
 	int			ret;
+	int			protocol;
 
-	acceptsock = dfunc.CheckNewConnections();
-	if (acceptsock == -1)
-		return NULL;
+	// control packets may already have been read off with the clients' packets
+	if (sharedsockets[net_landriverlevel].control.head)
+		acceptsock = sharedsockets[net_landriverlevel].socket;
+	else
+	{
+		acceptsock = dfunc.CheckNewConnections();
+		if (acceptsock == -1)
+			return NULL;
+		sharedsockets[net_landriverlevel].socket = acceptsock;
+	}
 
 	SZ_Clear(&net_message);
 
-	len = dfunc.Read (acceptsock, net_message.data, net_message.maxsize, &clientaddr);
+	len = ReadControlPacket (net_landriverlevel, net_message.data, net_message.maxsize, &clientaddr);
 	if (len < sizeof(int))
 		return NULL;
 	net_message.cursize = len;
@@ -631,6 +1052,11 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		return NULL;
 	}
 
+	// newer clients follow with the best game protocol they understand
+	protocol = PROTOCOL_VERSION;
+	if (msg_readcount + 4 <= net_message.cursize)
+		protocol = MSG_ReadLong();
+
 	// see if this guy is already connected
 	for (s = net_activeSockets; s; s = s->next)
 	{
@@ -677,27 +1103,41 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		return NULL;
 	}
 
-	// allocate a network socket
-	newsock = dfunc.OpenSocket(0);
-	if (newsock == -1)
+	if (net_sharedsocket.value)
 	{
-		NET_FreeQSocket(sock);
-		return NULL;
+		// talk to the client from the accept socket
+		newsock = acceptsock;
 	}
-
-	// connect to the client
-	if (dfunc.Connect (newsock, &clientaddr) == -1)
+	else
 	{
-		dfunc.CloseSocket(newsock);
-		NET_FreeQSocket(sock);
-		return NULL;
+		// allocate a network socket
+		newsock = dfunc.OpenSocket(0);
+		if (newsock == -1)
+		{
+			NET_FreeQSocket(sock);
+			return NULL;
+		}
+
+		// connect to the client
+		if (dfunc.Connect (newsock, &clientaddr) == -1)
+		{
+			dfunc.CloseSocket(newsock);
+			NET_FreeQSocket(sock);
+			return NULL;
+		}
 	}
 
 	// everything is allocated, just fill in the details	
 	sock->socket = newsock;
 	sock->landriver = net_landriverlevel;
 	sock->addr = clientaddr;
+	sock->protocol = protocol;
 	Q_strcpy(sock->address, dfunc.AddrToString(&clientaddr));
+	if (newsock == acceptsock)
+	{
+		sock->sharedsocket = true;
+		HashSocket (sock);
+	}
 
 	// send him back the info about the server connection he has been allocated
 	SZ_Clear(&net_message);
@@ -879,6 +1319,7 @@ static qsocket_t *_Datagram_Connect (char *host)
 		MSG_WriteByte(&net_message, CCREQ_CONNECT);
 		MSG_WriteString(&net_message, "QUAKE");
 		MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
+		MSG_WriteLong(&net_message, PROTOCOL_DELTA);	// older servers ignore it
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
 		dfunc.Write (newsock, net_message.data, net_message.cursize, &sendaddr);
 		SZ_Clear(&net_message);
@@ -114,6 +114,7 @@ qsocket_t *Loop_CheckNewConnections (void)
 	loop_client->sendMessageLength = 0;
 	loop_client->receiveMessageLength = 0;
 	loop_client->canSend = true;
+	loop_server->protocol = PROTOCOL_DELTA;	// the local client always has it
 	return loop_server;
 }
 
@@ -82,7 +82,19 @@ The sequence and buffer fields will be filled in properly
 */
 qsocket_t *NET_NewQSocket (void)
 {
-	qsocket_t	*sock;
+	qsocket_t	*sock, *s;
+
+	if (net_freeSockets == NULL)
+	{
+		// a connection that is only delivering its goodbye can make way,
+		// the one that has been at it longest first
+		sock = NULL;
+		for (s = net_activeSockets; s; s = s->next)
+			if (s->lingering && (!sock || s->lingerTime < sock->lingerTime))
+				sock = s;
+		if (sock)
+			NET_Close (sock);
+	}
 
 	if (net_freeSockets == NULL)
 		return NULL;
@@ -114,6 +126,13 @@ qsocket_t *NET_NewQSocket (void)
 	sock->receiveSequence = 0;
 	sock->unreliableReceiveSequence = 0;
 	sock->receiveMessageLength = 0;
+	sock->protocol = PROTOCOL_VERSION;
+	sock->sharedsocket = false;
+	sock->hashnext = NULL;
+	memset (&sock->incoming, 0, sizeof(sock->incoming));
+	sock->backlogLength = 0;
+	sock->lingering = false;
+	sock->lingerTime = 0;
 
 	return sock;
 }
@@ -603,6 +622,10 @@ qboolean NET_CanSendMessage (qsocket_t *sock)
 	if (sock->disconnected)
 		return false;
 
+	// everything else waits its turn behind the backlog
+	if (sock->backlogLength)
+		return false;
+
 	SetNetTime();
 
 	r = sfunc.CanSendMessage(sock);
@@ -611,77 +634,156 @@ qboolean NET_CanSendMessage (qsocket_t *sock)
 }
 
 
-int NET_SendToAll(sizebuf_t *data, int blocktime)
+/*
+=================
+NET_QueueMessage
+=================
+*/
+int NET_QueueMessage (qsocket_t *sock, sizebuf_t *data)
+{
+	if (!sock)
+		return -1;
+
+	if (sock->disconnected)
+	{
+		Con_Printf("NET_QueueMessage: disconnected socket\n");
+		return -1;
+	}
+
+	if (NET_CanSendMessage (sock))
+		return NET_SendMessage (sock, data);
+
+	if (sock->backlogLength + data->cursize > NET_MAXMESSAGE)
+	{
+		Con_Printf ("NET_QueueMessage: backlog overflow for %s\n", sock->address);
+		return 0;
+	}
+
+	Q_memcpy (sock->backlog + sock->backlogLength, data->data, data->cursize);
+	sock->backlogLength += data->cursize;
+	return 1;
+}
+
+
+/*
+=================
+NET_QueueToAll
+
+Used for the reconnect on a level change and the disconnect on shutdown,
+which used to block the whole server until every client had acknowledged
+them
+=================
+*/
+int NET_QueueToAll (sizebuf_t *data)
 {
-	double		start;
 	int			i;
 	int			count = 0;
-	qboolean	state1 [MAX_SCOREBOARD];
-	qboolean	state2 [MAX_SCOREBOARD];
 
 	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 	{
-		if (!host_client->netconnection)
+		if (!host_client->netconnection || !host_client->active)
 			continue;
-		if (host_client->active)
-		{
-			if (host_client->netconnection->driver == 0)
-			{
-				NET_SendMessage(host_client->netconnection, data);
-				state1[i] = true;
-				state2[i] = true;
-				continue;
-			}
+		if (NET_QueueMessage (host_client->netconnection, data) != 1)
 			count++;
-			state1[i] = false;
-			state2[i] = false;
-		}
-		else
-		{
-			state1[i] = true;
-			state2[i] = true;
-		}
 	}
 
-	start = Sys_FloatTime();
-	while (count)
+	return count;
+}
+
+
+/*
+=================
+NET_Linger
+=================
+*/
+void NET_Linger (qsocket_t *sock)
+{
+	if (!sock)
+		return;
+
+	if (sock->disconnected)
+		return;
+
+	SetNetTime();
+
+	// loopback messages are delivered as they are sent
+	if (!sock->driver || (!sock->backlogLength && sfunc.CanSendMessage (sock)))
+	{
+		NET_Close (sock);
+		return;
+	}
+
+	sock->lingering = true;
+	sock->lingerTime = net_time;
+}
+
+
+/*
+=================
+NET_SendQueued
+=================
+*/
+void NET_SendQueued (void)
+{
+	qsocket_t	*sock, *next;
+	sizebuf_t	buf;
+	qboolean	sent;
+	int			r;
+
+	sent = false;
+	for (sock = net_activeSockets ; sock ; sock = next)
 	{
-		count = 0;
-		for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+		next = sock->next;
+		if (!sock->backlogLength && !sock->lingering)
+			continue;
+
+		if (sock->lingering)
 		{
-			if (! state1[i])
-			{
-				if (NET_CanSendMessage (host_client->netconnection))
-				{
-					state1[i] = true;
-					NET_SendMessage(host_client->netconnection, data);
-				}
-				else
-				{
-					NET_GetMessage (host_client->netconnection);
-				}
-				count++;
-				continue;
-			}
+			// nothing else reads a closed connection, so pick up the
+			// acknowledgements here and throw everything else away
+			do
+				r = NET_GetMessage (sock);
+			while (r > 0);
 
-			if (! state2[i])
+			if (r == -1 || net_time - sock->lingerTime > NET_LINGERTIME)
 			{
-				if (NET_CanSendMessage (host_client->netconnection))
-				{
-					state2[i] = true;
-				}
-				else
-				{
-					NET_GetMessage (host_client->netconnection);
-				}
-				count++;
+				NET_Close (sock);
 				continue;
 			}
 		}
-		if ((Sys_FloatTime() - start) > blocktime)
-			break;
+
+		if (!sfunc.CanSendMessage (sock))
+			continue;
+
+		if (!sock->backlogLength)
+		{
+			NET_Close (sock);	// lingering, and it all got there
+			continue;
+		}
+
+		buf.data = sock->backlog;
+		buf.maxsize = NET_MAXMESSAGE;
+		buf.cursize = sock->backlogLength;
+		sock->backlogLength = 0;
+		if (NET_SendMessage (sock, &buf) == 1)
+			sent = true;
 	}
-	return count;
+
+	if (sent)
+		NET_Flush ();
+}
+
+
+/*
+=================
+NET_Flush
+=================
+*/
+void NET_Flush (void)
+{
+	for (net_driverlevel=0 ; net_driverlevel<net_numdrivers ; net_driverlevel++)
+		if (net_drivers[net_driverlevel].initialized && net_drivers[net_driverlevel].Flush)
+			net_drivers[net_driverlevel].Flush ();
 }
 
 
@@ -764,9 +866,27 @@ NET_Shutdown
 void		NET_Shutdown (void)
 {
 	qsocket_t	*sock;
+	double		start;
 
 	SetNetTime();
 
+// give the dropped clients a moment to get their svc_disconnect, the
+// connections close themselves as their backlogs are acknowledged
+	start = net_time;
+	while (net_time - start < NET_SHUTDOWNTIME)
+	{
+		for (sock = net_activeSockets; sock; sock = sock->next)
+			if (sock->lingering)
+				break;
+		if (!sock)
+			break;
+
+		NET_SendQueued ();
+		NET_Flush ();		// resends, and lets the shared sockets be read again
+		Sys_Sleep ();
+		SetNetTime();
+	}
+
 	for (sock = net_activeSockets; sock; sock = sock->next)
 		NET_Close(sock);
 
@@ -791,6 +911,8 @@ void NET_Poll(void)
 
 	SetNetTime();
 
+	NET_SendQueued ();
+
 	for (pp = pollProcedureList; pp; pp = pp->next)
 	{
 		if (pp->nextTime > net_time)
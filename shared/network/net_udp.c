@@ -0,0 +1,572 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// net_udp.c -- BSD sockets UDP driver, the POSIX counterpart of net_wins.c
+
+#ifdef __linux__
+#define _GNU_SOURCE		// recvmmsg and sendmmsg
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "quakedef.h"
+#include "net_udp.h"
+
+extern cvar_t hostname;
+
+#define MAXHOSTNAMELEN		256
+
+static int net_acceptsocket = -1;		// socket for fielding new connections
+static int net_controlsocket;
+static int net_broadcastsocket = 0;
+static struct qsockaddr broadcastaddr;
+
+static unsigned long myAddr;
+
+//=============================================================================
+
+void UDP_GetLocalAddress (void)
+{
+	struct hostent	*local = NULL;
+	char			buff[MAXHOSTNAMELEN];
+	unsigned long	addr;
+
+	if (myAddr != INADDR_ANY)
+		return;
+
+	if (gethostname(buff, MAXHOSTNAMELEN) == -1)
+		return;
+
+	local = gethostbyname(buff);
+	if (local == NULL)
+		return;
+
+	myAddr = *(int *)local->h_addr_list[0];
+
+	addr = ntohl(myAddr);
+	sprintf(my_tcpip_address, "%d.%d.%d.%d", (int)((addr >> 24) & 0xff), (int)((addr >> 16) & 0xff), (int)((addr >> 8) & 0xff), (int)(addr & 0xff));
+}
+
+
+int UDP_Init (void)
+{
+	int		i;
+	char	buff[MAXHOSTNAMELEN];
+	char	*p;
+
+	if (COM_CheckParm ("-noudp"))
+		return -1;
+
+	// determine my name
+	if (gethostname(buff, MAXHOSTNAMELEN) == -1)
+	{
+		Con_DPrintf ("UDP_Init: gethostname failed\n");
+		return -1;
+	}
+	buff[MAXHOSTNAMELEN - 1] = 0;
+
+	// if the quake hostname isn't set, set it to the machine name
+	if (Q_strcmp(hostname.string, "UNNAMED") == 0)
+	{
+		// see if it's a text IP address (well, close enough)
+		for (p = buff; *p; p++)
+			if ((*p < '0' || *p > '9') && *p != '.')
+				break;
+
+		// if it is a real name, strip off the domain; we only want the host
+		if (*p)
+		{
+			for (i = 0; i < 15; i++)
+				if (buff[i] == '.')
+					break;
+			buff[i] = 0;
+		}
+		Cvar_Set ("hostname", buff);
+	}
+
+	i = COM_CheckParm ("-ip");
+	if (i)
+	{
+		if (i < com_argc-1)
+		{
+			myAddr = inet_addr(com_argv[i+1]);
+			if (myAddr == INADDR_NONE)
+				Sys_Error ("%s is not a valid IP address", com_argv[i+1]);
+			strcpy(my_tcpip_address, com_argv[i+1]);
+		}
+		else
+		{
+			Sys_Error ("NET_Init: you must specify an IP address after -ip");
+		}
+	}
+	else
+	{
+		myAddr = INADDR_ANY;
+		strcpy(my_tcpip_address, "INADDR_ANY");
+	}
+
+	if ((net_controlsocket = UDP_OpenSocket (0)) == -1)
+	{
+		Con_Printf("UDP_Init: Unable to open control socket\n");
+		return -1;
+	}
+
+	((struct sockaddr_in *)&broadcastaddr)->sin_family = AF_INET;
+	((struct sockaddr_in *)&broadcastaddr)->sin_addr.s_addr = INADDR_BROADCAST;
+	((struct sockaddr_in *)&broadcastaddr)->sin_port = htons((unsigned short)net_hostport);
+
+	Con_Printf("UDP Initialized\n");
+	tcpipAvailable = true;
+
+	return net_controlsocket;
+}
+
+//=============================================================================
+
+void UDP_Shutdown (void)
+{
+	UDP_Listen (false);
+	UDP_CloseSocket (net_controlsocket);
+}
+
+//=============================================================================
+
+void UDP_Listen (qboolean state)
+{
+	// enable listening
+	if (state)
+	{
+		if (net_acceptsocket != -1)
+			return;
+		UDP_GetLocalAddress();
+		if ((net_acceptsocket = UDP_OpenSocket (net_hostport)) == -1)
+			Sys_Error ("UDP_Listen: Unable to open accept socket\n");
+		return;
+	}
+
+	// disable listening
+	if (net_acceptsocket == -1)
+		return;
+	UDP_CloseSocket (net_acceptsocket);
+	net_acceptsocket = -1;
+}
+
+//=============================================================================
+
+int UDP_OpenSocket (int port)
+{
+	int newsocket;
+	struct sockaddr_in address;
+	int _true = 1;
+
+	if ((newsocket = socket (PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+		return -1;
+
+	if (ioctl (newsocket, FIONBIO, &_true) == -1)
+		goto ErrorReturn;
+
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = myAddr;
+	address.sin_port = htons((unsigned short)port);
+	if( bind (newsocket, (void *)&address, sizeof(address)) == 0)
+	{
+		Sys_WatchSocket (newsocket);
+		return newsocket;
+	}
+
+	Sys_Error ("Unable to bind to %s", UDP_AddrToString((struct qsockaddr *)&address));
+ErrorReturn:
+	close (newsocket);
+	return -1;
+}
+
+//=============================================================================
+
+int UDP_CloseSocket (int socket)
+{
+	if (socket == net_broadcastsocket)
+		net_broadcastsocket = 0;
+	return close (socket);
+}
+
+
+//=============================================================================
+/*
+============
+PartialIPAddress
+
+this lets you type only as much of the net address as required, using
+the local network components to fill in the rest
+============
+*/
+static int PartialIPAddress (char *in, struct qsockaddr *hostaddr)
+{
+	char buff[256];
+	char *b;
+	int addr;
+	int num;
+	int mask;
+	int run;
+	int port;
+
+	buff[0] = '.';
+	b = buff;
+	strcpy(buff+1, in);
+	if (buff[1] == '.')
+		b++;
+
+	addr = 0;
+	mask=-1;
+	while (*b == '.')
+	{
+		b++;
+		num = 0;
+		run = 0;
+		while (!( *b < '0' || *b > '9'))
+		{
+		  num = num*10 + *b++ - '0';
+		  if (++run > 3)
+		  	return -1;
+		}
+		if ((*b < '0' || *b > '9') && *b != '.' && *b != ':' && *b != 0)
+			return -1;
+		if (num < 0 || num > 255)
+			return -1;
+		mask<<=8;
+		addr = (addr<<8) + num;
+	}
+
+	if (*b++ == ':')
+		port = Q_atoi(b);
+	else
+		port = net_hostport;
+
+	hostaddr->sa_family = AF_INET;
+	((struct sockaddr_in *)hostaddr)->sin_port = htons((short)port);
+	((struct sockaddr_in *)hostaddr)->sin_addr.s_addr = (myAddr & htonl(mask)) | htonl(addr);
+
+	return 0;
+}
+//=============================================================================
+
+int UDP_Connect (int socket, struct qsockaddr *addr)
+{
+	return 0;
+}
+
+//=============================================================================
+
+int UDP_CheckNewConnections (void)
+{
+	char buf[4096];
+
+	if (net_acceptsocket == -1)
+		return -1;
+
+	if (recvfrom (net_acceptsocket, buf, sizeof(buf), MSG_PEEK, NULL, NULL) > 0)
+	{
+		return net_acceptsocket;
+	}
+	return -1;
+}
+
+//=============================================================================
+
+int UDP_Read (int socket, byte *buf, int len, struct qsockaddr *addr)
+{
+	socklen_t addrlen = sizeof (struct qsockaddr);
+	int ret;
+
+	ret = recvfrom (socket, buf, len, 0, (struct sockaddr *)addr, &addrlen);
+	if (ret == -1 && (errno == EWOULDBLOCK || errno == EAGAIN || errno == ECONNREFUSED))
+		return 0;
+	return ret;
+}
+
+//=============================================================================
+
+int UDP_MakeSocketBroadcastCapable (int socket)
+{
+	int	i = 1;
+
+	// make this socket broadcast capable
+	if (setsockopt(socket, SOL_SOCKET, SO_BROADCAST, (char *)&i, sizeof(i)) < 0)
+		return -1;
+	net_broadcastsocket = socket;
+
+	return 0;
+}
+
+//=============================================================================
+
+/*
+Reads as many waiting packets as will fit in one system call.  Returns the
+number read, 0 if there were none.
+*/
+int UDP_ReadBatch (int socket, netpacket_t *packets, int count, int len)
+{
+#ifdef __linux__
+	struct mmsghdr	msgs[MAX_NETBATCH];
+	struct iovec	iov[MAX_NETBATCH];
+	int				i, ret;
+
+	if (count > MAX_NETBATCH)
+		count = MAX_NETBATCH;
+
+	memset (msgs, 0, count*sizeof(msgs[0]));
+	for (i=0 ; i<count ; i++)
+	{
+		iov[i].iov_base = packets[i].data;
+		iov[i].iov_len = len;
+		msgs[i].msg_hdr.msg_name = &packets[i].addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct qsockaddr);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = recvmmsg (socket, msgs, count, MSG_DONTWAIT, NULL);
+	if (ret == -1 && (errno == EWOULDBLOCK || errno == EAGAIN || errno == ECONNREFUSED))
+		return 0;
+
+	for (i=0 ; i<ret ; i++)
+		packets[i].length = msgs[i].msg_len;
+	return ret;
+#else
+	int		i, ret;
+
+	for (i=0 ; i<count ; i++)
+	{
+		ret = UDP_Read (socket, packets[i].data, len, &packets[i].addr);
+		if (ret == -1)
+			return i ? i : -1;
+		if (ret == 0)
+			break;
+		packets[i].length = ret;
+	}
+	return i;
+#endif
+}
+
+//=============================================================================
+
+/*
+Sends the packets with as few system calls as it can.  Packets the socket
+has no room for are dropped, as UDP_Write does.  A packet that fails is
+skipped and the rest still go, but -1 is returned.
+*/
+int UDP_WriteBatch (int socket, netpacket_t *packets, int count)
+{
+#ifdef __linux__
+	struct mmsghdr	msgs[MAX_NETBATCH];
+	struct iovec	iov[MAX_NETBATCH];
+	int				i, ret, sent, errors;
+
+	if (count > MAX_NETBATCH)
+		count = MAX_NETBATCH;
+
+	memset (msgs, 0, count*sizeof(msgs[0]));
+	for (i=0 ; i<count ; i++)
+	{
+		iov[i].iov_base = packets[i].data;
+		iov[i].iov_len = packets[i].length;
+		msgs[i].msg_hdr.msg_name = &packets[i].addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct qsockaddr);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+// sendmmsg stops at the first packet that fails
+	errors = 0;
+	for (sent = 0 ; sent < count ; sent += ret)
+	{
+		ret = sendmmsg (socket, msgs + sent, count - sent, 0);
+		if (ret == -1)
+		{
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				break;
+			errors++;
+			ret = 1;	// skip the one that failed
+		}
+	}
+	return errors ? -1 : sent;
+#else
+	int		i, errors;
+
+	errors = 0;
+	for (i=0 ; i<count ; i++)
+		if (UDP_Write (socket, packets[i].data, packets[i].length, &packets[i].addr) == -1)
+			errors++;
+	return errors ? -1 : count;
+#endif
+}
+
+//=============================================================================
+
+int UDP_Broadcast (int socket, byte *buf, int len)
+{
+	int ret;
+
+	if (socket != net_broadcastsocket)
+	{
+		if (net_broadcastsocket != 0)
+			Sys_Error("Attempted to use multiple broadcasts sockets\n");
+		UDP_GetLocalAddress();
+		ret = UDP_MakeSocketBroadcastCapable (socket);
+		if (ret == -1)
+		{
+			Con_Printf("Unable to make socket broadcast capable\n");
+			return ret;
+		}
+	}
+
+	return UDP_Write (socket, buf, len, &broadcastaddr);
+}
+
+//=============================================================================
+
+int UDP_Write (int socket, byte *buf, int len, struct qsockaddr *addr)
+{
+	int ret;
+
+	ret = sendto (socket, buf, len, 0, (struct sockaddr *)addr, sizeof(struct qsockaddr));
+	if (ret == -1 && (errno == EWOULDBLOCK || errno == EAGAIN))
+		return 0;
+
+	return ret;
+}
+
+//=============================================================================
+
+char *UDP_AddrToString (struct qsockaddr *addr)
+{
+	static char buffer[22];
+	int haddr;
+
+	haddr = ntohl(((struct sockaddr_in *)addr)->sin_addr.s_addr);
+	sprintf(buffer, "%d.%d.%d.%d:%d", (haddr >> 24) & 0xff, (haddr >> 16) & 0xff, (haddr >> 8) & 0xff, haddr & 0xff, ntohs(((struct sockaddr_in *)addr)->sin_port));
+	return buffer;
+}
+
+//=============================================================================
+
+int UDP_StringToAddr (char *string, struct qsockaddr *addr)
+{
+	int ha1, ha2, ha3, ha4, hp;
+	int ipaddr;
+
+	sscanf(string, "%d.%d.%d.%d:%d", &ha1, &ha2, &ha3, &ha4, &hp);
+	ipaddr = (ha1 << 24) | (ha2 << 16) | (ha3 << 8) | ha4;
+
+	addr->sa_family = AF_INET;
+	((struct sockaddr_in *)addr)->sin_addr.s_addr = htonl(ipaddr);
+	((struct sockaddr_in *)addr)->sin_port = htons((unsigned short)hp);
+	return 0;
+}
+
+//=============================================================================
+
+int UDP_GetSocketAddr (int socket, struct qsockaddr *addr)
+{
+	socklen_t addrlen = sizeof(struct qsockaddr);
+	unsigned int a;
+
+	Q_memset(addr, 0, sizeof(struct qsockaddr));
+	getsockname(socket, (struct sockaddr *)addr, &addrlen);
+	a = ((struct sockaddr_in *)addr)->sin_addr.s_addr;
+	if (a == 0 || a == inet_addr("127.0.0.1"))
+		((struct sockaddr_in *)addr)->sin_addr.s_addr = myAddr;
+
+	return 0;
+}
+
+//=============================================================================
+
+int UDP_GetNameFromAddr (struct qsockaddr *addr, char *name)
+{
+	struct hostent *hostentry;
+
+	hostentry = gethostbyaddr ((char *)&((struct sockaddr_in *)addr)->sin_addr, sizeof(struct in_addr), AF_INET);
+	if (hostentry)
+	{
+		Q_strncpy (name, (char *)hostentry->h_name, NET_NAMELEN - 1);
+		return 0;
+	}
+
+	Q_strcpy (name, UDP_AddrToString (addr));
+	return 0;
+}
+
+//=============================================================================
+
+int UDP_GetAddrFromName(char *name, struct qsockaddr *addr)
+{
+	struct hostent *hostentry;
+
+	if (name[0] >= '0' && name[0] <= '9')
+		return PartialIPAddress (name, addr);
+
+	hostentry = gethostbyname (name);
+	if (!hostentry)
+		return -1;
+
+	addr->sa_family = AF_INET;
+	((struct sockaddr_in *)addr)->sin_port = htons((unsigned short)net_hostport);
+	((struct sockaddr_in *)addr)->sin_addr.s_addr = *(int *)hostentry->h_addr_list[0];
+
+	return 0;
+}
+
+//=============================================================================
+
+int UDP_AddrCompare (struct qsockaddr *addr1, struct qsockaddr *addr2)
+{
+	if (addr1->sa_family != addr2->sa_family)
+		return -1;
+
+	if (((struct sockaddr_in *)addr1)->sin_addr.s_addr != ((struct sockaddr_in *)addr2)->sin_addr.s_addr)
+		return -1;
+
+	if (((struct sockaddr_in *)addr1)->sin_port != ((struct sockaddr_in *)addr2)->sin_port)
+		return 1;
+
+	return 0;
+}
+
+//=============================================================================
+
+int UDP_GetSocketPort (struct qsockaddr *addr)
+{
+	return ntohs(((struct sockaddr_in *)addr)->sin_port);
+}
+
+
+int UDP_SetSocketPort (struct qsockaddr *addr, int port)
+{
+	((struct sockaddr_in *)addr)->sin_port = htons((unsigned short)port);
+	return 0;
+}
+
+//=============================================================================
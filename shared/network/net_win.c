@@ -38,7 +38,8 @@ net_driver_t net_drivers[MAX_NET_DRIVERS] =
 	Loop_CanSendMessage,
 	Loop_CanSendUnreliableMessage,
 	Loop_Close,
-	Loop_Shutdown
+	Loop_Shutdown,
+	NULL
 	}
 	,
 	{
@@ -55,7 +56,8 @@ net_driver_t net_drivers[MAX_NET_DRIVERS] =
 	Datagram_CanSendMessage,
 	Datagram_CanSendUnreliableMessage,
 	Datagram_Close,
-	Datagram_Shutdown
+	Datagram_Shutdown,
+	Datagram_Flush
 	}
 };
 
@@ -87,7 +89,9 @@ net_landriver_t	net_landrivers[MAX_NET_DRIVERS] =
 	WINS_GetAddrFromName,
 	WINS_AddrCompare,
 	WINS_GetSocketPort,
-	WINS_SetSocketPort
+	WINS_SetSocketPort,
+	NULL,
+	NULL
 	}
 };
 
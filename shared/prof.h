@@ -0,0 +1,33 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// prof.h -- scoped server frame profiler
+
+// scopes are only recorded while host_profile is set, so an idle
+// PROF_BEGIN / PROF_END pair costs a single test of prof_active
+
+extern	qboolean	prof_active;
+
+void Prof_Init (void);
+void Prof_Frame (void);
+void Prof_Begin (char *name);
+void Prof_End (void);
+
+#define PROF_BEGIN(name)	do { if (prof_active) Prof_Begin (name); } while (0)
+#define PROF_END()			do { if (prof_active) Prof_End (); } while (0)
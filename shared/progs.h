@@ -32,6 +32,7 @@ typedef union eval_s
 } eval_t;	
 
 #define	MAX_ENT_LEAFS	16
+#define	NUM_FIND_FIELDS	3		// classname, targetname and target are indexed for PF_Find
 typedef struct edict_s
 {
 	qboolean	free;
@@ -43,6 +44,9 @@ typedef struct edict_s
 	entity_state_t	baseline;
 	
 	float		freetime;			// sv.time when the object was freed
+	link_t		findlinks[NUM_FIND_FIELDS];	// in the find index, NULL if not
+	link_t		*findheads[NUM_FIND_FIELDS];	// the list each findlink is in
+	link_t		freelink;			// in sv.free_edicts while free
 	entvars_t	v;					// C exported fields from progs
 // other fields from progs come immediately after
 } edict_t;
@@ -67,11 +71,18 @@ void PR_Init (void);
 
 void PR_ExecuteProgram (func_t fnum);
 void PR_LoadProgs (void);
+void PR_DecodeProgs (void);
+int PR_ExecuteFrame (int s, int exitdepth, int runaway);
+int PR_EnterFunction (dfunction_t *f);
+int PR_LeaveFunction (void);
 
 void PR_Profile_f (void);
 
 edict_t *ED_Alloc (void);
 void ED_Free (edict_t *ed);
+void ED_InitEdicts (void);
+qboolean ED_Grow (int count);
+void ED_RebuildFreeList (void);
 
 char	*ED_NewString (char *string);
 // returns a copy of the string allocated from the server's string heap
@@ -85,6 +96,12 @@ void ED_ParseGlobals (char *data);
 
 void ED_LoadFromFile (char *data);
 
+void ED_UnindexEdict (edict_t *ed);
+void ED_IndexField (edict_t *ed, int ofs);
+void ED_IndexStore (int ptr);
+qboolean ED_FindString (int start, int ofs, char *s, edict_t **result);
+// the find index used by PF_Find on the commonly searched string fields
+
 //define EDICT_NUM(n) ((edict_t *)(sv.edicts+ (n)*pr_edict_size))
 //define NUM_FOR_EDICT(e) (((byte *)(e) - sv.edicts)/pr_edict_size)
 
@@ -119,16 +136,44 @@ extern int pr_numbuiltins;
 
 extern int		pr_argc;
 
+extern	char	pr_string_temp[128];
+
 extern	qboolean	pr_trace;
 extern	dfunction_t	*pr_xfunction;
 extern	int			pr_xstatement;
+extern	int			pr_depth;
 
 extern	unsigned short		pr_crc;
 
+extern	cvar_t		pr_fastexec;
+extern	cvar_t		sv_fastfindradius;
+
+//============================================================================
+
+#if defined(__x86_64__) && defined(__linux__)
+#define	PR_JIT				// native code generation in pr_jit.c
+#endif
+
+#ifdef PR_JIT
+typedef void (*prjitfunc_t) (void);
+
+extern	prjitfunc_t	*pr_jitfunctions;	// NULL if pr_jit was 0 when the progs loaded
+extern	int			pr_jitrunaway;		// runaway count handed across compiled frames
+
+extern	jmp_buf		*pr_errorjmp;		// if set, PR_RunError jumps here instead
+extern	char		pr_errormsg[1024];
+
+void PR_JitInit (void);
+void PR_JitLoadProgs (void);
+prjitfunc_t PR_JitFunction (dfunction_t *f);
+#endif
+
 void PR_RunError (char *error, ...);
 
 void ED_PrintEdicts (void);
 void ED_PrintNum (int ent);
 
+void PF_ClearCheckLeafs (void);
+
 eval_t *GetEdictFieldValue(edict_t *ed, char *field);
 
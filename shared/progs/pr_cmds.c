@@ -702,6 +702,51 @@ int PF_newcheckclient (int check)
 	return i;
 }
 
+/*
+=================
+PF_CheckLeaf
+
+Every monster calls checkclient each time it thinks and most of them are
+standing still, so remember the leaf each edict last looked from
+=================
+*/
+typedef struct
+{
+	model_t		*model;
+	vec3_t		view;
+	mleaf_t		*leaf;
+} checkleaf_t;
+
+static checkleaf_t	checkleafs[MAX_EDICTS];
+
+mleaf_t *PF_CheckLeaf (edict_t *ent, vec3_t view)
+{
+	checkleaf_t	*cl;
+
+	cl = &checkleafs[NUM_FOR_EDICT(ent)];
+	if (cl->model != sv.worldmodel || !VectorCompare (cl->view, view))
+	{
+		cl->model = sv.worldmodel;
+		VectorCopy (view, cl->view);
+		cl->leaf = Mod_PointInLeaf (view, sv.worldmodel);
+	}
+
+	return cl->leaf;
+}
+
+/*
+=================
+PF_ClearCheckLeafs
+
+Called when a map is spawned.  Reloading the same map gets the same
+model_t back, but its leafs are on the hunk again.
+=================
+*/
+void PF_ClearCheckLeafs (void)
+{
+	memset (checkleafs, 0, sizeof(checkleafs));
+}
+
 /*
 =================
 PF_checkclient
@@ -744,7 +789,7 @@ void PF_checkclient (void)
 // if current entity can't possibly see the check entity, return 0
 	self = PROG_TO_EDICT(pr_global_struct->self);
 	VectorAdd (self->v.origin, self->v.view_ofs, view);
-	leaf = Mod_PointInLeaf (view, sv.worldmodel);
+	leaf = PF_CheckLeaf (self, view);
 	l = (leaf - sv.worldmodel->leafs) - 1;
 	if ( (l<0) || !(checkpvs[l>>3] & (1<<(l&7)) ) )
 	{
@@ -846,19 +891,61 @@ Returns a chain of entities that have origins within a spherical area
 findradius (origin, radius)
 =================
 */
+static int PF_EdictCompare (const void *a, const void *b)
+{
+	if (*(edict_t **)a < *(edict_t **)b)
+		return -1;
+	return *(edict_t **)a > *(edict_t **)b;
+}
+
 void PF_findradius (void)
 {
 	edict_t	*ent, *chain;
 	float	rad;
 	float	*org;
 	vec3_t	eorg;
-	int		i, j;
+	vec3_t	mins, maxs;
+	int		i, j, count;
+	static edict_t	*list[MAX_EDICTS];
 
 	chain = (edict_t *)sv.edicts;
 	
 	org = G_VECTOR(OFS_PARM0);
 	rad = G_FLOAT(OFS_PARM1);
 
+// only linked edicts can be in the area tree, and every entity center is
+// inside its absolute box, so the box around the sphere finds them all.
+// Sorting keeps the chain in the same order as the full scan.
+	if (sv_fastfindradius.value && rad >= 0)
+	{
+		for (j=0 ; j<3 ; j++)
+		{
+			mins[j] = org[j] - rad;
+			maxs[j] = org[j] + rad;
+		}
+		count = SV_AreaEdicts (mins, maxs, list, MAX_EDICTS);
+		qsort (list, count, sizeof(list[0]), PF_EdictCompare);
+
+		for (i=0 ; i<count ; i++)
+		{
+			ent = list[i];
+			if (ent->free)
+				continue;
+			if (ent->v.solid == SOLID_NOT)
+				continue;
+			for (j=0 ; j<3 ; j++)
+				eorg[j] = org[j] - (ent->v.origin[j] + (ent->v.mins[j] + ent->v.maxs[j])*0.5);			
+			if (Length(eorg) > rad)
+				continue;
+
+			ent->v.chain = EDICT_TO_PROG(chain);
+			chain = ent;
+		}
+
+		RETURN_EDICT(chain);
+		return;
+	}
+
 	ent = NEXT_EDICT(sv.edicts);
 	for (i=1 ; i<sv.num_edicts ; i++, ent = NEXT_EDICT(ent))
 	{
@@ -945,6 +1032,12 @@ void PF_Find (void)
 	s = G_STRING(OFS_PARM2);
 	if (!s)
 		PR_RunError ("PF_Find: bad search string");
+
+	if (ED_FindString (e, f, s, &ed))
+	{
+		RETURN_EDICT(ed);
+		return;
+	}
 		
 	for (e++ ; e < sv.num_edicts ; e++)
 	{
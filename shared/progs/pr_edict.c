@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // sv_edict.c -- entity dictionary
 
 #include "quakedef.h"
+#include <stddef.h>
 
 dprograms_t		*progs;
 dfunction_t		*pr_functions;
@@ -49,16 +50,46 @@ cvar_t	saved1 = {"saved1", "0", true};
 cvar_t	saved2 = {"saved2", "0", true};
 cvar_t	saved3 = {"saved3", "0", true};
 cvar_t	saved4 = {"saved4", "0", true};
+cvar_t	sv_fastfindradius = {"sv_fastfindradius", "1"};	// 0 = scan every edict
 
-#define	MAX_FIELD_LEN	64
-#define GEFV_CACHESIZE	2
+#define	NAMEHASH_SIZE	1024	// must be a power of two
 
-typedef struct {
-	ddef_t	*pcache;
-	char	field[MAX_FIELD_LEN];
-} gefv_cache;
+// name lookups for ED_FindField, ED_FindGlobal and ED_FindFunction,
+// chained through the def/function index
+static int	fieldhash[NAMEHASH_SIZE], *fieldchain;
+static int	globalhash[NAMEHASH_SIZE], *globalchain;
+static int	functionhash[NAMEHASH_SIZE], *functionchain;
 
-static gefv_cache	gefvCache[GEFV_CACHESIZE] = {{NULL, ""}, {NULL, ""}};
+/*
+
+The find index keeps, for each of a few commonly searched string fields, a
+list of the edicts holding each distinct string value, sorted by edict
+number.  Strings are interned by contents, since the same text can live at
+many string_t offsets.  Lists are updated whenever one of the fields is
+stored by the VM or parsed, and every match is still compared against the
+live field, so an edict left behind by some other write is only skipped.
+
+*/
+
+#define	MAX_FIND_STRINGS	2048
+#define	FIND_STRINGSPACE	32768
+
+typedef struct findstring_s
+{
+	struct findstring_s	*hashnext;
+	link_t				edicts[NUM_FIND_FIELDS];
+	char				*string;
+} findstring_t;
+
+static int			findfields[NUM_FIND_FIELDS];
+static findstring_t	*findhash[NAMEHASH_SIZE];
+static findstring_t	*findstrings;
+static int			numfindstrings;
+static char			*findspace;
+static int			findspaceused;
+static qboolean		findvalid;		// cleared if the index overflows
+
+#define	EDICT_FROM_FINDLINK(l,i)	((edict_t *)((byte *)(l) - offsetof(edict_t, findlinks[i])))
 
 /*
 =================
@@ -69,10 +100,112 @@ Sets everything to NULL
 */
 void ED_ClearEdict (edict_t *e)
 {
+	ED_UnindexEdict (e);
 	memset (&e->v, 0, progs->entityfields * 4);
 	e->free = false;
 }
 
+/*
+===============================================================================
+
+EDICT STORE
+
+Address space for MAX_EDICTS is reserved when the progs are loaded, so edict
+pointers and the VM's edict offsets stay good as the store grows.  Memory is
+only committed as far as sv.max_edicts.
+
+===============================================================================
+*/
+
+static void		*ed_reserved;
+static int		ed_reservedsize;
+
+#define	EDICT_FROM_FREELINK(l)	STRUCT_FROM_LINK(l,edict_t,freelink)
+
+/*
+=================
+ED_InitEdicts
+
+Called by SV_SpawnServer after PR_LoadProgs has set pr_edict_size
+=================
+*/
+void ED_InitEdicts (void)
+{
+	if (ed_reserved)
+		Sys_ReleaseMemory (ed_reserved, ed_reservedsize);
+
+	ed_reservedsize = MAX_EDICTS * pr_edict_size;
+	ed_reserved = Sys_ReserveMemory (ed_reservedsize);
+	if (!ed_reserved)
+		Sys_Error ("ED_InitEdicts: couldn't reserve %i bytes", ed_reservedsize);
+
+	sv.edicts = ed_reserved;
+	sv.max_edicts = 0;
+	ED_Grow (MIN_EDICTS);
+
+	ClearLink (&sv.free_edicts);
+}
+
+/*
+=================
+ED_Grow
+
+Makes room for at least count edicts, doubling the store each time.
+Returns false if that is more than MAX_EDICTS
+=================
+*/
+qboolean ED_Grow (int count)
+{
+	int		newmax;
+
+	if (count <= sv.max_edicts)
+		return true;
+	if (count > MAX_EDICTS)
+		return false;
+
+	newmax = sv.max_edicts ? sv.max_edicts : MIN_EDICTS;
+	while (newmax < count)
+		newmax *= 2;
+	if (newmax > MAX_EDICTS)
+		newmax = MAX_EDICTS;
+
+	Sys_CommitMemory (sv.edicts, newmax * pr_edict_size);
+	if (sv.max_edicts)
+		Con_DPrintf ("edicts grown to %i\n", newmax);
+	sv.max_edicts = newmax;
+
+	return true;
+}
+
+/*
+=================
+ED_RebuildFreeList
+
+Loading a game sets free edicts directly, so the queue is put back
+together from scratch, in freetime order
+=================
+*/
+void ED_RebuildFreeList (void)
+{
+	int		i;
+	edict_t	*e;
+	link_t	*l;
+
+	ClearLink (&sv.free_edicts);
+	for (i=0 ; i<sv.max_edicts ; i++)
+	{
+		e = EDICT_NUM(i);
+		e->freelink.prev = e->freelink.next = NULL;
+		if (i <= svs.maxclients || i >= sv.num_edicts || !e->free)
+			continue;
+
+		for (l = sv.free_edicts.prev ; l != &sv.free_edicts ; l = l->prev)
+			if (EDICT_FROM_FREELINK(l)->freetime <= e->freetime)
+				break;
+		InsertLinkAfter (&e->freelink, l);
+	}
+}
+
 /*
 =================
 ED_Alloc
@@ -82,30 +215,41 @@ Try to avoid reusing an entity that was recently freed, because it
 can cause the client to think the entity morphed into something else
 instead of being removed and recreated, which can cause interpolated
 angles and bad trails.
+
+Free edicts wait in sv.free_edicts in the order they were freed, so if the
+oldest can't be reused yet none of them can.
 =================
 */
 edict_t *ED_Alloc (void)
 {
-	int			i;
+	link_t		*l;
 	edict_t		*e;
 
-	for ( i=svs.maxclients+1 ; i<sv.num_edicts ; i++)
+	while ((l = sv.free_edicts.next) != &sv.free_edicts)
 	{
-		e = EDICT_NUM(i);
+		e = EDICT_FROM_FREELINK(l);
+
 		// the first couple seconds of server time can involve a lot of
 		// freeing and allocating, so relax the replacement policy
-		if (e->free && ( e->freetime < 2 || sv.time - e->freetime > 0.5 ) )
+		if (e->free && e->freetime >= 2 && sv.time - e->freetime <= 0.5)
+			break;
+
+		RemoveLink (l);
+		l->prev = l->next = NULL;
+
+		// client slots are never handed out
+		if (e->free && (byte *)e > (byte *)sv.edicts + svs.maxclients*pr_edict_size)
 		{
 			ED_ClearEdict (e);
 			return e;
 		}
 	}
-	
-	if (i == MAX_EDICTS)
+
+	if (!ED_Grow (sv.num_edicts + 1))
 		Sys_Error ("ED_Alloc: no free edicts");
-		
+
+	e = EDICT_NUM(sv.num_edicts);
 	sv.num_edicts++;
-	e = EDICT_NUM(i);
 	ED_ClearEdict (e);
 
 	return e;
@@ -136,6 +280,11 @@ void ED_Free (edict_t *ed)
 	ed->v.solid = 0;
 	
 	ed->freetime = sv.time;
+
+// queued behind everything freed earlier
+	if (ed->freelink.next)
+		RemoveLink (&ed->freelink);
+	InsertLinkBefore (&ed->freelink, &sv.free_edicts);
 }
 
 //===========================================================================
@@ -178,6 +327,46 @@ ddef_t *ED_FieldAtOfs (int ofs)
 	return NULL;
 }
 
+/*
+============
+ED_HashName
+============
+*/
+static int ED_HashName (char *name)
+{
+	unsigned	hash;
+
+	hash = 0;
+	while (*name)
+		hash = hash * 33 + *(byte *)name++;
+
+	return hash & (NAMEHASH_SIZE - 1);
+}
+
+/*
+============
+ED_BuildNameHash
+
+Chains are built back to front so the first of several defs with the same
+name is found first, as the old linear scans did
+============
+*/
+static void ED_BuildNameHash (int *hash, int **chain, int count, int stride, int *names, char *label)
+{
+	int		i, h;
+
+	*chain = Hunk_AllocName (count * sizeof(int), label);
+	for (i=0 ; i<NAMEHASH_SIZE ; i++)
+		hash[i] = -1;
+
+	for (i=count-1 ; i>=0 ; i--)
+	{
+		h = ED_HashName (pr_strings + *(int *)((byte *)names + i*stride));
+		(*chain)[i] = hash[h];
+		hash[h] = i;
+	}
+}
+
 /*
 ============
 ED_FindField
@@ -188,7 +377,7 @@ ddef_t *ED_FindField (char *name)
 	ddef_t		*def;
 	int			i;
 	
-	for (i=0 ; i<progs->numfielddefs ; i++)
+	for (i=fieldhash[ED_HashName(name)] ; i != -1 ; i=fieldchain[i])
 	{
 		def = &pr_fielddefs[i];
 		if (!strcmp(pr_strings + def->s_name,name) )
@@ -208,7 +397,7 @@ ddef_t *ED_FindGlobal (char *name)
 	ddef_t		*def;
 	int			i;
 	
-	for (i=0 ; i<progs->numglobaldefs ; i++)
+	for (i=globalhash[ED_HashName(name)] ; i != -1 ; i=globalchain[i])
 	{
 		def = &pr_globaldefs[i];
 		if (!strcmp(pr_strings + def->s_name,name) )
@@ -228,7 +417,7 @@ dfunction_t *ED_FindFunction (char *name)
 	dfunction_t		*func;
 	int				i;
 	
-	for (i=0 ; i<progs->numfunctions ; i++)
+	for (i=functionhash[ED_HashName(name)] ; i != -1 ; i=functionchain[i])
 	{
 		func = &pr_functions[i];
 		if (!strcmp(pr_strings + func->s_name,name) )
@@ -240,33 +429,235 @@ dfunction_t *ED_FindFunction (char *name)
 
 eval_t *GetEdictFieldValue(edict_t *ed, char *field)
 {
-	ddef_t			*def = NULL;
-	int				i;
-	static int		rep = 0;
+	ddef_t			*def;
+
+	def = ED_FindField (field);
+	if (!def)
+		return NULL;
+
+	return (eval_t *)((char *)&ed->v + def->ofs*4);
+}
+
+/*
+============================================================================
+
+FIND INDEX
+
+============================================================================
+*/
+
+/*
+============
+ED_InitFindIndex
 
-	for (i=0 ; i<GEFV_CACHESIZE ; i++)
+Called from PR_LoadProgs, so the index lives as long as the progs
+============
+*/
+static void ED_InitFindIndex (void)
+{
+	findfields[0] = offsetof(entvars_t, classname) / 4;
+	findfields[1] = offsetof(entvars_t, targetname) / 4;
+	findfields[2] = offsetof(entvars_t, target) / 4;
+
+	memset (findhash, 0, sizeof(findhash));
+	findstrings = Hunk_AllocName (MAX_FIND_STRINGS * sizeof(findstring_t), "findstr");
+	findspace = Hunk_AllocName (FIND_STRINGSPACE, "findspc");
+	numfindstrings = 0;
+	findspaceused = 0;
+	findvalid = true;
+}
+
+/*
+============
+ED_FindSlot
+
+Returns the index slot for a field offset, or -1 if it isn't indexed
+============
+*/
+static int ED_FindSlot (int ofs)
+{
+	int		i;
+
+	for (i=0 ; i<NUM_FIND_FIELDS ; i++)
+		if (findfields[i] == ofs)
+			return i;
+	return -1;
+}
+
+/*
+============
+ED_InternString
+
+Returns the interned copy of string, adding it if create is set
+============
+*/
+static findstring_t *ED_InternString (char *string, qboolean create)
+{
+	findstring_t	*fs;
+	int				h, i, len;
+
+	h = ED_HashName (string);
+	for (fs = findhash[h] ; fs ; fs = fs->hashnext)
+		if (!strcmp (fs->string, string))
+			return fs;
+
+	if (!create)
+		return NULL;
+
+	len = strlen (string) + 1;
+	if (numfindstrings == MAX_FIND_STRINGS || findspaceused + len > FIND_STRINGSPACE)
 	{
-		if (!strcmp(field, gefvCache[i].field))
-		{
-			def = gefvCache[i].pcache;
-			goto Done;
-		}
+		Con_DPrintf ("find index full, falling back to linear searches\n");
+		findvalid = false;
+		return NULL;
 	}
 
-	def = ED_FindField (field);
+	fs = &findstrings[numfindstrings++];
+	fs->string = findspace + findspaceused;
+	memcpy (fs->string, string, len);
+	findspaceused += len;
+	for (i=0 ; i<NUM_FIND_FIELDS ; i++)
+		ClearLink (&fs->edicts[i]);
+
+	fs->hashnext = findhash[h];
+	findhash[h] = fs;
+
+	return fs;
+}
+
+/*
+============
+ED_UnindexEdict
 
-	if (strlen(field) < MAX_FIELD_LEN)
+Takes an edict out of all the find lists, before its fields are cleared
+============
+*/
+void ED_UnindexEdict (edict_t *ed)
+{
+	int		i;
+
+	for (i=0 ; i<NUM_FIND_FIELDS ; i++)
 	{
-		gefvCache[rep].pcache = def;
-		strcpy (gefvCache[rep].field, field);
-		rep ^= 1;
+		if (!ed->findlinks[i].next)
+			continue;
+		RemoveLink (&ed->findlinks[i]);
+		ed->findlinks[i].prev = ed->findlinks[i].next = NULL;
+		ed->findheads[i] = NULL;
 	}
+}
 
-Done:
-	if (!def)
-		return NULL;
+/*
+============
+ED_IndexField
 
-	return (eval_t *)((char *)&ed->v + def->ofs*4);
+Called after the string field at ofs has been changed on ed
+============
+*/
+void ED_IndexField (edict_t *ed, int ofs)
+{
+	int				slot;
+	char			*string;
+	findstring_t	*fs;
+	link_t			*l, *head;
+
+	slot = ED_FindSlot (ofs);
+	if (slot < 0 || !findvalid)
+		return;
+
+	if (ed->findlinks[slot].next)
+	{
+		RemoveLink (&ed->findlinks[slot]);
+		ed->findlinks[slot].prev = ed->findlinks[slot].next = NULL;
+		ed->findheads[slot] = NULL;
+	}
+
+	if (!E_INT(ed, ofs))
+		return;
+
+	string = E_STRING(ed, ofs);
+	if (string >= pr_string_temp && string < pr_string_temp + sizeof(pr_string_temp))
+	{	// the text will change under us
+		Con_DPrintf ("find index disabled by a temp string\n");
+		findvalid = false;
+		return;
+	}
+
+	fs = ED_InternString (string, true);
+	if (!fs)
+		return;
+
+// keep the list in edict order, new edicts usually go at the end
+	head = &fs->edicts[slot];
+	for (l = head->prev ; l != head ; l = l->prev)
+		if (EDICT_FROM_FINDLINK(l, slot) < ed)
+			break;
+	InsertLinkAfter (&ed->findlinks[slot], l);
+	ed->findheads[slot] = head;
+}
+
+/*
+============
+ED_IndexStore
+
+Called by the VM after a string is stored through an entity field pointer
+============
+*/
+void ED_IndexStore (int ptr)
+{
+	int		e, ofs;
+
+	e = ptr / pr_edict_size;
+	ofs = (ptr - e*pr_edict_size - (int)offsetof(edict_t, v)) / 4;
+	ED_IndexField (EDICT_NUM(e), ofs);
+}
+
+/*
+============
+ED_FindString
+
+Looks for the first edict after start with the string s in field ofs.
+Returns false if the field isn't indexed, so the caller has to search.
+============
+*/
+qboolean ED_FindString (int start, int ofs, char *s, edict_t **result)
+{
+	int				slot;
+	findstring_t	*fs;
+	link_t			*l, *head;
+	edict_t			*ed, *startent;
+
+	slot = ED_FindSlot (ofs);
+	if (slot < 0 || !findvalid)
+		return false;
+
+	*result = sv.edicts;
+
+	fs = ED_InternString (s, false);
+	if (!fs)
+		return true;
+
+	startent = EDICT_NUM(start);
+	head = &fs->edicts[slot];
+
+// inside a find loop start is the last match, which is in this list, so
+// carry on from it instead of skipping everything before it again
+	if (startent->findheads[slot] == head)
+		l = startent->findlinks[slot].next;
+	else
+		l = head->next;
+
+	for ( ; l != head ; l = l->next)
+	{
+		ed = EDICT_FROM_FINDLINK(l, slot);
+		if (ed <= startent || ed->free)
+			continue;
+		if (!E_INT(ed, ofs) || strcmp (E_STRING(ed, ofs), s))
+			continue;	// changed by something that didn't reindex it
+		*result = ed;
+		break;
+	}
+
+	return true;
 }
 
 
@@ -811,7 +1202,10 @@ char *ED_ParseEdict (char *data, edict_t *ent)
 
 // clear it
 	if (ent != sv.edicts)	// hack
+	{
+		ED_UnindexEdict (ent);
 		memset (&ent->v, 0, progs->entityfields * 4);
+	}
 
 // go through all the dictionary pairs
 	while (1)
@@ -878,6 +1272,8 @@ sprintf (com_token, "0 %s 0", temp);
 
 		if (!ED_ParseEpair ((void *)&ent->v, key, com_token))
 			Host_Error ("ED_ParseEdict: parse error");
+		if ((key->type & ~DEF_SAVEGLOBAL) == ev_string)
+			ED_IndexField (ent, key->ofs);
 	}
 
 	if (!init)
@@ -985,20 +1381,48 @@ PR_LoadProgs
 void PR_LoadProgs (void)
 {
 	int		i;
-
-// flush the non-C variable lookup cache
-	for (i=0 ; i<GEFV_CACHESIZE ; i++)
-		gefvCache[i].field[0] = 0;
+	byte	*mapped;
+	int		ofs, skip, *lump;
 
 	CRC_Init (&pr_crc);
 
-	progs = (dprograms_t *)COM_LoadHunkFile ("progs.dat");
-	if (!progs)
-		Sys_Error ("PR_LoadProgs: couldn't load progs.dat");
-	Con_DPrintf ("Programs occupy %iK.\n", com_filesize/1024);
+// the statements are never written to, so if progs.dat is in a mapped pak
+// they are run from the mapping and only the rest is copied to the hunk
+	mapped = bigendien ? NULL : COM_MapFile ("progs.dat");
+	if (mapped)
+	{
+		ofs = ((dprograms_t *)mapped)->ofs_statements;
+		skip = ((dprograms_t *)mapped)->numstatements * sizeof(dstatement_t);
+		if (com_filesize < sizeof(dprograms_t) || ofs < sizeof(dprograms_t)
+		|| skip < 0 || ofs + skip > com_filesize)
+			mapped = NULL;
+	}
 
-	for (i=0 ; i<com_filesize ; i++)
-		CRC_ProcessByte (&pr_crc, ((byte *)progs)[i]);
+	if (mapped)
+	{
+		for (i=0 ; i<com_filesize ; i++)
+			CRC_ProcessByte (&pr_crc, mapped[i]);
+
+		progs = Hunk_AllocName (com_filesize - skip, "progs");
+		memcpy (progs, mapped, ofs);
+		memcpy ((byte *)progs + ofs, mapped + ofs + skip, com_filesize - ofs - skip);
+
+	// everything after the statements moved down
+		for (lump = &progs->ofs_statements ; lump <= &progs->ofs_globals ; lump += 2)
+			if (*lump > ofs)
+				*lump -= skip;
+		Con_DPrintf ("Programs occupy %iK, %iK mapped.\n", (com_filesize - skip)/1024, skip/1024);
+	}
+	else
+	{
+		progs = (dprograms_t *)COM_LoadHunkFile ("progs.dat");
+		if (!progs)
+			Sys_Error ("PR_LoadProgs: couldn't load progs.dat");
+		Con_DPrintf ("Programs occupy %iK.\n", com_filesize/1024);
+
+		for (i=0 ; i<com_filesize ; i++)
+			CRC_ProcessByte (&pr_crc, ((byte *)progs)[i]);
+	}
 
 // byte swap the header
 	for (i=0 ; i<sizeof(*progs)/4 ; i++)
@@ -1013,7 +1437,10 @@ void PR_LoadProgs (void)
 	pr_strings = (char *)progs + progs->ofs_strings;
 	pr_globaldefs = (ddef_t *)((byte *)progs + progs->ofs_globaldefs);
 	pr_fielddefs = (ddef_t *)((byte *)progs + progs->ofs_fielddefs);
-	pr_statements = (dstatement_t *)((byte *)progs + progs->ofs_statements);
+	if (mapped)
+		pr_statements = (dstatement_t *)(mapped + progs->ofs_statements);
+	else
+		pr_statements = (dstatement_t *)((byte *)progs + progs->ofs_statements);
 
 	pr_global_struct = (globalvars_t *)((byte *)progs + progs->ofs_globals);
 	pr_globals = (float *)pr_global_struct;
@@ -1021,7 +1448,7 @@ void PR_LoadProgs (void)
 	pr_edict_size = progs->entityfields * 4 + sizeof (edict_t) - sizeof(entvars_t);
 	
 // byte swap the lumps
-	for (i=0 ; i<progs->numstatements ; i++)
+	for (i=0 ; !mapped && i<progs->numstatements ; i++)
 	{
 		pr_statements[i].op = LittleShort(pr_statements[i].op);
 		pr_statements[i].a = LittleShort(pr_statements[i].a);
@@ -1057,6 +1484,16 @@ void PR_LoadProgs (void)
 
 	for (i=0 ; i<progs->numglobals ; i++)
 		((int *)pr_globals)[i] = LittleLong (((int *)pr_globals)[i]);
+
+	ED_BuildNameHash (fieldhash, &fieldchain, progs->numfielddefs, sizeof(ddef_t), &pr_fielddefs[0].s_name, "fieldhsh");
+	ED_BuildNameHash (globalhash, &globalchain, progs->numglobaldefs, sizeof(ddef_t), &pr_globaldefs[0].s_name, "globhsh");
+	ED_BuildNameHash (functionhash, &functionchain, progs->numfunctions, sizeof(dfunction_t), &pr_functions[0].s_name, "funchsh");
+	ED_InitFindIndex ();
+
+	PR_DecodeProgs ();
+#ifdef PR_JIT
+	PR_JitLoadProgs ();
+#endif
 }
 
 
@@ -1082,6 +1519,11 @@ void PR_Init (void)
 	Cvar_RegisterVariable (&saved2);
 	Cvar_RegisterVariable (&saved3);
 	Cvar_RegisterVariable (&saved4);
+	Cvar_RegisterVariable (&pr_fastexec);
+	Cvar_RegisterVariable (&sv_fastfindradius);
+#ifdef PR_JIT
+	PR_JitInit ();
+#endif
 }
 
 
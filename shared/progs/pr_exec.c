@@ -44,6 +44,11 @@ qboolean	pr_trace;
 dfunction_t	*pr_xfunction;
 int			pr_xstatement;
 
+#ifdef PR_JIT
+jmp_buf		*pr_errorjmp;		// pr_jitcheck catches program errors itself
+char		pr_errormsg[1024];
+#endif
+
 
 int		pr_argc;
 
@@ -267,6 +272,14 @@ void PR_RunError (char *error, ...)
 	vsprintf (string,error,argptr);
 	va_end (argptr);
 
+#ifdef PR_JIT
+	if (pr_errorjmp)
+	{
+		strcpy (pr_errormsg, string);
+		longjmp (*pr_errorjmp, 1);
+	}
+#endif
+
 	PR_PrintStatement (pr_statements + pr_xstatement);
 	PR_StackTrace ();
 	Con_Printf ("%s\n", string);
@@ -355,38 +368,25 @@ int PR_LeaveFunction (void)
 
 /*
 ====================
-PR_ExecuteProgram
+PR_ExecuteClassic
+
+The original statement at a time interpreter.  Used when tracing, when
+pr_fastexec is 0, and to finish off a decoded run that turned tracing on.
+Returns the remaining runaway count.
 ====================
 */
-void PR_ExecuteProgram (func_t fnum)
+static int PR_ExecuteClassic (int s, int exitdepth, int runaway)
 {
 	eval_t	*a, *b, *c;
-	int			s;
 	dstatement_t	*st;
-	dfunction_t	*f, *newf;
-	int		runaway;
+	dfunction_t	*newf;
 	int		i;
 	edict_t	*ed;
-	int		exitdepth;
 	eval_t	*ptr;
+#ifdef PR_JIT
+	prjitfunc_t	jitf;
+#endif
 
-	if (!fnum || fnum >= progs->numfunctions)
-	{
-		if (pr_global_struct->self)
-			ED_Print (PROG_TO_EDICT(pr_global_struct->self));
-		Host_Error ("PR_ExecuteProgram: NULL function");
-	}
-	
-	f = &pr_functions[fnum];
-
-	runaway = 100000;
-	pr_trace = false;
-
-// make a stack frame
-	exitdepth = pr_depth;
-
-	s = PR_EnterFunction (f);
-	
 while (1)
 {
 	s++;	// next statement
@@ -396,11 +396,11 @@ while (1)
 	b = (eval_t *)&pr_globals[st->b];
 	c = (eval_t *)&pr_globals[st->c];
 	
+	pr_xstatement = s;
 	if (!--runaway)
 		PR_RunError ("runaway loop error");
 		
 	pr_xfunction->profile++;
-	pr_xstatement = s;
 	
 	if (pr_trace)
 		PR_PrintStatement (st);
@@ -546,11 +546,15 @@ while (1)
 	case OP_STOREP_F:
 	case OP_STOREP_ENT:
 	case OP_STOREP_FLD:		// integers
-	case OP_STOREP_S:
 	case OP_STOREP_FNC:		// pointers
 		ptr = (eval_t *)((byte *)sv.edicts + b->_int);
 		ptr->_int = a->_int;
 		break;
+	case OP_STOREP_S:
+		ptr = (eval_t *)((byte *)sv.edicts + b->_int);
+		ptr->_int = a->_int;
+		ED_IndexStore (b->_int);
+		break;
 	case OP_STOREP_V:
 		ptr = (eval_t *)((byte *)sv.edicts + b->_int);
 		ptr->vector[0] = a->vector[0];
@@ -626,6 +630,17 @@ while (1)
 			break;
 		}
 
+#ifdef PR_JIT
+		if (pr_jitfunctions && (jitf = PR_JitFunction (newf)))
+		{
+			PR_EnterFunction (newf);
+			pr_jitrunaway = runaway;
+			jitf ();
+			runaway = pr_jitrunaway;
+			break;
+		}
+#endif
+
 		s = PR_EnterFunction (newf);
 		break;
 
@@ -637,7 +652,7 @@ while (1)
 	
 		s = PR_LeaveFunction ();
 		if (pr_depth == exitdepth)
-			return;		// all done
+			return runaway;		// all done
 		break;
 		
 	case OP_STATE:
@@ -655,5 +670,512 @@ while (1)
 		PR_RunError ("Bad opcode %i", st->op);
 	}
 }
+}
+
+/*
+============================================================================
+Pre-decoded execution
+
+PR_DecodeProgs translates pr_statements into a parallel prdecoded_t stream
+when the progs are loaded, with the global operand pointers and branch
+targets already resolved.  Where the compiler supports computed goto each
+decoded statement also carries the address of its handler, so dispatch is a
+single indirect jump.  The per statement profile counter is replaced by
+charging the runaway delta to pr_xfunction whenever the function changes,
+which gives the same totals for the profile command.
+============================================================================
+*/
+
+#ifdef __GNUC__
+#define	PR_COMPUTED_GOTO
+#endif
+
+typedef struct
+{
+#ifdef PR_COMPUTED_GOTO
+	void		*handler;
+#endif
+	int			op;
+	int			branch;		// target - 1 for OP_IF, OP_IFNOT and OP_GOTO
+	eval_t		*a, *b, *c;
+} prdecoded_t;
+
+cvar_t		pr_fastexec = {"pr_fastexec", "1"};
+
+static prdecoded_t	*pr_decoded;
+
+/*
+====================
+PR_ExecuteDecoded
+
+Returns the remaining runaway count.  If thread is set, only fills in the
+handler addresses of pr_decoded.
+====================
+*/
+static int PR_ExecuteDecoded (int s, int exitdepth, int runaway, qboolean thread)
+{
+	prdecoded_t	*st;
+	dfunction_t	*newf;
+	edict_t		*ed;
+	eval_t		*ptr;
+	int			profilebase;
+	int			i;
+#ifdef PR_JIT
+	prjitfunc_t	jitf;
+#endif
+
+#ifdef PR_COMPUTED_GOTO
+	if (thread)
+	{
+		void	*handlers[OP_BITOR+1];
+
+		for (i=0 ; i<=OP_BITOR ; i++)
+			handlers[i] = &&op_BAD;
+
+#define	THREAD(x)	handlers[OP_##x] = &&op_##x
+		THREAD(DONE); THREAD(RETURN);
+		THREAD(MUL_F); THREAD(MUL_V); THREAD(MUL_FV); THREAD(MUL_VF); THREAD(DIV_F);
+		THREAD(ADD_F); THREAD(ADD_V); THREAD(SUB_F); THREAD(SUB_V);
+		THREAD(EQ_F); THREAD(EQ_V); THREAD(EQ_S); THREAD(EQ_E); THREAD(EQ_FNC);
+		THREAD(NE_F); THREAD(NE_V); THREAD(NE_S); THREAD(NE_E); THREAD(NE_FNC);
+		THREAD(LE); THREAD(GE); THREAD(LT); THREAD(GT);
+		THREAD(LOAD_F); THREAD(LOAD_V); THREAD(LOAD_S); THREAD(LOAD_ENT); THREAD(LOAD_FLD); THREAD(LOAD_FNC);
+		THREAD(ADDRESS);
+		THREAD(STORE_F); THREAD(STORE_V); THREAD(STORE_S); THREAD(STORE_ENT); THREAD(STORE_FLD); THREAD(STORE_FNC);
+		THREAD(STOREP_F); THREAD(STOREP_V); THREAD(STOREP_S); THREAD(STOREP_ENT); THREAD(STOREP_FLD); THREAD(STOREP_FNC);
+		THREAD(NOT_F); THREAD(NOT_V); THREAD(NOT_S); THREAD(NOT_ENT); THREAD(NOT_FNC);
+		THREAD(IF); THREAD(IFNOT); THREAD(GOTO);
+		THREAD(CALL0); THREAD(CALL1); THREAD(CALL2); THREAD(CALL3); THREAD(CALL4);
+		THREAD(CALL5); THREAD(CALL6); THREAD(CALL7); THREAD(CALL8);
+		THREAD(STATE); THREAD(AND); THREAD(OR); THREAD(BITAND); THREAD(BITOR);
+#undef THREAD
+
+		for (i=0 ; i<progs->numstatements ; i++)
+		{
+			if ((unsigned)pr_decoded[i].op <= OP_BITOR)
+				pr_decoded[i].handler = handlers[pr_decoded[i].op];
+			else
+				pr_decoded[i].handler = &&op_BAD;
+		}
+		return 0;
+	}
+
+#define	OPCODE(x)	op_##x:
+#define	NEXT		if (!--runaway) goto runaway_error; st++; goto *st->handler
+#else
+#define	OPCODE(x)	case OP_##x:
+#define	NEXT		continue
+#endif
+
+// charge the statements run since the last switch to the current function
+#define	FLUSHPROFILE	pr_xfunction->profile += profilebase - runaway; profilebase = runaway
+#define	SYNCSTATEMENT	pr_xstatement = st - pr_decoded; FLUSHPROFILE
+
+	profilebase = runaway;
+	st = pr_decoded + s;
+
+#ifdef PR_COMPUTED_GOTO
+	NEXT;
+#else
+while (1)
+{
+	if (!--runaway)
+		goto runaway_error;
+	st++;
+
+	switch (st->op)
+	{
+#endif
+	OPCODE(ADD_F)
+		st->c->_float = st->a->_float + st->b->_float;
+		NEXT;
+	OPCODE(ADD_V)
+		st->c->vector[0] = st->a->vector[0] + st->b->vector[0];
+		st->c->vector[1] = st->a->vector[1] + st->b->vector[1];
+		st->c->vector[2] = st->a->vector[2] + st->b->vector[2];
+		NEXT;
+
+	OPCODE(SUB_F)
+		st->c->_float = st->a->_float - st->b->_float;
+		NEXT;
+	OPCODE(SUB_V)
+		st->c->vector[0] = st->a->vector[0] - st->b->vector[0];
+		st->c->vector[1] = st->a->vector[1] - st->b->vector[1];
+		st->c->vector[2] = st->a->vector[2] - st->b->vector[2];
+		NEXT;
+
+	OPCODE(MUL_F)
+		st->c->_float = st->a->_float * st->b->_float;
+		NEXT;
+	OPCODE(MUL_V)
+		st->c->_float = st->a->vector[0]*st->b->vector[0]
+				+ st->a->vector[1]*st->b->vector[1]
+				+ st->a->vector[2]*st->b->vector[2];
+		NEXT;
+	OPCODE(MUL_FV)
+		st->c->vector[0] = st->a->_float * st->b->vector[0];
+		st->c->vector[1] = st->a->_float * st->b->vector[1];
+		st->c->vector[2] = st->a->_float * st->b->vector[2];
+		NEXT;
+	OPCODE(MUL_VF)
+		st->c->vector[0] = st->b->_float * st->a->vector[0];
+		st->c->vector[1] = st->b->_float * st->a->vector[1];
+		st->c->vector[2] = st->b->_float * st->a->vector[2];
+		NEXT;
+
+	OPCODE(DIV_F)
+		st->c->_float = st->a->_float / st->b->_float;
+		NEXT;
+
+	OPCODE(BITAND)
+		st->c->_float = (int)st->a->_float & (int)st->b->_float;
+		NEXT;
+
+	OPCODE(BITOR)
+		st->c->_float = (int)st->a->_float | (int)st->b->_float;
+		NEXT;
+
+	OPCODE(GE)
+		st->c->_float = st->a->_float >= st->b->_float;
+		NEXT;
+	OPCODE(LE)
+		st->c->_float = st->a->_float <= st->b->_float;
+		NEXT;
+	OPCODE(GT)
+		st->c->_float = st->a->_float > st->b->_float;
+		NEXT;
+	OPCODE(LT)
+		st->c->_float = st->a->_float < st->b->_float;
+		NEXT;
+	OPCODE(AND)
+		st->c->_float = st->a->_float && st->b->_float;
+		NEXT;
+	OPCODE(OR)
+		st->c->_float = st->a->_float || st->b->_float;
+		NEXT;
+
+	OPCODE(NOT_F)
+		st->c->_float = !st->a->_float;
+		NEXT;
+	OPCODE(NOT_V)
+		st->c->_float = !st->a->vector[0] && !st->a->vector[1] && !st->a->vector[2];
+		NEXT;
+	OPCODE(NOT_S)
+		st->c->_float = !st->a->string || !pr_strings[st->a->string];
+		NEXT;
+	OPCODE(NOT_FNC)
+		st->c->_float = !st->a->function;
+		NEXT;
+	OPCODE(NOT_ENT)
+		st->c->_float = (PROG_TO_EDICT(st->a->edict) == sv.edicts);
+		NEXT;
+
+	OPCODE(EQ_F)
+		st->c->_float = st->a->_float == st->b->_float;
+		NEXT;
+	OPCODE(EQ_V)
+		st->c->_float = (st->a->vector[0] == st->b->vector[0]) &&
+					(st->a->vector[1] == st->b->vector[1]) &&
+					(st->a->vector[2] == st->b->vector[2]);
+		NEXT;
+	OPCODE(EQ_S)
+		st->c->_float = !strcmp(pr_strings+st->a->string,pr_strings+st->b->string);
+		NEXT;
+	OPCODE(EQ_E)
+		st->c->_float = st->a->_int == st->b->_int;
+		NEXT;
+	OPCODE(EQ_FNC)
+		st->c->_float = st->a->function == st->b->function;
+		NEXT;
+
+	OPCODE(NE_F)
+		st->c->_float = st->a->_float != st->b->_float;
+		NEXT;
+	OPCODE(NE_V)
+		st->c->_float = (st->a->vector[0] != st->b->vector[0]) ||
+					(st->a->vector[1] != st->b->vector[1]) ||
+					(st->a->vector[2] != st->b->vector[2]);
+		NEXT;
+	OPCODE(NE_S)
+		st->c->_float = strcmp(pr_strings+st->a->string,pr_strings+st->b->string);
+		NEXT;
+	OPCODE(NE_E)
+		st->c->_float = st->a->_int != st->b->_int;
+		NEXT;
+	OPCODE(NE_FNC)
+		st->c->_float = st->a->function != st->b->function;
+		NEXT;
+
+//==================
+	OPCODE(STORE_F)
+	OPCODE(STORE_ENT)
+	OPCODE(STORE_FLD)		// integers
+	OPCODE(STORE_S)
+	OPCODE(STORE_FNC)		// pointers
+		st->b->_int = st->a->_int;
+		NEXT;
+	OPCODE(STORE_V)
+		st->b->vector[0] = st->a->vector[0];
+		st->b->vector[1] = st->a->vector[1];
+		st->b->vector[2] = st->a->vector[2];
+		NEXT;
+
+	OPCODE(STOREP_F)
+	OPCODE(STOREP_ENT)
+	OPCODE(STOREP_FLD)		// integers
+	OPCODE(STOREP_FNC)		// pointers
+		ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+		ptr->_int = st->a->_int;
+		NEXT;
+	OPCODE(STOREP_S)
+		ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+		ptr->_int = st->a->_int;
+		ED_IndexStore (st->b->_int);
+		NEXT;
+	OPCODE(STOREP_V)
+		ptr = (eval_t *)((byte *)sv.edicts + st->b->_int);
+		ptr->vector[0] = st->a->vector[0];
+		ptr->vector[1] = st->a->vector[1];
+		ptr->vector[2] = st->a->vector[2];
+		NEXT;
+
+	OPCODE(ADDRESS)
+		ed = PROG_TO_EDICT(st->a->edict);
+
+		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		{
+			SYNCSTATEMENT;
+			PR_RunError ("assignment to world entity");
+		}
+		st->c->_int = (byte *)((int *)&ed->v + st->b->_int) - (byte *)sv.edicts;
+		NEXT;
+
+	OPCODE(LOAD_F)
+	OPCODE(LOAD_FLD)
+	OPCODE(LOAD_ENT)
+	OPCODE(LOAD_S)
+	OPCODE(LOAD_FNC)
+		ed = PROG_TO_EDICT(st->a->edict);
+
+		ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+		st->c->_int = ptr->_int;
+		NEXT;
+
+	OPCODE(LOAD_V)
+		ed = PROG_TO_EDICT(st->a->edict);
+
+		ptr = (eval_t *)((int *)&ed->v + st->b->_int);
+		st->c->vector[0] = ptr->vector[0];
+		st->c->vector[1] = ptr->vector[1];
+		st->c->vector[2] = ptr->vector[2];
+		NEXT;
+
+//==================
+
+	OPCODE(IFNOT)
+		if (!st->a->_int)
+			st = pr_decoded + st->branch;
+		NEXT;
+
+	OPCODE(IF)
+		if (st->a->_int)
+			st = pr_decoded + st->branch;
+		NEXT;
+
+	OPCODE(GOTO)
+		st = pr_decoded + st->branch;
+		NEXT;
+
+	OPCODE(CALL0)
+	OPCODE(CALL1)
+	OPCODE(CALL2)
+	OPCODE(CALL3)
+	OPCODE(CALL4)
+	OPCODE(CALL5)
+	OPCODE(CALL6)
+	OPCODE(CALL7)
+	OPCODE(CALL8)
+		pr_argc = st->op - OP_CALL0;
+		SYNCSTATEMENT;
+		if (!st->a->function)
+			PR_RunError ("NULL function");
+
+		newf = &pr_functions[st->a->function];
+
+		if (newf->first_statement < 0)
+		{	// negative statements are built in functions
+			i = -newf->first_statement;
+			if (i >= pr_numbuiltins)
+				PR_RunError ("Bad builtin call number");
+			pr_builtins[i] ();
+
+			if (pr_trace)
+			{	// traceon was called, so finish this run the slow way
+				return PR_ExecuteClassic (st - pr_decoded, exitdepth, runaway);
+			}
+			NEXT;
+		}
+
+#ifdef PR_JIT
+		if (pr_jitfunctions && (jitf = PR_JitFunction (newf)))
+		{
+			PR_EnterFunction (newf);
+			pr_jitrunaway = runaway;
+			jitf ();
+			runaway = pr_jitrunaway;
+			profilebase = runaway;	// the compiled code charged its own profile
+			NEXT;
+		}
+#endif
+
+		st = pr_decoded + PR_EnterFunction (newf);
+		NEXT;
+
+	OPCODE(DONE)
+	OPCODE(RETURN)
+		pr_globals[OFS_RETURN] = st->a->vector[0];
+		pr_globals[OFS_RETURN+1] = st->a->vector[1];
+		pr_globals[OFS_RETURN+2] = st->a->vector[2];
+
+		FLUSHPROFILE;
+		st = pr_decoded + PR_LeaveFunction ();
+		if (pr_depth == exitdepth)
+			return runaway;		// all done
+		NEXT;
+
+	OPCODE(STATE)
+		ed = PROG_TO_EDICT(pr_global_struct->self);
+		ed->v.nextthink = pr_global_struct->time + 0.1;
+
+		if (st->a->_float != ed->v.frame)
+		{
+			ed->v.frame = st->a->_float;
+		}
+		ed->v.think = st->b->function;
+		NEXT;
+
+#ifdef PR_COMPUTED_GOTO
+op_BAD:
+#else
+	default:
+#endif
+		SYNCSTATEMENT;
+		PR_RunError ("Bad opcode %i", st->op);
+#ifndef PR_COMPUTED_GOTO
+	}
+}
+#endif
+
+runaway_error:
+	st++;		// the statement it stopped before, as in the other interpreter
+	SYNCSTATEMENT;
+	PR_RunError ("runaway loop error");
+	return 0;
+
+#undef OPCODE
+#undef NEXT
+#undef FLUSHPROFILE
+#undef SYNCSTATEMENT
+}
+
+/*
+====================
+PR_DecodeProgs
+
+Builds the pre-decoded statement stream, called from PR_LoadProgs after the
+statements have been byte swapped.
+====================
+*/
+void PR_DecodeProgs (void)
+{
+	int				i;
+	dstatement_t	*st;
+	prdecoded_t		*d;
+
+	pr_decoded = Hunk_AllocName (progs->numstatements * sizeof(prdecoded_t), "decoded");
+
+	for (i=0, st=pr_statements, d=pr_decoded ; i<progs->numstatements ; i++, st++, d++)
+	{
+		d->op = st->op;
+		d->a = (eval_t *)&pr_globals[st->a];
+		d->b = (eval_t *)&pr_globals[st->b];
+		d->c = (eval_t *)&pr_globals[st->c];
+
+		if (st->op == OP_IF || st->op == OP_IFNOT)
+			d->branch = i + st->b - 1;	// offset the st++
+		else if (st->op == OP_GOTO)
+			d->branch = i + st->a - 1;	// offset the st++
+	}
+
+#ifdef PR_COMPUTED_GOTO
+	PR_ExecuteDecoded (0, 0, 0, true);
+#endif
+}
+
+/*
+====================
+PR_ExecuteFrame
+
+Interprets from statement s + 1 until the stack unwinds back to exitdepth,
+returning the remaining runaway count
+====================
+*/
+int PR_ExecuteFrame (int s, int exitdepth, int runaway)
+{
+	if (pr_fastexec.value && pr_decoded)
+		return PR_ExecuteDecoded (s, exitdepth, runaway, false);
+	return PR_ExecuteClassic (s, exitdepth, runaway);
+}
+
+/*
+====================
+PR_ExecuteProgram
+====================
+*/
+void PR_ExecuteProgram (func_t fnum)
+{
+	int			s;
+	dfunction_t	*f;
+	int		exitdepth;
+#ifdef PR_JIT
+	prjitfunc_t	jitf;
+	int		oldrunaway;
+#endif
+
+	if (!fnum || fnum >= progs->numfunctions)
+	{
+		if (pr_global_struct->self)
+			ED_Print (PROG_TO_EDICT(pr_global_struct->self));
+		Host_Error ("PR_ExecuteProgram: NULL function");
+	}
+	
+	f = &pr_functions[fnum];
+
+	pr_trace = false;
+
+// make a stack frame
+	exitdepth = pr_depth;
+
+	s = PR_EnterFunction (f);
+
+	PROF_BEGIN (pr_strings + f->s_name);
+
+#ifdef PR_JIT
+// a builtin in a compiled function may have called back into us, and
+// that function reloads its own count from pr_jitrunaway when the builtin
+// returns, so anything compiled under here must not leave its count behind
+	oldrunaway = pr_jitrunaway;
+	if (pr_jitfunctions && (jitf = PR_JitFunction (f)))
+	{
+		pr_jitrunaway = 100000;
+		jitf ();
+	}
+	else
+		PR_ExecuteFrame (s, exitdepth, 100000);
+	pr_jitrunaway = oldrunaway;
+#else
+	PR_ExecuteFrame (s, exitdepth, 100000);
+#endif
 
+	PROF_END ();
 }
@@ -0,0 +1,1133 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// pr_jit.c -- native x86-64 code for QuakeC functions
+
+#include "quakedef.h"
+
+#ifdef PR_JIT
+
+#include <sys/mman.h>
+#include <stddef.h>
+
+/*
+
+A compiled function is entered after PR_EnterFunction has set up its frame,
+and returns after PR_LeaveFunction has torn it down, so pr_stack, pr_depth
+and pr_xfunction look exactly as they do under the interpreter.
+
+Register use inside compiled code:
+	rbx		pr_globals
+	r12d	runaway count
+	r13		&pr_jitrunaway, where r12d is kept across helper calls
+	r14d	runaway count when the profile was last charged
+
+Float, vector, store, field and branch opcodes are emitted inline.  The
+rest, including calls and returns, go through C helpers that share the
+interpreter's semantics.  Tracing is not supported in compiled code.
+
+*/
+
+#define	JIT_MAXSTATEMENT	128		// worst case bytes for one statement
+#define	JIT_MAXFUNCTION		64		// prologue, epilogue and runaway stub
+
+cvar_t	pr_jit = {"pr_jit", "0"};
+cvar_t	pr_jitthreshold = {"pr_jitthreshold", "0"};	// profile count before compiling, 0 = at load
+
+prjitfunc_t	*pr_jitfunctions;
+int			pr_jitrunaway;
+
+static byte	*jit_failed;		// [numfunctions] can't be compiled
+static byte	**jit_stmtaddr;		// [numstatements] native address of each statement
+static byte	**jit_branchat;		// [numstatements] rel32 of the statement's branch
+
+static byte	*jit_code;
+static int	jit_codesize;
+static int	jit_codeused;
+static byte	*jit_p;
+
+/*
+============================================================================
+
+HELPERS
+
+Called from compiled code with the statement number
+
+============================================================================
+*/
+
+static void PR_JitRunaway (int s)
+{
+	pr_xstatement = s;
+	PR_RunError ("runaway loop error");
+}
+
+static void PR_JitCall (int s, int profilebase)
+{
+	dstatement_t	*st;
+	dfunction_t		*newf;
+	prjitfunc_t		code;
+	int				i;
+
+	st = &pr_statements[s];
+	pr_xstatement = s;
+	pr_xfunction->profile += profilebase - pr_jitrunaway;
+
+	pr_argc = st->op - OP_CALL0;
+	if (!G_FUNCTION(st->a))
+		PR_RunError ("NULL function");
+
+	newf = &pr_functions[G_FUNCTION(st->a)];
+
+	if (newf->first_statement < 0)
+	{	// negative statements are built in functions
+		i = -newf->first_statement;
+		if (i >= pr_numbuiltins)
+			PR_RunError ("Bad builtin call number");
+		pr_builtins[i] ();
+		return;
+	}
+
+	PR_EnterFunction (newf);
+
+	if ((code = PR_JitFunction (newf)))
+		code ();
+	else
+		pr_jitrunaway = PR_ExecuteFrame (newf->first_statement - 1, pr_depth - 1, pr_jitrunaway);
+}
+
+static void PR_JitReturn (int s, int profilebase)
+{
+	dstatement_t	*st;
+
+	st = &pr_statements[s];
+	pr_xstatement = s;
+	pr_xfunction->profile += profilebase - pr_jitrunaway;
+
+	pr_globals[OFS_RETURN] = pr_globals[st->a];
+	pr_globals[OFS_RETURN+1] = pr_globals[st->a+1];
+	pr_globals[OFS_RETURN+2] = pr_globals[st->a+2];
+
+	PR_LeaveFunction ();
+}
+
+/*
+=================
+PR_JitStep
+
+Opcodes that are rare enough, or awkward enough, to leave in C
+=================
+*/
+static void PR_JitStep (int s)
+{
+	dstatement_t	*st;
+	eval_t	*a, *b, *c;
+	eval_t	*ptr;
+	edict_t	*ed;
+
+	pr_xstatement = s;
+	st = &pr_statements[s];
+	a = (eval_t *)&pr_globals[st->a];
+	b = (eval_t *)&pr_globals[st->b];
+	c = (eval_t *)&pr_globals[st->c];
+
+	switch (st->op)
+	{
+	case OP_BITAND:
+		c->_float = (int)a->_float & (int)b->_float;
+		break;
+	case OP_BITOR:
+		c->_float = (int)a->_float | (int)b->_float;
+		break;
+	case OP_AND:
+		c->_float = a->_float && b->_float;
+		break;
+	case OP_OR:
+		c->_float = a->_float || b->_float;
+		break;
+
+	case OP_NOT_V:
+		c->_float = !a->vector[0] && !a->vector[1] && !a->vector[2];
+		break;
+	case OP_NOT_S:
+		c->_float = !a->string || !pr_strings[a->string];
+		break;
+	case OP_NOT_FNC:
+		c->_float = !a->function;
+		break;
+	case OP_NOT_ENT:
+		c->_float = (PROG_TO_EDICT(a->edict) == sv.edicts);
+		break;
+
+	case OP_EQ_V:
+		c->_float = (a->vector[0] == b->vector[0]) &&
+					(a->vector[1] == b->vector[1]) &&
+					(a->vector[2] == b->vector[2]);
+		break;
+	case OP_EQ_S:
+		c->_float = !strcmp(pr_strings+a->string,pr_strings+b->string);
+		break;
+	case OP_NE_V:
+		c->_float = (a->vector[0] != b->vector[0]) ||
+					(a->vector[1] != b->vector[1]) ||
+					(a->vector[2] != b->vector[2]);
+		break;
+	case OP_NE_S:
+		c->_float = strcmp(pr_strings+a->string,pr_strings+b->string);
+		break;
+
+	case OP_STOREP_S:
+		ptr = (eval_t *)((byte *)sv.edicts + b->_int);
+		ptr->_int = a->_int;
+		ED_IndexStore (b->_int);
+		break;
+
+	case OP_ADDRESS:
+		ed = PROG_TO_EDICT(a->edict);
+
+		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+			PR_RunError ("assignment to world entity");
+		c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)sv.edicts;
+		break;
+
+	case OP_STATE:
+		ed = PROG_TO_EDICT(pr_global_struct->self);
+		ed->v.nextthink = pr_global_struct->time + 0.1;
+
+		if (a->_float != ed->v.frame)
+		{
+			ed->v.frame = a->_float;
+		}
+		ed->v.think = b->function;
+		break;
+
+	default:
+		PR_RunError ("Bad opcode %i", st->op);
+	}
+}
+
+/*
+============================================================================
+
+CODE EMISSION
+
+============================================================================
+*/
+
+static void J_Byte (int b)
+{
+	*jit_p++ = b;
+}
+
+static void J_Long (int l)
+{
+	memcpy (jit_p, &l, 4);
+	jit_p += 4;
+}
+
+static void J_Pointer (void *p)
+{
+	memcpy (jit_p, &p, sizeof(p));
+	jit_p += sizeof(p);
+}
+
+static void J_Bytes (int count, ...)
+{
+	va_list		argptr;
+
+	va_start (argptr, count);
+	while (count--)
+		J_Byte (va_arg (argptr, int));
+	va_end (argptr);
+}
+
+// modrm for reg, [rbx + ofs*4]
+static void J_Global (int reg, int ofs)
+{
+	J_Byte (0x83 | (reg<<3));
+	J_Long (ofs*4);
+}
+
+// scalar single op between xmm reg and a global
+static void J_SSE (int op, int reg, int ofs)
+{
+	J_Bytes (3, 0xf3, 0x0f, op);
+	J_Global (reg, ofs);
+}
+
+// movabs rax, func ; call rax
+static void J_CallHelper (void *func)
+{
+	J_Bytes (2, 0x48, 0xb8);
+	J_Pointer (func);
+	J_Bytes (2, 0xff, 0xd0);
+}
+
+// cvtsi2ss xmm0, reg ; movss [c], xmm0
+static void J_StoreBoolean (int reg, int c)
+{
+	J_Bytes (4, 0xf3, 0x0f, 0x2a, 0xc0 | reg);
+	J_SSE (0x11, 0, c);
+}
+
+// rcx = sv.edicts + the edict offset in rax
+static void J_EdictBase (void)
+{
+	J_Bytes (2, 0x48, 0xb9);				// movabs rcx, &sv.edicts
+	J_Pointer (&sv.edicts);
+	J_Bytes (3, 0x48, 0x8b, 0x09);			// mov rcx, [rcx]
+	J_Bytes (3, 0x48, 0x01, 0xc1);			// add rcx, rax
+}
+
+// a helper call that may run more QuakeC, so the runaway count goes through memory
+static void J_FrameHelper (void *func, int s)
+{
+	J_Bytes (4, 0x45, 0x89, 0x65, 0x00);	// mov [r13], r12d
+	J_Byte (0xbf);							// mov edi, s
+	J_Long (s);
+	J_Bytes (3, 0x44, 0x89, 0xf6);			// mov esi, r14d
+	J_CallHelper (func);
+	J_Bytes (4, 0x45, 0x8b, 0x65, 0x00);	// mov r12d, [r13]
+	J_Bytes (3, 0x45, 0x89, 0xe6);			// mov r14d, r12d
+}
+
+/*
+=================
+J_Statement
+=================
+*/
+static void J_Statement (int s)
+{
+	dstatement_t	*st;
+	int				i;
+
+	st = &pr_statements[s];
+
+	switch (st->op)
+	{
+	case OP_ADD_F:
+	case OP_SUB_F:
+	case OP_MUL_F:
+	case OP_DIV_F:
+		J_SSE (0x10, 0, st->a);
+		J_SSE (st->op == OP_ADD_F ? 0x58 : st->op == OP_SUB_F ? 0x5c : st->op == OP_MUL_F ? 0x59 : 0x5e, 0, st->b);
+		J_SSE (0x11, 0, st->c);
+		break;
+
+	case OP_ADD_V:
+	case OP_SUB_V:
+		for (i=0 ; i<3 ; i++)
+		{
+			J_SSE (0x10, 0, st->a+i);
+			J_SSE (st->op == OP_ADD_V ? 0x58 : 0x5c, 0, st->b+i);
+			J_SSE (0x11, 0, st->c+i);
+		}
+		break;
+
+	case OP_MUL_V:
+		J_SSE (0x10, 0, st->a);
+		J_SSE (0x59, 0, st->b);
+		J_SSE (0x10, 1, st->a+1);
+		J_SSE (0x59, 1, st->b+1);
+		J_Bytes (4, 0xf3, 0x0f, 0x58, 0xc1);	// addss xmm0, xmm1
+		J_SSE (0x10, 1, st->a+2);
+		J_SSE (0x59, 1, st->b+2);
+		J_Bytes (4, 0xf3, 0x0f, 0x58, 0xc1);
+		J_SSE (0x11, 0, st->c);
+		break;
+
+	case OP_MUL_FV:
+	case OP_MUL_VF:
+		for (i=0 ; i<3 ; i++)
+		{
+			if (st->op == OP_MUL_FV)
+			{
+				J_SSE (0x10, 0, st->a);
+				J_SSE (0x59, 0, st->b+i);
+			}
+			else
+			{
+				J_SSE (0x10, 0, st->b);
+				J_SSE (0x59, 0, st->a+i);
+			}
+			J_SSE (0x11, 0, st->c+i);
+		}
+		break;
+
+	// ucomiss leaves unordered as CF=ZF=PF=1, which seta/setae treat as false
+	case OP_GT:
+	case OP_GE:
+	case OP_LT:
+	case OP_LE:
+		J_Bytes (2, 0x31, 0xc0);				// xor eax, eax
+		if (st->op == OP_GT || st->op == OP_GE)
+		{
+			J_SSE (0x10, 0, st->a);
+			J_Bytes (2, 0x0f, 0x2e);			// ucomiss xmm0, b
+			J_Global (0, st->b);
+		}
+		else
+		{
+			J_SSE (0x10, 0, st->b);
+			J_Bytes (2, 0x0f, 0x2e);			// ucomiss xmm0, a
+			J_Global (0, st->a);
+		}
+		if (st->op == OP_GT || st->op == OP_LT)
+			J_Bytes (3, 0x0f, 0x97, 0xc0);		// seta al
+		else
+			J_Bytes (3, 0x0f, 0x93, 0xc0);		// setae al
+		J_StoreBoolean (0, st->c);
+		break;
+
+	case OP_EQ_F:
+	case OP_NE_F:
+	case OP_NOT_F:
+		J_Bytes (2, 0x31, 0xc0);				// xor eax, eax
+		J_Bytes (2, 0x31, 0xc9);				// xor ecx, ecx
+		J_SSE (0x10, 0, st->a);
+		if (st->op == OP_NOT_F)
+		{
+			J_Bytes (3, 0x0f, 0x57, 0xc9);		// xorps xmm1, xmm1
+			J_Bytes (3, 0x0f, 0x2e, 0xc1);		// ucomiss xmm0, xmm1
+		}
+		else
+		{
+			J_Bytes (2, 0x0f, 0x2e);			// ucomiss xmm0, b
+			J_Global (0, st->b);
+		}
+		if (st->op == OP_NE_F)
+		{
+			J_Bytes (3, 0x0f, 0x95, 0xc0);		// setne al
+			J_Bytes (3, 0x0f, 0x9a, 0xc1);		// setp cl
+			J_Bytes (2, 0x09, 0xc8);			// or eax, ecx
+		}
+		else
+		{
+			J_Bytes (3, 0x0f, 0x94, 0xc0);		// sete al
+			J_Bytes (3, 0x0f, 0x9b, 0xc1);		// setnp cl
+			J_Bytes (2, 0x21, 0xc8);			// and eax, ecx
+		}
+		J_StoreBoolean (0, st->c);
+		break;
+
+	case OP_EQ_E:
+	case OP_EQ_FNC:
+	case OP_NE_E:
+	case OP_NE_FNC:
+		J_Bytes (2, 0x31, 0xc9);				// xor ecx, ecx
+		J_Byte (0x8b);							// mov eax, a
+		J_Global (0, st->a);
+		J_Byte (0x3b);							// cmp eax, b
+		J_Global (0, st->b);
+		if (st->op == OP_EQ_E || st->op == OP_EQ_FNC)
+			J_Bytes (3, 0x0f, 0x94, 0xc1);		// sete cl
+		else
+			J_Bytes (3, 0x0f, 0x95, 0xc1);		// setne cl
+		J_StoreBoolean (1, st->c);
+		break;
+
+	case OP_STORE_F:
+	case OP_STORE_ENT:
+	case OP_STORE_FLD:
+	case OP_STORE_S:
+	case OP_STORE_FNC:
+	case OP_STORE_V:
+		for (i=0 ; i < (st->op == OP_STORE_V ? 3 : 1) ; i++)
+		{
+			J_Byte (0x8b);						// mov eax, a
+			J_Global (0, st->a+i);
+			J_Byte (0x89);						// mov b, eax
+			J_Global (0, st->b+i);
+		}
+		break;
+
+	case OP_STOREP_F:
+	case OP_STOREP_ENT:
+	case OP_STOREP_FLD:
+	case OP_STOREP_FNC:
+	case OP_STOREP_V:
+		J_Bytes (2, 0x48, 0x63);				// movsxd rax, b
+		J_Global (0, st->b);
+		J_EdictBase ();
+		for (i=0 ; i < (st->op == OP_STOREP_V ? 3 : 1) ; i++)
+		{
+			J_Byte (0x8b);						// mov edx, a
+			J_Global (2, st->a+i);
+			J_Bytes (2, 0x89, 0x91);			// mov [rcx+i*4], edx
+			J_Long (i*4);
+		}
+		break;
+
+	case OP_LOAD_F:
+	case OP_LOAD_FLD:
+	case OP_LOAD_ENT:
+	case OP_LOAD_S:
+	case OP_LOAD_FNC:
+	case OP_LOAD_V:
+		J_Bytes (2, 0x48, 0x63);				// movsxd rax, a
+		J_Global (0, st->a);
+		J_EdictBase ();
+		J_Bytes (2, 0x48, 0x63);				// movsxd rdx, b
+		J_Global (2, st->b);
+		for (i=0 ; i < (st->op == OP_LOAD_V ? 3 : 1) ; i++)
+		{
+			J_Bytes (3, 0x8b, 0x84, 0x91);		// mov eax, [rcx+rdx*4+v+i*4]
+			J_Long (offsetof(edict_t, v) + i*4);
+			J_Byte (0x89);						// mov c, eax
+			J_Global (0, st->c+i);
+		}
+		break;
+
+	case OP_IF:
+	case OP_IFNOT:
+		J_Byte (0x83);							// cmp dword a, 0
+		J_Global (7, st->a);
+		J_Byte (0);
+		J_Bytes (2, 0x0f, st->op == OP_IF ? 0x85 : 0x84);	// jnz / jz
+		jit_branchat[s] = jit_p;
+		J_Long (0);
+		break;
+
+	case OP_GOTO:
+		J_Byte (0xe9);							// jmp
+		jit_branchat[s] = jit_p;
+		J_Long (0);
+		break;
+
+	case OP_CALL0:
+	case OP_CALL1:
+	case OP_CALL2:
+	case OP_CALL3:
+	case OP_CALL4:
+	case OP_CALL5:
+	case OP_CALL6:
+	case OP_CALL7:
+	case OP_CALL8:
+		J_FrameHelper (PR_JitCall, s);
+		break;
+
+	case OP_DONE:
+	case OP_RETURN:
+		J_FrameHelper (PR_JitReturn, s);
+		J_Bytes (4, 0x48, 0x83, 0xc4, 0x08);	// add rsp, 8
+		J_Bytes (2, 0x41, 0x5e);				// pop r14
+		J_Bytes (2, 0x41, 0x5d);				// pop r13
+		J_Bytes (2, 0x41, 0x5c);				// pop r12
+		J_Byte (0x5b);							// pop rbx
+		J_Byte (0xc3);							// ret
+		break;
+
+	default:
+		J_Byte (0xbf);							// mov edi, s
+		J_Long (s);
+		J_CallHelper (PR_JitStep);
+		break;
+	}
+}
+
+/*
+=================
+PR_JitFunctionEnd
+
+A body runs up to the next function's statements
+=================
+*/
+static int PR_JitFunctionEnd (int first)
+{
+	int		i, last;
+
+	last = progs->numstatements;
+	for (i=0 ; i<progs->numfunctions ; i++)
+		if (pr_functions[i].first_statement > first && pr_functions[i].first_statement < last)
+			last = pr_functions[i].first_statement;
+	return last;
+}
+
+/*
+=================
+PR_JitCompile
+
+Returns NULL if the function can't be compiled.  The code buffer must be
+writable.
+=================
+*/
+static prjitfunc_t PR_JitCompile (int fnum)
+{
+	dfunction_t		*f;
+	dstatement_t	*st;
+	int				first, last;
+	int				i, s, target;
+	byte			*start, *runaway;
+
+	f = &pr_functions[fnum];
+	jit_failed[fnum] = true;
+
+	first = f->first_statement;
+	if (first <= 0)
+		return NULL;
+
+	last = PR_JitFunctionEnd (first);
+
+// don't compile anything that could fall out of its body or branch out of it
+	st = &pr_statements[last-1];
+	if (st->op != OP_DONE && st->op != OP_RETURN && st->op != OP_GOTO)
+		return NULL;
+
+	for (s=first, st=&pr_statements[first] ; s<last ; s++, st++)
+	{
+		if (st->op > OP_BITOR)
+			return NULL;
+		if (st->op == OP_IF || st->op == OP_IFNOT)
+			target = s + st->b;
+		else if (st->op == OP_GOTO)
+			target = s + st->a;
+		else
+			continue;
+		if (target < first || target >= last)
+			return NULL;
+	}
+
+	if (jit_codeused + (last - first) * JIT_MAXSTATEMENT + JIT_MAXFUNCTION > jit_codesize)
+	{
+		Con_DPrintf ("PR_JitCompile: out of code space for %s\n", pr_strings + f->s_name);
+		return NULL;
+	}
+
+	start = jit_p = jit_code + jit_codeused;
+
+// prologue, leaving the stack 16 byte aligned for helper calls
+	J_Byte (0x53);								// push rbx
+	J_Bytes (2, 0x41, 0x54);					// push r12
+	J_Bytes (2, 0x41, 0x55);					// push r13
+	J_Bytes (2, 0x41, 0x56);					// push r14
+	J_Bytes (4, 0x48, 0x83, 0xec, 0x08);		// sub rsp, 8
+	J_Bytes (2, 0x48, 0xbb);					// movabs rbx, pr_globals
+	J_Pointer (pr_globals);
+	J_Bytes (2, 0x49, 0xbd);					// movabs r13, &pr_jitrunaway
+	J_Pointer (&pr_jitrunaway);
+	J_Bytes (4, 0x45, 0x8b, 0x65, 0x00);		// mov r12d, [r13]
+	J_Bytes (3, 0x45, 0x89, 0xe6);				// mov r14d, r12d
+
+	for (s=first ; s<last ; s++)
+	{
+		jit_stmtaddr[s] = jit_p;
+		jit_branchat[s] = NULL;
+		J_Bytes (3, 0x41, 0xff, 0xcc);			// dec r12d
+		J_Bytes (2, 0x0f, 0x84);				// jz runaway stub, patched below
+		J_Long (0);
+		J_Statement (s);
+	}
+
+	runaway = jit_p;
+	J_Byte (0x5f);								// pop rdi, the statement pushed by the stub
+	J_CallHelper (PR_JitRunaway);
+	J_Byte (0xcc);								// int3, PR_RunError doesn't return
+
+	for (s=first ; s<last ; s++)
+	{
+		i = jit_p - (jit_stmtaddr[s] + 9);
+		memcpy (jit_stmtaddr[s] + 5, &i, 4);
+		J_Byte (0x68);							// push s
+		J_Long (s);
+		J_Byte (0xe9);							// jmp runaway
+		J_Long (runaway - (jit_p + 4));
+
+		if (!jit_branchat[s])
+			continue;
+		st = &pr_statements[s];
+		target = s + (st->op == OP_GOTO ? st->a : st->b);
+		i = jit_stmtaddr[target] - (jit_branchat[s] + 4);
+		memcpy (jit_branchat[s], &i, 4);
+	}
+
+	jit_codeused = ((jit_p - jit_code) + 15) & ~15;
+	jit_failed[fnum] = false;
+	pr_jitfunctions[fnum] = (prjitfunc_t)start;
+
+	return pr_jitfunctions[fnum];
+}
+
+/*
+=================
+PR_JitFunction
+
+Returns the native code for f, compiling it first if it has run enough
+=================
+*/
+prjitfunc_t PR_JitFunction (dfunction_t *f)
+{
+	int			fnum;
+	prjitfunc_t	code;
+
+	fnum = f - pr_functions;
+	if (pr_jitfunctions[fnum])
+		return pr_jitfunctions[fnum];
+	if (jit_failed[fnum] || f->profile < pr_jitthreshold.value)
+		return NULL;
+
+	mprotect (jit_code, jit_codesize, PROT_READ | PROT_WRITE);
+	code = PR_JitCompile (fnum);
+	mprotect (jit_code, jit_codesize, PROT_READ | PROT_EXEC);
+
+	return code;
+}
+
+/*
+=================
+PR_JitLoadProgs
+
+Called at the end of PR_LoadProgs
+=================
+*/
+void PR_JitLoadProgs (void)
+{
+	int		i, count;
+
+	if (jit_code)
+	{
+		munmap (jit_code, jit_codesize);
+		jit_code = NULL;
+	}
+	pr_jitfunctions = NULL;
+
+	if (!pr_jit.value)
+		return;
+
+	jit_codesize = progs->numstatements * JIT_MAXSTATEMENT + progs->numfunctions * JIT_MAXFUNCTION;
+	jit_codesize = (jit_codesize + 4095) & ~4095;
+	jit_code = mmap (NULL, jit_codesize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit_code == MAP_FAILED)
+	{
+		jit_code = NULL;
+		Con_Printf ("PR_JitLoadProgs: couldn't map %i bytes\n", jit_codesize);
+		return;
+	}
+	jit_codeused = 0;
+
+	pr_jitfunctions = Hunk_AllocName (progs->numfunctions * sizeof(prjitfunc_t), "jitfuncs");
+	jit_failed = Hunk_AllocName (progs->numfunctions, "jitfail");
+	jit_stmtaddr = Hunk_AllocName (progs->numstatements * sizeof(byte *), "jitstmt");
+	jit_branchat = Hunk_AllocName (progs->numstatements * sizeof(byte *), "jitbrnch");
+
+	count = 0;
+	if (pr_jitthreshold.value <= 0)
+	{
+		for (i=1 ; i<progs->numfunctions ; i++)
+			if (PR_JitCompile (i))
+				count++;
+		Con_DPrintf ("Compiled %i of %i functions into %iK.\n", count, progs->numfunctions, jit_codeused/1024);
+	}
+
+	mprotect (jit_code, jit_codesize, PROT_READ | PROT_EXEC);
+}
+
+/*
+============================================================================
+
+DIFFERENTIAL CHECK
+
+pr_jitcheck runs compiled functions once under the interpreter and once
+compiled, from the same globals and edicts, and compares the globals,
+entity fields and program error each run finishes with.  Only functions
+that can safely be run twice are checked: every call they make has to be
+through a global no statement writes, to QuakeC that can itself be checked
+or to one of the builtins below, which only look at the world.
+
+============================================================================
+*/
+
+static char	*jit_checkbuiltins[] =
+{
+	"makevectors", "normalize", "vlen", "vectoyaw", "vectoangles",
+	"traceline", "pointcontents", "checkbottom",
+	"ftos", "vtos", "fabs", "floor", "ceil", "rint",
+	NULL
+};
+
+extern	int		localstack_used;
+
+static int		jit_errorstatement;
+
+/*
+=================
+PR_JitCheckable
+
+Marks the functions pr_jitcheck can run
+=================
+*/
+static void PR_JitCheckable (byte *checkable)
+{
+	byte			*written;
+	dstatement_t	*st;
+	dfunction_t		*f;
+	char			**name;
+	int				i, s, last, g, changed;
+
+// globals a statement or a call frame can change
+	written = calloc (progs->numglobals, 1);
+	if (!written)
+		Sys_Error ("PR_JitCheckable: out of memory");
+	for (s=0, st=pr_statements ; s<progs->numstatements ; s++, st++)
+	{
+		if (st->op >= OP_STORE_F && st->op <= OP_STORE_FNC)
+			g = st->b;
+		else if ((st->op >= OP_STOREP_F && st->op <= OP_RETURN)
+		|| (st->op >= OP_IF && st->op <= OP_GOTO) || st->op == OP_DONE)
+			continue;
+		else
+			g = st->c;
+		for (i=0 ; i<3 && g+i < progs->numglobals ; i++)
+		{
+			written[g+i] = true;
+			if (st->op != OP_MUL_FV && st->op != OP_MUL_VF && st->op != OP_ADD_V
+			&& st->op != OP_SUB_V && st->op != OP_LOAD_V && st->op != OP_STORE_V)
+				break;
+		}
+	}
+	for (i=0, f=pr_functions ; i<progs->numfunctions ; i++, f++)
+		for (g=f->parm_start ; g<f->parm_start + f->locals && g<progs->numglobals ; g++)
+			written[g] = true;
+
+// start from every function that might do, and strike off the ones that
+// call something that can't, until nothing changes
+	for (i=1, f=pr_functions+1 ; i<progs->numfunctions ; i++, f++)
+	{
+		if (f->first_statement > 0)
+		{
+			checkable[i] = true;
+			continue;
+		}
+		for (name=jit_checkbuiltins ; *name ; name++)
+			if (!strcmp (*name, pr_strings + f->s_name))
+				checkable[i] = true;
+	}
+
+	do
+	{
+		changed = false;
+		for (i=1, f=pr_functions+1 ; i<progs->numfunctions ; i++, f++)
+		{
+			if (!checkable[i] || f->first_statement <= 0)
+				continue;
+			last = PR_JitFunctionEnd (f->first_statement);
+			for (s=f->first_statement, st=&pr_statements[s] ; s<last ; s++, st++)
+			{
+				if (st->op < OP_CALL0 || st->op > OP_CALL8)
+					continue;
+				g = G_FUNCTION(st->a);
+				if (written[st->a] || g <= 0 || g >= progs->numfunctions || !checkable[g])
+				{
+					checkable[i] = false;
+					changed = true;
+					break;
+				}
+			}
+		}
+	} while (changed);
+
+	free (written);
+}
+
+/*
+=================
+PR_JitCheckRun
+
+Runs a function from the current globals and returns false if it stopped
+with a program error
+=================
+*/
+static qboolean PR_JitCheckRun (int fnum, qboolean native)
+{
+	jmp_buf		errorjmp;
+	prjitfunc_t	*jitfunctions;
+	dfunction_t	*xfunction;
+	int			xstatement, depth, stackused, runaway;
+	int			s;
+	qboolean	ok;
+
+	xfunction = pr_xfunction;
+	xstatement = pr_xstatement;
+	depth = pr_depth;
+	stackused = localstack_used;
+	runaway = pr_jitrunaway;
+	jitfunctions = pr_jitfunctions;
+
+	if (!native)
+		pr_jitfunctions = NULL;		// so nothing it calls is run compiled
+	pr_errorjmp = &errorjmp;
+
+	if (setjmp (errorjmp))
+	{
+		jit_errorstatement = pr_xstatement;
+		ok = false;
+	}
+	else
+	{
+		s = PR_EnterFunction (&pr_functions[fnum]);
+		if (native)
+		{
+			pr_jitrunaway = 100000;
+			jitfunctions[fnum] ();
+		}
+		else
+			PR_ExecuteFrame (s, depth, 100000);
+		ok = true;
+	}
+
+	pr_errorjmp = NULL;
+	pr_jitfunctions = jitfunctions;
+	pr_jitrunaway = runaway;
+	localstack_used = stackused;
+	pr_depth = depth;
+	pr_xstatement = xstatement;
+	pr_xfunction = xfunction;
+
+	return ok;
+}
+
+/*
+=================
+PR_JitCheckEdicts
+
+Saves the entity fields of every edict, or puts back the ones that have
+changed and brings their find index entries up to date
+=================
+*/
+static void PR_JitCheckEdicts (byte *save, qboolean restore)
+{
+	int		e, size;
+	edict_t	*ed;
+
+	size = progs->entityfields * 4;
+	for (e=0 ; e<sv.num_edicts ; e++, save += size)
+	{
+		ed = EDICT_NUM(e);
+		if (!restore)
+		{
+			memcpy (save, &ed->v, size);
+			continue;
+		}
+		if (!memcmp (save, &ed->v, size))
+			continue;
+		memcpy (&ed->v, save, size);
+		if (ed->free)
+			continue;		// free edicts aren't indexed
+		ED_IndexField (ed, &ed->v.classname - (string_t *)&ed->v);
+		ED_IndexField (ed, &ed->v.targetname - (string_t *)&ed->v);
+		ED_IndexField (ed, &ed->v.target - (string_t *)&ed->v);
+	}
+}
+
+/*
+=================
+PR_JitCheckDiffer
+
+Returns the first of count words that differ, or -1.  Any two NaNs match.
+=================
+*/
+static int PR_JitCheckDiffer (int *a, int *b, int count)
+{
+	int		i;
+
+	for (i=0 ; i<count ; i++)
+	{
+		if (a[i] == b[i])
+			continue;
+		if ((a[i] & 0x7fffffff) > 0x7f800000 && (b[i] & 0x7fffffff) > 0x7f800000)
+			continue;
+		return i;
+	}
+	return -1;
+}
+
+static char *PR_JitCheckDef (ddef_t *defs, int numdefs, int ofs)
+{
+	int		i;
+
+	for (i=0 ; i<numdefs ; i++)
+		if (defs[i].ofs == ofs)
+			return pr_strings + defs[i].s_name;
+	return "?";
+}
+
+/*
+=================
+PR_JitCheck_f
+
+pr_jitcheck [edicts]
+
+Each function is run as self world and as self each of a spread of up to
+edicts live edicts, 8 by default
+=================
+*/
+void PR_JitCheck_f (void)
+{
+	byte		*checkable;
+	int			*gsave, *gstart, *gresult;
+	byte		*edicts, *eresult;
+	int			selfs[65];
+	int			numselfs, maxselfs;
+	int			i, j, e, d, fnum;
+	int			functions, runs, errors, mismatches;
+	dfunction_t	*f;
+	char		*name;
+	qboolean	ok1, ok2;
+	int			stmt1;
+	char		msg1[1024];
+
+	if (!sv.active)
+	{
+		Con_Printf ("pr_jitcheck: no server running\n");
+		return;
+	}
+	if (!pr_jitfunctions)
+	{
+		Con_Printf ("pr_jitcheck: progs were loaded with pr_jit 0\n");
+		return;
+	}
+
+	maxselfs = 8;
+	if (Cmd_Argc () > 1)
+		maxselfs = Q_atoi (Cmd_Argv (1));
+	if (maxselfs < 0)
+		maxselfs = 0;
+	if (maxselfs > 64)
+		maxselfs = 64;
+
+// world, then live edicts spread across the list
+	numselfs = 0;
+	selfs[numselfs++] = 0;
+	for (i=0 ; i<maxselfs ; i++)
+	{
+		e = 1 + i * (sv.num_edicts - 1) / maxselfs;
+		for ( ; e<sv.num_edicts && EDICT_NUM(e)->free ; e++)
+			;
+		if (e < sv.num_edicts && e != selfs[numselfs-1])
+			selfs[numselfs++] = e;
+	}
+
+// compile whatever hasn't run enough to be compiled yet
+	mprotect (jit_code, jit_codesize, PROT_READ | PROT_WRITE);
+	for (i=1 ; i<progs->numfunctions ; i++)
+		if (!pr_jitfunctions[i] && !jit_failed[i])
+			PR_JitCompile (i);
+	mprotect (jit_code, jit_codesize, PROT_READ | PROT_EXEC);
+
+	checkable = calloc (progs->numfunctions, 1);
+	gsave = malloc (progs->numglobals * 4 * 3);
+	edicts = malloc (sv.num_edicts * progs->entityfields * 4 * 2);
+	if (!checkable || !gsave || !edicts)
+		Sys_Error ("PR_JitCheck_f: out of memory");
+	gstart = gsave + progs->numglobals;
+	gresult = gstart + progs->numglobals;
+	eresult = edicts + sv.num_edicts * progs->entityfields * 4;
+
+	PR_JitCheckable (checkable);
+
+	memcpy (gsave, pr_globals, progs->numglobals * 4);
+	PR_JitCheckEdicts (edicts, false);
+
+	functions = runs = errors = mismatches = 0;
+	for (fnum=1, f=pr_functions+1 ; fnum<progs->numfunctions ; fnum++, f++)
+	{
+		if (!pr_jitfunctions[fnum] || !checkable[fnum])
+			continue;
+		functions++;
+		name = pr_strings + f->s_name;
+
+		for (j=0 ; j<numselfs ; j++)
+		{
+		// zeros are a valid value of every type, so parms and locals that
+		// are read before they are set don't lead off into the weeds
+			memcpy (gstart, gsave, progs->numglobals * 4);
+			memset (gstart, 0, (OFS_PARM7 + 3) * 4);
+			memset (gstart + f->parm_start, 0, f->locals * 4);
+			((globalvars_t *)gstart)->self = EDICT_TO_PROG(EDICT_NUM(selfs[j]));
+
+			memcpy (pr_globals, gstart, progs->numglobals * 4);
+			ok1 = PR_JitCheckRun (fnum, false);
+			stmt1 = jit_errorstatement;
+			strcpy (msg1, ok1 ? "" : pr_errormsg);
+			memcpy (gresult, pr_globals, progs->numglobals * 4);
+			PR_JitCheckEdicts (eresult, false);
+			PR_JitCheckEdicts (edicts, true);
+
+			memcpy (pr_globals, gstart, progs->numglobals * 4);
+			ok2 = PR_JitCheckRun (fnum, true);
+
+			runs++;
+			if (!ok1)
+				errors++;
+
+			if (ok1 != ok2 || (!ok1 && (stmt1 != jit_errorstatement || strcmp (msg1, pr_errormsg))))
+			{
+				if (mismatches++ < 10)
+					Con_Printf ("%s self %i: \"%s\" at %i interpreted, \"%s\" at %i compiled\n",
+						name, selfs[j], ok1 ? "" : msg1, ok1 ? -1 : stmt1,
+						ok2 ? "" : pr_errormsg, ok2 ? -1 : jit_errorstatement);
+			}
+			else if (ok1 && (d = PR_JitCheckDiffer (gresult, (int *)pr_globals, progs->numglobals)) >= 0)
+			{
+				if (mismatches++ < 10)
+					Con_Printf ("%s self %i: global %s (%i) %08x interpreted, %08x compiled\n",
+						name, selfs[j], PR_JitCheckDef (pr_globaldefs, progs->numglobaldefs, d), d,
+						gresult[d], ((int *)pr_globals)[d]);
+			}
+			else if (ok1)
+			{
+				for (e=0 ; e<sv.num_edicts ; e++)
+				{
+					d = PR_JitCheckDiffer ((int *)(eresult + e * progs->entityfields * 4),
+						(int *)&EDICT_NUM(e)->v, progs->entityfields);
+					if (d < 0)
+						continue;
+					if (mismatches++ < 10)
+						Con_Printf ("%s self %i: edict %i field %s (%i) differs\n",
+							name, selfs[j], e, PR_JitCheckDef (pr_fielddefs, progs->numfielddefs, d), d);
+					break;
+				}
+			}
+
+			PR_JitCheckEdicts (edicts, true);
+		}
+	}
+
+	memcpy (pr_globals, gsave, progs->numglobals * 4);
+
+	Con_Printf ("%i functions checked in %i runs, %i stopped with program errors, %i mismatched\n",
+		functions, runs, errors, mismatches);
+
+	free (gsave);
+	free (edicts);
+	free (checkable);
+}
+
+/*
+=================
+PR_JitInit
+=================
+*/
+void PR_JitInit (void)
+{
+	Cvar_RegisterVariable (&pr_jit);
+	Cvar_RegisterVariable (&pr_jitthreshold);
+	Cmd_AddCommand ("pr_jitcheck", PR_JitCheck_f);
+}
+
+#endif	// PR_JIT
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // protocol.h -- communications protocols
 
 #define	PROTOCOL_VERSION	15
+#define	PROTOCOL_DELTA		16		// entities delta from the last acknowledged frame
 
 // if the high bit of the servercmd is set, the low bits are fast update flags:
 #define	U_MOREBITS	(1<<0)
@@ -130,6 +131,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define svc_cutscene		34
 
+#define	svc_packetentities	35		// PROTOCOL_DELTA only
+									// [long] sequence [byte] frames back to delta from, 0 = baselines
+									// entity records in number order, [short] 0 ends the list
+									// record: [short] number (| U_REMOVE) [byte] bits [byte] morebits
+									// then the fields in U_ bit order, as a fast update
+
 //
 // client to server
 //
@@ -138,6 +145,49 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	clc_disconnect	2
 #define	clc_move		3			// [usercmd_t]
 #define	clc_stringcmd	4		// [string] message
+											// PROTOCOL_DELTA clc_move ends with
+											// [long] last svc_packetentities sequence
+
+
+//
+// PROTOCOL_DELTA entity frames
+//
+// Both ends keep the last UPDATE_BACKUP frames a client was sent.  A frame
+// names the frame it was delta compressed from, and lists only the entities
+// that were added, removed or changed since; an entity not mentioned keeps
+// its state from that frame.  Entities that weren't in it delta from their
+// baseline.
+//
+#define	UPDATE_BACKUP	16			// must be a power of two
+#define	UPDATE_MASK		(UPDATE_BACKUP-1)
+
+#define	MAX_PACKET_ENTITIES	256		// more than a datagram can hold
+
+#define	U_REMOVE		(1<<15)		// on the entity number, no bits or fields follow
+
+#define	PE_NOLERP		1
+
+// an entity as the client will see it after the coords and angles are
+// quantized, so comparing two never sends a change that isn't one
+typedef struct
+{
+	unsigned short	number;
+	byte			modelindex;
+	byte			frame;
+	byte			colormap;
+	byte			skin;
+	byte			effects;
+	byte			flags;			// PE_NOLERP
+	short			origin[3];		// as MSG_WriteCoord
+	byte			angles[3];		// as MSG_WriteAngle
+} packedentity_t;
+
+typedef struct
+{
+	int				sequence;
+	int				numentities;
+	packedentity_t	entities[MAX_PACKET_ENTITIES];	// sorted by number
+} entityframe_t;
 
 
 //
@@ -65,6 +65,11 @@ void	VID_UnlockBuffer (void);
 #define UNALIGNED_OK	0
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define idSSE2	1		// SSE2 intrinsics for the wide inner loops
+#include <emmintrin.h>
+#endif
+
 // !!! if this is changed, it must be changed in d_ifacea.h too !!!
 #define CACHE_SIZE	32		// used to align key data structures
 
@@ -96,7 +101,10 @@ void	VID_UnlockBuffer (void);
 //
 // per-level limits
 //
-#define	MAX_EDICTS		600			// FIXME: ouch! ouch! ouch!
+#define	MIN_EDICTS		600			// sv.edicts starts with room for this many
+#define	MAX_EDICTS		8192		// and grows up to this, svc_sound packs the
+									//  entity into 13 bits
+#define	MAX_OLDEDICTS	600			// all protocol 15 clients have room for
 #define	MAX_LIGHTSTYLES	64
 #define	MAX_MODELS		256			// these are sent over the net as bytes
 #define	MAX_SOUNDS		256			// so they cannot be blindly increased
@@ -244,6 +252,7 @@ typedef struct
 #include "view.h"
 #include "menu.h"
 #include "crc.h"
+#include "prof.h"
 #include "cdaudio.h"
 
 #ifdef GLQUAKE
@@ -301,6 +310,8 @@ void Host_Frame (float time);
 void Host_Quit_f (void);
 void Host_ClientCommands (char *fmt, ...);
 void Host_ShutdownServer (qboolean crash);
+void Host_AutoSnapshot (void);
+void Host_FinishSnapshot (void);
 
 extern qboolean		msg_suppress_1;		// suppresses resolution and cache size console output
 										//  an fullscreen DIB focus gain/loss
@@ -24,6 +24,7 @@ typedef struct
 	int			maxclients;
 	int			maxclientslimit;
 	struct client_s	*clients;		// [maxclients]
+	entityframe_t	*frames;		// [maxclientslimit*UPDATE_BACKUP], by client number
 	int			serverflags;		// episode completion information
 	qboolean	changelevel_issued;	// cleared when at SV_SpawnServer
 } server_static_t;
@@ -52,10 +53,11 @@ typedef struct
 	char		*sound_precache[MAX_SOUNDS];	// NULL terminated
 	char		*lightstyles[MAX_LIGHTSTYLES];
 	int			num_edicts;
-	int			max_edicts;
+	int			max_edicts;			// room committed so far, see ED_Grow
 	edict_t		*edicts;			// can NOT be array indexed, because
 									// edict_t is variable sized, but can
 									// be used to reference the world ent
+	link_t		free_edicts;		// oldest first, see ED_Alloc
 	server_state_t	state;			// some actions are only valid during load
 
 	sizebuf_t	datagram;
@@ -102,6 +104,12 @@ typedef struct client_s
 
 // client known data for deltas	
 	int				old_frags;
+
+// PROTOCOL_DELTA entity frames, kept in svs.frames
+	int				protocol;			// PROTOCOL_VERSION or PROTOCOL_DELTA
+	int				framesequence;		// of the last svc_packetentities sent
+	int				deltaack;			// last frame the client has, -1 for none
+	int				deltafirst;			// acks before this are from the last level
 } client_t;
 
 
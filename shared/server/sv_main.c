@@ -26,6 +26,9 @@ server_static_t	svs;
 
 char	localmodels[MAX_MODELS][5];			// inline model names for precache
 
+cvar_t	sv_parallelsend = {"sv_parallelsend", "1"};	// build client datagrams on worker threads
+cvar_t	sv_deltaentities = {"sv_deltaentities", "1"};	// offer PROTOCOL_DELTA to clients that have it
+
 //============================================================================
 
 /*
@@ -45,6 +48,7 @@ void SV_Init (void)
 	extern	cvar_t	sv_maxspeed;
 	extern	cvar_t	sv_accelerate;
 	extern	cvar_t	sv_idealpitchscale;
+	extern	cvar_t	sv_tracecache;
 
 	Cvar_RegisterVariable (&sv_maxvelocity);
 	Cvar_RegisterVariable (&sv_gravity);
@@ -55,6 +59,11 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_accelerate);
 	Cvar_RegisterVariable (&sv_idealpitchscale);
 	Cvar_RegisterVariable (&sv_nostep);
+	Cvar_RegisterVariable (&sv_tracecache);
+	Cvar_RegisterVariable (&sv_parallelsend);
+	Cvar_RegisterVariable (&sv_deltaentities);
+
+	Cmd_AddCommand ("areastats", SV_AreaStats_f);
 
 	for (i=0 ; i<MAX_MODELS ; i++)
 		sprintf (localmodels[i], "*%i", i);
@@ -98,6 +107,24 @@ void SV_StartParticle (vec3_t org, vec3_t dir, int color, int count)
 	MSG_WriteByte (&sv.datagram, color);
 }           
 
+/*
+==================
+SV_OldClients
+
+True if any active client is on protocol 15
+==================
+*/
+static qboolean SV_OldClients (void)
+{
+	int		i;
+
+	for (i=0 ; i<svs.maxclients ; i++)
+		if (svs.clients[i].active && svs.clients[i].protocol != PROTOCOL_DELTA)
+			return true;
+
+	return false;
+}
+
 /*  
 ==================
 SV_StartSound
@@ -147,6 +174,14 @@ void SV_StartSound (edict_t *entity, int channel, char *sample, int volume,
     
 	ent = NUM_FOR_EDICT(entity);
 
+// protocol 15 clients only have room for MAX_OLDEDICTS entities, so past
+// that the sound is left where it starts, on an automatic world channel
+	if (ent >= MAX_OLDEDICTS && SV_OldClients ())
+	{
+		ent = 0;
+		channel = 0;
+	}
+
 	channel = (ent<<3) | channel;
 
 	field_mask = 0;
@@ -194,7 +229,7 @@ void SV_SendServerinfo (client_t *client)
 	MSG_WriteString (&client->message,message);
 
 	MSG_WriteByte (&client->message, svc_serverinfo);
-	MSG_WriteLong (&client->message, PROTOCOL_VERSION);
+	MSG_WriteLong (&client->message, client->protocol);
 	MSG_WriteByte (&client->message, svs.maxclients);
 
 	if (!coop.value && deathmatch.value)
@@ -228,6 +263,10 @@ void SV_SendServerinfo (client_t *client)
 
 	client->sendsignon = true;
 	client->spawned = false;		// need prespawn, spawn, etc
+
+// the client throws away its entity frames on a new serverinfo
+	client->deltaack = -1;
+	client->deltafirst = client->framesequence + 1;
 }
 
 /*
@@ -271,6 +310,11 @@ void SV_ConnectClient (int clientnum)
 	client->message.maxsize = sizeof(client->msgbuf);
 	client->message.allowoverflow = true;		// we can catch it
 
+	if (sv_deltaentities.value && netconnection->protocol == PROTOCOL_DELTA)
+		client->protocol = PROTOCOL_DELTA;
+	else
+		client->protocol = PROTOCOL_VERSION;
+
 	if (sv.loadgame)
 		memcpy (client->spawn_parms, spawn_parms, sizeof(spawn_parms));
 	else
@@ -353,13 +397,62 @@ crosses a waterline.
 =============================================================================
 */
 
-int		fatbytes;
-byte	fatpvs[MAX_MAP_LEAFS/8];
+#define	FATPVS_LEAFS	16			// most leafs a cached fat PVS is keyed on
+#define	FATPVS_CACHE	(MAX_SCOREBOARD*2)	// more than a frame's worth of clients
 
-void SV_AddToFatPVS (vec3_t org, mnode_t *node)
+typedef struct
+{
+	int		numleafs;
+	int		leafs[FATPVS_LEAFS];	// in tree walk order, so a set always lists the same
+	int		used;					// sv_fatpvsframe of the last lookup, 0 if empty
+	byte	pvs[MAX_MAP_LEAFS/8];
+} fatpvs_t;
+
+static fatpvs_t	sv_fatpvs[FATPVS_CACHE];
+static int		sv_fatpvsframe;
+
+/*
+=============
+SV_FatLeafs
+
+Collects the non solid leafs within 8 pixels of the point, returns false
+if there are more than FATPVS_LEAFS
+=============
+*/
+qboolean SV_FatLeafs (vec3_t org, mnode_t *node, int *leafs, int *numleafs)
+{
+	mplane_t	*plane;
+	float	d;
+
+	while (1)
+	{
+		if (node->contents < 0)
+		{
+			if (node->contents == CONTENTS_SOLID)
+				return true;
+			if (*numleafs == FATPVS_LEAFS)
+				return false;
+			leafs[(*numleafs)++] = (mleaf_t *)node - sv.worldmodel->leafs;
+			return true;
+		}
+	
+		plane = node->plane;
+		d = DotProduct (org, plane->normal) - plane->dist;
+		if (d > 8)
+			node = node->children[0];
+		else if (d < -8)
+			node = node->children[1];
+		else
+		{	// go down both
+			if (!SV_FatLeafs (org, node->children[0], leafs, numleafs))
+				return false;
+			node = node->children[1];
+		}
+	}
+}
+
+void SV_AddToFatPVS (vec3_t org, mnode_t *node, byte *fatpvs)
 {
-	int		i;
-	byte	*pvs;
 	mplane_t	*plane;
 	float	d;
 
@@ -369,11 +462,8 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node)
 		if (node->contents < 0)
 		{
 			if (node->contents != CONTENTS_SOLID)
-			{
-				pvs = Mod_LeafPVS ( (mleaf_t *)node, sv.worldmodel);
-				for (i=0 ; i<fatbytes ; i++)
-					fatpvs[i] |= pvs[i];
-			}
+				Mod_OrPVS (fatpvs, Mod_LeafPVS ( (mleaf_t *)node, sv.worldmodel),
+					PVS_ROWBYTES(sv.worldmodel->numleafs));
 			return;
 		}
 	
@@ -385,7 +475,7 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node)
 			node = node->children[1];
 		else
 		{	// go down both
-			SV_AddToFatPVS (org, node->children[0]);
+			SV_AddToFatPVS (org, node->children[0], fatpvs);
 			node = node->children[1];
 		}
 	}
@@ -396,15 +486,54 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node)
 SV_FatPVS
 
 Calculates a PVS that is the inclusive or of all leafs within 8 pixels of the
-given point.
+given point.  The result is cached on the set of leafs, so clients that
+haven't moved far, or are standing together, share one.  fatpvs is only
+used when the point touches too many leafs to cache.
 =============
 */
-byte *SV_FatPVS (vec3_t org)
+byte *SV_FatPVS (vec3_t org, byte *fatpvs)
 {
-	fatbytes = (sv.worldmodel->numleafs+31)>>3;
-	Q_memset (fatpvs, 0, fatbytes);
-	SV_AddToFatPVS (org, sv.worldmodel->nodes);
-	return fatpvs;
+	int			leafs[FATPVS_LEAFS];
+	int			i, numleafs, rowbytes;
+	fatpvs_t	*fp, *oldest;
+
+	rowbytes = PVS_ROWBYTES(sv.worldmodel->numleafs);
+	sv_areastats.fatpvs++;
+
+	numleafs = 0;
+	if (!SV_FatLeafs (org, sv.worldmodel->nodes, leafs, &numleafs))
+	{
+		Q_memset (fatpvs, 0, rowbytes);
+		SV_AddToFatPVS (org, sv.worldmodel->nodes, fatpvs);
+		return fatpvs;
+	}
+
+	oldest = sv_fatpvs;
+	for (i=0, fp=sv_fatpvs ; i<FATPVS_CACHE ; i++, fp++)
+	{
+		if (fp->used && fp->numleafs == numleafs
+		&& !memcmp (fp->leafs, leafs, numleafs*sizeof(int)))
+		{
+			fp->used = sv_fatpvsframe;
+			sv_areastats.fatpvshits++;
+			return fp->pvs;
+		}
+		if (fp->used < oldest->used)
+			oldest = fp;
+	}
+
+// there are more entries than clients, so this never takes one handed
+// out earlier in the frame
+	fp = oldest;
+	fp->numleafs = numleafs;
+	memcpy (fp->leafs, leafs, numleafs*sizeof(int));
+	fp->used = sv_fatpvsframe;
+
+	Q_memset (fp->pvs, 0, rowbytes);
+	for (i=0 ; i<numleafs ; i++)
+		Mod_OrPVS (fp->pvs, Mod_LeafPVS (sv.worldmodel->leafs + leafs[i], sv.worldmodel), rowbytes);
+
+	return fp->pvs;
 }
 
 //=============================================================================
@@ -416,22 +545,17 @@ SV_WriteEntitiesToClient
 
 =============
 */
-void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
+void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg, byte *pvs)
 {
 	int		e, i;
 	int		bits;
-	byte	*pvs;
-	vec3_t	org;
 	float	miss;
 	edict_t	*ent;
 
-// find the client's PVS
-	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
-	pvs = SV_FatPVS (org);
-
-// send over all entities (excpet the client) that touch the pvs
+// send over all entities (excpet the client) that touch the pvs, as far
+// as a protocol 15 client has room for
 	ent = NEXT_EDICT(sv.edicts);
-	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
+	for (e=1 ; e<sv.num_edicts && e<MAX_OLDEDICTS ; e++, ent = NEXT_EDICT(ent))
 	{
 // ignore if not touching a PV leaf
 		if (ent != clent)	// clent is ALLWAYS sent
@@ -450,7 +574,7 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
 
 		if (msg->maxsize - msg->cursize < 16)
 		{
-			Con_Printf ("packet overflow\n");
+			msg->overflowed = true;		// reported by SV_SendClientDatagram
 			return;
 		}
 
@@ -534,6 +658,251 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
 	}
 }
 
+/*
+=============================================================================
+
+PROTOCOL_DELTA clients get their entities as an svc_packetentities, delta
+compressed from the last frame they acknowledged in a clc_move.  Until
+they have one, or if it has dropped out of the UPDATE_BACKUP window, the
+frame is sent against the baselines like a fast update.
+
+=============================================================================
+*/
+
+#define	MAX_PACKET_RECORD	18		// number, two bytes of bits, and all the fields
+
+/*
+=============
+SV_PackEntity
+
+Quantizes a state the way a fast update would write it
+=============
+*/
+void SV_PackEntity (packedentity_t *pe, int number, entity_state_t *state, int flags)
+{
+	int		i;
+
+	pe->number = number;
+	pe->modelindex = state->modelindex;
+	pe->frame = state->frame;
+	pe->colormap = state->colormap;
+	pe->skin = state->skin;
+	pe->effects = state->effects;
+	pe->flags = flags;
+	for (i=0 ; i<3 ; i++)
+	{
+		pe->origin[i] = (int)(state->origin[i]*8);
+		pe->angles[i] = ((int)state->angles[i]*256/360) & 255;
+	}
+}
+
+/*
+=============
+SV_WriteDeltaEntity
+
+Writes a record for the fields of to that differ from from.  Nothing is
+written for an unchanged entity unless force is set.
+=============
+*/
+void SV_WriteDeltaEntity (packedentity_t *from, packedentity_t *to, sizebuf_t *msg, qboolean force)
+{
+	int		i;
+	int		bits;
+
+	bits = 0;
+
+	for (i=0 ; i<3 ; i++)
+		if (to->origin[i] != from->origin[i])
+			bits |= U_ORIGIN1<<i;
+
+	if (to->angles[0] != from->angles[0])
+		bits |= U_ANGLE1;
+	if (to->angles[1] != from->angles[1])
+		bits |= U_ANGLE2;
+	if (to->angles[2] != from->angles[2])
+		bits |= U_ANGLE3;
+
+	if (to->colormap != from->colormap)
+		bits |= U_COLORMAP;
+	if (to->skin != from->skin)
+		bits |= U_SKIN;
+	if (to->frame != from->frame)
+		bits |= U_FRAME;
+	if (to->effects != from->effects)
+		bits |= U_EFFECTS;
+	if (to->modelindex != from->modelindex)
+		bits |= U_MODEL;
+
+	if (!bits && to->flags == from->flags && !force)
+		return;		// the client already has it
+
+// the nolerp bit is the new value, not a change
+	if (to->flags & PE_NOLERP)
+		bits |= U_NOLERP;
+
+	if (bits >= 256)
+		bits |= U_MOREBITS;
+
+	MSG_WriteShort (msg, to->number);
+	MSG_WriteByte (msg, bits);
+	if (bits & U_MOREBITS)
+		MSG_WriteByte (msg, bits>>8);
+
+	if (bits & U_MODEL)
+		MSG_WriteByte (msg, to->modelindex);
+	if (bits & U_FRAME)
+		MSG_WriteByte (msg, to->frame);
+	if (bits & U_COLORMAP)
+		MSG_WriteByte (msg, to->colormap);
+	if (bits & U_SKIN)
+		MSG_WriteByte (msg, to->skin);
+	if (bits & U_EFFECTS)
+		MSG_WriteByte (msg, to->effects);
+	if (bits & U_ORIGIN1)
+		MSG_WriteShort (msg, to->origin[0]);
+	if (bits & U_ANGLE1)
+		MSG_WriteByte (msg, to->angles[0]);
+	if (bits & U_ORIGIN2)
+		MSG_WriteShort (msg, to->origin[1]);
+	if (bits & U_ANGLE2)
+		MSG_WriteByte (msg, to->angles[1]);
+	if (bits & U_ORIGIN3)
+		MSG_WriteShort (msg, to->origin[2]);
+	if (bits & U_ANGLE3)
+		MSG_WriteByte (msg, to->angles[2]);
+}
+
+/*
+=============
+SV_WritePacketEntities
+
+Runs on a worker thread.  If the datagram fills up, the entities that
+weren't written are stored in the new frame as the client will rebuild
+it: ones in the old frame keep their old state and new ones are left out.
+=============
+*/
+void SV_WritePacketEntities (client_t *client, int sequence, sizebuf_t *msg, byte *pvs)
+{
+	int				e, i;
+	int				oldindex, newindex, oldnum, newnum;
+	int				numbase, numvisible, count;
+	qboolean		full;
+	edict_t			*ent, *clent;
+	entityframe_t	*frames, *frame, *base;
+	packedentity_t	*out, baseline;
+	packedentity_t	visible[MAX_PACKET_ENTITIES];
+	entity_state_t	state;
+
+	frames = svs.frames + (client - svs.clients)*UPDATE_BACKUP;
+	frame = &frames[sequence & UPDATE_MASK];
+
+	base = NULL;
+	if (client->deltaack >= client->deltafirst && sequence - client->deltaack < UPDATE_BACKUP)
+	{
+		base = &frames[client->deltaack & UPDATE_MASK];
+		if (base->sequence != client->deltaack)
+			base = NULL;
+	}
+	numbase = base ? base->numentities : 0;
+
+// collect everything the client can see
+	clent = client->edict;
+	numvisible = 0;
+	ent = NEXT_EDICT(sv.edicts);
+	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
+	{
+		if (ent != clent)	// clent is ALLWAYS sent
+		{
+			if (!ent->v.modelindex || !pr_strings[ent->v.model])
+				continue;
+
+			for (i=0 ; i < ent->num_leafs ; i++)
+				if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i]&7) ))
+					break;
+				
+			if (i == ent->num_leafs)
+				continue;		// not visible
+		}
+
+		if (numvisible == MAX_PACKET_ENTITIES)
+		{
+			msg->overflowed = true;
+			break;
+		}
+
+		VectorCopy (ent->v.origin, state.origin);
+		VectorCopy (ent->v.angles, state.angles);
+		state.modelindex = ent->v.modelindex;
+		state.frame = ent->v.frame;
+		state.colormap = ent->v.colormap;
+		state.skin = ent->v.skin;
+		state.effects = ent->v.effects;
+		SV_PackEntity (&visible[numvisible++], e, &state,
+			ent->v.movetype == MOVETYPE_STEP ? PE_NOLERP : 0);	// don't mess up the step animation
+	}
+
+	MSG_WriteByte (msg, svc_packetentities);
+	MSG_WriteLong (msg, sequence);
+	MSG_WriteByte (msg, base ? sequence - client->deltaack : 0);
+
+// merge the two sorted lists
+	out = frame->entities;
+	count = 0;
+	full = false;
+	oldindex = newindex = 0;
+	while (oldindex < numbase || newindex < numvisible)
+	{
+		oldnum = oldindex < numbase ? base->entities[oldindex].number : 0x10000;
+		newnum = newindex < numvisible ? visible[newindex].number : 0x10000;
+
+		if (!full && msg->maxsize - msg->cursize < MAX_PACKET_RECORD + 2)
+		{
+			full = true;
+			msg->overflowed = true;		// reported by SV_SendClientDatagram
+		}
+
+		if (newnum == oldnum)
+		{	// delta from the old frame
+			if (full)
+				out[count++] = base->entities[oldindex];
+			else
+			{
+				SV_WriteDeltaEntity (&base->entities[oldindex], &visible[newindex], msg, false);
+				out[count++] = visible[newindex];
+			}
+			oldindex++;
+			newindex++;
+		}
+		else if (newnum < oldnum)
+		{	// new to the client, delta from the baseline.  the old entities
+			// left must still fit in the frame
+			if (!full && count + numbase - oldindex < MAX_PACKET_ENTITIES)
+			{
+				ent = EDICT_NUM(newnum);
+				SV_PackEntity (&baseline, newnum, &ent->baseline, 0);
+				SV_WriteDeltaEntity (&baseline, &visible[newindex], msg, true);
+				out[count++] = visible[newindex];
+			}
+			else
+				msg->overflowed = true;
+			newindex++;
+		}
+		else
+		{	// the client can't see it anymore
+			if (full)
+				out[count++] = base->entities[oldindex];
+			else
+				MSG_WriteShort (msg, oldnum | U_REMOVE);
+			oldindex++;
+		}
+	}
+
+	MSG_WriteShort (msg, 0);	// end of the list
+
+	frame->sequence = sequence;
+	frame->numentities = count;
+}
+
 /*
 =============
 SV_CleanupEnts
@@ -692,34 +1061,98 @@ void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
 	}
 }
 
+/*
+=============================================================================
+
+Each spawned client's datagram is built in its own snapshot.  The client
+data can change the edict and run traces, and the fat PVS comes out of a
+shared cache, so both are done on the main thread; the entity list only
+reads the world, so once physics has run for the frame it is built for all
+clients at once on the worker threads.  Only the sends are left to do one
+after another.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	client_t	*client;
+	sizebuf_t	msg;
+	byte		buf[MAX_DATAGRAM];
+	byte		*pvs;
+	byte		fatpvs[MAX_MAP_LEAFS/8];	// if SV_FatPVS can't cache it
+	int			sequence;					// of the svc_packetentities, PROTOCOL_DELTA only
+} snapshot_t;
+
+static snapshot_t	sv_snapshots[MAX_SCOREBOARD];
+
 /*
 =======================
-SV_SendClientDatagram
+SV_StartClientDatagram
 =======================
 */
-qboolean SV_SendClientDatagram (client_t *client)
+void SV_StartClientDatagram (client_t *client, snapshot_t *snap)
 {
-	byte		buf[MAX_DATAGRAM];
-	sizebuf_t	msg;
-	
-	msg.data = buf;
-	msg.maxsize = sizeof(buf);
-	msg.cursize = 0;
+	vec3_t	org;
+
+	snap->client = client;
+	snap->msg.data = snap->buf;
+	snap->msg.maxsize = sizeof(snap->buf);
+	snap->msg.cursize = 0;
+	snap->msg.allowoverflow = false;
+	snap->msg.overflowed = false;
 
-	MSG_WriteByte (&msg, svc_time);
-	MSG_WriteFloat (&msg, sv.time);
+	MSG_WriteByte (&snap->msg, svc_time);
+	MSG_WriteFloat (&snap->msg, sv.time);
 
 // add the client specific data to the datagram
-	SV_WriteClientdataToMessage (client->edict, &msg);
+	SV_WriteClientdataToMessage (client->edict, &snap->msg);
+
+// find the client's PVS
+	VectorAdd (client->edict->v.origin, client->edict->v.view_ofs, org);
+	snap->pvs = SV_FatPVS (org, snap->fatpvs);
+
+	if (client->protocol == PROTOCOL_DELTA)
+		snap->sequence = ++client->framesequence;
+}
+
+/*
+=======================
+SV_BuildClientEntities
+
+Runs on a worker thread, so it must not touch anything but the snapshot
+=======================
+*/
+void SV_BuildClientEntities (void *data, int index)
+{
+	snapshot_t	*snap;
+
+	snap = ((snapshot_t **)data)[index];
+	if (snap->client->protocol == PROTOCOL_DELTA)
+		SV_WritePacketEntities (snap->client, snap->sequence, &snap->msg, snap->pvs);
+	else
+		SV_WriteEntitiesToClient (snap->client->edict, &snap->msg, snap->pvs);
+}
+
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+qboolean SV_SendClientDatagram (snapshot_t *snap)
+{
+	sizebuf_t	*msg;
 
-	SV_WriteEntitiesToClient (client->edict, &msg);
+	msg = &snap->msg;
+	if (msg->overflowed)
+		Con_Printf ("packet overflow\n");
 
 // copy the server datagram if there is space
-	if (msg.cursize + sv.datagram.cursize < msg.maxsize)
-		SZ_Write (&msg, sv.datagram.data, sv.datagram.cursize);
+	if (msg->cursize + sv.datagram.cursize < msg->maxsize)
+		SZ_Write (msg, sv.datagram.data, sv.datagram.cursize);
 
 // send the datagram
-	if (NET_SendUnreliableMessage (client->netconnection, &msg) == -1)
+	if (NET_SendUnreliableMessage (snap->client->netconnection, msg) == -1)
 	{
 		SV_DropClient (true);// if the message couldn't send, kick off
 		return false;
@@ -798,12 +1231,30 @@ SV_SendClientMessages
 */
 void SV_SendClientMessages (void)
 {
-	int			i;
+	int			i, numsnapshots;
+	snapshot_t	*snapshots[MAX_SCOREBOARD];
 	
 // update frags, names, etc
 	SV_UpdateToReliableMessages ();
 
-// build individual updates
+// build the datagrams
+	sv_fatpvsframe++;
+	numsnapshots = 0;
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (!host_client->active || !host_client->spawned)
+			continue;
+		SV_StartClientDatagram (host_client, &sv_snapshots[i]);
+		snapshots[numsnapshots++] = &sv_snapshots[i];
+	}
+
+	if (sv_parallelsend.value)
+		Sys_RunJobs (SV_BuildClientEntities, snapshots, numsnapshots);
+	else
+		for (i=0 ; i<numsnapshots ; i++)
+			SV_BuildClientEntities (snapshots, i);
+
+// send individual updates
 	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 	{
 		if (!host_client->active)
@@ -811,7 +1262,7 @@ void SV_SendClientMessages (void)
 
 		if (host_client->spawned)
 		{
-			if (!SV_SendClientDatagram (host_client))
+			if (!SV_SendClientDatagram (&sv_snapshots[i]))
 				continue;
 		}
 		else
@@ -973,7 +1424,7 @@ void SV_SendReconnect (void)
 
 	MSG_WriteChar (&msg, svc_stufftext);
 	MSG_WriteString (&msg, "reconnect\n");
-	NET_SendToAll (&msg, 5);
+	NET_QueueToAll (&msg);
 	
 	if (cls.state != ca_dedicated)
 		Cmd_ExecuteString ("reconnect\n", src_command);
@@ -1057,6 +1508,8 @@ void SV_SpawnServer (char *server)
 	Host_ClearMemory ();
 
 	memset (&sv, 0, sizeof(sv));
+	memset (sv_fatpvs, 0, sizeof(sv_fatpvs));		// keyed on the old map's leafs
+	PF_ClearCheckLeafs ();
 
 	strcpy (sv.name, server);
 
@@ -1064,9 +1517,7 @@ void SV_SpawnServer (char *server)
 	PR_LoadProgs ();
 
 // allocate server memory
-	sv.max_edicts = MAX_EDICTS;
-	
-	sv.edicts = Hunk_AllocName (sv.max_edicts*pr_edict_size, "edicts");
+	ED_InitEdicts ();
 
 	sv.datagram.maxsize = sizeof(sv.datagram_buf);
 	sv.datagram.cursize = 0;
@@ -1154,6 +1605,9 @@ void SV_SpawnServer (char *server)
 	SV_Physics ();
 	SV_Physics ();
 
+// fit the area tree to where everything ended up
+	SV_BalanceWorld ();
+
 // create a baseline for more efficient communications
 	SV_CreateBaseline ();
 
@@ -36,8 +36,10 @@ int c_yes, c_no;
 
 qboolean SV_CheckBottom (edict_t *ent)
 {
-	vec3_t	mins, maxs, start, stop;
-	trace_t	trace;
+	vec3_t	mins, maxs, start[5], stop[5];
+	vec3_t	corners[4];
+	int		contents[4];
+	trace_t	trace[5];
 	int		x, y;
 	float	mid, bottom;
 	
@@ -47,15 +49,17 @@ qboolean SV_CheckBottom (edict_t *ent)
 // if all of the points under the corners are solid world, don't bother
 // with the tougher checks
 // the corners must be within 16 of the midpoint
-	start[2] = mins[2] - 1;
 	for	(x=0 ; x<=1 ; x++)
 		for	(y=0 ; y<=1 ; y++)
 		{
-			start[0] = x ? maxs[0] : mins[0];
-			start[1] = y ? maxs[1] : mins[1];
-			if (SV_PointContents (start) != CONTENTS_SOLID)
-				goto realcheck;
+			corners[x*2+y][0] = x ? maxs[0] : mins[0];
+			corners[x*2+y][1] = y ? maxs[1] : mins[1];
+			corners[x*2+y][2] = mins[2] - 1;
 		}
+	SV_HullPointContentsBatch (&sv.worldmodel->hulls[0], 0, corners, 4, contents);
+	for (x=0 ; x<4 ; x++)
+		if (contents[x] != CONTENTS_SOLID)
+			goto realcheck;
 
 	c_yes++;
 	return true;		// we got out easy
@@ -64,33 +68,31 @@ realcheck:
 	c_no++;
 //
 // check it for real...
+// the midpoint and the corners are traced together, the corners are
+// only looked at if the midpoint found a floor
 //
-	start[2] = mins[2];
-	
-// the midpoint must be within 16 of the bottom
-	start[0] = stop[0] = (mins[0] + maxs[0])*0.5;
-	start[1] = stop[1] = (mins[1] + maxs[1])*0.5;
-	stop[2] = start[2] - 2*STEPSIZE;
-	trace = SV_Move (start, vec3_origin, vec3_origin, stop, true, ent);
+	for (x=0 ; x<5 ; x++)
+	{
+		start[x][0] = stop[x][0] = x ? corners[x-1][0] : (mins[0] + maxs[0])*0.5;
+		start[x][1] = stop[x][1] = x ? corners[x-1][1] : (mins[1] + maxs[1])*0.5;
+		start[x][2] = mins[2];
+		stop[x][2] = mins[2] - 2*STEPSIZE;
+	}
+	SV_MoveBatch (5, start, vec3_origin, vec3_origin, stop, true, ent, trace);
 
-	if (trace.fraction == 1.0)
+// the midpoint must be within 16 of the bottom
+	if (trace[0].fraction == 1.0)
 		return false;
-	mid = bottom = trace.endpos[2];
+	mid = bottom = trace[0].endpos[2];
 	
 // the corners must be within 16 of the midpoint	
-	for	(x=0 ; x<=1 ; x++)
-		for	(y=0 ; y<=1 ; y++)
-		{
-			start[0] = stop[0] = x ? maxs[0] : mins[0];
-			start[1] = stop[1] = y ? maxs[1] : mins[1];
-			
-			trace = SV_Move (start, vec3_origin, vec3_origin, stop, true, ent);
-			
-			if (trace.fraction != 1.0 && trace.endpos[2] > bottom)
-				bottom = trace.endpos[2];
-			if (trace.fraction == 1.0 || mid - trace.endpos[2] > STEPSIZE)
-				return false;
-		}
+	for	(x=1 ; x<5 ; x++)
+	{
+		if (trace[x].fraction != 1.0 && trace[x].endpos[2] > bottom)
+			bottom = trace[x].endpos[2];
+		if (trace[x].fraction == 1.0 || mid - trace[x].endpos[2] > STEPSIZE)
+			return false;
+	}
 
 	c_yes++;
 	return true;
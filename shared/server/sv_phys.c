@@ -429,8 +429,8 @@ void SV_PushMove (edict_t *pusher, float movetime)
 	vec3_t		mins, maxs, move;
 	vec3_t		entorig, pushorig;
 	int			num_moved;
-	edict_t		*moved_edict[MAX_EDICTS];
-	vec3_t		moved_from[MAX_EDICTS];
+	static edict_t	*moved_edict[MAX_EDICTS];	// too big for the stack
+	static vec3_t	moved_from[MAX_EDICTS];
 
 	if (!pusher->v.velocity[0] && !pusher->v.velocity[1] && !pusher->v.velocity[2])
 	{
@@ -1135,6 +1135,41 @@ void SV_Physics_Step (edict_t *ent)
 
 //============================================================================
 
+static char *sv_movetypenames[] =
+{
+	"MOVETYPE_NONE",
+	"MOVETYPE_ANGLENOCLIP",
+	"MOVETYPE_ANGLECLIP",
+	"MOVETYPE_WALK",
+	"MOVETYPE_STEP",
+	"MOVETYPE_FLY",
+	"MOVETYPE_TOSS",
+	"MOVETYPE_PUSH",
+	"MOVETYPE_NOCLIP",
+	"MOVETYPE_FLYMISSILE",
+	"MOVETYPE_BOUNCE"
+};
+
+/*
+================
+SV_PhysicsScope
+
+Profiler scope name for an entity's physics
+================
+*/
+static char *SV_PhysicsScope (edict_t *ent, int num)
+{
+	int		movetype;
+
+	if (num > 0 && num <= svs.maxclients)
+		return "SV_Physics_Client";
+
+	movetype = (int)ent->v.movetype;
+	if (movetype < 0 || movetype >= sizeof(sv_movetypenames)/sizeof(sv_movetypenames[0]))
+		return "MOVETYPE_BAD";
+	return sv_movetypenames[movetype];
+}
+
 /*
 ================
 SV_Physics
@@ -1168,6 +1203,8 @@ void SV_Physics (void)
 			SV_LinkEdict (ent, true);	// force retouch even for stationary
 		}
 
+		PROF_BEGIN (SV_PhysicsScope (ent, i));
+
 		if (i > 0 && i <= svs.maxclients)
 			SV_Physics_Client (ent, i);
 		else if (ent->v.movetype == MOVETYPE_PUSH)
@@ -1185,10 +1222,14 @@ void SV_Physics (void)
 			SV_Physics_Toss (ent);
 		else
 			Sys_Error ("SV_Physics: bad movetype %i", (int)ent->v.movetype);			
+
+		PROF_END ();
 	}
 	
 	if (pr_global_struct->force_retouch)
 		pr_global_struct->force_retouch--;	
 
+	SV_CheckAreaNodes ();
+
 	sv.time += host_frametime;
 }
\ No newline at end of file
@@ -445,6 +445,14 @@ void SV_ReadClientMove (usercmd_t *move)
 	i = MSG_ReadByte ();
 	if (i)
 		host_client->edict->v.impulse = i;
+
+// read the last entity frame the client got
+	if (host_client->protocol == PROTOCOL_DELTA)
+	{
+		i = MSG_ReadLong ();
+		if (i >= host_client->deltafirst && i <= host_client->framesequence)
+			host_client->deltaack = i;
+	}
 }
 
 /*
@@ -77,6 +77,7 @@ typedef struct
 	vec3_t	origin;			// origin of sound effect
 	float	dist_mult;		// distance multiplier (attenuation/clipK)
 	int		master_vol;		// 0-255 master volume
+	qboolean	virtualized;	// not painted, only end keeps its place
 } channel_t;
 
 typedef struct
@@ -138,6 +139,10 @@ extern	channel_t   channels[MAX_CHANNELS];
 
 extern	int			total_channels;
 
+// the static channels near enough to be painted; the others are virtual
+extern	channel_t	*snd_heard[MAX_CHANNELS];
+extern	int			snd_numheard;
+
 //
 // Fake dma is a synchronous faking of the DMA progress used for
 // isolating performance in the renderer.  The fakedma_updates is
@@ -147,6 +152,7 @@ extern	int			total_channels;
 extern qboolean 		fakedma;
 extern int 			fakedma_updates;
 extern int		paintedtime;
+extern int		soundtime;
 extern vec3_t listener_origin;
 extern vec3_t listener_forward;
 extern vec3_t listener_right;
@@ -158,6 +164,9 @@ extern float sound_nominal_clip_dist;
 extern	cvar_t loadas8bit;
 extern	cvar_t bgmvolume;
 extern	cvar_t volume;
+extern	cvar_t snd_simd;
+extern	cvar_t snd_filter;
+extern	cvar_t snd_diskcache;
 
 extern qboolean	snd_initialized;
 
@@ -169,8 +178,35 @@ sfxcache_t *S_LoadSound (sfx_t *s);
 wavinfo_t GetWavinfo (char *name, byte *wav, int wavlength);
 
 void SND_InitScaletable (void);
+void SND_InitMixer (void);
+void SND_MixBench_f (void);
 void SNDDMA_Submit(void);
 
+// the mixer may be on a thread of its own; device code that runs beside
+// it takes the mixer lock, and reports failures through S_DMAError so
+// S_Update can deal with them on the main thread
+#define	DMA_WARN		0		// just print the message
+#define	DMA_SHUTDOWN	1		// stop the sound system
+#define	DMA_RESTART		2		// stop it and start it again
+
+void S_LockMixer (void);
+void S_UnlockMixer (void);
+void S_DMAError (char *msg, int action);
+
+// the mixer's S_LoadSound, which only returns what is still cached
+sfxcache_t *SND_GetCache (sfx_t *sfx);
+
+// the offline driver in snd_wav.c, used in place of SNDDMA_* when
+// snd_wavout is set; it is always mixed from the main thread
+extern qboolean	snd_wavout;
+extern char		snd_wavname[MAX_OSPATH];
+extern int		snd_wavspeed;
+
+qboolean SNDWAV_Init (void);
+void SNDWAV_Update (double frametime);
+void SNDWAV_Paint (void);
+void SNDWAV_Shutdown (void);
+
 void S_AmbientOff (void);
 void S_AmbientOn (void);
 
@@ -31,6 +31,7 @@ void S_SoundList(void);
 void S_Update_();
 void S_StopAllSounds(qboolean clear);
 void S_StopAllSoundsC(void);
+void S_WavOut_f (void);
 
 // =======================================================================
 // Internal sound data & structures
@@ -82,6 +83,94 @@ cvar_t snd_show = {"snd_show", "0"};
 cvar_t _snd_mixahead = {"_snd_mixahead", "0.1", true};
 
 
+// ====================================================================
+// Mixer command queue
+// ====================================================================
+
+typedef enum
+{
+	sc_start,
+	sc_stop,
+	sc_static,
+	sc_stopall,
+	sc_clearbuffer,
+	sc_listener
+} sndcmdtype_t;
+
+typedef struct
+{
+	vec3_t		origin;
+	vec3_t		right;
+	int			viewentity;
+	sfx_t		*ambient_sfx[NUM_AMBIENTS];
+	int			ambient_vol[NUM_AMBIENTS];
+} sndlistener_t;
+
+typedef struct
+{
+	sndcmdtype_t	type;
+	sfx_t			*sfx;
+	int				entnum;
+	int				entchannel;
+	vec3_t			origin;
+	float			vol;
+	float			attenuation;
+	qboolean		clear;
+	sndlistener_t	listener;
+} sndcmd_t;
+
+#define	MAX_SOUNDCMDS	256		// must be a power of two
+static sndcmd_t				snd_cmds[MAX_SOUNDCMDS];
+static volatile unsigned	snd_cmdhead;	// moved by the main thread
+static volatile unsigned	snd_cmdtail;	// moved by the mixer
+
+// sounds the mixer found flushed from the cache
+#define	MAX_SOUNDLOADS	64		// must be a power of two
+static sfx_t				*snd_loads[MAX_SOUNDLOADS];
+static volatile unsigned	snd_loadhead;	// moved by the mixer
+static volatile unsigned	snd_loadtail;	// moved by the main thread
+
+static sndlistener_t		snd_listener;		// the mixer's view of the listener
+static qboolean				snd_respatialize;
+static volatile int			snd_active;			// voices painted, for snd_show
+static volatile int			snd_virtual;		// voices out of earshot
+
+// the main thread's side of the channels
+static int					snd_numstatics;
+static sfx_t				*snd_ambientsfx[NUM_AMBIENTS];
+static int					snd_ambientvol[NUM_AMBIENTS];
+
+static void					*snd_thread;
+static volatile qboolean	snd_quit;
+static void					*snd_lock;		// held for each pass of the mixer
+
+static char * volatile		snd_dmamsg;		// left by S_DMAError for S_Update
+static volatile int			snd_dmaaction;
+static volatile qboolean	snd_dmafailed;
+
+// static channels are bucketed by origin, so a new listener position only
+// looks at the ones that could be heard from it
+#define	SND_CELLSIZE	256
+#define	SND_BUCKETS		256		// must be a power of two
+static channel_t			*snd_buckets[SND_BUCKETS];
+static channel_t			*snd_bucketnext[MAX_CHANNELS];
+static float				snd_staticrange;		// farthest any static can be heard
+static int					snd_numstaticvoices;	// statics with a sound
+static int					snd_visited[MAX_CHANNELS];
+static int					snd_visitframe;
+
+channel_t	*snd_heard[MAX_CHANNELS];
+int			snd_numheard;
+
+static void SND_RunCommands (void);
+static void SND_StopAllSounds (qboolean clear);
+static void SND_ClearBuffer (void);
+static void S_StartMixer (void);
+static qboolean S_WavName (char *out, char *name);
+static qboolean	snd_resync;		// device position doesn't match paintedtime yet
+static void S_StopMixer (void);
+
+
 // ====================================================================
 // User-setable variables
 // ====================================================================
@@ -125,6 +214,8 @@ void S_SoundInfo_f(void)
     Con_Printf("%5d speed\n", shm->speed);
     Con_Printf("0x%x dma buffer\n", shm->buffer);
 	Con_Printf("%5d total_channels\n", total_channels);
+	Con_Printf("%5d active voices\n", snd_active);
+	Con_Printf("%5d virtual voices\n", snd_virtual);
 }
 
 
@@ -141,7 +232,15 @@ void S_Startup (void)
 	if (!snd_initialized)
 		return;
 
-	if (!fakedma)
+	if (snd_wavout)
+	{
+		if (!SNDWAV_Init ())
+		{
+			sound_started = 0;
+			return;
+		}
+	}
+	else if (!fakedma)
 	{
 		rc = SNDDMA_Init();
 
@@ -156,6 +255,9 @@ void S_Startup (void)
 	}
 
 	sound_started = 1;
+	snd_resync = true;
+
+	S_StartMixer ();
 }
 
 
@@ -166,20 +268,28 @@ S_Init
 */
 void S_Init (void)
 {
+	int		i;
 
 	Con_Printf("\nSound Initialization\n");
 
 	if (COM_CheckParm("-nosound"))
 		return;
 
-	if (COM_CheckParm("-simsound"))
+	i = COM_CheckParm ("-wavout");
+	if (i && i < com_argc-1)
+		snd_wavout = S_WavName (snd_wavname, com_argv[i+1]);
+	else if (COM_CheckParm("-simsound"))
 		fakedma = true;
 
+	snd_lock = Sys_CreateLock ();
+
 	Cmd_AddCommand("play", S_Play);
 	Cmd_AddCommand("playvol", S_PlayVol);
 	Cmd_AddCommand("stopsound", S_StopAllSoundsC);
 	Cmd_AddCommand("soundlist", S_SoundList);
 	Cmd_AddCommand("soundinfo", S_SoundInfo_f);
+	Cmd_AddCommand("snd_mixbench", SND_MixBench_f);
+	Cmd_AddCommand("snd_wavout", S_WavOut_f);
 
 	Cvar_RegisterVariable(&nosound);
 	Cvar_RegisterVariable(&volume);
@@ -192,6 +302,9 @@ void S_Init (void)
 	Cvar_RegisterVariable(&snd_noextraupdate);
 	Cvar_RegisterVariable(&snd_show);
 	Cvar_RegisterVariable(&_snd_mixahead);
+	Cvar_RegisterVariable(&snd_simd);
+	Cvar_RegisterVariable(&snd_filter);
+	Cvar_RegisterVariable(&snd_diskcache);
 
 	if (host_parms.memsize < 0x800000)
 	{
@@ -203,9 +316,10 @@ void S_Init (void)
 
 	snd_initialized = true;
 
-	S_Startup ();
-
 	SND_InitScaletable ();
+	SND_InitMixer ();
+
+	S_Startup ();
 
 	known_sfx = Hunk_AllocName (MAX_SFX*sizeof(sfx_t), "sfx_t");
 	num_sfx = 0;
@@ -227,7 +341,8 @@ void S_Init (void)
 		shm->buffer = Hunk_AllocName(1<<16, "shmbuf");
 	}
 
-	Con_Printf ("Sound sampling rate: %i\n", shm->speed);
+	if (shm)
+		Con_Printf ("Sound sampling rate: %i\n", shm->speed);
 
 	// provides a tick sound until washed clean
 
@@ -251,13 +366,17 @@ void S_Shutdown(void)
 	if (!sound_started)
 		return;
 
+	S_StopMixer ();
+
 	if (shm)
 		shm->gamealive = 0;
 
 	shm = 0;
 	sound_started = 0;
 
-	if (!fakedma)
+	if (snd_wavout)
+		SNDWAV_Shutdown ();
+	else if (!fakedma)
 	{
 		SNDDMA_Shutdown();
 	}
@@ -346,6 +465,229 @@ sfx_t *S_PrecacheSound (char *name)
 
 //=============================================================================
 
+/*
+===============================================================================
+
+MIXER COMMANDS
+
+The main thread never touches channels[], paintbuffer or the dma buffer.
+Starting, stopping and placing sounds are queued as commands, which the
+mixer applies before it paints.  The queue has one producer and one
+consumer, so all it needs is a memory barrier between writing an entry
+and moving the index that hands it over.
+
+Without a mixer thread (-nosoundthread or -simsound) every command is run
+as soon as it is queued and S_Update mixes, just as before.
+
+===============================================================================
+*/
+
+/*
+==================
+S_RunQueuedCommands
+
+Runs the queue on the main thread when there is no mixer thread
+==================
+*/
+static void S_RunQueuedCommands (void)
+{
+	S_LockMixer ();
+	Cache_Lock ();
+	SND_RunCommands ();
+	Cache_Unlock ();
+	S_UnlockMixer ();
+}
+
+/*
+==================
+S_AllocCommand
+
+Returns the next free queue entry, waiting for the mixer if it is full
+==================
+*/
+static sndcmd_t *S_AllocCommand (sndcmdtype_t type)
+{
+	sndcmd_t	*cmd;
+
+	while (snd_cmdhead - snd_cmdtail == MAX_SOUNDCMDS)
+		Sys_Sleep ();
+
+	cmd = &snd_cmds[snd_cmdhead & (MAX_SOUNDCMDS-1)];
+	memset (cmd, 0, sizeof(*cmd));
+	cmd->type = type;
+	return cmd;
+}
+
+/*
+==================
+S_SubmitCommand
+
+Hands the entry from S_AllocCommand to the mixer
+==================
+*/
+static void S_SubmitCommand (void)
+{
+	Sys_MemoryBarrier ();	// the entry has to be seen before the new head
+	snd_cmdhead++;
+
+	if (!snd_thread)
+		S_RunQueuedCommands ();
+}
+
+/*
+==================
+SND_GetCache
+
+The mixer's S_LoadSound.  The cache lock keeps the data from moving, but
+the mixer can't load anything, so a flushed sound is skipped and queued
+for S_Update to load again
+==================
+*/
+sfxcache_t *SND_GetCache (sfx_t *sfx)
+{
+	sfxcache_t	*sc;
+
+	sc = sfx->cache.data;
+	if (sc)
+		return sc;
+
+	if (snd_loadhead - snd_loadtail < MAX_SOUNDLOADS)
+	{
+		snd_loads[snd_loadhead & (MAX_SOUNDLOADS-1)] = sfx;
+		Sys_MemoryBarrier ();
+		snd_loadhead++;
+	}
+	return NULL;
+}
+
+/*
+==================
+S_LoadFlushedSounds
+==================
+*/
+static void S_LoadFlushedSounds (void)
+{
+	unsigned	head;
+
+	head = snd_loadhead;
+	Sys_MemoryBarrier ();
+
+	while (snd_loadtail != head)
+	{
+		S_LoadSound (snd_loads[snd_loadtail & (MAX_SOUNDLOADS-1)]);
+		Sys_MemoryBarrier ();
+		snd_loadtail++;
+	}
+}
+
+/*
+==================
+S_DMAError
+
+The mixer can't print, or shut the device down, from its own thread, so
+it leaves the message for S_Update.  A failed device isn't painted again.
+==================
+*/
+void S_DMAError (char *msg, int action)
+{
+	if (snd_dmamsg && snd_dmaaction >= action)
+		return;
+
+	if (action != DMA_WARN)
+		snd_dmafailed = true;
+	snd_dmaaction = action;
+	Sys_MemoryBarrier ();
+	snd_dmamsg = msg;
+}
+
+/*
+==================
+S_CheckDMAError
+==================
+*/
+static void S_CheckDMAError (void)
+{
+	char	*msg;
+	int		action;
+
+	msg = snd_dmamsg;
+	if (!msg)
+		return;
+	Sys_MemoryBarrier ();
+	action = snd_dmaaction;
+	snd_dmamsg = NULL;
+
+	if (action == DMA_WARN)
+	{
+		Con_DPrintf ("%s", msg);
+		return;
+	}
+
+	Con_Printf ("%s", msg);
+	S_Shutdown ();
+	snd_dmafailed = false;
+	if (action == DMA_RESTART)
+		S_Startup ();
+}
+
+
+// =======================================================================
+// Mixer thread
+// =======================================================================
+
+void S_LockMixer (void)
+{
+	if (snd_lock)
+		Sys_Lock (snd_lock);
+}
+
+void S_UnlockMixer (void)
+{
+	if (snd_lock)
+		Sys_Unlock (snd_lock);
+}
+
+static void S_MixerThread (void *data, int index)
+{
+	while (!snd_quit)
+	{
+		S_Update_ ();
+		Sys_Sleep ();
+	}
+}
+
+/*
+==================
+S_StartMixer
+==================
+*/
+static void S_StartMixer (void)
+{
+	if (snd_thread || fakedma || snd_wavout || COM_CheckParm ("-nosoundthread"))
+		return;
+
+	snd_quit = false;
+	snd_thread = Sys_CreateThread (S_MixerThread, NULL);
+	if (!snd_thread)
+		Con_SafePrintf ("Couldn't start the sound mixer thread\n");
+}
+
+/*
+==================
+S_StopMixer
+==================
+*/
+static void S_StopMixer (void)
+{
+	if (!snd_thread)
+		return;
+
+	snd_quit = true;
+	Sys_WaitThread (snd_thread);
+	snd_thread = NULL;
+}
+
+
 /*
 =================
 SND_PickChannel
@@ -371,7 +713,7 @@ channel_t *SND_PickChannel(int entnum, int entchannel)
 		}
 
 		// don't let monster sounds override player sounds
-		if (channels[ch_idx].entnum == cl.viewentity && entnum != cl.viewentity && channels[ch_idx].sfx)
+		if (channels[ch_idx].entnum == snd_listener.viewentity && entnum != snd_listener.viewentity && channels[ch_idx].sfx)
 			continue;
 
 		if (channels[ch_idx].end - paintedtime < life_left)
@@ -404,7 +746,7 @@ void SND_Spatialize(channel_t *ch)
 	sfx_t *snd;
 
 // anything coming from the view entity will allways be full volume
-	if (ch->entnum == cl.viewentity)
+	if (ch->entnum == snd_listener.viewentity)
 	{
 		ch->leftvol = ch->master_vol;
 		ch->rightvol = ch->master_vol;
@@ -414,11 +756,11 @@ void SND_Spatialize(channel_t *ch)
 // calculate stereo seperation and distance attenuation
 
 	snd = ch->sfx;
-	VectorSubtract(ch->origin, listener_origin, source_vec);
+	VectorSubtract(ch->origin, snd_listener.origin, source_vec);
 	
 	dist = VectorNormalize(source_vec) * ch->dist_mult;
 	
-	dot = DotProduct(listener_right, source_vec);
+	dot = DotProduct(snd_listener.right, source_vec);
 
 	if (shm->channels == 1)
 	{
@@ -444,17 +786,102 @@ void SND_Spatialize(channel_t *ch)
 }           
 
 
+// =======================================================================
+// Virtual voices
+// =======================================================================
+
+/*
+=================
+SND_Resume
+
+A channel that isn't painted keeps its place only in end, as the painter
+holds pos + end - paintedtime to the sound's length.  Works out pos again
+for a channel coming back into earshot.
+=================
+*/
+static void SND_Resume (channel_t *ch)
+{
+	sfxcache_t	*sc;
+	int			looplength;
+
+	sc = SND_GetCache (ch->sfx);
+	if (!sc)
+		return;		// the painter restarts it at the loop once it's back
+
+	if (ch->end > paintedtime)
+	{
+		ch->pos = sc->length - (ch->end - paintedtime);
+		return;
+	}
+
+	if (sc->loopstart < 0)
+	{
+		ch->sfx = NULL;		// finished while it couldn't be heard
+		return;
+	}
+
+	looplength = sc->length - sc->loopstart;
+	ch->pos = sc->loopstart + (paintedtime - ch->end) % looplength;
+	ch->end = paintedtime + sc->length - ch->pos;
+}
+
+/*
+=================
+SND_SetVirtual
+=================
+*/
+static void SND_SetVirtual (channel_t *ch, qboolean virtualized)
+{
+	if (!virtualized && ch->virtualized)
+		SND_Resume (ch);
+	ch->virtualized = virtualized;
+}
+
+/*
+=================
+SND_Bucket
+=================
+*/
+static int SND_Bucket (int x, int y, int z)
+{
+	return (x * 73856093 ^ y * 19349663 ^ z * 83492791) & (SND_BUCKETS-1);
+}
+
+/*
+=================
+SND_AddStatic
+=================
+*/
+static void SND_AddStatic (channel_t *ch)
+{
+	int		b;
+	float	range;
+
+	b = SND_Bucket ((int)floor (ch->origin[0] / SND_CELLSIZE),
+		(int)floor (ch->origin[1] / SND_CELLSIZE),
+		(int)floor (ch->origin[2] / SND_CELLSIZE));
+	snd_bucketnext[ch - channels] = snd_buckets[b];
+	snd_buckets[b] = ch;
+
+// SND_Spatialize takes the distance times dist_mult off a full volume
+	if (ch->dist_mult > 0)
+		range = 1.0 / ch->dist_mult;
+	else
+		range = 1.0e9;		// heard everywhere
+	if (range > snd_staticrange)
+		snd_staticrange = range;
+
+	snd_numstaticvoices++;
+}
+
+
 // =======================================================================
 // Start a sound effect
 // =======================================================================
 
 void S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation)
 {
-	channel_t *target_chan, *check;
-	sfxcache_t	*sc;
-	int		vol;
-	int		ch_idx;
-	int		skip;
+	sndcmd_t	*cmd;
 
 	if (!sound_started)
 		return;
@@ -465,34 +892,56 @@ void S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float f
 	if (nosound.value)
 		return;
 
-	vol = fvol*255;
+// the mixer can't load sounds, so make sure it's in
+	if (!S_LoadSound (sfx))
+		return;		// couldn't load the sound's data
+
+	cmd = S_AllocCommand (sc_start);
+	cmd->sfx = sfx;
+	cmd->entnum = entnum;
+	cmd->entchannel = entchannel;
+	VectorCopy (origin, cmd->origin);
+	cmd->vol = fvol;
+	cmd->attenuation = attenuation;
+	S_SubmitCommand ();
+}
+
+static void SND_StartSound (sndcmd_t *cmd)
+{
+	channel_t *target_chan, *check;
+	sfxcache_t	*sc;
+	int		vol;
+	int		ch_idx;
+	int		skip;
+
+	vol = cmd->vol*255;
 
 // pick a channel to play on
-	target_chan = SND_PickChannel(entnum, entchannel);
+	target_chan = SND_PickChannel(cmd->entnum, cmd->entchannel);
 	if (!target_chan)
 		return;
 		
 // spatialize
 	memset (target_chan, 0, sizeof(*target_chan));
-	VectorCopy(origin, target_chan->origin);
-	target_chan->dist_mult = attenuation / sound_nominal_clip_dist;
+	VectorCopy(cmd->origin, target_chan->origin);
+	target_chan->dist_mult = cmd->attenuation / sound_nominal_clip_dist;
 	target_chan->master_vol = vol;
-	target_chan->entnum = entnum;
-	target_chan->entchannel = entchannel;
+	target_chan->entnum = cmd->entnum;
+	target_chan->entchannel = cmd->entchannel;
 	SND_Spatialize(target_chan);
 
 	if (!target_chan->leftvol && !target_chan->rightvol)
 		return;		// not audible at all
 
 // new channel
-	sc = S_LoadSound (sfx);
+	sc = SND_GetCache (cmd->sfx);
 	if (!sc)
 	{
 		target_chan->sfx = NULL;
-		return;		// couldn't load the sound's data
+		return;		// flushed since it was queued
 	}
 
-	target_chan->sfx = sfx;
+	target_chan->sfx = cmd->sfx;
 	target_chan->pos = 0.0;
     target_chan->end = paintedtime + sc->length;	
 
@@ -503,7 +952,7 @@ void S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float f
     {
 		if (check == target_chan)
 			continue;
-		if (check->sfx == sfx && !check->pos)
+		if (check->sfx == cmd->sfx && !check->pos)
 		{
 			skip = rand () % (int)(0.1*shm->speed);
 			if (skip >= target_chan->end)
@@ -517,6 +966,19 @@ void S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float f
 }
 
 void S_StopSound(int entnum, int entchannel)
+{
+	sndcmd_t	*cmd;
+
+	if (!sound_started)
+		return;
+
+	cmd = S_AllocCommand (sc_stop);
+	cmd->entnum = entnum;
+	cmd->entchannel = entchannel;
+	S_SubmitCommand ();
+}
+
+static void SND_StopSound(int entnum, int entchannel)
 {
 	int i;
 
@@ -534,11 +996,24 @@ void S_StopSound(int entnum, int entchannel)
 
 void S_StopAllSounds(qboolean clear)
 {
-	int		i;
+	sndcmd_t	*cmd;
 
 	if (!sound_started)
 		return;
 
+	snd_numstatics = 0;
+	memset (snd_ambientsfx, 0, sizeof(snd_ambientsfx));
+	memset (snd_ambientvol, 0, sizeof(snd_ambientvol));
+
+	cmd = S_AllocCommand (sc_stopall);
+	cmd->clear = clear;
+	S_SubmitCommand ();
+}
+
+static void SND_StopAllSounds(qboolean clear)
+{
+	int		i;
+
 	total_channels = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;	// no statics
 
 	for (i=0 ; i<MAX_CHANNELS ; i++)
@@ -547,8 +1022,13 @@ void S_StopAllSounds(qboolean clear)
 
 	Q_memset(channels, 0, MAX_CHANNELS * sizeof(channel_t));
 
+	memset (snd_buckets, 0, sizeof(snd_buckets));
+	snd_staticrange = 0;
+	snd_numstaticvoices = 0;
+	snd_numheard = 0;
+
 	if (clear)
-		S_ClearBuffer ();
+		SND_ClearBuffer ();
 }
 
 void S_StopAllSoundsC (void)
@@ -557,6 +1037,15 @@ void S_StopAllSoundsC (void)
 }
 
 void S_ClearBuffer (void)
+{
+	if (!sound_started)
+		return;
+
+	S_AllocCommand (sc_clearbuffer);
+	S_SubmitCommand ();
+}
+
+static void SND_ClearBuffer (void)
 {
 	int		clear;
 		
@@ -586,15 +1075,13 @@ void S_ClearBuffer (void)
 		{
 			if (hresult != DSERR_BUFFERLOST)
 			{
-				Con_Printf ("S_ClearBuffer: DS::Lock Sound Buffer Failed\n");
-				S_Shutdown ();
+				S_DMAError ("S_ClearBuffer: DS::Lock Sound Buffer Failed\n", DMA_SHUTDOWN);
 				return;
 			}
 
 			if (++reps > 10000)
 			{
-				Con_Printf ("S_ClearBuffer: DS: couldn't restore buffer\n");
-				S_Shutdown ();
+				S_DMAError ("S_ClearBuffer: DS: couldn't restore buffer\n", DMA_SHUTDOWN);
 				return;
 			}
 		}
@@ -619,38 +1106,64 @@ S_StaticSound
 */
 void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 {
-	channel_t	*ss;
-	sfxcache_t		*sc;
+	sndcmd_t	*cmd;
+	sfxcache_t	*sc;
 
 	if (!sfx)
 		return;
 
-	if (total_channels == MAX_CHANNELS)
+	if (MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS + snd_numstatics == MAX_CHANNELS)
 	{
 		Con_Printf ("total_channels == MAX_CHANNELS\n");
 		return;
 	}
 
+	snd_numstatics++;
+
+// the channel is used up even if the sound can't be played
+	sc = S_LoadSound (sfx);
+	if (sc && sc->loopstart == -1)
+	{
+		Con_Printf ("Sound %s not looped\n", sfx->name);
+		sc = NULL;
+	}
+
+	cmd = S_AllocCommand (sc_static);
+	if (sc)
+		cmd->sfx = sfx;
+	VectorCopy (origin, cmd->origin);
+	cmd->vol = vol;
+	cmd->attenuation = attenuation;
+	S_SubmitCommand ();
+}
+
+static void SND_StaticSound (sndcmd_t *cmd)
+{
+	channel_t	*ss;
+	sfxcache_t		*sc;
+
+	if (total_channels == MAX_CHANNELS)
+		return;
+
 	ss = &channels[total_channels];
 	total_channels++;
 
-	sc = S_LoadSound (sfx);
-	if (!sc)
+	if (!cmd->sfx)
 		return;
 
-	if (sc->loopstart == -1)
-	{
-		Con_Printf ("Sound %s not looped\n", sfx->name);
+	sc = SND_GetCache (cmd->sfx);
+	if (!sc)
 		return;
-	}
-	
-	ss->sfx = sfx;
-	VectorCopy (origin, ss->origin);
-	ss->master_vol = vol;
-	ss->dist_mult = (attenuation/64) / sound_nominal_clip_dist;
+
+	ss->sfx = cmd->sfx;
+	VectorCopy (cmd->origin, ss->origin);
+	ss->master_vol = cmd->vol;
+	ss->dist_mult = (cmd->attenuation/64) / sound_nominal_clip_dist;
     ss->end = paintedtime + sc->length;	
-	
-	SND_Spatialize (ss);
+
+// it is heard from the next listener update on
+	ss->virtualized = true;
+	SND_AddStatic (ss);
 }
 
 
@@ -659,6 +1172,8 @@ void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 /*
 ===================
 S_UpdateAmbientSounds
+
+Works out the ambient levels for the next listener command
 ===================
 */
 void S_UpdateAmbientSounds (void)
@@ -666,7 +1181,6 @@ void S_UpdateAmbientSounds (void)
 	mleaf_t		*l;
 	float		vol;
 	int			ambient_channel;
-	channel_t	*chan;
 
 	if (!snd_ambient)
 		return;
@@ -679,34 +1193,31 @@ void S_UpdateAmbientSounds (void)
 	if (!l || !ambient_level.value)
 	{
 		for (ambient_channel = 0 ; ambient_channel< NUM_AMBIENTS ; ambient_channel++)
-			channels[ambient_channel].sfx = NULL;
+			snd_ambientsfx[ambient_channel] = NULL;
 		return;
 	}
 
 	for (ambient_channel = 0 ; ambient_channel< NUM_AMBIENTS ; ambient_channel++)
 	{
-		chan = &channels[ambient_channel];	
-		chan->sfx = ambient_sfx[ambient_channel];
+		snd_ambientsfx[ambient_channel] = ambient_sfx[ambient_channel];
 	
 		vol = ambient_level.value * l->ambient_sound_level[ambient_channel];
 		if (vol < 8)
 			vol = 0;
 
 	// don't adjust volume too fast
-		if (chan->master_vol < vol)
+		if (snd_ambientvol[ambient_channel] < vol)
 		{
-			chan->master_vol += host_frametime * ambient_fade.value;
-			if (chan->master_vol > vol)
-				chan->master_vol = vol;
+			snd_ambientvol[ambient_channel] += host_frametime * ambient_fade.value;
+			if (snd_ambientvol[ambient_channel] > vol)
+				snd_ambientvol[ambient_channel] = vol;
 		}
-		else if (chan->master_vol > vol)
+		else if (snd_ambientvol[ambient_channel] > vol)
 		{
-			chan->master_vol -= host_frametime * ambient_fade.value;
-			if (chan->master_vol < vol)
-				chan->master_vol = vol;
+			snd_ambientvol[ambient_channel] -= host_frametime * ambient_fade.value;
+			if (snd_ambientvol[ambient_channel] < vol)
+				snd_ambientvol[ambient_channel] = vol;
 		}
-		
-		chan->leftvol = chan->rightvol = chan->master_vol;
 	}
 }
 
@@ -720,10 +1231,9 @@ Called once each time through the main loop
 */
 void S_Update(vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 {
-	int			i, j;
-	int			total;
-	channel_t	*ch;
-	channel_t	*combine;
+	sndcmd_t	*cmd;
+
+	S_CheckDMAError ();
 
 	if (!sound_started || (snd_blocked > 0))
 		return;
@@ -736,75 +1246,224 @@ void S_Update(vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 // update general area ambient sound sources
 	S_UpdateAmbientSounds ();
 
-	combine = NULL;
+// bring back anything the mixer found flushed from the cache
+	S_LoadFlushedSounds ();
 
-// update spatialization for static and dynamic sounds	
-	ch = channels+NUM_AMBIENTS;
-	for (i=NUM_AMBIENTS ; i<total_channels; i++, ch++)
+	cmd = S_AllocCommand (sc_listener);
+	VectorCopy (listener_origin, cmd->listener.origin);
+	VectorCopy (listener_right, cmd->listener.right);
+	cmd->listener.viewentity = cl.viewentity;
+	memcpy (cmd->listener.ambient_sfx, snd_ambientsfx, sizeof(snd_ambientsfx));
+	memcpy (cmd->listener.ambient_vol, snd_ambientvol, sizeof(snd_ambientvol));
+	S_SubmitCommand ();
+
+//
+// debugging output
+//
+	if (snd_show.value)
+		Con_Printf ("----(%i, %i virtual)----\n", snd_active, snd_virtual);
+
+// mix some sound
+	if (snd_wavout)
+		SNDWAV_Update (host_frametime);
+	if (!snd_thread)
+		S_Update_();
+}
+
+/*
+============
+SND_SetListener
+============
+*/
+static void SND_SetListener (sndlistener_t *listener)
+{
+	int			ambient_channel;
+	channel_t	*chan;
+
+	snd_listener = *listener;
+	snd_respatialize = true;
+
+	for (ambient_channel = 0 ; ambient_channel< NUM_AMBIENTS ; ambient_channel++)
+	{
+		chan = &channels[ambient_channel];	
+		chan->sfx = listener->ambient_sfx[ambient_channel];
+		chan->master_vol = listener->ambient_vol[ambient_channel];
+		chan->leftvol = chan->rightvol = chan->master_vol;
+		SND_SetVirtual (chan, !chan->sfx || !chan->master_vol);
+	}
+}
+
+/*
+============
+SND_RunCommands
+
+Applies everything the main thread has queued
+============
+*/
+static void SND_RunCommands (void)
+{
+	unsigned	head;
+	sndcmd_t	*cmd;
+
+	head = snd_cmdhead;
+	Sys_MemoryBarrier ();	// entries are read after the head that covers them
+
+	while (snd_cmdtail != head)
+	{
+		cmd = &snd_cmds[snd_cmdtail & (MAX_SOUNDCMDS-1)];
+		switch (cmd->type)
+		{
+		case sc_start:
+			SND_StartSound (cmd);
+			break;
+		case sc_stop:
+			SND_StopSound (cmd->entnum, cmd->entchannel);
+			break;
+		case sc_static:
+			SND_StaticSound (cmd);
+			break;
+		case sc_stopall:
+			SND_StopAllSounds (cmd->clear);
+			break;
+		case sc_clearbuffer:
+			SND_ClearBuffer ();
+			break;
+		case sc_listener:
+			SND_SetListener (&cmd->listener);
+			break;
+		}
+
+		Sys_MemoryBarrier ();	// done with the entry before it is handed back
+		snd_cmdtail++;
+	}
+}
+
+/*
+============
+SND_HearBucket
+
+Spatializes the statics in a bucket, adding the ones that can be heard
+to snd_heard.  A static with the same sound as one already heard is
+combined with it, so we don't mix five torches every frame.
+============
+*/
+static void SND_HearBucket (int b)
+{
+	int			i;
+	channel_t	*ch;
+
+	for (ch = snd_buckets[b] ; ch ; ch = snd_bucketnext[ch - channels])
 	{
+		if (snd_visited[ch - channels] == snd_visitframe)
+			continue;
+		snd_visited[ch - channels] = snd_visitframe;
+
 		if (!ch->sfx)
 			continue;
-		SND_Spatialize(ch);         // respatialize channel
+		SND_Spatialize (ch);
 		if (!ch->leftvol && !ch->rightvol)
+		{
+			SND_SetVirtual (ch, true);
 			continue;
+		}
 
-	// try to combine static sounds with a previous channel of the same
-	// sound effect so we don't mix five torches every frame
-	
-		if (i >= MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS)
+		for (i=0 ; i<snd_numheard ; i++)
+			if (snd_heard[i]->sfx == ch->sfx)
+				break;
+		if (i < snd_numheard)
 		{
-		// see if it can just use the last one
-			if (combine && combine->sfx == ch->sfx)
-			{
-				combine->leftvol += ch->leftvol;
-				combine->rightvol += ch->rightvol;
-				ch->leftvol = ch->rightvol = 0;
-				continue;
-			}
-		// search for one
-			combine = channels+MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;
-			for (j=MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS ; j<i; j++, combine++)
-				if (combine->sfx == ch->sfx)
-					break;
-					
-			if (j == total_channels)
-			{
-				combine = NULL;
-			}
-			else
-			{
-				if (combine != ch)
-				{
-					combine->leftvol += ch->leftvol;
-					combine->rightvol += ch->rightvol;
-					ch->leftvol = ch->rightvol = 0;
-				}
-				continue;
-			}
+			snd_heard[i]->leftvol += ch->leftvol;
+			snd_heard[i]->rightvol += ch->rightvol;
+			ch->leftvol = ch->rightvol = 0;
+			SND_SetVirtual (ch, true);
+			continue;
 		}
-		
-		
+
+		SND_SetVirtual (ch, false);
+		if (ch->sfx)
+			snd_heard[snd_numheard++] = ch;
 	}
+}
 
-//
-// debugging output
-//
-	if (snd_show.value)
+/*
+============
+SND_UpdateChannels
+
+Respatializes everything for a new listener position
+============
+*/
+static void SND_UpdateChannels (void)
+{
+	int			i, x, y, z;
+	int			mins[3], maxs[3], cells;
+	int			active;
+	channel_t	*ch;
+	channel_t	*lastheard[MAX_CHANNELS];
+	int			numlastheard;
+
+// update spatialization for dynamic sounds
+	active = 0;
+	ch = channels+NUM_AMBIENTS;
+	for (i=NUM_AMBIENTS ; i<MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS ; i++, ch++)
 	{
-		total = 0;
-		ch = channels;
-		for (i=0 ; i<total_channels; i++, ch++)
-			if (ch->sfx && (ch->leftvol || ch->rightvol) )
-			{
-				//Con_Printf ("%3i %3i %s\n", ch->leftvol, ch->rightvol, ch->sfx->name);
-				total++;
-			}
-		
-		Con_Printf ("----(%i)----\n", total);
+		if (!ch->sfx)
+			continue;
+		SND_Spatialize(ch);         // respatialize channel
+		SND_SetVirtual (ch, !ch->leftvol && !ch->rightvol);
+		if (ch->sfx && !ch->virtualized)
+			active++;
+	}
+	for (i=0 ; i<NUM_AMBIENTS ; i++)
+		if (channels[i].sfx && !channels[i].virtualized)
+			active++;
+
+// only the statics in cells near enough to be heard are looked at
+	numlastheard = snd_numheard;
+	memcpy (lastheard, snd_heard, numlastheard * sizeof(*lastheard));
+	snd_numheard = 0;
+	snd_visitframe++;
+
+	cells = SND_BUCKETS + 1;
+	if (snd_staticrange < SND_CELLSIZE * SND_BUCKETS)
+	{
+		cells = 1;
+		for (i=0 ; i<3 ; i++)
+		{
+			mins[i] = (int)floor ((snd_listener.origin[i] - snd_staticrange) / SND_CELLSIZE);
+			maxs[i] = (int)floor ((snd_listener.origin[i] + snd_staticrange) / SND_CELLSIZE);
+			cells *= maxs[i] - mins[i] + 1;
+		}
 	}
 
-// mix some sound
-	S_Update_();
+	if (cells > SND_BUCKETS)
+	{	// every bucket would be looked at anyway
+		for (i=0 ; i<SND_BUCKETS ; i++)
+			SND_HearBucket (i);
+	}
+	else
+	{
+		for (x=mins[0] ; x<=maxs[0] ; x++)
+			for (y=mins[1] ; y<=maxs[1] ; y++)
+				for (z=mins[2] ; z<=maxs[2] ; z++)
+					SND_HearBucket (SND_Bucket (x, y, z));
+	}
+
+// statics that were heard but are out of range now
+	for (i=0 ; i<numlastheard ; i++)
+	{
+		ch = lastheard[i];
+		if (snd_visited[ch - channels] == snd_visitframe)
+			continue;
+		ch->leftvol = ch->rightvol = 0;
+		SND_SetVirtual (ch, true);
+	}
+
+// counts for snd_show
+	snd_active = active + snd_numheard;
+	snd_virtual = snd_numstaticvoices - snd_numheard;
+	for (i=0 ; i<MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS ; i++)
+		if (channels[i].sfx && channels[i].virtualized)
+			snd_virtual++;
 }
 
 void GetSoundtime(void)
@@ -820,6 +1479,15 @@ void GetSoundtime(void)
 // calls to S_Update.  Oh well.
 	samplepos = SNDDMA_GetDMAPos();
 
+	if (snd_resync)
+	{	// a device that was just started counts from its own position,
+		// so count its buffers from where painting had got to
+		buffers = (paintedtime - samplepos/shm->channels + fullsamples - 1) / fullsamples;
+		if (buffers < 0)
+			buffers = 0;
+		oldsamplepos = samplepos;
+		snd_resync = false;
+	}
 
 	if (samplepos < oldsamplepos)
 	{
@@ -829,7 +1497,7 @@ void GetSoundtime(void)
 		{	// time to chop things off to avoid 32 bit limits
 			buffers = 0;
 			paintedtime = fullsamples;
-			S_StopAllSounds (true);
+			SND_StopAllSounds (true);
 		}
 	}
 	oldsamplepos = samplepos;
@@ -846,16 +1514,34 @@ void S_ExtraUpdate (void)
 
 	if (snd_noextraupdate.value)
 		return;		// don't pollute timings
+	if (snd_thread)
+		return;		// it keeps itself ahead
 	S_Update_();
 }
 
-void S_Update_(void)
+/*
+============
+SND_Paint
+
+Mixes ahead of the dma position
+============
+*/
+static void SND_Paint (void)
 {
 	unsigned        endtime;
 	int				samps;
-	
-	if (!sound_started || (snd_blocked > 0))
+
+	if (snd_respatialize)
+	{
+		SND_UpdateChannels ();
+		snd_respatialize = false;
+	}
+
+	if (snd_wavout)
+	{
+		SNDWAV_Paint ();
 		return;
+	}
 
 // Updates DMA time
 	GetSoundtime();
@@ -881,7 +1567,7 @@ void S_Update_(void)
 		if (pDSBuf)
 		{
 			if (pDSBuf->lpVtbl->GetStatus (pDSBuf, &dwStatus) != DD_OK)
-				Con_Printf ("Couldn't get sound buffer status\n");
+				S_DMAError ("Couldn't get sound buffer status\n", DMA_WARN);
 			
 			if (dwStatus & DSBSTATUS_BUFFERLOST)
 				pDSBuf->lpVtbl->Restore (pDSBuf);
@@ -897,6 +1583,30 @@ void S_Update_(void)
 	SNDDMA_Submit ();
 }
 
+/*
+============
+S_Update_
+
+A pass of the mixer, on its thread or from S_Update and S_ExtraUpdate
+============
+*/
+void S_Update_(void)
+{
+	if (!sound_started)
+		return;
+
+	S_LockMixer ();
+	Cache_Lock ();		// sound data can't be flushed while it is painted
+
+	SND_RunCommands ();
+
+	if (snd_blocked <= 0 && !snd_dmafailed)
+		SND_Paint ();
+
+	Cache_Unlock ();
+	S_UnlockMixer ();
+}
+
 /*
 ===============================================================================
 
@@ -978,6 +1688,68 @@ void S_SoundList(void)
 }
 
 
+static qboolean S_WavName (char *out, char *name)
+{
+	if (strstr(name, ".."))
+	{
+		Con_Printf ("Relative pathnames are not allowed.\n");
+		return false;
+	}
+	if (strlen(com_gamedir) + strlen(name) + 6 > MAX_OSPATH)
+	{
+		Con_Printf ("%s: name too long\n", name);
+		return false;
+	}
+	sprintf (out, "%s/%s", com_gamedir, name);
+	COM_DefaultExtension (out, ".wav");
+	return true;
+}
+
+/*
+==================
+S_WavOut_f
+
+snd_wavout <file> restarts the sound on the offline driver, mixing into
+a wav file in the game directory; snd_wavout on its own finishes the
+file and goes back to the sound card
+==================
+*/
+void S_WavOut_f (void)
+{
+	char	name[MAX_OSPATH];
+
+	if (Cmd_Argc () > 2)
+	{
+		Con_Printf ("snd_wavout [file] : mix sound into a wav file\n");
+		return;
+	}
+	if (fakedma)
+	{
+		Con_Printf ("snd_wavout: not with -simsound\n");
+		return;
+	}
+	if (Cmd_Argc () == 1 && !snd_wavout)
+	{
+		Con_Printf ("not writing a wav file\n");
+		return;
+	}
+	if (Cmd_Argc () == 2 && !S_WavName (name, Cmd_Argv(1)))
+		return;
+
+// keep the rate the sounds were resampled for
+	if (shm)
+		snd_wavspeed = shm->speed;
+
+	S_Shutdown ();
+
+	snd_wavout = (Cmd_Argc () == 2);
+	if (snd_wavout)
+		Q_strcpy (snd_wavname, name);
+
+	S_Startup ();
+}
+
+
 void S_LocalSound (char *sound)
 {
 	sfx_t	*sfx;
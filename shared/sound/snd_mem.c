@@ -23,8 +23,148 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 int			cache_full_cycle;
 
+cvar_t	snd_filter = {"snd_filter", "1", true};			// 0 = point sample like the original
+cvar_t	snd_diskcache = {"snd_diskcache", "1", true};	// keep resampled sounds in soundcache/
+
 byte *S_Alloc (int size);
 
+/*
+===============================================================================
+
+POLYPHASE RESAMPLING
+
+Each output sample is a windowed sinc over the SND_TAPS source samples
+around it.  The fractional source position is rounded to one of
+SND_PHASES filters, which are made once for each pair of rates.  The
+SSE2 and portable loops add the taps up in the same order, so they give
+the same samples and a saved sound doesn't depend on the cpu that made it.
+
+===============================================================================
+*/
+
+#define	SND_TAPS	16
+#define	SND_PHASES	256
+
+static	float	snd_filters[SND_PHASES][SND_TAPS];
+static	int		snd_filterin, snd_filterout;	// rates they were made for
+
+/*
+================
+SND_MakeFilters
+================
+*/
+static void SND_MakeFilters (int inrate, int outrate)
+{
+	int		phase, tap;
+	double	cutoff, x, h, sum;
+
+	if (snd_filterin == inrate && snd_filterout == outrate)
+		return;
+	snd_filterin = inrate;
+	snd_filterout = outrate;
+
+// when decimating, cut off at the new nyquist frequency
+	cutoff = 1.0;
+	if (outrate < inrate)
+		cutoff = (double)outrate / inrate;
+
+	for (phase=0 ; phase<SND_PHASES ; phase++)
+	{
+		sum = 0;
+		for (tap=0 ; tap<SND_TAPS ; tap++)
+		{
+		// distance from the output sample to the tap's source sample
+			x = tap - (SND_TAPS/2 - 1) - (double)phase / SND_PHASES;
+			if (x == 0)
+				h = cutoff;
+			else
+				h = sin (M_PI * cutoff * x) / (M_PI * x);
+			h *= 0.5 + 0.5 * cos (M_PI * x / (SND_TAPS/2));	// hann window
+			snd_filters[phase][tap] = h;
+			sum += h;
+		}
+
+	// unity gain, so a steady level stays put
+		for (tap=0 ; tap<SND_TAPS ; tap++)
+			snd_filters[phase][tap] /= sum;
+	}
+}
+
+/*
+================
+SND_StoreSample
+================
+*/
+static void SND_StoreSample (byte *out, int i, int width, float sum)
+{
+	int		sample;
+
+	if (sum >= 0)
+		sample = (int)(sum + 0.5f);
+	else
+		sample = (int)(sum - 0.5f);
+	if (sample > 32767)
+		sample = 32767;
+	else if (sample < -32768)
+		sample = -32768;
+
+	if (width == 2)
+		((short *)out)[i] = sample;
+	else
+		((signed char *)out)[i] = sample >> 8;
+}
+
+/*
+================
+SND_FilterSamples
+
+in holds the source after SND_TAPS/2 samples of silence, with SND_TAPS
+more after it in case rounding runs the last position off the end.
+Output sample i is taken from source position i * inrate / outrate, kept
+in 32.32 fixed point; the top bits of the fraction pick the filter.
+================
+*/
+static void SND_FilterSamples (float *in, int inrate, int outrate, byte *out, int outcount, int width)
+{
+	int		i;
+	unsigned long long	pos, step;
+	float	*s, *f;
+#ifdef idSSE2
+	__m128	acc;
+#else
+	float	lane[4];
+	int		j, k;
+#endif
+
+	SND_MakeFilters (inrate, outrate);
+
+	step = ((unsigned long long)inrate << 32) / outrate;
+	pos = 0;
+
+	for (i=0 ; i<outcount ; i++, pos += step)
+	{
+		f = snd_filters[(unsigned)pos / (0x100000000ULL / SND_PHASES)];
+		s = in + (int)(pos >> 32) + 1;		// back SND_TAPS/2 - 1, past the silence
+
+#ifdef idSSE2
+		acc = _mm_mul_ps (_mm_loadu_ps (s), _mm_loadu_ps (f));
+		acc = _mm_add_ps (acc, _mm_mul_ps (_mm_loadu_ps (s+4), _mm_loadu_ps (f+4)));
+		acc = _mm_add_ps (acc, _mm_mul_ps (_mm_loadu_ps (s+8), _mm_loadu_ps (f+8)));
+		acc = _mm_add_ps (acc, _mm_mul_ps (_mm_loadu_ps (s+12), _mm_loadu_ps (f+12)));
+		acc = _mm_add_ps (acc, _mm_movehl_ps (acc, acc));
+		acc = _mm_add_ss (acc, _mm_shuffle_ps (acc, acc, 1));
+		SND_StoreSample (out, i, width, _mm_cvtss_f32 (acc));
+#else
+		for (j=0 ; j<4 ; j++)
+			lane[j] = s[j] * f[j];
+		for (k=4 ; k<SND_TAPS ; k+=4)
+			for (j=0 ; j<4 ; j++)
+				lane[j] += s[k+j] * f[k+j];
+		SND_StoreSample (out, i, width, (lane[0] + lane[2]) + (lane[1] + lane[3]));
+#endif
+	}
+}
+
 /*
 ================
 ResampleSfx
@@ -37,6 +177,8 @@ void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 	float	stepscale;
 	int		i;
 	int		sample, samplefrac, fracstep;
+	int		incount;
+	float	*in;
 	sfxcache_t	*sc;
 	
 	sc = Cache_Check (&sfx->cache);
@@ -45,6 +187,7 @@ void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 
 	stepscale = (float)inrate / shm->speed;	// this is usually 0.5, 1, or 2
 
+	incount = sc->length;
 	outcount = sc->length / stepscale;
 	sc->length = outcount;
 	if (sc->loopstart != -1)
@@ -66,6 +209,22 @@ void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 			((signed char *)sc->data)[i]
 			= (int)( (unsigned char)(data[i]) - 128);
 	}
+	else if (stepscale != 1 && snd_filter.value
+	&& (in = malloc ((incount + SND_TAPS/2 + SND_TAPS) * sizeof(*in))) != NULL)
+	{
+// filtered
+		memset (in, 0, SND_TAPS/2 * sizeof(*in));
+		memset (in + SND_TAPS/2 + incount, 0, SND_TAPS * sizeof(*in));
+		for (i=0 ; i<incount ; i++)
+		{
+			if (inwidth == 2)
+				in[SND_TAPS/2 + i] = LittleShort ( ((short *)data)[i] );
+			else
+				in[SND_TAPS/2 + i] = (int)( (unsigned char)(data[i]) - 128) << 8;
+		}
+		SND_FilterSamples (in, inrate, shm->speed, sc->data, outcount, sc->width);
+		free (in);
+	}
 	else
 	{
 // general case
@@ -89,6 +248,157 @@ void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 
 //=============================================================================
 
+/*
+===============================================================================
+
+RESAMPLED SOUND CACHE
+
+Resampled sounds are saved under <gamedir>/soundcache/<rate>/ so the wav
+doesn't have to be parsed and filtered again when the sound is flushed
+or the next map precaches it.  A saved sound is used only if the wav is
+still the same: the same directory crc of the pak it came from, or the
+same modification time for a loose file, and the same size.
+
+===============================================================================
+*/
+
+#define	SNDCACHE_IDENT		(('D'<<24)+('N'<<16)+('S'<<8)+'Q')	// little-endian "QSND"
+#define	SNDCACHE_VERSION	1
+
+typedef struct
+{
+	int		ident;
+	int		version;
+	int		stamp;			// COM_FileStamp of the wav
+	int		filesize;		// size of the wav
+	int		filter;			// snd_filter it was resampled with
+	int		eightbit;		// loadas8bit it was loaded with
+	int		length;			// sfxcache_t fields
+	int		loopstart;
+	int		speed;
+	int		width;
+} dsndcache_t;
+
+/*
+================
+S_CachePath
+
+Returns false for names that would put the file outside the sound cache
+================
+*/
+static qboolean S_CachePath (sfx_t *s, char *path)
+{
+	char	base[MAX_QPATH];
+
+	if (strstr (s->name, ".."))
+		return false;
+
+	COM_StripExtension (s->name, base);
+	sprintf (path, "%s/soundcache/%i/%s.snd", com_gamedir, shm->speed, base);
+	return true;
+}
+
+/*
+================
+S_ReadCachedSound
+
+Reads a saved sound straight into the cache, or returns NULL if there
+isn't an up to date one
+================
+*/
+static sfxcache_t *S_ReadCachedSound (sfx_t *s, int stamp, int filesize)
+{
+	char		path[MAX_OSPATH];
+	dsndcache_t	header;
+	FILE		*f;
+	int			size;
+	sfxcache_t	*sc;
+
+	if (!S_CachePath (s, path))
+		return NULL;
+	f = fopen (path, "rb");
+	if (!f)
+		return NULL;
+
+	if (fread (&header, sizeof(header), 1, f) != 1
+	|| header.ident != SNDCACHE_IDENT || header.version != SNDCACHE_VERSION
+	|| header.stamp != stamp || header.filesize != filesize
+	|| header.filter != (snd_filter.value != 0) || header.eightbit != (loadas8bit.value != 0)
+	|| header.speed != shm->speed || header.length < 0
+	|| (header.width != 1 && header.width != 2)
+	|| header.length > (0x7fffffff - sizeof(sfxcache_t)) / header.width
+	|| header.loopstart < -1 || header.loopstart >= header.length)
+	{
+		fclose (f);
+		return NULL;
+	}
+
+	size = header.length * header.width;
+	sc = Cache_Alloc (&s->cache, size + sizeof(sfxcache_t), s->name);
+	if (!sc)
+	{
+		fclose (f);
+		return NULL;
+	}
+
+	sc->length = header.length;
+	sc->loopstart = header.loopstart;
+	sc->speed = header.speed;
+	sc->width = header.width;
+	sc->stereo = 0;
+	if (fread (sc->data, 1, size, f) != size)
+	{
+		Cache_Free (&s->cache);
+		sc = NULL;
+	}
+
+	fclose (f);
+	return sc;
+}
+
+/*
+================
+S_WriteCachedSound
+================
+*/
+static void S_WriteCachedSound (sfx_t *s, sfxcache_t *sc, int stamp, int filesize)
+{
+	char		path[MAX_OSPATH];
+	dsndcache_t	header;
+	FILE		*f;
+	int			size;
+
+	if (!S_CachePath (s, path))
+		return;
+	COM_CreatePath (path);
+	f = fopen (path, "wb");
+	if (!f)
+		return;		// read only game directory, just don't save it
+
+	header.ident = SNDCACHE_IDENT;
+	header.version = SNDCACHE_VERSION;
+	header.stamp = stamp;
+	header.filesize = filesize;
+	header.filter = snd_filter.value != 0;
+	header.eightbit = loadas8bit.value != 0;
+	header.length = sc->length;
+	header.loopstart = sc->loopstart;
+	header.speed = sc->speed;
+	header.width = sc->width;
+
+	size = sc->length * sc->width;
+	if (fwrite (&header, sizeof(header), 1, f) != 1
+	|| fwrite (sc->data, 1, size, f) != size)
+	{
+		fclose (f);
+		remove (path);		// a short file would only be thrown out later
+		return;
+	}
+	fclose (f);
+}
+
+//=============================================================================
+
 /*
 ==============
 S_LoadSound
@@ -102,6 +412,7 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 	int		len;
 	float	stepscale;
 	sfxcache_t	*sc;
+	int		stamp, filesize;
 	byte	stackbuf[1*1024];		// avoid dirtying the cache heap
 
 // see if still in memory
@@ -114,9 +425,24 @@ sfxcache_t *S_LoadSound (sfx_t *s)
     Q_strcpy(namebuffer, "sound/");
     Q_strcat(namebuffer, s->name);
 
+// see if it was saved already resampled
+	stamp = COM_FileStamp (namebuffer);
+	filesize = com_filesize;
+	if (stamp != -1 && snd_diskcache.value)
+	{
+		Cache_Lock ();
+		sc = S_ReadCachedSound (s, stamp, filesize);
+		Cache_Unlock ();
+		if (sc)
+			return sc;
+	}
+
 //	Con_Printf ("loading %s\n",namebuffer);
 
-	data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf));
+// wavs in a mapped pak are resampled straight out of the mapping
+	data = COM_MapFile(namebuffer);
+	if (!data)
+		data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf));
 
 	if (!data)
 	{
@@ -136,9 +462,16 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 
 	len = len * info.width * info.channels;
 
+// the mixer reads s->cache.data under the cache lock, so keep it until
+// the sound is filled in
+	Cache_Lock ();
+
 	sc = Cache_Alloc ( &s->cache, len + sizeof(sfxcache_t), s->name);
 	if (!sc)
+	{
+		Cache_Unlock ();
 		return NULL;
+	}
 	
 	sc->length = info.samples;
 	sc->loopstart = info.loopstart;
@@ -148,6 +481,12 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 
 	ResampleSfx (s, sc->speed, sc->width, data + info.dataofs);
 
+	Cache_Unlock ();
+
+// only this thread moves cache data, so it can be saved outside the lock
+	if (stamp != -1 && snd_diskcache.value)
+		S_WriteCachedSound (s, sc, stamp, filesize);
+
 	return sc;
 }
 
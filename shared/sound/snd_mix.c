@@ -27,12 +27,37 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define DWORD	unsigned long
 #endif
 
+// the AVX2 kernels are built whenever the compiler can target them and
+// are only used if the cpu reports support at startup
+#if defined(idSSE2) && (defined(_MSC_VER) || defined(__GNUC__))
+#define idAVX2	1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET	__attribute__((target("avx2")))
+#endif
+#endif
+
 #define	PAINTBUFFER_SIZE	512
 portable_samplepair_t paintbuffer[PAINTBUFFER_SIZE];
 int		snd_scaletable[32][256];
 int 	*snd_p, snd_linear_count, snd_vol;
 short	*snd_out;
 
+cvar_t	snd_simd = {"snd_simd", "1"};
+
+typedef struct
+{
+	char	*name;
+	void	(*paint8) (channel_t *ch, sfxcache_t *sc, int count);
+	void	(*paint16) (channel_t *ch, sfxcache_t *sc, int count);
+	void	(*transfer) (void);		// snd_p to snd_out, see Snd_WriteLinearBlastStereo16
+} sndkernel_t;
+
+static	sndkernel_t	*snd_kernel;
+
 void Snd_WriteLinearBlastStereo16 (void);
 
 #if	!id386
@@ -62,6 +87,83 @@ void Snd_WriteLinearBlastStereo16 (void)
 }
 #endif
 
+#ifdef idSSE2
+/*
+================
+Snd_MulLo32
+
+32 bit multiply keeping the low half, which SSE2 only has for unsigned pairs
+================
+*/
+static __m128i Snd_MulLo32 (__m128i a, __m128i b)
+{
+	__m128i	even, odd;
+
+	even = _mm_mul_epu32 (a, b);
+	odd = _mm_mul_epu32 (_mm_srli_si128 (a, 4), _mm_srli_si128 (b, 4));
+	return _mm_unpacklo_epi32 (_mm_shuffle_epi32 (even, _MM_SHUFFLE(0,0,2,0)),
+		_mm_shuffle_epi32 (odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+static void Snd_WriteLinearBlastStereo16_SSE2 (void)
+{
+	int		i;
+	int		val;
+	__m128i	vol, a, b;
+
+	vol = _mm_set1_epi32 (snd_vol);
+	for (i=0 ; i+8<=snd_linear_count ; i+=8)
+	{
+		a = _mm_loadu_si128 ((__m128i *)(snd_p + i));
+		b = _mm_loadu_si128 ((__m128i *)(snd_p + i + 4));
+		a = _mm_srai_epi32 (Snd_MulLo32 (a, vol), 8);
+		b = _mm_srai_epi32 (Snd_MulLo32 (b, vol), 8);
+		_mm_storeu_si128 ((__m128i *)(snd_out + i), _mm_packs_epi32 (a, b));	// saturates
+	}
+
+	for ( ; i<snd_linear_count ; i++)
+	{
+		val = (snd_p[i]*snd_vol)>>8;
+		if (val > 0x7fff)
+			val = 0x7fff;
+		else if (val < (short)0x8000)
+			val = (short)0x8000;
+		snd_out[i] = val;
+	}
+}
+#endif
+
+#ifdef idAVX2
+AVX2_TARGET static void Snd_WriteLinearBlastStereo16_AVX2 (void)
+{
+	int		i;
+	int		val;
+	__m256i	vol, a, b;
+
+	vol = _mm256_set1_epi32 (snd_vol);
+	for (i=0 ; i+16<=snd_linear_count ; i+=16)
+	{
+		a = _mm256_loadu_si256 ((__m256i *)(snd_p + i));
+		b = _mm256_loadu_si256 ((__m256i *)(snd_p + i + 8));
+		a = _mm256_srai_epi32 (_mm256_mullo_epi32 (a, vol), 8);
+		b = _mm256_srai_epi32 (_mm256_mullo_epi32 (b, vol), 8);
+	// packs works within each 128 bit lane, so put the quads back in order
+		a = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), _MM_SHUFFLE(3,1,2,0));
+		_mm256_storeu_si256 ((__m256i *)(snd_out + i), a);
+	}
+
+	for ( ; i<snd_linear_count ; i++)
+	{
+		val = (snd_p[i]*snd_vol)>>8;
+		if (val > 0x7fff)
+			val = 0x7fff;
+		else if (val < (short)0x8000)
+			val = (short)0x8000;
+		snd_out[i] = val;
+	}
+}
+#endif
+
 void S_TransferStereo16 (int endtime)
 {
 	int		lpos;
@@ -89,17 +191,13 @@ void S_TransferStereo16 (int endtime)
 		{
 			if (hresult != DSERR_BUFFERLOST)
 			{
-				Con_Printf ("S_TransferStereo16: DS::Lock Sound Buffer Failed\n");
-				S_Shutdown ();
-				S_Startup ();
+				S_DMAError ("S_TransferStereo16: DS::Lock Sound Buffer Failed\n", DMA_RESTART);
 				return;
 			}
 
 			if (++reps > 10000)
 			{
-				Con_Printf ("S_TransferStereo16: DS: couldn't restore buffer\n");
-				S_Shutdown ();
-				S_Startup ();
+				S_DMAError ("S_TransferStereo16: DS: couldn't restore buffer\n", DMA_RESTART);
 				return;
 			}
 		}
@@ -124,7 +222,7 @@ void S_TransferStereo16 (int endtime)
 		snd_linear_count <<= 1;
 
 	// write a linear blast of samples
-		Snd_WriteLinearBlastStereo16 ();
+		snd_kernel->transfer ();
 
 		snd_p += snd_linear_count;
 		lpaintedtime += (snd_linear_count>>1);
@@ -176,17 +274,13 @@ void S_TransferPaintBuffer(int endtime)
 		{
 			if (hresult != DSERR_BUFFERLOST)
 			{
-				Con_Printf ("S_TransferPaintBuffer: DS::Lock Sound Buffer Failed\n");
-				S_Shutdown ();
-				S_Startup ();
+				S_DMAError ("S_TransferPaintBuffer: DS::Lock Sound Buffer Failed\n", DMA_RESTART);
 				return;
 			}
 
 			if (++reps > 10000)
 			{
-				Con_Printf ("S_TransferPaintBuffer: DS: couldn't restore buffer\n");
-				S_Shutdown ();
-				S_Startup ();
+				S_DMAError ("S_TransferPaintBuffer: DS: couldn't restore buffer\n", DMA_RESTART);
 				return;
 			}
 		}
@@ -258,13 +352,70 @@ CHANNEL MIXING
 void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int endtime);
 void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int endtime);
 
+sndkernel_t *SND_PickKernel (void);
+
+/*
+===================
+SND_PaintChannel
+
+Paints a channel from paintedtime up to end
+===================
+*/
+static void SND_PaintChannel (channel_t *ch, int end)
+{
+	sfxcache_t	*sc;
+	int		ltime, count;
+
+	if (!ch->sfx)
+		return;
+	if (!ch->leftvol && !ch->rightvol)
+		return;
+	sc = SND_GetCache (ch->sfx);
+	if (!sc)
+		return;
+
+	ltime = paintedtime;
+
+	while (ltime < end)
+	{	// paint up to end
+		if (ch->end < end)
+			count = ch->end - ltime;
+		else
+			count = end - ltime;
+
+		if (count > 0)
+		{	
+			if (sc->width == 1)
+				snd_kernel->paint8 (ch, sc, count);
+			else
+				snd_kernel->paint16 (ch, sc, count);
+
+			ltime += count;
+		}
+
+	// if at end of loop, restart
+		if (ltime >= ch->end)
+		{
+			if (sc->loopstart >= 0)
+			{
+				ch->pos = sc->loopstart;
+				ch->end = ltime + sc->length - ch->pos;
+			}
+			else				
+			{	// channel just stopped
+				ch->sfx = NULL;
+				break;
+			}
+		}
+	}
+}
+
 void S_PaintChannels(int endtime)
 {
 	int 	i;
 	int 	end;
-	channel_t *ch;
-	sfxcache_t	*sc;
-	int		ltime, count;
+
+	snd_kernel = SND_PickKernel ();
 
 	while (paintedtime < endtime)
 	{
@@ -276,54 +427,12 @@ void S_PaintChannels(int endtime)
 	// clear the paint buffer
 		Q_memset(paintbuffer, 0, (end - paintedtime) * sizeof(portable_samplepair_t));
 
-	// paint in the channels.
-		ch = channels;
-		for (i=0; i<total_channels ; i++, ch++)
-		{
-			if (!ch->sfx)
-				continue;
-			if (!ch->leftvol && !ch->rightvol)
-				continue;
-			sc = S_LoadSound (ch->sfx);
-			if (!sc)
-				continue;
-
-			ltime = paintedtime;
-
-			while (ltime < end)
-			{	// paint up to end
-				if (ch->end < end)
-					count = ch->end - ltime;
-				else
-					count = end - ltime;
-
-				if (count > 0)
-				{	
-					if (sc->width == 1)
-						SND_PaintChannelFrom8(ch, sc, count);
-					else
-						SND_PaintChannelFrom16(ch, sc, count);
-	
-					ltime += count;
-				}
-
-			// if at end of loop, restart
-				if (ltime >= ch->end)
-				{
-					if (sc->loopstart >= 0)
-					{
-						ch->pos = sc->loopstart;
-						ch->end = ltime + sc->length - ch->pos;
-					}
-					else				
-					{	// channel just stopped
-						ch->sfx = NULL;
-						break;
-					}
-				}
-			}
-															  
-		}
+	// paint in the channels.  statics out of earshot are virtual voices
+	// that aren't in snd_heard, and are never looked at here
+		for (i=0; i<MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS ; i++)
+			SND_PaintChannel (&channels[i], end);
+		for (i=0; i<snd_numheard ; i++)
+			SND_PaintChannel (snd_heard[i], end);
 
 	// transfer out according to DMA format
 		S_TransferPaintBuffer(end);
@@ -396,3 +505,426 @@ void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int count)
 	ch->pos += count;
 }
 
+
+/*
+===============================================================================
+
+SIMD KERNELS
+
+Each kernel gives exactly the same paintbuffer and output as the portable
+code.  8 bit samples are scaled by the volume rounded down to a multiple
+of 8, which is what snd_scaletable holds, so the products fit 16 bits.
+
+===============================================================================
+*/
+
+#ifdef idSSE2
+
+static void SND_PaintChannelFrom8_SSE2 (channel_t *ch, sfxcache_t *sc, int count)
+{
+	int		data;
+	int		leftvol, rightvol;
+	signed char	*sfx;
+	int		*out;
+	int		i;
+	__m128i	vol, s, lo, hi;
+
+	if (ch->leftvol > 255)
+		ch->leftvol = 255;
+	if (ch->rightvol > 255)
+		ch->rightvol = 255;
+
+	leftvol = ch->leftvol & ~7;
+	rightvol = ch->rightvol & ~7;
+	sfx = (signed char *)sc->data + ch->pos;
+	out = (int *)paintbuffer;
+
+	vol = _mm_set1_epi32 ((rightvol << 16) | leftvol);
+	for (i=0 ; i+8<=count ; i+=8, out+=16)
+	{
+		s = _mm_loadl_epi64 ((__m128i *)(sfx + i));
+		s = _mm_srai_epi16 (_mm_unpacklo_epi8 (s, s), 8);
+		lo = _mm_mullo_epi16 (_mm_unpacklo_epi16 (s, s), vol);	// l0 r0 l1 r1 l2 r2 l3 r3
+		hi = _mm_mullo_epi16 (_mm_unpackhi_epi16 (s, s), vol);
+
+		_mm_storeu_si128 ((__m128i *)out, _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)out),
+			_mm_srai_epi32 (_mm_unpacklo_epi16 (lo, lo), 16)));
+		_mm_storeu_si128 ((__m128i *)(out + 4), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(out + 4)),
+			_mm_srai_epi32 (_mm_unpackhi_epi16 (lo, lo), 16)));
+		_mm_storeu_si128 ((__m128i *)(out + 8), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(out + 8)),
+			_mm_srai_epi32 (_mm_unpacklo_epi16 (hi, hi), 16)));
+		_mm_storeu_si128 ((__m128i *)(out + 12), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(out + 12)),
+			_mm_srai_epi32 (_mm_unpackhi_epi16 (hi, hi), 16)));
+	}
+
+	for ( ; i<count ; i++, out+=2)
+	{
+		data = sfx[i];
+		out[0] += data * leftvol;
+		out[1] += data * rightvol;
+	}
+
+	ch->pos += count;
+}
+
+static void SND_PaintChannelFrom16_SSE2 (channel_t *ch, sfxcache_t *sc, int count)
+{
+	int		data;
+	int		leftvol, rightvol;
+	signed short	*sfx;
+	int		*out;
+	int		i;
+	__m128i	vol, s, d, pl, ph;
+
+	leftvol = ch->leftvol;
+	rightvol = ch->rightvol;
+	sfx = (signed short *)sc->data + ch->pos;
+	out = (int *)paintbuffer;
+
+	vol = _mm_set1_epi32 ((rightvol << 16) | leftvol);
+	for (i=0 ; i+8<=count ; i+=8, out+=16)
+	{
+		s = _mm_loadu_si128 ((__m128i *)(sfx + i));
+
+	// full 32 bit products from the low and high halves
+		d = _mm_unpacklo_epi16 (s, s);
+		pl = _mm_mullo_epi16 (d, vol);
+		ph = _mm_mulhi_epi16 (d, vol);
+		_mm_storeu_si128 ((__m128i *)out, _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)out),
+			_mm_srai_epi32 (_mm_unpacklo_epi16 (pl, ph), 8)));
+		_mm_storeu_si128 ((__m128i *)(out + 4), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(out + 4)),
+			_mm_srai_epi32 (_mm_unpackhi_epi16 (pl, ph), 8)));
+
+		d = _mm_unpackhi_epi16 (s, s);
+		pl = _mm_mullo_epi16 (d, vol);
+		ph = _mm_mulhi_epi16 (d, vol);
+		_mm_storeu_si128 ((__m128i *)(out + 8), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(out + 8)),
+			_mm_srai_epi32 (_mm_unpacklo_epi16 (pl, ph), 8)));
+		_mm_storeu_si128 ((__m128i *)(out + 12), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(out + 12)),
+			_mm_srai_epi32 (_mm_unpackhi_epi16 (pl, ph), 8)));
+	}
+
+	for ( ; i<count ; i++, out+=2)
+	{
+		data = sfx[i];
+		out[0] += (data * leftvol) >> 8;
+		out[1] += (data * rightvol) >> 8;
+	}
+
+	ch->pos += count;
+}
+
+#endif	// idSSE2
+
+#ifdef idAVX2
+
+AVX2_TARGET static void SND_PaintChannelFrom8_AVX2 (channel_t *ch, sfxcache_t *sc, int count)
+{
+	int		data;
+	int		leftvol, rightvol;
+	signed char	*sfx;
+	int		*out;
+	int		i;
+	__m256i	vol, lo, hi, s;
+
+	if (ch->leftvol > 255)
+		ch->leftvol = 255;
+	if (ch->rightvol > 255)
+		ch->rightvol = 255;
+
+	leftvol = ch->leftvol & ~7;
+	rightvol = ch->rightvol & ~7;
+	sfx = (signed char *)sc->data + ch->pos;
+	out = (int *)paintbuffer;
+
+	vol = _mm256_set_epi32 (rightvol, leftvol, rightvol, leftvol, rightvol, leftvol, rightvol, leftvol);
+	lo = _mm256_set_epi32 (3, 3, 2, 2, 1, 1, 0, 0);
+	hi = _mm256_set_epi32 (7, 7, 6, 6, 5, 5, 4, 4);
+	for (i=0 ; i+8<=count ; i+=8, out+=16)
+	{
+		s = _mm256_cvtepi8_epi32 (_mm_loadl_epi64 ((__m128i *)(sfx + i)));
+		_mm256_storeu_si256 ((__m256i *)out, _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *)out),
+			_mm256_mullo_epi32 (_mm256_permutevar8x32_epi32 (s, lo), vol)));
+		_mm256_storeu_si256 ((__m256i *)(out + 8), _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *)(out + 8)),
+			_mm256_mullo_epi32 (_mm256_permutevar8x32_epi32 (s, hi), vol)));
+	}
+
+	for ( ; i<count ; i++, out+=2)
+	{
+		data = sfx[i];
+		out[0] += data * leftvol;
+		out[1] += data * rightvol;
+	}
+
+	ch->pos += count;
+}
+
+AVX2_TARGET static void SND_PaintChannelFrom16_AVX2 (channel_t *ch, sfxcache_t *sc, int count)
+{
+	int		data;
+	int		leftvol, rightvol;
+	signed short	*sfx;
+	int		*out;
+	int		i;
+	__m256i	vol, lo, hi, s;
+
+	leftvol = ch->leftvol;
+	rightvol = ch->rightvol;
+	sfx = (signed short *)sc->data + ch->pos;
+	out = (int *)paintbuffer;
+
+	vol = _mm256_set_epi32 (rightvol, leftvol, rightvol, leftvol, rightvol, leftvol, rightvol, leftvol);
+	lo = _mm256_set_epi32 (3, 3, 2, 2, 1, 1, 0, 0);
+	hi = _mm256_set_epi32 (7, 7, 6, 6, 5, 5, 4, 4);
+	for (i=0 ; i+8<=count ; i+=8, out+=16)
+	{
+		s = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((__m128i *)(sfx + i)));
+		_mm256_storeu_si256 ((__m256i *)out, _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *)out),
+			_mm256_srai_epi32 (_mm256_mullo_epi32 (_mm256_permutevar8x32_epi32 (s, lo), vol), 8)));
+		_mm256_storeu_si256 ((__m256i *)(out + 8), _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *)(out + 8)),
+			_mm256_srai_epi32 (_mm256_mullo_epi32 (_mm256_permutevar8x32_epi32 (s, hi), vol), 8)));
+	}
+
+	for ( ; i<count ; i++, out+=2)
+	{
+		data = sfx[i];
+		out[0] += (data * leftvol) >> 8;
+		out[1] += (data * rightvol) >> 8;
+	}
+
+	ch->pos += count;
+}
+
+/*
+================
+SND_CPUHasAVX2
+================
+*/
+static qboolean SND_CPUHasAVX2 (void)
+{
+#ifdef _MSC_VER
+	int		regs[4];
+
+	__cpuid (regs, 0);
+	if (regs[0] < 7)
+		return false;
+
+// the os has to save the ymm registers too
+	__cpuid (regs, 1);
+	if ((regs[2] & (3<<27)) != (3<<27))		// osxsave and avx
+		return false;
+	if ((_xgetbv (0) & 6) != 6)
+		return false;
+
+	__cpuidex (regs, 7, 0);
+	return (regs[1] & (1<<5)) != 0;
+#else
+	__builtin_cpu_init ();
+	return __builtin_cpu_supports ("avx2") != 0;
+#endif
+}
+
+#endif	// idAVX2
+
+// widest last
+static sndkernel_t	snd_kernels[] =
+{
+#if id386
+	{"x86", SND_PaintChannelFrom8, SND_PaintChannelFrom16, Snd_WriteLinearBlastStereo16},
+#else
+	{"C", SND_PaintChannelFrom8, SND_PaintChannelFrom16, Snd_WriteLinearBlastStereo16},
+#endif
+#ifdef idSSE2
+	{"SSE2", SND_PaintChannelFrom8_SSE2, SND_PaintChannelFrom16_SSE2, Snd_WriteLinearBlastStereo16_SSE2},
+#endif
+#ifdef idAVX2
+	{"AVX2", SND_PaintChannelFrom8_AVX2, SND_PaintChannelFrom16_AVX2, Snd_WriteLinearBlastStereo16_AVX2},
+#endif
+};
+
+static	int		snd_numkernels;		// usable on this cpu
+
+/*
+================
+SND_InitMixer
+================
+*/
+void SND_InitMixer (void)
+{
+	snd_numkernels = sizeof(snd_kernels)/sizeof(snd_kernels[0]);
+#ifdef idAVX2
+	if (!SND_CPUHasAVX2 ())
+		snd_numkernels--;
+#endif
+
+	Con_DPrintf ("Sound mixer: %s\n", SND_PickKernel ()->name);
+}
+
+/*
+================
+SND_PickKernel
+
+snd_simd 0 forces the portable mixer
+================
+*/
+sndkernel_t *SND_PickKernel (void)
+{
+	if (!snd_simd.value || snd_numkernels < 1)
+		return &snd_kernels[0];
+	return &snd_kernels[snd_numkernels-1];
+}
+
+/*
+===============================================================================
+
+MIXER BENCHMARK
+
+===============================================================================
+*/
+
+#define	BENCH_LENGTH	(PAINTBUFFER_SIZE*86)	// about a second at 44khz
+
+/*
+================
+SND_BenchPaint
+
+Mixes every channel through one buffer of sfx, looping them, and returns
+the seconds taken
+================
+*/
+static double SND_BenchPaint (sndkernel_t *k, channel_t *chans, int numchans, sfxcache_t *sc, int samples)
+{
+	int		i, done;
+	double	start;
+
+	for (i=0 ; i<numchans ; i++)
+		chans[i].pos = (i * 997) % BENCH_LENGTH & ~(PAINTBUFFER_SIZE-1);
+
+	start = Sys_FloatTime ();
+	for (done=0 ; done<samples ; done+=PAINTBUFFER_SIZE)
+	{
+		Q_memset (paintbuffer, 0, sizeof(paintbuffer));
+		for (i=0 ; i<numchans ; i++)
+		{
+			if (sc->width == 1)
+				k->paint8 (&chans[i], sc, PAINTBUFFER_SIZE);
+			else
+				k->paint16 (&chans[i], sc, PAINTBUFFER_SIZE);
+			if (chans[i].pos >= BENCH_LENGTH)
+				chans[i].pos = 0;
+		}
+	}
+	return Sys_FloatTime () - start;
+}
+
+/*
+================
+SND_MixBench_f
+
+snd_mixbench [channels] [seconds] : mixes seconds of synthetic 44khz sound
+on channels channels with each kernel and checks they agree
+================
+*/
+void SND_MixBench_f (void)
+{
+	static portable_samplepair_t	ref8[PAINTBUFFER_SIZE], ref16[PAINTBUFFER_SIZE];
+	static short	outref[PAINTBUFFER_SIZE*2], out[PAINTBUFFER_SIZE*2];
+	sfxcache_t	*sc8, *sc16;
+	channel_t	*chans;
+	sndkernel_t	*k;
+	int			i, numchans, samples;
+	double		t8, t16, tt, mixed;
+	qboolean	match;
+
+	numchans = 32;
+	if (Cmd_Argc() > 1)
+		numchans = Q_atoi (Cmd_Argv(1));
+	samples = 10*11025*4;
+	if (Cmd_Argc() > 2)
+		samples = (int)(Q_atof (Cmd_Argv(2)) * 11025*4);
+	if (numchans < 1 || samples < PAINTBUFFER_SIZE)
+	{
+		Con_Printf ("snd_mixbench [channels] [seconds]\n");
+		return;
+	}
+
+	sc8 = malloc (sizeof(sfxcache_t) + BENCH_LENGTH);
+	sc16 = malloc (sizeof(sfxcache_t) + BENCH_LENGTH*2);
+	chans = calloc (numchans, sizeof(channel_t));
+	if (!sc8 || !sc16 || !chans)
+	{
+		free (sc8);
+		free (sc16);
+		free (chans);
+		Con_Printf ("snd_mixbench: out of memory\n");
+		return;
+	}
+
+	sc8->length = sc16->length = BENCH_LENGTH;
+	sc8->loopstart = sc16->loopstart = 0;
+	sc8->speed = sc16->speed = 11025*4;
+	sc8->stereo = sc16->stereo = 0;
+	sc8->width = 1;
+	sc16->width = 2;
+	for (i=0 ; i<BENCH_LENGTH ; i++)
+	{
+		sc8->data[i] = rand ();
+		((short *)sc16->data)[i] = rand ();
+	}
+
+	Con_Printf ("%i channels, %.1f seconds each, millions of samples a second\n", numchans, samples/(11025.0*4));
+	Con_Printf ("%-6s %8s %8s %8s\n", "kernel", "8 bit", "16 bit", "transfer");
+
+// the kernels share the transfer state with the mixer
+	S_LockMixer ();
+
+	mixed = (double)numchans * samples / 1000000;
+	for (k=snd_kernels ; k<snd_kernels+snd_numkernels ; k++)
+	{
+		for (i=0 ; i<numchans ; i++)
+		{
+			chans[i].leftvol = (i * 37) % 300;	// past 255 to check the clamp
+			chans[i].rightvol = 255 - (i * 53) % 256;
+		}
+
+	// check the kernel against the portable one before timing it
+		match = true;
+		SND_BenchPaint (k, chans, numchans, sc8, PAINTBUFFER_SIZE);
+		if (k == snd_kernels)
+			Q_memcpy (ref8, paintbuffer, sizeof(paintbuffer));
+		else if (Q_memcmp (ref8, paintbuffer, sizeof(paintbuffer)))
+			match = false;
+		SND_BenchPaint (k, chans, numchans, sc16, PAINTBUFFER_SIZE);
+		if (k == snd_kernels)
+			Q_memcpy (ref16, paintbuffer, sizeof(paintbuffer));
+		else if (Q_memcmp (ref16, paintbuffer, sizeof(paintbuffer)))
+			match = false;
+
+		t8 = SND_BenchPaint (k, chans, numchans, sc8, samples);
+		t16 = SND_BenchPaint (k, chans, numchans, sc16, samples);
+
+		snd_p = (int *)paintbuffer;
+		snd_out = out;
+		snd_vol = volume.value*256;
+		snd_linear_count = PAINTBUFFER_SIZE*2;
+		k->transfer ();
+		if (k == snd_kernels)
+			Q_memcpy (outref, out, sizeof(out));
+		else if (Q_memcmp (outref, out, sizeof(out)))
+			match = false;
+
+		tt = Sys_FloatTime ();
+		for (i=0 ; i<samples ; i+=PAINTBUFFER_SIZE)
+			k->transfer ();
+		tt = Sys_FloatTime () - tt;
+
+		Con_Printf ("%-6s %8.1f %8.1f %8.1f%s\n", k->name, mixed / t8, mixed / t16,
+			samples / tt / 1000000, match ? "" : "  MISMATCH");
+	}
+
+	S_UnlockMixer ();
+
+	free (sc8);
+	free (sc16);
+	free (chans);
+}
@@ -0,0 +1,248 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// snd_wav.c -- offline dma driver, mixes into a wav file on a virtual clock
+
+/*
+Nothing is played.  The dma position is a clock that S_Update moves on by
+host_frametime, and the mixer paints exactly up to it and appends what it
+painted to the file, so it runs as fast as the frames come.  With a fixed
+host_framerate the same demo always makes the same file, which gives the
+mixer a regression test and a throughput figure on machines without a
+sound card.
+*/
+
+#include "quakedef.h"
+
+#define	WAV_RINGSAMPLES		0x10000		// mono samples, a power of two
+#define	WAV_HEADERSIZE		44
+
+qboolean	snd_wavout;					// mixing to a file instead of a device
+char		snd_wavname[MAX_OSPATH];
+int			snd_wavspeed = 11025;
+
+static FILE		*wav_file;
+static short	*wav_ring;
+static double	wav_time;			// virtual seconds since the file was opened
+static int		wav_start;			// paintedtime when the file was opened
+static int		wav_clock;			// the virtual dma position in sample pairs
+static int		wav_written;		// sample pairs in the file so far
+static int		wav_frames;
+static double	wav_mixtime;
+
+
+static void SNDWAV_PutShort (byte *p, int s)
+{
+	p[0] = s & 0xff;
+	p[1] = (s >> 8) & 0xff;
+}
+
+static void SNDWAV_PutLong (byte *p, int l)
+{
+	p[0] = l & 0xff;
+	p[1] = (l >> 8) & 0xff;
+	p[2] = (l >> 16) & 0xff;
+	p[3] = (l >> 24) & 0xff;
+}
+
+/*
+==================
+SNDWAV_WriteHeader
+
+A 16 bit pcm header for datasize bytes of samples
+==================
+*/
+static void SNDWAV_WriteHeader (int datasize)
+{
+	byte	h[WAV_HEADERSIZE];
+
+	memcpy (h, "RIFF", 4);
+	SNDWAV_PutLong (h+4, 36 + datasize);
+	memcpy (h+8, "WAVEfmt ", 8);
+	SNDWAV_PutLong (h+16, 16);
+	SNDWAV_PutShort (h+20, 1);			// pcm
+	SNDWAV_PutShort (h+22, sn.channels);
+	SNDWAV_PutLong (h+24, sn.speed);
+	SNDWAV_PutLong (h+28, sn.speed * sn.channels * 2);
+	SNDWAV_PutShort (h+32, sn.channels * 2);
+	SNDWAV_PutShort (h+34, 16);
+	memcpy (h+36, "data", 4);
+	SNDWAV_PutLong (h+40, datasize);
+
+	fseek (wav_file, 0, SEEK_SET);
+	fwrite (h, 1, sizeof(h), wav_file);
+}
+
+/*
+==================
+SNDWAV_Init
+
+Opens snd_wavname and sets up a dma buffer in memory for the mixer
+==================
+*/
+qboolean SNDWAV_Init (void)
+{
+	wav_file = fopen (snd_wavname, "wb");
+	if (!wav_file)
+	{
+		Con_Printf ("Couldn't open %s\n", snd_wavname);
+		return false;
+	}
+
+	wav_ring = malloc (WAV_RINGSAMPLES * sizeof(short));
+	if (!wav_ring)
+	{
+		fclose (wav_file);
+		wav_file = NULL;
+		Con_Printf ("Couldn't allocate the sound buffer\n");
+		return false;
+	}
+	memset (wav_ring, 0, WAV_RINGSAMPLES * sizeof(short));
+
+	shm = &sn;
+	shm->splitbuffer = 0;
+	shm->channels = 2;
+	shm->samplebits = 16;
+	shm->speed = snd_wavspeed;
+	shm->samples = WAV_RINGSAMPLES;
+	shm->samplepos = 0;
+	shm->submission_chunk = 1;
+	shm->soundalive = true;
+	shm->gamealive = true;
+	shm->buffer = (unsigned char *)wav_ring;
+
+	SNDWAV_WriteHeader (0);
+
+	wav_time = 0;
+	wav_start = wav_clock = wav_written = paintedtime;
+	wav_frames = 0;
+	wav_mixtime = 0;
+
+	Con_Printf ("Writing sound to %s\n", snd_wavname);
+	return true;
+}
+
+/*
+==================
+SNDWAV_Update
+
+Moves the virtual dma position on by a frame
+==================
+*/
+void SNDWAV_Update (double frametime)
+{
+	int		ahead;
+
+	wav_time += frametime;
+	wav_clock = wav_start + (int)(wav_time * shm->speed);
+
+// the ring can't hold more than this between writes
+	ahead = shm->samples / shm->channels / 2;
+	if (wav_clock - wav_written > ahead)
+	{
+		wav_clock = wav_written + ahead;
+		wav_time = (double)(wav_clock - wav_start) / shm->speed;
+	}
+
+	wav_frames++;
+}
+
+/*
+==================
+SNDWAV_Write
+
+Appends everything painted since the last write
+==================
+*/
+static void SNDWAV_Write (void)
+{
+	int		i, pairs, pos, count;
+	short	*p;
+
+	pairs = shm->samples / shm->channels;
+	while (wav_written < paintedtime)
+	{
+		pos = wav_written & (pairs - 1);
+		count = paintedtime - wav_written;
+		if (count > pairs - pos)
+			count = pairs - pos;
+
+		p = wav_ring + pos * shm->channels;
+		for (i=0 ; i<count * shm->channels ; i++)
+			p[i] = LittleShort (p[i]);
+
+		if (fwrite (p, count * shm->channels * sizeof(short), 1, wav_file) != 1)
+		{
+			S_DMAError (va("Couldn't write %s\n", snd_wavname), DMA_SHUTDOWN);
+			return;
+		}
+		wav_written += count;
+	}
+}
+
+/*
+==================
+SNDWAV_Paint
+
+Stands in for the mix ahead in SND_Paint.  Mixing ahead of a clock that
+only moves once a frame would just be mixing the next frame early, so
+this paints up to the clock and no further.
+==================
+*/
+void SNDWAV_Paint (void)
+{
+	double	start;
+
+	soundtime = wav_clock;
+
+	start = Sys_FloatTime ();
+	S_PaintChannels (wav_clock);
+	wav_mixtime += Sys_FloatTime () - start;
+
+	SNDWAV_Write ();
+}
+
+/*
+==================
+SNDWAV_Shutdown
+
+Finishes the file and reports what the mixer cost
+==================
+*/
+void SNDWAV_Shutdown (void)
+{
+	double	seconds;
+
+	if (!wav_file)
+		return;
+
+	SNDWAV_WriteHeader ((wav_written - wav_start) * sn.channels * sizeof(short));
+	fclose (wav_file);
+	wav_file = NULL;
+
+	seconds = (double)(wav_written - wav_start) / sn.speed;
+	Con_Printf ("Wrote %.1f seconds of sound in %i frames to %s\n", seconds, wav_frames, snd_wavname);
+	if (wav_mixtime > 0 && wav_frames)
+		Con_Printf ("mixed in %.3f seconds, %.1fx realtime, %.3f ms a frame\n",
+			wav_mixtime, seconds / wav_mixtime, wav_mixtime * 1000 / wav_frames);
+
+	free (wav_ring);
+	wav_ring = NULL;
+	sn.buffer = NULL;
+}
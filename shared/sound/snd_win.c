@@ -81,12 +81,14 @@ void S_BlockSound (void)
 // DirectSound takes care of blocking itself
 	if (snd_iswave)
 	{
+		S_LockMixer ();
 		snd_blocked++;
 
 		if (snd_blocked == 1)
 		{
 			waveOutReset (hWaveOut);
 		}
+		S_UnlockMixer ();
 	}
 }
 
@@ -679,7 +681,7 @@ void SNDDMA_Submit(void)
 	{
 		if ( snd_completed == snd_sent )
 		{
-			Con_DPrintf ("Sound overrun\n");
+			S_DMAError ("Sound overrun\n", DMA_WARN);
 			break;
 		}
 
@@ -708,8 +710,7 @@ void SNDDMA_Submit(void)
 
 		if (wResult != MMSYSERR_NOERROR)
 		{ 
-			Con_SafePrintf ("Failed to write block to device\n");
-			FreeSound ();
+			S_DMAError ("Failed to write block to device\n", DMA_SHUTDOWN);
 			return; 
 		} 
 	}
@@ -34,6 +34,9 @@ void Sys_FileSeek (int handle, int position);
 int Sys_FileRead (int handle, void *dest, int count);
 int Sys_FileWrite (int handle, void *data, int count);
 int	Sys_FileTime (char *path);
+void *Sys_FileMap (int handle);
+// maps all of an open file read only for the life of the program
+// returns NULL if the file can't be mapped
 void Sys_mkdir (char *path);
 
 //
@@ -41,6 +44,12 @@ void Sys_mkdir (char *path);
 //
 void Sys_MakeCodeWriteable (unsigned long startaddr, unsigned long length);
 
+void *Sys_ReserveMemory (int size);
+// reserves address space with no memory behind it, NULL if there isn't room
+void Sys_CommitMemory (void *base, int size);
+// backs the first size bytes of a reservation with zero filled memory
+void Sys_ReleaseMemory (void *base, int size);
+
 //
 // system IO
 //
@@ -65,6 +74,44 @@ void Sys_Sleep (void);
 void Sys_SendKeyEvents (void);
 // Perform Key_Event () callbacks until the input que is empty
 
+void Sys_WatchSocket (int socket);
+// POSIX dedicated server only: the main loop wakes as soon as the socket
+// has something to read
+
+//
+// worker threads
+//
+typedef void (*sys_job_t) (void *data, int index);
+
+void Sys_RunJobs (sys_job_t job, void *data, int count);
+// calls job (data, index) for every index below count, spread over a pool
+// of worker threads and the caller, and returns when they have all finished
+
+int Sys_NumWorkers (void);
+// threads besides the caller that Sys_RunJobs hands work to, -threads <n>
+// sets it, 0 runs every job on the caller
+
+void Sys_BeginBackgroundJob (sys_job_t job, void *data);
+// calls job (data, 0) on a thread of its own and returns straight away.
+// There is only ever one, so it waits for the last one to finish first
+
+void Sys_FinishBackgroundJob (void);
+// waits for the Sys_BeginBackgroundJob job, if one is running
+
+void *Sys_CreateThread (sys_job_t job, void *data);
+// calls job (data, 0) on a long lived thread of its own, NULL if one
+// couldn't be started
+void Sys_WaitThread (void *thread);
+// waits for a Sys_CreateThread job to return and frees the thread
+
+void *Sys_CreateLock (void);
+// the thread holding a lock may take it again
+void Sys_Lock (void *lock);
+void Sys_Unlock (void *lock);
+
+void Sys_MemoryBarrier (void);
+// no load or store moves across it, for queues shared without a lock
+
 void Sys_LowFPPrecision (void);
 void Sys_HighFPPrecision (void);
 void Sys_SetFPCW (void);
@@ -37,6 +37,24 @@ typedef struct
 } trace_t;
 
 
+typedef struct
+{
+	int		moves;			// SV_Move calls
+	int		links;			// solid edicts looked at by SV_ClipToLinks
+	int		clips;			// exact clips against entities
+	int		touches;		// SV_TouchLinks calls
+	int		triggerlinks;	// trigger edicts looked at by SV_TouchLinks
+	int		rebuilds;		// SV_BalanceWorld calls
+	int		frames;			// server frames run
+	int		traces;			// traces through a hull
+	int		tracehits;		// traces answered by the trace cache
+	int		batched;		// traces run by SV_RecursiveHullCheckBatch
+	int		fatpvs;			// SV_FatPVS calls
+	int		fatpvshits;		// fat PVS answered by its cache
+} areastats_t;
+
+extern	areastats_t	sv_areastats;
+
 #define	MOVE_NORMAL		0
 #define	MOVE_NOMONSTERS	1
 #define	MOVE_MISSILE	2
@@ -45,6 +63,14 @@ typedef struct
 void SV_ClearWorld (void);
 // called after the world model has been loaded, before linking any entities
 
+void SV_BalanceWorld (void);
+// rebuilds the area tree with split planes fitted to the linked edicts
+
+void SV_CheckAreaNodes (void);
+// called every server frame, rebalances the area tree if it has got crowded
+
+void SV_AreaStats_f (void);
+
 void SV_UnlinkEdict (edict_t *ent);
 // call before removing an entity, and before trying to move one,
 // so it doesn't clip against itself
@@ -56,6 +82,16 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers);
 // sets ent->v.absmin and ent->v.absmax
 // if touchtriggers, calls prog functions for the intersected triggers
 
+int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount);
+// fills in list with the solid and trigger edicts whose absmin/absmax touch
+// the box, as of their last SV_LinkEdict.  SOLID_NOT edicts are never listed
+
+#define	MAX_BATCH_POINTS	16
+
+void SV_HullPointContentsBatch (hull_t *hull, int num, vec3_t *points, int count, int *contents);
+// contents[i] = SV_HullPointContents (hull, num, points[i]), walking the
+// nodes the points share only once
+
 int SV_PointContents (vec3_t p);
 int SV_TruePointContents (vec3_t p);
 // returns the CONTENTS_* value from the world at the given point.
@@ -76,3 +112,8 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 // shouldn't be considered solid objects
 
 // passedict is explicitly excluded from clipping checks (normally NULL)
+
+void SV_MoveBatch (int count, vec3_t *start, vec3_t mins, vec3_t maxs, vec3_t *end, int type, edict_t *passedict, trace_t *traces);
+// traces[i] = SV_Move (start[i], mins, maxs, end[i], type, passedict) for
+// up to MAX_BATCH_POINTS traces, with the world hull walked for all of
+// them together
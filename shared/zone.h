@@ -37,7 +37,9 @@ server allocations when changing to a higher video mode.
 
 Z_??? Zone memory functions used for small, dynamic allocations like text
 strings from command input.  There is only about 48K for it, allocated at
-the very bottom of the hunk.
+the very bottom of the hunk.  Blocks of 256 bytes or less come out of size
+class slabs in a separate 64K arena above it, and only go to the zone when
+the arena is used up.
 
 Cache_??? Cache memory is for objects that can be dynamically loaded and
 can usefully stay persistant between levels.  The size of the cache
@@ -75,6 +77,8 @@ client and server low hunk allocations
 
 startup hunk allocations
 
+Zone slab arena
+
 Zone block
 
 ----- Bottom of Memory -----
@@ -104,6 +108,8 @@ void Hunk_FreeToLowMark (int mark);
 int	Hunk_HighMark (void);
 void Hunk_FreeToHighMark (int mark);
 
+int	Hunk_FreeSize (void);
+
 void *Hunk_TempAlloc (int size);
 
 void Hunk_Check (void);
@@ -125,6 +131,11 @@ void *Cache_Alloc (cache_user_t *c, int size, char *name);
 // Returns NULL if all purgable data was tossed and there still
 // wasn't enough room.
 
+void Cache_Lock (void);
+void Cache_Unlock (void);
+// cached data is only freed or moved with the lock held, so another
+// thread can read c->data directly while it holds it
+
 void Cache_Report (void);
 
 
@@ -35,6 +35,8 @@ model_t *Mod_LoadModel (model_t *mod, qboolean crash);
 
 byte	mod_novis[MAX_MAP_LEAFS/8];
 
+cvar_t	mod_pvscache = {"mod_pvscache", "4096"};	// kb of unpacked PVS rows per map
+
 #define	MAX_MOD_KNOWN	256
 model_t	mod_known[MAX_MOD_KNOWN];
 int		mod_numknown;
@@ -51,6 +53,7 @@ Mod_Init
 */
 void Mod_Init (void)
 {
+	Cvar_RegisterVariable (&mod_pvscache);
 	memset (mod_novis, 0xff, sizeof(mod_novis));
 }
 
@@ -110,11 +113,13 @@ mleaf_t *Mod_PointInLeaf (vec3_t p, model_t *model)
 /*
 ===================
 Mod_DecompressVis
+
+Unpacks a visibility row into decompressed, which must hold MAX_MAP_LEAFS/8
+bytes, so threads with their own buffers can share the model
 ===================
 */
-byte *Mod_DecompressVis (byte *in, model_t *model)
+byte *Mod_DecompressVis (byte *in, model_t *model, byte *decompressed)
 {
-	static byte	decompressed[MAX_MAP_LEAFS/8];
 	int		c;
 	byte	*out;
 	int		row;
@@ -152,11 +157,215 @@ byte *Mod_DecompressVis (byte *in, model_t *model)
 	return decompressed;
 }
 
+/*
+===============================================================================
+
+PVS CACHE
+
+The world's visibility rows are decompressed once at map load and kept on
+the hunk, so the server's fat PVS, PF_checkclient and R_MarkLeaves don't
+unpack the same leafs over and over.  mod_pvscache bounds the memory in kb,
+and it never takes more than a quarter of the hunk left after the map, so
+a small -mem or dedicated hunk still has room for everything else.  A map
+whose rows don't all fit keeps the most recently used ones instead.
+
+===============================================================================
+*/
+
+typedef struct pvscache_s
+{
+	int		numleafs;		// rows exist for leafs 1 to numleafs
+	int		rowbytes;		// PVS_ROWBYTES of numleafs
+	int		numslots;
+	qboolean	complete;	// every row resident, nothing moves
+	byte	*rows;			// numslots * rowbytes
+	int		*leafslot;		// slot holding each leaf's row, -1 if none
+	int		*slotleaf;		// leaf in each slot, -1 if empty
+	int		*prev, *next;	// slots in use order, numslots is the head
+} pvscache_t;
+
+/*
+===================
+Mod_OrPVS
+
+dest |= src for bytes, a multiple of 16
+===================
+*/
+void Mod_OrPVS (byte *dest, byte *src, int bytes)
+{
+	int		i;
+
+#ifdef idSSE2
+	for (i=0 ; i<bytes ; i+=16)
+		_mm_storeu_si128 ((__m128i *)(dest + i),
+			_mm_or_si128 (_mm_loadu_si128 ((__m128i *)(dest + i)), _mm_loadu_si128 ((__m128i *)(src + i))));
+#else
+	unsigned	*d, *s;
+
+	d = (unsigned *)dest;
+	s = (unsigned *)src;
+	for (i=0 ; i<bytes ; i+=16, d+=4, s+=4)
+	{
+		d[0] |= s[0];
+		d[1] |= s[1];
+		d[2] |= s[2];
+		d[3] |= s[3];
+	}
+#endif
+}
+
+/*
+===================
+Mod_BuildPVSCache
+===================
+*/
+void Mod_BuildPVSCache (model_t *mod)
+{
+	pvscache_t	*pc;
+	int			i, rowbytes, numslots, bytes;
+	byte		decompressed[MAX_MAP_LEAFS/8];
+
+	mod->pvscache = NULL;
+	if (!mod->visdata || mod->numleafs < 1)
+		return;
+
+	rowbytes = PVS_ROWBYTES(mod->numleafs);
+	bytes = (int)(mod_pvscache.value * 1024);
+	if (bytes > Hunk_FreeSize () / 4)
+		bytes = Hunk_FreeSize () / 4;
+	numslots = bytes / rowbytes;
+	if (numslots > mod->numleafs)
+		numslots = mod->numleafs;
+	if (numslots < 64)
+		return;		// too small to be worth the bookkeeping
+
+	pc = Hunk_AllocName (sizeof(*pc), "pvscache");
+	pc->numleafs = mod->numleafs;
+	pc->rowbytes = rowbytes;
+	pc->numslots = numslots;
+	pc->complete = (numslots == mod->numleafs);
+	pc->rows = Hunk_AllocName (numslots * rowbytes, "pvscache");
+	pc->leafslot = Hunk_AllocName ((mod->numleafs + 1) * sizeof(int), "pvscache");
+
+	if (pc->complete)
+	{
+		pc->leafslot[0] = -1;
+		for (i=1 ; i<=mod->numleafs ; i++)
+		{
+			Mod_DecompressVis (mod->leafs[i].compressed_vis, mod, decompressed);
+			memcpy (pc->rows + (i-1)*rowbytes, decompressed, (mod->numleafs+7)>>3);
+			pc->leafslot[i] = i-1;
+		}
+	}
+	else
+	{
+		pc->slotleaf = Hunk_AllocName (numslots * sizeof(int), "pvscache");
+		pc->prev = Hunk_AllocName ((numslots + 1) * sizeof(int), "pvscache");
+		pc->next = Hunk_AllocName ((numslots + 1) * sizeof(int), "pvscache");
+		for (i=0 ; i<=mod->numleafs ; i++)
+			pc->leafslot[i] = -1;
+		for (i=0 ; i<numslots ; i++)
+			pc->slotleaf[i] = -1;
+		for (i=0 ; i<=numslots ; i++)
+		{	// a ring through the head
+			pc->next[i] = (i + 1) % (numslots + 1);
+			pc->prev[i] = (i + numslots) % (numslots + 1);
+		}
+		Con_DPrintf ("%s: %i of %i PVS rows cached\n", mod->name, numslots, mod->numleafs);
+	}
+
+	mod->pvscache = pc;
+}
+
+/*
+===================
+Mod_CachedPVS
+
+Moves the leaf's row to the front of the use order, unpacking it over the
+least recently used one if it isn't resident.  Not thread safe.
+===================
+*/
+byte *Mod_CachedPVS (model_t *model, int leafnum)
+{
+	static byte	decompressed[MAX_MAP_LEAFS/8];
+	pvscache_t	*pc;
+	int			slot, head;
+	byte		*row;
+
+	pc = model->pvscache;
+	slot = pc->leafslot[leafnum];
+	if (pc->complete)
+		return pc->rows + slot*pc->rowbytes;
+
+	head = pc->numslots;
+	if (slot < 0)
+	{	// take the slot at the tail
+		slot = pc->prev[head];
+		if (pc->slotleaf[slot] >= 0)
+			pc->leafslot[pc->slotleaf[slot]] = -1;
+		pc->slotleaf[slot] = leafnum;
+		pc->leafslot[leafnum] = slot;
+
+	// the unpacking can run past the row, so it goes through a buffer
+		Mod_DecompressVis (model->leafs[leafnum].compressed_vis, model, decompressed);
+		row = pc->rows + slot*pc->rowbytes;
+		memcpy (row, decompressed, (pc->numleafs+7)>>3);
+	}
+
+// unlink and put back at the head
+	pc->next[pc->prev[slot]] = pc->next[slot];
+	pc->prev[pc->next[slot]] = pc->prev[slot];
+	pc->next[slot] = pc->next[head];
+	pc->prev[slot] = head;
+	pc->prev[pc->next[head]] = slot;
+	pc->next[head] = slot;
+
+	return pc->rows + slot*pc->rowbytes;
+}
+
+/*
+===================
+Mod_LeafPVSBuffer
+
+Thread safe: only reads a complete cache, otherwise unpacks into buffer
+===================
+*/
+byte *Mod_LeafPVSBuffer (mleaf_t *leaf, model_t *model, byte *buffer)
+{
+	pvscache_t	*pc;
+	int			leafnum;
+
+	if (leaf == model->leafs)
+		return mod_novis;
+
+	pc = model->pvscache;
+	leafnum = leaf - model->leafs;
+	if (pc && pc->complete && leafnum <= pc->numleafs)
+		return pc->rows + pc->leafslot[leafnum]*pc->rowbytes;
+
+	return Mod_DecompressVis (leaf->compressed_vis, model, buffer);
+}
+
+/*
+===================
+Mod_LeafPVS
+
+The row is only good until the next call
+===================
+*/
 byte *Mod_LeafPVS (mleaf_t *leaf, model_t *model)
 {
+	static byte	decompressed[MAX_MAP_LEAFS/8];
+	int			leafnum;
+
 	if (leaf == model->leafs)
 		return mod_novis;
-	return Mod_DecompressVis (leaf->compressed_vis, model);
+
+	leafnum = leaf - model->leafs;
+	if (model->pvscache && leafnum <= model->pvscache->numleafs)
+		return Mod_CachedPVS (model, leafnum);
+
+	return Mod_DecompressVis (leaf->compressed_vis, model, decompressed);
 }
 
 /*
@@ -537,11 +746,24 @@ Mod_LoadEntities
 */
 void Mod_LoadEntities (lump_t *l)
 {
+	byte	*mapped;
+
 	if (!l->filelen)
 	{
 		loadmodel->entities = NULL;
 		return;
 	}
+
+// if the bsp is in a mapped pak and the lump is terminated, the entity
+// string can be parsed right where it is
+	mapped = COM_MapFile (loadmodel->name);
+	if (mapped && l->fileofs >= 0 && l->fileofs + l->filelen <= com_filesize
+	&& !mapped[l->fileofs + l->filelen - 1])
+	{
+		loadmodel->entities = (char *)mapped + l->fileofs;
+		return;
+	}
+
 	loadmodel->entities = Hunk_AllocName ( l->filelen, loadname);	
 	memcpy (loadmodel->entities, mod_base + l->fileofs, l->filelen);
 }
@@ -1200,6 +1422,9 @@ void Mod_LoadBrushModel (model_t *mod, void *buffer)
 		
 		mod->numleafs = bm->visleafs;
 
+		if (i == 0)
+			Mod_BuildPVSCache (mod);	// the submodels share the world's
+
 		if (i < mod->numsubmodels-1)
 		{	// duplicate the basic information
 			char	name[10];